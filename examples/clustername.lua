@@ -1,4 +1,6 @@
 __nowaiting = true	-- If you turn this flag off, cluster.call would block when node name is absent
+-- __compress = 4096	-- compress the messages larger than 4K, if the peer supports it
+-- __compress_dict = "./examples/clusterdict"	-- optional, samples of the common messages. Both sides must use the same one
 
 db = "127.0.0.1:2528"
 db2 = "127.0.0.1:2529"
@@ -5,8 +5,12 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <time.h>
+#include <stddef.h>
 
 #include "skynet.h"
+#include "spinlock.h"
+#include "atomic.h"
 
 /*
 	uint32_t/string addr 
@@ -37,6 +41,374 @@ fill_header(lua_State *L, uint8_t *buf, int sz) {
 	buf[1] = sz & 0xff;
 }
 
+/*
+	Payload compression, LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md).
+
+	A compressed payload is
+		DWORD dict id (0 : no dictionary)
+		DWORD original size
+		PADDING lz4 block
+
+	The dictionary is a prefix the matches can refer to, both sides must have the same one.
+	Dictionaries are registered once per process and never released, the receiver looks them up by id.
+ */
+
+#define LZ_HASHLOG 12
+#define LZ_HASHSIZE (1 << LZ_HASHLOG)
+#define LZ_MINMATCH 4
+#define LZ_MFLIMIT 12
+#define LZ_LASTLITERALS 5
+#define LZ_MAXDISTANCE 0xffff
+#define LZ_HEADER 8
+#define MAX_DICT 16
+#define MAX_DICT_SIZE 0x10000
+
+struct compress_dict {
+	uint32_t id;
+	int sz;
+	uint8_t *data;
+	uint32_t table[LZ_HASHSIZE];	// hash table of the dictionary, copied before each compression
+};
+
+static struct {
+	struct spinlock lock;
+	ATOM_INT n;
+	struct compress_dict *d[MAX_DICT];
+	ATOM_SIZET count;
+	ATOM_SIZET packed;
+	ATOM_SIZET raw;
+	ATOM_SIZET ns;
+} Z;
+
+struct compressor {
+	int threshold;
+	int usedict;
+	struct compress_dict *dict;
+	uint64_t count;
+	uint64_t raw;
+	uint64_t packed;	// the size sent, include the messages not worth to compress
+	uint64_t ns;
+};
+
+static inline uint64_t
+cputime() {
+	struct timespec ti;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ti);
+	return (uint64_t)ti.tv_sec * 1000000000 + ti.tv_nsec;
+}
+
+static inline uint32_t
+lz_read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t
+lz_hash(uint32_t v) {
+	return (v * 2654435761U) >> (32 - LZ_HASHLOG);
+}
+
+static inline uint8_t *
+lz_length(uint8_t *op, size_t len) {
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+/*
+	Compress src[0, srcsz), the bytes in [start, src) are the dictionary.
+	table stores the positions relative to start.
+	return 0 if dst is not large enough.
+ */
+static int
+lz_compress(const uint8_t *start, const uint8_t *src, int srcsz, uint8_t *dst, int dstsz, uint32_t *table) {
+	const uint8_t *ip = src;
+	const uint8_t *anchor = src;
+	const uint8_t *iend = src + srcsz;
+	const uint8_t *mflimit = iend - LZ_MFLIMIT;
+	const uint8_t *matchlimit = iend - LZ_LASTLITERALS;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + dstsz;
+	size_t litlen;
+	if (srcsz > LZ_MFLIMIT) {
+		while (ip < mflimit) {
+			uint32_t seq = lz_read32(ip);
+			uint32_t h = lz_hash(seq);
+			const uint8_t *ref = start + table[h];
+			table[h] = (uint32_t)(ip - start);
+			if (ref >= ip || ip - ref > LZ_MAXDISTANCE || lz_read32(ref) != seq) {
+				// skip faster in the incompressible data
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+			while (ip > anchor && ref > start && ip[-1] == ref[-1]) {
+				--ip;
+				--ref;
+			}
+			const uint8_t *mp = ip + LZ_MINMATCH;
+			const uint8_t *mr = ref + LZ_MINMATCH;
+			while (mp < matchlimit && *mp == *mr) {
+				++mp;
+				++mr;
+			}
+			litlen = ip - anchor;
+			size_t mlen = mp - ip - LZ_MINMATCH;
+			if (op + 1 + litlen / 255 + 1 + litlen + 2 + mlen / 255 + 1 > oend)
+				return 0;
+			uint8_t *token = op++;
+			if (litlen >= 15) {
+				*token = 15 << 4;
+				op = lz_length(op, litlen - 15);
+			} else {
+				*token = (uint8_t)(litlen << 4);
+			}
+			memcpy(op, anchor, litlen);
+			op += litlen;
+			uint32_t offset = (uint32_t)(ip - ref);
+			op[0] = offset & 0xff;
+			op[1] = (offset >> 8) & 0xff;
+			op += 2;
+			if (mlen >= 15) {
+				*token |= 15;
+				op = lz_length(op, mlen - 15);
+			} else {
+				*token |= (uint8_t)mlen;
+			}
+			ip = anchor = mp;
+			if (ip < mflimit) {
+				table[lz_hash(lz_read32(ip - 2))] = (uint32_t)(ip - 2 - start);
+			}
+		}
+	}
+	// last literals
+	litlen = iend - anchor;
+	if (op + 1 + litlen / 255 + 1 + litlen > oend)
+		return 0;
+	if (litlen >= 15) {
+		*op++ = 15 << 4;
+		op = lz_length(op, litlen - 15);
+	} else {
+		*op++ = (uint8_t)(litlen << 4);
+	}
+	memcpy(op, anchor, litlen);
+	op += litlen;
+	return (int)(op - dst);
+}
+
+static inline int
+lz_readlength(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+	unsigned s;
+	do {
+		if (*ip >= iend)
+			return 0;
+		s = *(*ip)++;
+		*len += s;
+	} while (s == 255);
+	return 1;
+}
+
+// return 0 if the block is malformed or doesn't decode to exactly dstsz bytes
+static int
+lz_decompress(const uint8_t *src, int srcsz, uint8_t *dst, int dstsz, const uint8_t *dict, int dictsz) {
+	const uint8_t *ip = src;
+	const uint8_t *iend = src + srcsz;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + dstsz;
+	for (;;) {
+		if (ip >= iend)
+			return 0;
+		unsigned token = *ip++;
+		size_t len = token >> 4;
+		if (len == 15 && !lz_readlength(&ip, iend, &len))
+			return 0;
+		if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len)
+			return 0;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+		if (ip == iend)
+			break;
+		if (iend - ip < 2)
+			return 0;
+		size_t offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (offset == 0)
+			return 0;
+		len = token & 15;
+		if (len == 15 && !lz_readlength(&ip, iend, &len))
+			return 0;
+		len += LZ_MINMATCH;
+		if ((size_t)(oend - op) < len)
+			return 0;
+		const uint8_t *ref;
+		if (offset > (size_t)(op - dst)) {
+			// the match begins in the dictionary
+			size_t back = offset - (op - dst);
+			if (back > (size_t)dictsz)
+				return 0;
+			size_t n = back < len ? back : len;
+			memcpy(op, dict + dictsz - back, n);
+			op += n;
+			len -= n;
+			ref = dst;
+		} else {
+			ref = op - offset;
+		}
+		if (op - ref >= (ptrdiff_t)len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			// overlapped copy
+			while (len--) {
+				*op++ = *ref++;
+			}
+		}
+	}
+	return op == oend;
+}
+
+static uint32_t
+dict_id(const uint8_t *data, int sz) {
+	// FNV-1a
+	uint32_t h = 2166136261U;
+	int i;
+	for (i=0;i<sz;i++) {
+		h = (h ^ data[i]) * 16777619U;
+	}
+	return h ? h : 1;
+}
+
+static struct compress_dict *
+dict_query(uint32_t id) {
+	int n = ATOM_LOAD(&Z.n);
+	int i;
+	for (i=0;i<n;i++) {
+		if (Z.d[i]->id == id)
+			return Z.d[i];
+	}
+	return NULL;
+}
+
+static struct compress_dict *
+dict_register(const uint8_t *data, int sz) {
+	if (sz > MAX_DICT_SIZE) {
+		// only the last 64K can be referenced
+		data += sz - MAX_DICT_SIZE;
+		sz = MAX_DICT_SIZE;
+	}
+	uint32_t id = dict_id(data, sz);
+	SPIN_LOCK(&Z)
+	struct compress_dict *d = dict_query(id);
+	int n = ATOM_LOAD(&Z.n);
+	if (d == NULL && n < MAX_DICT) {
+		d = skynet_malloc(sizeof(*d));
+		d->id = id;
+		d->sz = sz;
+		d->data = skynet_malloc(sz);
+		memcpy(d->data, data, sz);
+		memset(d->table, 0, sizeof(d->table));
+		int i;
+		for (i=0;i+LZ_MINMATCH<=sz;i++) {
+			d->table[lz_hash(lz_read32(d->data+i))] = i;
+		}
+		Z.d[n] = d;
+		ATOM_STORE(&Z.n, n+1);
+	}
+	SPIN_UNLOCK(&Z)
+	return d;
+}
+
+/*
+	Compress msg/sz into a new buffer with the payload header.
+	return NULL if it's not worth.
+ */
+static void *
+compress_payload(struct compressor *z, const void *msg, uint32_t sz, uint32_t *csz) {
+	if (z == NULL || sz < (uint32_t)z->threshold)
+		return NULL;
+	uint64_t t = cputime();
+	struct compress_dict *d = z->usedict ? z->dict : NULL;
+	uint32_t table[LZ_HASHSIZE];
+	const uint8_t *start, *src;
+	uint8_t *tmp = NULL;
+	if (d) {
+		memcpy(table, d->table, sizeof(table));
+		tmp = skynet_malloc(d->sz + sz);
+		memcpy(tmp, d->data, d->sz);
+		memcpy(tmp + d->sz, msg, sz);
+		start = tmp;
+		src = tmp + d->sz;
+	} else {
+		memset(table, 0, sizeof(table));
+		start = src = msg;
+	}
+	// at least 1/16 smaller, or send it uncompressed
+	int cap = sz - sz / 16;
+	uint8_t *buf = skynet_malloc(cap);
+	int n = 0;
+	if (cap > LZ_HEADER) {
+		n = lz_compress(start, src, sz, buf + LZ_HEADER, cap - LZ_HEADER, table);
+	}
+	skynet_free(tmp);
+	++z->count;
+	z->raw += sz;
+	z->ns += cputime() - t;
+	if (n == 0) {
+		z->packed += sz;
+		skynet_free(buf);
+		return NULL;
+	}
+	fill_uint32(buf, d ? d->id : 0);
+	fill_uint32(buf+4, sz);
+	*csz = n + LZ_HEADER;
+	z->packed += *csz;
+	return buf;
+}
+
+// return a new buffer, or NULL if the payload is invalid
+static void *
+decompress_payload(const uint8_t *buf, uint32_t sz, uint32_t *rsz) {
+	if (sz < LZ_HEADER)
+		return NULL;
+	uint64_t t = cputime();
+	uint32_t id = buf[0] | buf[1]<<8 | buf[2]<<16 | buf[3]<<24;
+	uint32_t size = buf[4] | buf[5]<<8 | buf[6]<<16 | buf[7]<<24;
+	const uint8_t *dict = NULL;
+	int dictsz = 0;
+	if (id) {
+		struct compress_dict *d = dict_query(id);
+		if (d == NULL)
+			return NULL;
+		dict = d->data;
+		dictsz = d->sz;
+	}
+	// lz4 can't expand more than 255 times, don't trust the size from the peer
+	if (size == 0 || size > 0x7fffffff || size / 255 > sz)
+		return NULL;
+	uint8_t *ret = skynet_malloc(size);
+	if (!lz_decompress(buf + LZ_HEADER, sz - LZ_HEADER, ret, size, dict, dictsz)) {
+		skynet_free(ret);
+		return NULL;
+	}
+	*rsz = size;
+	ATOM_FINC(&Z.count);
+	ATOM_FADD(&Z.packed, sz);
+	ATOM_FADD(&Z.raw, size);
+	ATOM_FADD(&Z.ns, cputime() - t);
+	return ret;
+}
+
+static struct compressor *
+tocompressor(lua_State *L, int index) {
+	if (lua_isnoneornil(L, index))
+		return NULL;
+	return luaL_checkudata(L, index, "CLUSTERZ");
+}
+
 /*
 	The request package : 
 		first WORD is size of the package with big-endian
@@ -79,14 +451,17 @@ fill_header(lua_State *L, uint8_t *buf, int sz) {
 		WORD stringsz + 1
 		BYTE 4
 		STRING tag
+
+	BYTE 0x20 is or-ed into the type 0/1/0x41/0x80/0x81/0xc1 if msg is a compressed payload,
+	sz is the size of the compressed payload.
  */
 static int
-packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
+packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push, int flag) {
 	uint32_t addr = (uint32_t)lua_tointeger(L,1);
 	uint8_t buf[TEMP_LENGTH];
 	if (sz < MULTI_PART) {
 		fill_header(L, buf, sz+9);
-		buf[2] = 0;
+		buf[2] = flag;
 		fill_uint32(buf+3, addr);
 		fill_uint32(buf+7, is_push ? 0 : (uint32_t)session);
 		memcpy(buf+11,msg,sz);
@@ -96,7 +471,7 @@ packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 	} else {
 		int part = (sz - 1) / MULTI_PART + 1;
 		fill_header(L, buf, 13);
-		buf[2] = is_push ? 0x41 : 1;	// multi push or request
+		buf[2] = (is_push ? 0x41 : 1) | flag;	// multi push or request
 		fill_uint32(buf+3, addr);
 		fill_uint32(buf+7, (uint32_t)session);
 		fill_uint32(buf+11, sz);
@@ -106,7 +481,7 @@ packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 }
 
 static int
-packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
+packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push, int flag) {
 	size_t namelen = 0;
 	const char *name = lua_tolstring(L, 1, &namelen);
 	if (name == NULL || namelen < 1 || namelen > 255) {
@@ -121,7 +496,7 @@ packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 	uint8_t buf[TEMP_LENGTH];
 	if (sz < MULTI_PART) {
 		fill_header(L, buf, sz+6+namelen);
-		buf[2] = 0x80;
+		buf[2] = 0x80 | flag;
 		buf[3] = (uint8_t)namelen;
 		memcpy(buf+4, name, namelen);
 		fill_uint32(buf+4+namelen, is_push ? 0 : (uint32_t)session);
@@ -132,7 +507,7 @@ packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 	} else {
 		int part = (sz - 1) / MULTI_PART + 1;
 		fill_header(L, buf, 10+namelen);
-		buf[2] = is_push ? 0xc1 : 0x81;	// multi push or request
+		buf[2] = (is_push ? 0xc1 : 0x81) | flag;	// multi push or request
 		buf[3] = (uint8_t)namelen;
 		memcpy(buf+4, name, namelen);
 		fill_uint32(buf+4+namelen, (uint32_t)session);
@@ -180,12 +555,21 @@ packrequest(lua_State *L, int is_push) {
 		skynet_free(msg);
 		return luaL_error(L, "Invalid request session %d", session);
 	}
+	int flag = 0;
+	uint32_t csz;
+	void * cmsg = compress_payload(tocompressor(L, 5), msg, sz, &csz);
+	if (cmsg) {
+		skynet_free(msg);
+		msg = cmsg;
+		sz = csz;
+		flag = 0x20;
+	}
 	int addr_type = lua_type(L,1);
 	int multipak;
 	if (addr_type == LUA_TNUMBER) {
-		multipak = packreq_number(L, session, msg, sz, is_push);
+		multipak = packreq_number(L, session, msg, sz, is_push, flag);
 	} else {
-		multipak = packreq_string(L, session, msg, sz, is_push);
+		multipak = packreq_string(L, session, msg, sz, is_push, flag);
 	}
 	uint32_t new_session = (uint32_t)session + 1;
 	if (new_session > INT32_MAX) {
@@ -252,8 +636,33 @@ return_buffer(lua_State *L, const char * buffer, int sz) {
 	lua_pushinteger(L, sz);
 }
 
+static void
+return_payload(lua_State *L, const char * buffer, int sz, int compressed) {
+	if (!compressed) {
+		return_buffer(L, buffer, sz);
+		return;
+	}
+	uint32_t rsz;
+	void * ptr = decompress_payload((const uint8_t *)buffer, sz, &rsz);
+	if (ptr == NULL) {
+		luaL_error(L, "Invalid compressed cluster message (size=%d)", sz);
+	}
+	lua_pushlightuserdata(L, ptr);
+	lua_pushinteger(L, rsz);
+}
+
+// the size of compressed multi part message is negative, see lconcat
+static void
+push_size(lua_State *L, uint32_t size, int compressed) {
+	if (compressed) {
+		lua_pushinteger(L, -(lua_Integer)size);
+	} else {
+		lua_pushinteger(L, size);
+	}
+}
+
 static int
-unpackreq_number(lua_State *L, const uint8_t * buf, int sz) {
+unpackreq_number(lua_State *L, const uint8_t * buf, int sz, int compressed) {
 	if (sz < 9) {
 		return luaL_error(L, "Invalid cluster message (size=%d)", sz);
 	}
@@ -262,7 +671,7 @@ unpackreq_number(lua_State *L, const uint8_t * buf, int sz) {
 	lua_pushinteger(L, address);
 	lua_pushinteger(L, session);
 
-	return_buffer(L, (const char *)buf+9, sz-9);
+	return_payload(L, (const char *)buf+9, sz-9, compressed);
 	if (session == 0) {
 		lua_pushnil(L);
 		lua_pushboolean(L,1);	// is_push, no reponse
@@ -273,7 +682,7 @@ unpackreq_number(lua_State *L, const uint8_t * buf, int sz) {
 }
 
 static int
-unpackmreq_number(lua_State *L, const uint8_t * buf, int sz, int is_push) {
+unpackmreq_number(lua_State *L, const uint8_t * buf, int sz, int is_push, int compressed) {
 	if (sz != 13) {
 		return luaL_error(L, "Invalid cluster message size %d (multi req must be 13)", sz);
 	}
@@ -283,7 +692,7 @@ unpackmreq_number(lua_State *L, const uint8_t * buf, int sz, int is_push) {
 	lua_pushinteger(L, address);
 	lua_pushinteger(L, session);
 	lua_pushnil(L);
-	lua_pushinteger(L, size);
+	push_size(L, size, compressed);
 	lua_pushboolean(L, 1);	// padding multi part
 	lua_pushboolean(L, is_push);
 
@@ -312,7 +721,7 @@ unpacktrace(lua_State *L, const char * buf, int sz) {
 }
 
 static int
-unpackreq_string(lua_State *L, const uint8_t * buf, int sz) {
+unpackreq_string(lua_State *L, const uint8_t * buf, int sz, int compressed) {
 	if (sz < 2) {
 		return luaL_error(L, "Invalid cluster message (size=%d)", sz);
 	}
@@ -323,7 +732,7 @@ unpackreq_string(lua_State *L, const uint8_t * buf, int sz) {
 	lua_pushlstring(L, (const char *)buf+2, namesz);
 	uint32_t session = unpack_uint32(buf + namesz + 2);
 	lua_pushinteger(L, (uint32_t)session);
-	return_buffer(L, (const char *)buf+2+namesz+4, sz - namesz - 6);
+	return_payload(L, (const char *)buf+2+namesz+4, sz - namesz - 6, compressed);
 	if (session == 0) {
 		lua_pushnil(L);
 		lua_pushboolean(L,1);	// is_push, no reponse
@@ -334,7 +743,7 @@ unpackreq_string(lua_State *L, const uint8_t * buf, int sz) {
 }
 
 static int
-unpackmreq_string(lua_State *L, const uint8_t * buf, int sz, int is_push) {
+unpackmreq_string(lua_State *L, const uint8_t * buf, int sz, int is_push, int compressed) {
 	if (sz < 2) {
 		return luaL_error(L, "Invalid cluster message (size=%d)", sz);
 	}
@@ -347,7 +756,7 @@ unpackmreq_string(lua_State *L, const uint8_t * buf, int sz, int is_push) {
 	uint32_t size = unpack_uint32(buf + namesz + 6);
 	lua_pushinteger(L, session);
 	lua_pushnil(L);
-	lua_pushinteger(L, size);
+	push_size(L, size, compressed);
 	lua_pushboolean(L, 1);	// padding multipart
 	lua_pushboolean(L, is_push);
 
@@ -368,27 +777,31 @@ lunpackrequest(lua_State *L) {
 	}
 	if (sz == 0)
 		return luaL_error(L, "Invalid req package. size == 0");
-	switch (msg[0]) {
+	int compressed = msg[0] & 0x20;
+	switch (msg[0] & ~0x20) {
 	case 0:
-		return unpackreq_number(L, (const uint8_t *)msg, sz);
+		return unpackreq_number(L, (const uint8_t *)msg, sz, compressed);
 	case 1:
-		return unpackmreq_number(L, (const uint8_t *)msg, sz, 0);	// request
+		return unpackmreq_number(L, (const uint8_t *)msg, sz, 0, compressed);	// request
 	case '\x41':
-		return unpackmreq_number(L, (const uint8_t *)msg, sz, 1);	// push
+		return unpackmreq_number(L, (const uint8_t *)msg, sz, 1, compressed);	// push
 	case 2:
 	case 3:
+		if (compressed)
+			break;
 		return unpackmreq_part(L, (const uint8_t *)msg, sz);
 	case 4:
+		if (compressed)
+			break;
 		return unpacktrace(L, msg, sz);
 	case '\x80':
-		return unpackreq_string(L, (const uint8_t *)msg, sz);
+		return unpackreq_string(L, (const uint8_t *)msg, sz, compressed);
 	case '\x81':
-		return unpackmreq_string(L, (const uint8_t *)msg, sz, 0 );	// request
+		return unpackmreq_string(L, (const uint8_t *)msg, sz, 0, compressed);	// request
 	case '\xc1':
-		return unpackmreq_string(L, (const uint8_t *)msg, sz, 1 );	// push
-	default:
-		return luaL_error(L, "Invalid req package type %d", msg[0]);
+		return unpackmreq_string(L, (const uint8_t *)msg, sz, 1, compressed);	// push
 	}
+	return luaL_error(L, "Invalid req package type %d", msg[0]);
 }
 
 /*
@@ -401,17 +814,22 @@ lunpackrequest(lua_State *L) {
 		2: multi begin
 		3: multi part
 		4: multi end
+		5: ok, compressed
+		6: multi begin, compressed
 	PADDING msg
 		type = 0, error msg
 		type = 1, msg
 		type = 2, DWORD size
 		type = 3/4, msg
+		type = 5, compressed payload
+		type = 6, DWORD size of the compressed payload
  */
 /*
 	int session
 	boolean ok
 	lightuserdata msg
 	int sz
+	userdata compressor (optional)
 	return string response
  */
 static int
@@ -430,12 +848,21 @@ lpackresponse(lua_State *L) {
 		sz = (size_t)luaL_checkinteger(L, 4);
 	}
 
+	uint8_t type = ok;
+	void * cmsg = NULL;
 	if (!ok) {
 		if (sz > MULTI_PART) {
 			// truncate the error msg if too long
 			sz = MULTI_PART;
 		}
 	} else {
+		uint32_t csz;
+		cmsg = compress_payload(tocompressor(L, 5), msg, sz, &csz);
+		if (cmsg) {
+			msg = cmsg;
+			sz = csz;
+			type = 5;
+		}
 		if (sz > MULTI_PART) {
 			// return 
 			int part = (sz - 1) / MULTI_PART + 1;
@@ -445,7 +872,7 @@ lpackresponse(lua_State *L) {
 			// multi part begin
 			fill_header(L, buf, 9);
 			fill_uint32(buf+2, session);
-			buf[6] = 2;
+			buf[6] = cmsg ? 6 : 2;
 			fill_uint32(buf+7, (uint32_t)sz);
 			lua_pushlstring(L, (const char *)buf, 11);
 			lua_rawseti(L, -2, 1);
@@ -469,6 +896,7 @@ lpackresponse(lua_State *L) {
 				sz -= s;
 				ptr += s;
 			}
+			skynet_free(cmsg);
 			return 1;
 		}
 	}
@@ -476,8 +904,9 @@ lpackresponse(lua_State *L) {
 	uint8_t buf[TEMP_LENGTH];
 	fill_header(L, buf, sz+5);
 	fill_uint32(buf+2, session);
-	buf[6] = ok;
+	buf[6] = type;
 	memcpy(buf+7,msg,sz);
+	skynet_free(cmsg);
 
 	lua_pushlstring(L, (const char *)buf, sz+7);
 
@@ -511,14 +940,25 @@ lunpackresponse(lua_State *L) {
 		lua_pushlstring(L, buf+5, sz-5);
 		return 3;
 	case 2:	// multi begin
+	case 6:	// multi begin, compressed
 		if (sz != 9) {
 			return 0;
 		}
-		sz = unpack_uint32((const uint8_t *)buf+5);
 		lua_pushboolean(L, 1);
-		lua_pushinteger(L, sz);
+		push_size(L, unpack_uint32((const uint8_t *)buf+5), buf[4] == 6);
 		lua_pushboolean(L, 1);
 		return 4;
+	case 5: {	// ok, compressed
+		uint32_t rsz;
+		void * ptr = decompress_payload((const uint8_t *)buf+5, sz-5, &rsz);
+		if (ptr == NULL) {
+			return 0;
+		}
+		lua_pushboolean(L, 1);
+		lua_pushlstring(L, (const char *)ptr, rsz);
+		skynet_free(ptr);
+		return 3;
+	}
 	case 3:	// multi part
 		lua_pushboolean(L, 1);
 		lua_pushlstring(L, buf+5, sz-5);
@@ -563,6 +1003,11 @@ lconcat(lua_State *L) {
 		return 0;
 	int sz = lua_tointeger(L,-1);
 	lua_pop(L,1);
+	int compressed = 0;
+	if (sz < 0) {
+		compressed = 1;
+		sz = -sz;
+	}
 	char * buff = skynet_malloc(sz);
 	int idx = 2;
 	int offset = 0;
@@ -582,12 +1027,80 @@ lconcat(lua_State *L) {
 		skynet_free(buff);
 		return 0;
 	}
+	if (compressed) {
+		uint32_t rsz;
+		void * ptr = decompress_payload((const uint8_t *)buff, sz, &rsz);
+		skynet_free(buff);
+		if (ptr == NULL)
+			return 0;
+		buff = ptr;
+		sz = rsz;
+	}
 	// buff/sz will send to other service, See clusterd.lua
 	lua_pushlightuserdata(L, buff);
 	lua_pushinteger(L, sz);
 	return 2;
 }
 
+static int
+lcompressor(lua_State *L) {
+	int threshold = luaL_checkinteger(L, 1);
+	size_t sz = 0;
+	const char * dict = luaL_optlstring(L, 2, NULL, &sz);
+	struct compressor *z = lua_newuserdatauv(L, sizeof(*z), 0);
+	memset(z, 0, sizeof(*z));
+	z->threshold = threshold > LZ_MFLIMIT ? threshold : LZ_MFLIMIT + 1;
+	if (dict && sz >= LZ_MINMATCH) {
+		z->dict = dict_register((const uint8_t *)dict, (int)sz);
+		if (z->dict == NULL)
+			return luaL_error(L, "Too many compress dictionaries (max = %d)", MAX_DICT);
+		z->usedict = 1;
+	}
+	luaL_setmetatable(L, "CLUSTERZ");
+	return 1;
+}
+
+// use the dictionary or not, the peer must have the same one
+static int
+lzusedict(lua_State *L) {
+	struct compressor *z = luaL_checkudata(L, 1, "CLUSTERZ");
+	z->usedict = z->dict && lua_toboolean(L, 2);
+	return 0;
+}
+
+static int
+lzdictid(lua_State *L) {
+	struct compressor *z = luaL_checkudata(L, 1, "CLUSTERZ");
+	lua_pushinteger(L, z->dict ? z->dict->id : 0);
+	return 1;
+}
+
+/*
+	return count, raw bytes, packed bytes, cpu time (ns)
+ */
+static int
+lzstat(lua_State *L) {
+	struct compressor *z = luaL_checkudata(L, 1, "CLUSTERZ");
+	lua_pushinteger(L, z->count);
+	lua_pushinteger(L, z->raw);
+	lua_pushinteger(L, z->packed);
+	lua_pushinteger(L, z->ns);
+	return 4;
+}
+
+/*
+	process wide decompression stat
+	return count, packed bytes, raw bytes, cpu time (ns)
+ */
+static int
+ldecompressstat(lua_State *L) {
+	lua_pushinteger(L, ATOM_LOAD(&Z.count));
+	lua_pushinteger(L, ATOM_LOAD(&Z.packed));
+	lua_pushinteger(L, ATOM_LOAD(&Z.raw));
+	lua_pushinteger(L, ATOM_LOAD(&Z.ns));
+	return 4;
+}
+
 static int
 lisname(lua_State *L) {
 	const char * name = lua_tostring(L, 1);
@@ -628,9 +1141,22 @@ luaopen_skynet_cluster_core(lua_State *L) {
 		{ "concat", lconcat },
 		{ "isname", lisname },
 		{ "nodename", lnodename },
+		{ "compressor", lcompressor },
+		{ "decompressstat", ldecompressstat },
 		{ NULL, NULL },
 	};
 	luaL_checkversion(L);
+	if (luaL_newmetatable(L, "CLUSTERZ")) {
+		luaL_Reg z[] = {
+			{ "usedict", lzusedict },
+			{ "dictid", lzdictid },
+			{ "stat", lzstat },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, z);
+		lua_setfield(L, -2, "__index");
+	}
+	lua_pop(L, 1);
 	luaL_newlib(L,l);
 
 	return 1;
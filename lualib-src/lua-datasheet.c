@@ -1,10 +1,14 @@
 #include <lua.h>
 #include <lauxlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #define NODECACHE "_ctable"
 #define PROXYCACHE "_proxy"
 #define TABLES "_ctables"
+#define COLUMNSMETA "_columnsmeta"
+#define ROWMETA "_rowmeta"
+#define ROWCACHE "_row"
 
 #define VALUE_NIL 0
 #define VALUE_INTEGER 1
@@ -15,12 +19,18 @@
 #define VALUE_INVALID 6
 
 #define INVALID_OFFSET 0xffffffff
+#define COLUMNS_MARKER 0xffffffff
 
 struct proxy {
 	const char * data;
 	int index;
 };
 
+struct row {
+	struct proxy * p;	// proxy of columns
+	uint32_t row;
+};
+
 struct document {
 	uint32_t strtbl;
 	uint32_t n;
@@ -37,6 +47,24 @@ struct table {
 	// kvpair[dict]
 };
 
+struct column {
+	uint32_t key;
+	uint8_t type;
+	uint8_t width;
+	uint16_t reserved;
+	uint32_t dict;
+	uint32_t offset;
+};
+
+// A homogeneous array of records is stored by columns, see datasheet/dump.lua
+struct columns {
+	uint32_t marker;	// COLUMNS_MARKER, instead of table.array
+	uint32_t rows;
+	uint32_t ncol;
+	uint32_t size;
+	struct column col[1];
+};
+
 static inline const struct table *
 gettable(const struct document *doc, int index) {
 	if (doc->index[index] == INVALID_OFFSET) {
@@ -45,6 +73,56 @@ gettable(const struct document *doc, int index) {
 	return (const struct table *)((const char *)doc + sizeof(uint32_t) + sizeof(uint32_t) + doc->n * sizeof(uint32_t) + doc->index[index]);
 }
 
+static inline const struct columns *
+getcolumns(const struct table *t) {
+	if (t == NULL || t->array != COLUMNS_MARKER)
+		return NULL;
+	return (const struct columns *)t;
+}
+
+static inline const uint32_t *
+tablevalue(const struct table *t) {
+	return (const uint32_t *)((const char *)t + sizeof(uint32_t) + sizeof(uint32_t) + ((t->array + t->dict + 3) & ~3));
+}
+
+static inline uint32_t getuint32(const void *v);
+
+static int
+same_value(const struct document *doc, const uint32_t *v, const struct document *newdoc, const uint32_t *nv, int type) {
+	if (type == VALUE_STRING) {
+		const char * str = (const char *)doc + doc->strtbl + getuint32(v);
+		const char * newstr = (const char *)newdoc + newdoc->strtbl + getuint32(nv);
+		return strcmp(str, newstr) == 0;
+	}
+	return *v == *nv;
+}
+
+/*
+	The table indices are stable across versions (see dump.diff), so the table values are compared by index,
+	and the strings are compared by content.
+ */
+static int
+same_table(const struct document *doc, const struct table *t, const struct document *newdoc, const struct table *newt) {
+	if (t->array != newt->array || t->dict != newt->dict)
+		return 0;
+	if (memcmp(t->type, newt->type, t->array + t->dict) != 0)
+		return 0;
+	const uint32_t * v = tablevalue(t);
+	const uint32_t * nv = tablevalue(newt);
+	int i;
+	for (i=0;i<t->array;i++) {
+		if (!same_value(doc, v++, newdoc, nv++, t->type[i]))
+			return 0;
+	}
+	for (i=0;i<t->dict;i++) {
+		if (!same_value(doc, v++, newdoc, nv++, VALUE_STRING))
+			return 0;
+		if (!same_value(doc, v++, newdoc, nv++, t->type[t->array+i]))
+			return 0;
+	}
+	return 1;
+}
+
 static void
 create_proxy(lua_State *L, const void *data, int index) {
 	const struct table * t = gettable(data, index);
@@ -58,7 +136,11 @@ create_proxy(lua_State *L, const void *data, int index) {
 	}
 	lua_pop(L, 1);
 	lua_newtable(L);
-	lua_pushvalue(L, lua_upvalueindex(1));
+	if (getcolumns(t)) {
+		lua_getfield(L, LUA_REGISTRYINDEX, COLUMNSMETA);
+	} else {
+		lua_pushvalue(L, lua_upvalueindex(1));
+	}
 	lua_setmetatable(L, -2);
 	lua_pushvalue(L, -1);
 	// NODECACHE, table, table
@@ -98,6 +180,15 @@ clear_table(lua_State *L) {
 	}
 }
 
+static void
+push_meta(lua_State *L, int columns) {
+	if (columns) {
+		lua_getfield(L, LUA_REGISTRYINDEX, COLUMNSMETA);
+	} else {
+		lua_pushvalue(L, lua_upvalueindex(1));
+	}
+}
+
 static void
 update_cache(lua_State *L, const void *data, const void * newdata) {
 	lua_getfield(L, LUA_REGISTRYINDEX, NODECACHE);
@@ -119,10 +210,25 @@ update_cache(lua_State *L, const void *data, const void * newdata) {
 				const struct table * newt = gettable(newdata, p->index);
 				lua_pop(L, 1);
 				// pointer, table
-				clear_table(L);
-				lua_pushvalue(L, lua_upvalueindex(1));
-				// pointer, table, meta
-				lua_setmetatable(L, -2);
+				int columns = getcolumns(newt) != NULL;
+				if (lua_getmetatable(L, -1)) {
+					// not copied yet
+					lua_getfield(L, LUA_REGISTRYINDEX, COLUMNSMETA);
+					int oldcolumns = lua_rawequal(L, -1, -2);
+					lua_pop(L, 2);
+					if (oldcolumns || columns) {
+						// drop the cached rows, the row proxies read the new data
+						clear_table(L);
+						push_meta(L, columns);
+						lua_setmetatable(L, -2);
+					}
+				} else if (newt == NULL || columns || !same_table(data, lua_touserdata(L, -2), newdata, newt)) {
+					// the copied table is changed
+					clear_table(L);
+					push_meta(L, columns);
+					// pointer, table, meta
+					lua_setmetatable(L, -2);
+				}
 				// pointer, table
 				if (newt) {
 					lua_rawsetp(L, nt, newt);
@@ -236,7 +342,7 @@ copytable(lua_State *L, int tbl, struct proxy *p) {
 	if (t == NULL) {
 		luaL_error(L, "Invalid proxy (index = %d)", p->index);
 	}
-	const uint32_t * v = (const uint32_t *)((const char *)t + sizeof(uint32_t) + sizeof(uint32_t) + ((t->array + t->dict + 3) & ~3));
+	const uint32_t * v = tablevalue(t);
 	int i;
 	for (i=0;i<t->array;i++) {
 		pushvalue(L, v++, t->type[i], doc);
@@ -249,6 +355,248 @@ copytable(lua_State *L, int tbl, struct proxy *p) {
 	}
 }
 
+static inline int32_t
+getinteger(const uint8_t *v, int width) {
+	switch (width) {
+	case 1:
+		return (int8_t)v[0];
+	case 2:
+		return (int16_t)(v[0] | v[1] << 8);
+	default:
+		return (int32_t)getuint32(v);
+	}
+}
+
+static inline uint32_t
+getcode(const uint8_t *v, int width) {
+	switch (width) {
+	case 1:
+		return v[0];
+	case 2:
+		return v[0] | v[1] << 8;
+	default:
+		return getuint32(v);
+	}
+}
+
+static void
+pushcolumn(lua_State *L, const struct document *doc, const struct columns *c, const struct column *col, uint32_t row) {
+	const uint8_t * data = (const uint8_t *)c + col->offset;
+	switch (col->type) {
+	case VALUE_INTEGER:
+		lua_pushinteger(L, getinteger(data + row * col->width, col->width));
+		break;
+	case VALUE_REAL:
+		lua_pushnumber(L, getfloat(data + row * 4));
+		break;
+	case VALUE_BOOLEAN:
+		lua_pushboolean(L, data[row]);
+		break;
+	case VALUE_STRING: {
+		uint32_t code = getcode(data + col->dict * 4 + row * col->width, col->width);
+		pushvalue(L, data + code * 4, VALUE_STRING, doc);
+		break;
+	}
+	default:
+		luaL_error(L, "Invalid column type %d", col->type);
+	}
+}
+
+static int
+findcolumn(const struct document *doc, const struct columns *c, const char *key, size_t sz) {
+	int i;
+	for (i=0;i<c->ncol;i++) {
+		const char * name = (const char *)doc + doc->strtbl + c->col[i].key;
+		// compare the length first, don't read past the end of a shorter name
+		if (strnlen(name, sz + 1) == sz && memcmp(name, key, sz) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static struct proxy *
+getproxy(lua_State *L, int index) {
+	lua_getfield(L, LUA_REGISTRYINDEX, PROXYCACHE);
+	lua_pushvalue(L, index);
+	if (lua_rawget(L, -2) != LUA_TUSERDATA) {
+		lua_pop(L, 2);
+		return NULL;
+	}
+	struct proxy * p = lua_touserdata(L, -1);
+	lua_pop(L, 2);
+	return p;
+}
+
+static const struct columns *
+proxycolumns(lua_State *L, struct proxy *p) {
+	const struct document * doc = (const struct document *)p->data;
+	if (p->index < 0 || p->index >= doc->n) {
+		luaL_error(L, "Invalid proxy (index = %d, total = %d)", p->index, (int)doc->n);
+	}
+	const struct columns * c = getcolumns(gettable(doc, p->index));
+	if (c == NULL) {
+		luaL_error(L, "Invalid columns (index = %d)", p->index);
+	}
+	return c;
+}
+
+static const struct columns *
+checkcolumns(lua_State *L, struct proxy **p) {
+	*p = getproxy(L, 1);
+	if (*p == NULL) {
+		luaL_error(L, "Invalid proxy table %p", lua_topointer(L, 1));
+	}
+	return proxycolumns(L, *p);
+}
+
+// The row proxy is created at first access, and cached in the columns table
+static int
+lcolumnsindex(lua_State *L) {
+	int isint;
+	lua_Integer n = lua_tointegerx(L, 2, &isint);
+	struct proxy * p;
+	const struct columns * c = checkcolumns(L, &p);
+	if (!isint || n < 1 || n > c->rows)
+		return 0;
+	lua_newtable(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, ROWMETA);
+	lua_setmetatable(L, -2);
+	lua_getfield(L, LUA_REGISTRYINDEX, ROWCACHE);
+	lua_pushvalue(L, -2);
+	// row, ROWCACHE, row
+	struct row * r = lua_newuserdatauv(L, sizeof(struct row), 1);
+	r->p = p;
+	r->row = n - 1;
+	// keep the columns table (and its proxy) alive
+	lua_pushvalue(L, 1);
+	lua_setiuservalue(L, -2, 1);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+	// row
+	lua_pushvalue(L, -1);
+	lua_rawseti(L, 1, n);
+	return 1;
+}
+
+static int
+lcolumnsnext(lua_State *L) {
+	struct proxy * p;
+	const struct columns * c = checkcolumns(L, &p);
+	lua_Integer n = luaL_optinteger(L, 2, 0) + 1;
+	if (n > c->rows)
+		return 0;
+	lua_pushinteger(L, n);
+	lua_geti(L, 1, n);
+	return 2;
+}
+
+static int
+lcolumnspairs(lua_State *L) {
+	lua_pushcfunction(L, lcolumnsnext);
+	lua_pushvalue(L, 1);
+	lua_pushnil(L);
+	return 3;
+}
+
+static int
+lcolumnslen(lua_State *L) {
+	struct proxy * p;
+	const struct columns * c = checkcolumns(L, &p);
+	lua_pushinteger(L, c->rows);
+	return 1;
+}
+
+static const struct columns *
+checkrow(lua_State *L, struct row **r) {
+	lua_getfield(L, LUA_REGISTRYINDEX, ROWCACHE);
+	lua_pushvalue(L, 1);
+	if (lua_rawget(L, -2) != LUA_TUSERDATA) {
+		luaL_error(L, "Invalid row proxy %p", lua_topointer(L, 1));
+	}
+	*r = lua_touserdata(L, -1);
+	lua_pop(L, 2);
+	const struct columns * c = proxycolumns(L, (*r)->p);
+	if ((*r)->row >= c->rows) {
+		luaL_error(L, "Invalid row %d (total = %d)", (int)(*r)->row + 1, (int)c->rows);
+	}
+	return c;
+}
+
+static int
+lrowindex(lua_State *L) {
+	struct row * r;
+	const struct columns * c = checkrow(L, &r);
+	if (lua_type(L, 2) != LUA_TSTRING)
+		return 0;
+	size_t sz;
+	const char * key = lua_tolstring(L, 2, &sz);
+	const struct document * doc = (const struct document *)r->p->data;
+	int i = findcolumn(doc, c, key, sz);
+	if (i < 0)
+		return 0;
+	pushcolumn(L, doc, c, &c->col[i], r->row);
+	return 1;
+}
+
+static int
+lrownext(lua_State *L) {
+	struct row * r;
+	const struct columns * c = checkrow(L, &r);
+	const struct document * doc = (const struct document *)r->p->data;
+	int i = 0;
+	if (!lua_isnoneornil(L, 2)) {
+		size_t sz;
+		const char * key = luaL_checklstring(L, 2, &sz);
+		i = findcolumn(doc, c, key, sz);
+		if (i < 0) {
+			return luaL_error(L, "Invalid key %s", key);
+		}
+		++i;
+	}
+	if (i >= c->ncol)
+		return 0;
+	pushvalue(L, &c->col[i].key, VALUE_STRING, doc);
+	pushcolumn(L, doc, c, &c->col[i], r->row);
+	return 2;
+}
+
+static int
+lrowpairs(lua_State *L) {
+	lua_pushcfunction(L, lrownext);
+	lua_pushvalue(L, 1);
+	lua_pushnil(L);
+	return 3;
+}
+
+/*
+	table columns, string key
+	return an array of the values of the column, or nil if the table is not stored by columns
+ */
+static int
+lcolumn(lua_State *L) {
+	const char * key = luaL_checkstring(L, 2);
+	struct proxy * p = getproxy(L, 1);
+	if (p == NULL || !lua_getmetatable(L, 1))
+		return 0;
+	lua_getfield(L, LUA_REGISTRYINDEX, COLUMNSMETA);
+	if (!lua_rawequal(L, -1, -2))
+		return 0;
+	lua_pop(L, 2);
+	const struct columns * c = proxycolumns(L, p);
+	const struct document * doc = (const struct document *)p->data;
+	int i = findcolumn(doc, c, key, lua_rawlen(L, 2));
+	if (i < 0)
+		return 0;
+	const struct column * col = &c->col[i];
+	uint32_t n;
+	lua_createtable(L, c->rows, 0);
+	for (n=0;n<c->rows;n++) {
+		pushcolumn(L, doc, c, col, n);
+		lua_rawseti(L, -2, n+1);
+	}
+	return 1;
+}
+
 static int
 lnew(lua_State *L) {
 	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
@@ -334,6 +682,28 @@ gen_metatable(lua_State *L) {
 	lua_newtable(L);
 	lua_setfield(L, LUA_REGISTRYINDEX, TABLES);
 
+	new_weak_table(L, "k");	// ROWCACHE { row:userdata }
+	lua_setfield(L, LUA_REGISTRYINDEX, ROWCACHE);
+
+	lua_createtable(L, 0, 3);
+	luaL_Reg columns[] = {
+		{ "__index", lcolumnsindex },
+		{ "__pairs", lcolumnspairs },
+		{ "__len", lcolumnslen },
+		{ NULL, NULL },
+	};
+	luaL_setfuncs(L, columns, 0);
+	lua_setfield(L, LUA_REGISTRYINDEX, COLUMNSMETA);
+
+	lua_createtable(L, 0, 2);
+	luaL_Reg row[] = {
+		{ "__index", lrowindex },
+		{ "__pairs", lrowpairs },
+		{ NULL, NULL },
+	};
+	luaL_setfuncs(L, row, 0);
+	lua_setfield(L, LUA_REGISTRYINDEX, ROWMETA);
+
 	lua_createtable(L, 0, 1);	// mod table
 
 	lua_createtable(L, 0, 2);	// metatable
@@ -360,6 +730,7 @@ luaopen_skynet_datasheet_core(lua_State *L) {
 	luaL_Reg l[] = {
 		{ "new", lnew },
 		{ "update", lupdate },
+		{ "column", lcolumn },
 		{ NULL, NULL },
 	};
 
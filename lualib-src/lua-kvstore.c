@@ -0,0 +1,708 @@
+#define LUA_LIB
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rwlock.h"
+#include "skynet_malloc.h"
+#include "atomic.h"
+
+/*
+	The in-process store of datacenter, shared by all the services in the process.
+
+	The top level keys are distributed into KV_SHARD shards by hash, each shard has a rwlock.
+	A table value is stored as a branch (nested hash table), it's protected by the lock of the shard
+	of the top level key, so the operations on the same top level key are serialized.
+
+	The waiters (see lwait) are registered in the shard, datacenterd answers them when lset reports.
+ */
+
+#define KV_SHARD 64
+#define KV_MAXDEPTH 32
+#define KV_MAXKEY 32
+
+#define KV_NIL 0
+#define KV_BOOLEAN 1
+#define KV_INTEGER 2
+#define KV_REAL 3
+#define KV_STRING 4
+#define KV_POINTER 5
+#define KV_TABLE 6
+
+struct kv_table;
+
+struct kv_value {
+	int type;
+	union {
+		int boolean;
+		lua_Integer i;
+		lua_Number n;
+		void * p;
+		struct {
+			char * str;
+			size_t sz;
+		} s;
+		struct kv_table * t;
+	} u;
+};
+
+struct kv_entry {
+	struct kv_entry * next;
+	uint32_t hash;
+	struct kv_value key;
+	struct kv_value value;
+};
+
+struct kv_table {
+	int size;	// power of 2, or 0
+	int count;
+	struct kv_entry ** slot;
+};
+
+struct kv_waiter {
+	struct kv_waiter * next;
+	lua_Integer id;
+	int depth;
+	struct kv_value key[KV_MAXKEY];
+};
+
+struct kv_shard {
+	struct rwlock lock;
+	struct kv_table root;
+	struct kv_waiter * waiter;
+};
+
+struct kv_store {
+	ATOM_INT opened;
+	struct kv_shard shard[KV_SHARD];
+};
+
+static struct kv_store S;
+
+static uint32_t
+kv_hash(const struct kv_value *k) {
+	switch (k->type) {
+	case KV_STRING: {
+		uint32_t h = 2166136261u;
+		size_t i;
+		for (i=0;i<k->u.s.sz;i++) {
+			h = (h ^ (uint8_t)k->u.s.str[i]) * 16777619u;
+		}
+		return h;
+	}
+	case KV_INTEGER:
+	case KV_REAL:
+	case KV_POINTER: {
+		uint64_t x;
+		if (k->type == KV_REAL) {
+			memcpy(&x, &k->u.n, sizeof(x));
+		} else if (k->type == KV_POINTER) {
+			x = (uint64_t)(uintptr_t)k->u.p;
+		} else {
+			x = (uint64_t)k->u.i;
+		}
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		return (uint32_t)x;
+	}
+	case KV_BOOLEAN:
+		return k->u.boolean;
+	default:
+		return 0;
+	}
+}
+
+static int
+kv_equal(const struct kv_value *a, const struct kv_value *b) {
+	if (a->type != b->type)
+		return 0;
+	switch (a->type) {
+	case KV_STRING:
+		return a->u.s.sz == b->u.s.sz && memcmp(a->u.s.str, b->u.s.str, a->u.s.sz) == 0;
+	case KV_INTEGER:
+		return a->u.i == b->u.i;
+	case KV_REAL:
+		return a->u.n == b->u.n;
+	case KV_BOOLEAN:
+		return a->u.boolean == b->u.boolean;
+	case KV_POINTER:
+		return a->u.p == b->u.p;
+	default:
+		return 0;
+	}
+}
+
+static void kv_freetable(struct kv_table *t);
+
+static void
+kv_freevalue(struct kv_value *v) {
+	if (v->type == KV_STRING) {
+		skynet_free(v->u.s.str);
+	} else if (v->type == KV_TABLE) {
+		kv_freetable(v->u.t);
+	}
+	v->type = KV_NIL;
+}
+
+static void
+kv_freetable(struct kv_table *t) {
+	int i;
+	for (i=0;i<t->size;i++) {
+		struct kv_entry * e = t->slot[i];
+		while (e) {
+			struct kv_entry * next = e->next;
+			kv_freevalue(&e->key);
+			kv_freevalue(&e->value);
+			skynet_free(e);
+			e = next;
+		}
+	}
+	skynet_free(t->slot);
+	skynet_free(t);
+}
+
+static struct kv_entry *
+kv_find(struct kv_table *t, const struct kv_value *key, uint32_t hash) {
+	if (t->size == 0)
+		return NULL;
+	struct kv_entry * e = t->slot[hash & (t->size - 1)];
+	while (e) {
+		if (e->hash == hash && kv_equal(&e->key, key))
+			return e;
+		e = e->next;
+	}
+	return NULL;
+}
+
+static void
+kv_rehash(struct kv_table *t) {
+	int size = t->size ? t->size * 2 : 4;
+	struct kv_entry ** slot = skynet_malloc(size * sizeof(struct kv_entry *));
+	memset(slot, 0, size * sizeof(struct kv_entry *));
+	int i;
+	for (i=0;i<t->size;i++) {
+		struct kv_entry * e = t->slot[i];
+		while (e) {
+			struct kv_entry * next = e->next;
+			int idx = e->hash & (size - 1);
+			e->next = slot[idx];
+			slot[idx] = e;
+			e = next;
+		}
+	}
+	skynet_free(t->slot);
+	t->slot = slot;
+	t->size = size;
+}
+
+// the key is moved into the new entry
+static struct kv_entry *
+kv_insert(struct kv_table *t, struct kv_value *key, uint32_t hash) {
+	if (t->count >= t->size) {
+		kv_rehash(t);
+	}
+	struct kv_entry * e = skynet_malloc(sizeof(*e));
+	int idx = hash & (t->size - 1);
+	e->next = t->slot[idx];
+	e->hash = hash;
+	e->key = *key;
+	key->type = KV_NIL;
+	e->value.type = KV_NIL;
+	t->slot[idx] = e;
+	++t->count;
+	return e;
+}
+
+static void
+kv_remove(struct kv_table *t, struct kv_entry *entry) {
+	struct kv_entry ** p = &t->slot[entry->hash & (t->size - 1)];
+	while (*p != entry) {
+		p = &(*p)->next;
+	}
+	*p = entry->next;
+	--t->count;
+	kv_freevalue(&entry->key);
+	skynet_free(entry);
+}
+
+static struct kv_table *
+kv_newtable(void) {
+	struct kv_table * t = skynet_malloc(sizeof(*t));
+	t->size = 0;
+	t->count = 0;
+	t->slot = NULL;
+	return t;
+}
+
+// the key refers to the string in lua (not copied), return 0 if the type is not supported
+static int
+kv_key(lua_State *L, int index, struct kv_value *k) {
+	switch (lua_type(L, index)) {
+	case LUA_TSTRING:
+		k->type = KV_STRING;
+		k->u.s.str = (char *)lua_tolstring(L, index, &k->u.s.sz);
+		return 1;
+	case LUA_TNUMBER: {
+		int isint;
+		k->u.i = lua_tointegerx(L, index, &isint);
+		if (isint) {
+			k->type = KV_INTEGER;
+		} else {
+			k->type = KV_REAL;
+			k->u.n = lua_tonumber(L, index);
+		}
+		return 1;
+	}
+	case LUA_TBOOLEAN:
+		k->type = KV_BOOLEAN;
+		k->u.boolean = lua_toboolean(L, index);
+		return 1;
+	case LUA_TLIGHTUSERDATA:
+		k->type = KV_POINTER;
+		k->u.p = lua_touserdata(L, index);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void
+kv_copystring(struct kv_value *v) {
+	if (v->type == KV_STRING) {
+		char * str = skynet_malloc(v->u.s.sz + 1);
+		memcpy(str, v->u.s.str, v->u.s.sz);
+		str[v->u.s.sz] = '\0';
+		v->u.s.str = str;
+	}
+}
+
+// deep copy, read the value out of the lock without calling lua api
+static void
+kv_clone(struct kv_value *dst, const struct kv_value *src) {
+	*dst = *src;
+	if (src->type == KV_STRING) {
+		kv_copystring(dst);
+	} else if (src->type == KV_TABLE) {
+		const struct kv_table * st = src->u.t;
+		struct kv_table * t = kv_newtable();
+		int i;
+		dst->u.t = t;
+		for (i=0;i<st->size;i++) {
+			const struct kv_entry * e = st->slot[i];
+			for (;e;e=e->next) {
+				struct kv_value key = e->key;
+				kv_copystring(&key);
+				struct kv_entry * ne = kv_insert(t, &key, e->hash);
+				kv_clone(&ne->value, &e->value);
+			}
+		}
+	}
+}
+
+// convert the lua value without raising error (the lock may be held), return the error message or NULL
+static const char *
+kv_tovalue(lua_State *L, int index, struct kv_value *v, int depth) {
+	if (lua_type(L, index) == LUA_TNIL) {
+		v->type = KV_NIL;
+		return NULL;
+	}
+	if (lua_type(L, index) == LUA_TNUMBER) {
+		// keep the subtype of the value, only the keys are normalized (2.0 -> 2)
+		if (lua_isinteger(L, index)) {
+			v->type = KV_INTEGER;
+			v->u.i = lua_tointeger(L, index);
+		} else {
+			v->type = KV_REAL;
+			v->u.n = lua_tonumber(L, index);
+		}
+		return NULL;
+	}
+	if (kv_key(L, index, v)) {
+		kv_copystring(v);
+		return NULL;
+	}
+	if (lua_type(L, index) != LUA_TTABLE) {
+		v->type = KV_NIL;
+		return "Unsupported value type";
+	}
+	if (depth > KV_MAXDEPTH || !lua_checkstack(L, 3)) {
+		v->type = KV_NIL;
+		return "The table is too deep";
+	}
+	index = lua_absindex(L, index);
+	struct kv_table * t = kv_newtable();
+	v->type = KV_TABLE;
+	v->u.t = t;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		struct kv_value key;
+		if (!kv_key(L, -2, &key)) {
+			lua_pop(L, 2);
+			kv_freevalue(v);
+			return "Unsupported key type";
+		}
+		kv_copystring(&key);
+		struct kv_entry * e = kv_insert(t, &key, kv_hash(&key));
+		const char * err = kv_tovalue(L, -1, &e->value, depth + 1);
+		lua_pop(L, 1);
+		if (err) {
+			lua_pop(L, 1);
+			kv_freevalue(v);
+			return err;
+		}
+	}
+	return NULL;
+}
+
+static void
+kv_pushvalue(lua_State *L, const struct kv_value *v) {
+	switch (v->type) {
+	case KV_BOOLEAN:
+		lua_pushboolean(L, v->u.boolean);
+		break;
+	case KV_INTEGER:
+		lua_pushinteger(L, v->u.i);
+		break;
+	case KV_REAL:
+		lua_pushnumber(L, v->u.n);
+		break;
+	case KV_STRING:
+		lua_pushlstring(L, v->u.s.str, v->u.s.sz);
+		break;
+	case KV_POINTER:
+		lua_pushlightuserdata(L, v->u.p);
+		break;
+	case KV_TABLE: {
+		struct kv_table * t = v->u.t;
+		int i;
+		luaL_checkstack(L, 3, NULL);
+		lua_createtable(L, 0, t->count);
+		for (i=0;i<t->size;i++) {
+			struct kv_entry * e = t->slot[i];
+			for (;e;e=e->next) {
+				kv_pushvalue(L, &e->key);
+				kv_pushvalue(L, &e->value);
+				lua_rawset(L, -3);
+			}
+		}
+		break;
+	}
+	default:
+		lua_pushnil(L);
+		break;
+	}
+}
+
+struct kv_path {
+	int depth;
+	struct kv_value key[KV_MAXKEY];
+	uint32_t hash[KV_MAXKEY];
+};
+
+static void
+kv_checkpath(lua_State *L, int from, int to, struct kv_path *path) {
+	int i;
+	path->depth = to - from + 1;
+	if (path->depth <= 0) {
+		luaL_error(L, "Need a key");
+	}
+	if (path->depth > KV_MAXKEY) {
+		luaL_error(L, "Too many keys");
+	}
+	if (!ATOM_LOAD(&S.opened)) {
+		luaL_error(L, "The kvstore is not opened");
+	}
+	for (i=0;i<path->depth;i++) {
+		if (!kv_key(L, from + i, &path->key[i])) {
+			luaL_error(L, "Unsupported key type %s", luaL_typename(L, from + i));
+		}
+		path->hash[i] = kv_hash(&path->key[i]);
+	}
+}
+
+static inline struct kv_shard *
+kv_shard(struct kv_path *path) {
+	return &S.shard[path->hash[0] % KV_SHARD];
+}
+
+// find the value of path in shard, NULL if not exist
+static struct kv_value *
+kv_lookup(struct kv_shard *shard, const struct kv_value *key, const uint32_t *hash, int depth) {
+	struct kv_table * t = &shard->root;
+	int i;
+	for (i=0;;i++) {
+		struct kv_entry * e = kv_find(t, &key[i], hash[i]);
+		if (e == NULL)
+			return NULL;
+		if (i == depth - 1)
+			return &e->value;
+		if (e->value.type != KV_TABLE)
+			return NULL;
+		t = e->value.u.t;
+	}
+}
+
+static int
+pget(lua_State *L) {
+	struct kv_value * v = lua_touserdata(L, 1);
+	kv_pushvalue(L, v);
+	return 1;
+}
+
+/*
+	key1, key2, ...
+	return the value (the table is copied)
+
+	The value is copied under the lock, and converted to lua after unlock :
+	the lua api may run a gc finalizer, which may call kv.set on the same shard.
+ */
+static int
+lget(lua_State *L) {
+	struct kv_path path;
+	struct kv_value copy;
+	kv_checkpath(L, 1, lua_gettop(L), &path);
+	struct kv_shard * shard = kv_shard(&path);
+	rwlock_rlock(&shard->lock);
+	struct kv_value * v = kv_lookup(shard, path.key, path.hash, path.depth);
+	if (v) {
+		kv_clone(&copy, v);
+	} else {
+		copy.type = KV_NIL;
+	}
+	rwlock_runlock(&shard->lock);
+	if (copy.type == KV_NIL)
+		return 0;
+	lua_pushcfunction(L, pget);
+	lua_pushlightuserdata(L, &copy);
+	int err = lua_pcall(L, 1, 1, 0);
+	kv_freevalue(&copy);
+	if (err != LUA_OK) {
+		return lua_error(L);
+	}
+	return 1;
+}
+
+static int
+kv_prefix(const struct kv_value *a, const struct kv_value *b, int n) {
+	int i;
+	for (i=0;i<n;i++) {
+		if (!kv_equal(&a[i], &b[i]))
+			return 0;
+	}
+	return 1;
+}
+
+static void
+kv_freewaiter(struct kv_waiter *w) {
+	int i;
+	for (i=0;i<w->depth;i++) {
+		kv_freevalue(&w->key[i]);
+	}
+	skynet_free(w);
+}
+
+/*
+	The same as datacenterd : the waiters of the path are woken up when the value is created,
+	and the waiters of a prefix get an error because a branch can't be waited.
+	The waiters of a longer path are woken up if the value exists now, it may be in a new parent table.
+	Move the woken waiters into *result, the id is negative for error.
+ */
+static void
+kv_wakeup(struct kv_shard *shard, struct kv_path *path, struct kv_waiter **result) {
+	struct kv_waiter ** p = &shard->waiter;
+	while (*p) {
+		struct kv_waiter * w = *p;
+		int n = w->depth < path->depth ? w->depth : path->depth;
+		int wake = 0;
+		if (kv_prefix(w->key, path->key, n)) {
+			if (w->depth <= path->depth) {
+				wake = w->depth < path->depth ? -1 : 1;
+			} else {
+				uint32_t hash[KV_MAXKEY];
+				int i;
+				for (i=0;i<w->depth;i++) {
+					hash[i] = kv_hash(&w->key[i]);
+				}
+				struct kv_value * v = kv_lookup(shard, w->key, hash, w->depth);
+				wake = (v && v->type != KV_NIL) ? 1 : 0;
+			}
+		}
+		if (wake) {
+			*p = w->next;
+			if (wake < 0)
+				w->id = -w->id;
+			w->next = *result;
+			*result = w;
+		} else {
+			p = &w->next;
+		}
+	}
+}
+
+struct kv_update {
+	struct kv_path * path;
+	struct kv_value value;
+	struct kv_value old;
+	struct kv_waiter * woken;
+	const char * err;
+};
+
+static void
+kv_set(struct kv_shard *shard, struct kv_update *u) {
+	struct kv_path * path = u->path;
+	struct kv_table * t = &shard->root;
+	int set = u->value.type != KV_NIL;
+	int i;
+	for (i=0;i<path->depth;i++) {
+		struct kv_entry * e = kv_find(t, &path->key[i], path->hash[i]);
+		if (i == path->depth - 1) {
+			if (e == NULL) {
+				if (u->value.type == KV_NIL)
+					return;
+				struct kv_value key = path->key[i];
+				kv_copystring(&key);
+				e = kv_insert(t, &key, path->hash[i]);
+			}
+			u->old = e->value;
+			e->value = u->value;
+			u->value.type = KV_NIL;
+			if (e->value.type == KV_NIL) {
+				kv_remove(t, e);
+			}
+			break;
+		}
+		if (e == NULL) {
+			if (u->value.type == KV_NIL)
+				return;
+			struct kv_value key = path->key[i];
+			kv_copystring(&key);
+			e = kv_insert(t, &key, path->hash[i]);
+			e->value.type = KV_TABLE;
+			e->value.u.t = kv_newtable();
+		} else if (e->value.type != KV_TABLE) {
+			u->err = "Not a branch";
+			return;
+		}
+		t = e->value.u.t;
+	}
+	// replacing a table may create the values of deeper paths, so check the waiters even if old is not nil
+	if (set && shard->waiter) {
+		kv_wakeup(shard, path, &u->woken);
+	}
+}
+
+/*
+	key1, key2, ... , value
+	return the old value, and the ids of the woken waiters { [id] = true/false (error) } if any
+ */
+static int
+lset(lua_State *L) {
+	int top = lua_gettop(L);
+	struct kv_path path;
+	struct kv_update u;
+	kv_checkpath(L, 1, top - 1, &path);
+	u.path = &path;
+	u.old.type = KV_NIL;
+	u.woken = NULL;
+	u.err = kv_tovalue(L, top, &u.value, 0);
+	if (u.err) {
+		return luaL_error(L, "%s", u.err);
+	}
+	struct kv_shard * shard = kv_shard(&path);
+	rwlock_wlock(&shard->lock);
+	kv_set(shard, &u);
+	rwlock_wunlock(&shard->lock);
+	kv_freevalue(&u.value);	// not NIL if failed
+	if (u.err) {
+		return luaL_error(L, "%s", u.err);
+	}
+	lua_settop(L, 0);
+	kv_pushvalue(L, &u.old);
+	kv_freevalue(&u.old);
+	if (u.woken == NULL)
+		return 1;
+	lua_newtable(L);
+	while (u.woken) {
+		struct kv_waiter * w = u.woken;
+		u.woken = w->next;
+		lua_pushboolean(L, w->id > 0);
+		lua_rawseti(L, -2, w->id > 0 ? w->id : -w->id);
+		kv_freewaiter(w);
+	}
+	return 2;
+}
+
+/*
+	integer id (> 0)
+	key1, key2, ...
+	return true if the value exists, or register the waiter and return false
+ */
+static int
+lwait(lua_State *L) {
+	lua_Integer id = luaL_checkinteger(L, 1);
+	struct kv_path path;
+	kv_checkpath(L, 2, lua_gettop(L), &path);
+	if (id <= 0) {
+		return luaL_error(L, "Invalid waiter id");
+	}
+	struct kv_waiter * w = skynet_malloc(sizeof(*w));
+	int i;
+	w->id = id;
+	w->depth = path.depth;
+	for (i=0;i<path.depth;i++) {
+		w->key[i] = path.key[i];
+		kv_copystring(&w->key[i]);
+	}
+	struct kv_shard * shard = kv_shard(&path);
+	rwlock_wlock(&shard->lock);
+	struct kv_value * v = kv_lookup(shard, path.key, path.hash, path.depth);
+	int exist = v && v->type != KV_NIL;
+	if (!exist) {
+		w->next = shard->waiter;
+		shard->waiter = w;
+	}
+	rwlock_wunlock(&shard->lock);
+	if (exist) {
+		kv_freewaiter(w);
+	}
+	lua_pushboolean(L, exist);
+	return 1;
+}
+
+// called by datacenterd (before any other access), the services in this process can access the store directly after it
+static int
+lopen(lua_State *L) {
+	if (!ATOM_LOAD(&S.opened)) {
+		int i;
+		for (i=0;i<KV_SHARD;i++) {
+			rwlock_init(&S.shard[i].lock);
+		}
+		ATOM_STORE(&S.opened, 1);
+	}
+	return 0;
+}
+
+static int
+lopened(lua_State *L) {
+	lua_pushboolean(L, ATOM_LOAD(&S.opened));
+	return 1;
+}
+
+LUAMOD_API int
+luaopen_skynet_kvstore(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "get", lget },
+		{ "set", lset },
+		{ "wait", lwait },
+		{ "open", lopen },
+		{ "opened", lopened },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L, l);
+	return 1;
+}
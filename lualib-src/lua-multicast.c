@@ -8,6 +8,7 @@
 #include <string.h>
 
 #include "atomic.h"
+#include "rwlock.h"
 
 struct mc_package {
 	ATOM_INT reference;
@@ -137,6 +138,424 @@ mc_remote(lua_State *L) {
 	return 2;
 }
 
+/*
+	Channel membership of this node, shared by all the services in the process.
+	multicastd maintains it, and the publisher pushes the package into the queues
+	of local subscribers directly (see mc_publish), without a hop through multicastd.
+ */
+
+struct mc_index {
+	uint32_t handle;
+	int pos;
+};
+
+// an immutable copy of the members, the publisher sends to it after releasing the locks
+struct mc_view {
+	ATOM_INT ref;
+	int n;
+	uint32_t member[1];
+};
+
+struct mc_channel {
+	uint32_t id;
+	int remote;	// the channel is owned by other node, or other nodes subscribe it
+	struct rwlock lock;
+	int n;
+	int cap;
+	uint32_t *member;
+	int index_cap;	// power of 2
+	struct mc_index *index;	// handle -> position in member
+	ATOM_POINTER view;	// struct mc_view *, built by the first publish after the members change
+};
+
+struct mc_registry {
+	struct rwlock lock;
+	int n;
+	int cap;	// power of 2
+	struct mc_channel **slot;
+};
+
+static struct mc_registry R;
+// 0 : R.lock is not initialized, 1 : initializing, 2 : ready
+static ATOM_INT R_INIT = 0;
+
+static inline int
+hash_id(uint32_t id, int cap) {
+	return (int)((id * 2654435761u) & (uint32_t)(cap - 1));
+}
+
+static struct mc_channel *
+channel_find(uint32_t id) {
+	if (R.cap == 0)
+		return NULL;
+	int h = hash_id(id, R.cap);
+	struct mc_channel *c;
+	while ((c = R.slot[h])) {
+		if (c->id == id)
+			return c;
+		h = (h + 1) & (R.cap - 1);
+	}
+	return NULL;
+}
+
+static void
+channel_insert_(struct mc_channel **slot, int cap, struct mc_channel *c) {
+	int h = hash_id(c->id, cap);
+	while (slot[h]) {
+		h = (h + 1) & (cap - 1);
+	}
+	slot[h] = c;
+}
+
+static void
+channel_insert(struct mc_channel *c) {
+	if ((R.n + 1) * 2 > R.cap) {
+		int cap = R.cap ? R.cap * 2 : 64;
+		struct mc_channel **slot = skynet_malloc(cap * sizeof(*slot));
+		memset(slot, 0, cap * sizeof(*slot));
+		int i;
+		for (i=0;i<R.cap;i++) {
+			if (R.slot[i])
+				channel_insert_(slot, cap, R.slot[i]);
+		}
+		skynet_free(R.slot);
+		R.slot = slot;
+		R.cap = cap;
+	}
+	channel_insert_(R.slot, R.cap, c);
+	++R.n;
+}
+
+static struct mc_channel *
+channel_remove(uint32_t id) {
+	if (R.cap == 0)
+		return NULL;
+	int mask = R.cap - 1;
+	int h = hash_id(id, R.cap);
+	struct mc_channel *c;
+	while ((c = R.slot[h])) {
+		if (c->id == id)
+			break;
+		h = (h + 1) & mask;
+	}
+	if (c == NULL)
+		return NULL;
+	// backward shift deletion
+	int hole = h;
+	int i = (h + 1) & mask;
+	struct mc_channel *next;
+	while ((next = R.slot[i])) {
+		int home = hash_id(next->id, R.cap);
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			R.slot[hole] = next;
+			hole = i;
+		}
+		i = (i + 1) & mask;
+	}
+	R.slot[hole] = NULL;
+	--R.n;
+	return c;
+}
+
+static struct mc_index *
+index_find(struct mc_channel *c, uint32_t handle) {
+	if (c->index_cap == 0)
+		return NULL;
+	int h = hash_id(handle, c->index_cap);
+	while (c->index[h].handle) {
+		if (c->index[h].handle == handle)
+			return &c->index[h];
+		h = (h + 1) & (c->index_cap - 1);
+	}
+	return NULL;
+}
+
+static void
+index_insert_(struct mc_index *index, int cap, uint32_t handle, int pos) {
+	int h = hash_id(handle, cap);
+	while (index[h].handle) {
+		h = (h + 1) & (cap - 1);
+	}
+	index[h].handle = handle;
+	index[h].pos = pos;
+}
+
+static void
+index_remove(struct mc_channel *c, struct mc_index *slot) {
+	int mask = c->index_cap - 1;
+	int hole = (int)(slot - c->index);
+	int i = (hole + 1) & mask;
+	while (c->index[i].handle) {
+		int home = hash_id(c->index[i].handle, c->index_cap);
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			c->index[hole] = c->index[i];
+			hole = i;
+		}
+		i = (i + 1) & mask;
+	}
+	c->index[hole].handle = 0;
+}
+
+static void
+view_release(struct mc_view *v) {
+	if (v && ATOM_FDEC(&v->ref) == 1) {
+		skynet_free(v);
+	}
+}
+
+// lock c->lock for writing before calling it
+static void
+view_reset(struct mc_channel *c) {
+	struct mc_view *v = (struct mc_view *)ATOM_LOAD(&c->view);
+	ATOM_STORE(&c->view, 0);
+	view_release(v);
+}
+
+// lock c->lock for reading before calling it, return the view with a reference of the caller
+static struct mc_view *
+view_grab(struct mc_channel *c) {
+	struct mc_view *v = (struct mc_view *)ATOM_LOAD(&c->view);
+	if (v == NULL) {
+		v = skynet_malloc(sizeof(*v) + (c->n - 1) * sizeof(uint32_t));
+		ATOM_INIT(&v->ref, 1);	// the reference of channel
+		v->n = c->n;
+		memcpy(v->member, c->member, c->n * sizeof(uint32_t));
+		if (!ATOM_CAS_POINTER(&c->view, 0, (uintptr_t)v)) {
+			// other publisher built it at the same time
+			skynet_free(v);
+			v = (struct mc_view *)ATOM_LOAD(&c->view);
+		}
+	}
+	ATOM_FINC(&v->ref);
+	return v;
+}
+
+static int
+member_add(struct mc_channel *c, uint32_t handle) {
+	if (index_find(c, handle))
+		return 0;
+	if (c->n >= c->cap) {
+		int cap = c->cap ? c->cap * 2 : 16;
+		c->member = skynet_realloc(c->member, cap * sizeof(uint32_t));
+		c->cap = cap;
+	}
+	if ((c->n + 1) * 2 > c->index_cap) {
+		int cap = c->index_cap ? c->index_cap * 2 : 32;
+		struct mc_index * index = skynet_malloc(cap * sizeof(*index));
+		memset(index, 0, cap * sizeof(*index));
+		int i;
+		for (i=0;i<c->n;i++) {
+			index_insert_(index, cap, c->member[i], i);
+		}
+		skynet_free(c->index);
+		c->index = index;
+		c->index_cap = cap;
+	}
+	c->member[c->n] = handle;
+	index_insert_(c->index, c->index_cap, handle, c->n);
+	++c->n;
+	view_reset(c);
+	return 1;
+}
+
+static int
+member_remove(struct mc_channel *c, uint32_t handle) {
+	struct mc_index * slot = index_find(c, handle);
+	if (slot == NULL)
+		return 0;
+	int pos = slot->pos;
+	index_remove(c, slot);
+	--c->n;
+	if (pos != c->n) {
+		// move the last one to the hole
+		uint32_t last = c->member[c->n];
+		c->member[pos] = last;
+		index_find(c, last)->pos = pos;
+	}
+	view_reset(c);
+	return 1;
+}
+
+static void
+channel_delete(struct mc_channel *c) {
+	view_release((struct mc_view *)ATOM_LOAD(&c->view));
+	skynet_free(c->member);
+	skynet_free(c->index);
+	skynet_free(c);
+}
+
+/*
+	integer channel
+	boolean remote
+
+	create the channel if it doesn't exist, and set the remote flag
+ */
+static int
+mc_newchannel(lua_State *L) {
+	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
+	int remote = lua_toboolean(L, 2);
+	rwlock_wlock(&R.lock);
+	struct mc_channel *c = channel_find(id);
+	if (c == NULL) {
+		c = skynet_malloc(sizeof(*c));
+		memset(c, 0, sizeof(*c));
+		c->id = id;
+		rwlock_init(&c->lock);
+		channel_insert(c);
+	}
+	c->remote = remote;
+	rwlock_wunlock(&R.lock);
+	return 0;
+}
+
+static int
+mc_delchannel(lua_State *L) {
+	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
+	rwlock_wlock(&R.lock);
+	struct mc_channel *c = channel_remove(id);
+	rwlock_wunlock(&R.lock);
+	if (c) {
+		channel_delete(c);
+	}
+	return 0;
+}
+
+static int
+mc_setremote(lua_State *L) {
+	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
+	int remote = lua_toboolean(L, 2);
+	rwlock_rlock(&R.lock);
+	struct mc_channel *c = channel_find(id);
+	if (c) {
+		rwlock_wlock(&c->lock);
+		c->remote = remote;
+		rwlock_wunlock(&c->lock);
+	}
+	rwlock_runlock(&R.lock);
+	return 0;
+}
+
+/*
+	integer channel
+	integer handle
+
+	return boolean (false if the channel doesn't exist or the handle has joined)
+ */
+static int
+mc_join(lua_State *L) {
+	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
+	uint32_t handle = (uint32_t)luaL_checkinteger(L, 2);
+	int ret = 0;
+	rwlock_rlock(&R.lock);
+	struct mc_channel *c = channel_find(id);
+	if (c) {
+		rwlock_wlock(&c->lock);
+		ret = member_add(c, handle);
+		rwlock_wunlock(&c->lock);
+	}
+	rwlock_runlock(&R.lock);
+	lua_pushboolean(L, ret);
+	return 1;
+}
+
+/*
+	integer channel
+	integer handle
+
+	return the number of subscribers left, or nil if the handle isn't a subscriber
+ */
+static int
+mc_leave(lua_State *L) {
+	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
+	uint32_t handle = (uint32_t)luaL_checkinteger(L, 2);
+	int n = -1;
+	rwlock_rlock(&R.lock);
+	struct mc_channel *c = channel_find(id);
+	if (c) {
+		rwlock_wlock(&c->lock);
+		if (member_remove(c, handle)) {
+			n = c->n;
+		}
+		rwlock_wunlock(&c->lock);
+	}
+	rwlock_runlock(&R.lock);
+	if (n < 0)
+		return 0;
+	lua_pushinteger(L, n);
+	return 1;
+}
+
+static void
+free_package(struct mc_package *pack) {
+	skynet_free(pack->data);
+	skynet_free(pack);
+}
+
+/*
+	integer channel
+	integer source
+	lightuserdata struct mc_package **
+	integer size (must be sizeof(struct mc_package *))
+	boolean all
+
+	Push the package to all the local subscribers, the reference of package is the number of them.
+	If the channel is unknown or remote, and all is false, return nil and leave the package to multicastd.
+	Otherwise return the number of subscribers, the package (struct mc_package **) is freed.
+ */
+static int
+mc_publish(lua_State *L) {
+	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
+	uint32_t source = (uint32_t)luaL_checkinteger(L, 2);
+	struct mc_package ** ptr = lua_touserdata(L, 3);
+	int sz = luaL_checkinteger(L, 4);
+	if (ptr == NULL || sz != sizeof(ptr)) {
+		return luaL_error(L, "Invalid multicast package size %d", sz);
+	}
+	int all = lua_toboolean(L, 5);
+	struct mc_package * pack = *ptr;
+
+	rwlock_rlock(&R.lock);
+	struct mc_channel *c = channel_find(id);
+	if (c == NULL || (c->remote && !all)) {
+		rwlock_runlock(&R.lock);
+		if (!all) {
+			return 0;
+		}
+		// dead channel
+		free_package(pack);
+		skynet_free(ptr);
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+	rwlock_rlock(&c->lock);
+	struct mc_view *v = c->n > 0 ? view_grab(c) : NULL;
+	rwlock_runlock(&c->lock);
+	rwlock_runlock(&R.lock);
+
+	// don't hold the locks across the fan-out, join/leave and other publishers may go on
+	int n = 0;
+	int sent = 0;
+	if (v) {
+		n = v->n;
+		ATOM_STORE(&pack->reference, n);
+		sent = skynet_sendmulti(NULL, source, v->member, n, PTYPE_MULTICAST, (int)id, &pack, sizeof(pack));
+		view_release(v);
+	}
+
+	skynet_free(ptr);
+	if (sent < n) {
+		// some subscribers have exited
+		int dead = n - sent;
+		if (ATOM_FSUB(&pack->reference, dead) == dead) {
+			free_package(pack);
+		}
+	} else if (n == 0) {
+		free_package(pack);
+	}
+	lua_pushinteger(L, sent);
+	return 1;
+}
+
 static int
 mc_nextid(lua_State *L) {
 	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
@@ -157,9 +576,22 @@ luaopen_skynet_multicast_core(lua_State *L) {
 		{ "remote", mc_remote },
 		{ "packremote", mc_packremote },
 		{ "nextid", mc_nextid },
+		{ "newchannel", mc_newchannel },
+		{ "delchannel", mc_delchannel },
+		{ "setremote", mc_setremote },
+		{ "join", mc_join },
+		{ "leave", mc_leave },
+		{ "publish", mc_publish },
 		{ NULL, NULL },
 	};
 	luaL_checkversion(L);
+	// the module may be opened by many services at the same time, init R.lock only once
+	if (ATOM_CAS(&R_INIT, 0, 1)) {
+		rwlock_init(&R.lock);
+		ATOM_STORE(&R_INIT, 2);
+	} else {
+		while (ATOM_LOAD(&R_INIT) != 2) {}
+	}
 	luaL_newlib(L,l);
 	return 1;
 }
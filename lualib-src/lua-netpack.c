@@ -2,7 +2,11 @@
 
 #include "skynet_malloc.h"
 
+#include "skynet.h"
+
 #include "skynet_socket.h"
+#include "spinlock.h"
+#include "atomic.h"
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -28,6 +32,203 @@
 	Each package is uint16 + data , uint16 (serialized in big-endian) is the number of bytes comprising the data .
  */
 
+/*
+	Slice mode (netpack.queue(true)) : a package lies in one socket buffer is not copied, the message is a pointer
+	into the socket buffer (slice). The buffer is freed after all the slices in it are released by netpack.release.
+	The slices are registered in a process-wide map (slice ptr -> block), because they may be released in other services.
+	Slices must be sent as PTYPE_CLIENT : release_package is registered to the framework for this type,
+	so the framework releases a slice correctly if the receiver doesn't reserve it or exits before dispatching it.
+	Every PTYPE_CLIENT message in the process is released by release_package then, so the live slices are also
+	counted in a lock-free filter (SLICE_MARK) : a pointer whose bucket is zero is not a slice, and it's freed
+	without touching the map.
+ */
+
+struct slice_block {
+	int ref;
+	void * buffer;
+};
+
+struct slice_entry {
+	const void * ptr;
+	struct slice_block * block;
+};
+
+struct slice_map {
+	struct spinlock lock;
+	int cap;
+	int n;
+	struct slice_entry * e;
+};
+
+#define SLICE_FILTER 4096
+
+static struct slice_map S;
+// 0 : S.lock is not initialized, 1 : initializing, 2 : ready
+static ATOM_INT SLICE_INIT = 0;
+// set when the first slice queue is created, before that no message can be a slice
+static ATOM_INT SLICE_ON = 0;
+// the number of live slices in each bucket (hashed by slice ptr)
+static ATOM_INT SLICE_MARK[SLICE_FILTER];
+
+// process-wide statistics : packages, slices, bytes copied
+static ATOM_SIZET STAT_PACKAGE = 0;
+static ATOM_SIZET STAT_SLICE = 0;
+static ATOM_SIZET STAT_COPY = 0;
+
+static inline int
+slice_hash(const void *ptr, int cap) {
+	uint64_t h = (uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15ull;
+	return (int)(h >> 32) & (cap - 1);
+}
+
+static void
+slice_insert_(struct slice_map *m, const void *ptr, struct slice_block *block) {
+	int i = slice_hash(ptr, m->cap);
+	while (m->e[i].ptr) {
+		i = (i + 1) & (m->cap - 1);
+	}
+	m->e[i].ptr = ptr;
+	m->e[i].block = block;
+	++m->n;
+}
+
+static void
+slice_expand(struct slice_map *m) {
+	struct slice_entry * old = m->e;
+	int oldcap = m->cap;
+	m->cap = oldcap == 0 ? 1024 : oldcap * 2;
+	m->n = 0;
+	m->e = skynet_malloc(m->cap * sizeof(struct slice_entry));
+	memset(m->e, 0, m->cap * sizeof(struct slice_entry));
+	int i;
+	for (i=0;i<oldcap;i++) {
+		if (old[i].ptr) {
+			slice_insert_(m, old[i].ptr, old[i].block);
+		}
+	}
+	skynet_free(old);
+}
+
+// lock S before calling it
+static void
+slice_insert(const void *ptr, struct slice_block *block) {
+	if (S.n * 2 >= S.cap) {
+		slice_expand(&S);
+	}
+	slice_insert_(&S, ptr, block);
+}
+
+// lock S before calling it, return NULL if ptr is not a slice
+static struct slice_block *
+slice_remove(const void *ptr) {
+	if (S.n == 0)
+		return NULL;
+	int mask = S.cap - 1;
+	int i = slice_hash(ptr, S.cap);
+	while (S.e[i].ptr != ptr) {
+		if (S.e[i].ptr == NULL)
+			return NULL;
+		i = (i + 1) & mask;
+	}
+	struct slice_block * block = S.e[i].block;
+	--S.n;
+	// backward shift deletion, keep the probe sequences unbroken
+	int j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (S.e[j].ptr == NULL)
+			break;
+		int k = slice_hash(S.e[j].ptr, S.cap);
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		S.e[i] = S.e[j];
+		i = j;
+	}
+	S.e[i].ptr = NULL;
+	S.e[i].block = NULL;
+	return block;
+}
+
+// lock S before calling it
+static void
+slice_unref(struct slice_block *block) {
+	if (--block->ref == 0) {
+		skynet_free(block->buffer);
+		skynet_free(block);
+	}
+}
+
+// release a message from the queue : a slice or a copy
+static void
+release_package(void *ptr) {
+	int mark = slice_hash(ptr, SLICE_FILTER);
+	if (ATOM_LOAD(&SLICE_MARK[mark]) == 0) {
+		// the mark of a slice is set before it's sent, so ptr can't be a slice
+		skynet_free(ptr);
+		return;
+	}
+	SPIN_LOCK(&S)
+	struct slice_block * block = slice_remove(ptr);
+	if (block) {
+		ATOM_FDEC(&SLICE_MARK[mark]);
+		slice_unref(block);
+	}
+	SPIN_UNLOCK(&S)
+	if (block == NULL) {
+		skynet_free(ptr);
+	}
+}
+
+// the socket buffer being filtered
+struct socket_buffer {
+	void * buffer;
+	int slice;
+	struct slice_block * block;
+};
+
+static void
+socket_buffer_init(struct socket_buffer *sb, void *buffer, int slice) {
+	sb->buffer = buffer;
+	sb->slice = slice;
+	sb->block = NULL;
+}
+
+// return a message of the package lies in the socket buffer
+static void *
+take_package(struct socket_buffer *sb, void *data, int size) {
+	ATOM_FINC(&STAT_PACKAGE);
+	if (!sb->slice || size == 0) {
+		void * tmp = skynet_malloc(size);
+		memcpy(tmp, data, size);
+		ATOM_FADD(&STAT_COPY, size);
+		return tmp;
+	}
+	ATOM_FINC(&STAT_SLICE);
+	SPIN_LOCK(&S)
+	if (sb->block == NULL) {
+		// the ref of filter itself, see socket_buffer_release
+		sb->block = skynet_malloc(sizeof(struct slice_block));
+		sb->block->ref = 1;
+		sb->block->buffer = sb->buffer;
+	}
+	++sb->block->ref;
+	slice_insert(data, sb->block);
+	ATOM_FINC(&SLICE_MARK[slice_hash(data, SLICE_FILTER)]);
+	SPIN_UNLOCK(&S)
+	return data;
+}
+
+static void
+socket_buffer_release(struct socket_buffer *sb) {
+	if (sb->block == NULL) {
+		skynet_free(sb->buffer);
+		return;
+	}
+	SPIN_LOCK(&S)
+	slice_unref(sb->block);
+	SPIN_UNLOCK(&S)
+}
+
 struct netpack {
 	int id;
 	int size;
@@ -42,6 +243,7 @@ struct uncomplete {
 };
 
 struct queue {
+	int slice;
 	int cap;
 	int head;
 	int tail;
@@ -75,7 +277,11 @@ lclear(lua_State *L) {
 	}
 	for (i=q->head;i<q->tail;i++) {
 		struct netpack *np = &q->queue[i % q->cap];
-		skynet_free(np->buffer);
+		if (q->slice) {
+			release_package(np->buffer);
+		} else {
+			skynet_free(np->buffer);
+		}
 	}
 	q->head = q->tail = 0;
 
@@ -114,18 +320,33 @@ find_uncomplete(struct queue *q, int fd) {
 	return NULL;
 }
 
+static struct queue *
+new_queue(lua_State *L, int slice) {
+	if (slice && !ATOM_LOAD(&SLICE_ON)) {
+		SPIN_LOCK(&S)
+		if (!ATOM_LOAD(&SLICE_ON)) {
+			skynet_message_release(PTYPE_CLIENT, release_package);
+			ATOM_STORE(&SLICE_ON, 1);
+		}
+		SPIN_UNLOCK(&S)
+	}
+	struct queue *q = lua_newuserdatauv(L, sizeof(struct queue), 0);
+	q->slice = slice;
+	q->cap = QUEUESIZE;
+	q->head = 0;
+	q->tail = 0;
+	int i;
+	for (i=0;i<HASHSIZE;i++) {
+		q->hash[i] = NULL;
+	}
+	return q;
+}
+
 static struct queue *
 get_queue(lua_State *L) {
 	struct queue *q = lua_touserdata(L,1);
 	if (q == NULL) {
-		q = lua_newuserdatauv(L, sizeof(struct queue), 0);
-		q->cap = QUEUESIZE;
-		q->head = 0;
-		q->tail = 0;
-		int i;
-		for (i=0;i<HASHSIZE;i++) {
-			q->hash[i] = NULL;
-		}
+		q = new_queue(L, 0);
 		lua_replace(L, 1);
 	}
 	return q;
@@ -134,6 +355,7 @@ get_queue(lua_State *L) {
 static void
 expand_queue(lua_State *L, struct queue *q) {
 	struct queue *nq = lua_newuserdatauv(L, sizeof(struct queue) + q->cap * sizeof(struct netpack), 0);
+	nq->slice = q->slice;
 	nq->cap = q->cap + QUEUESIZE;
 	nq->head = 0;
 	nq->tail = q->cap;
@@ -149,11 +371,9 @@ expand_queue(lua_State *L, struct queue *q) {
 }
 
 static void
-push_data(lua_State *L, int fd, void *buffer, int size, int clone) {
-	if (clone) {
-		void * tmp = skynet_malloc(size);
-		memcpy(tmp, buffer, size);
-		buffer = tmp;
+push_data(lua_State *L, int fd, void *buffer, int size, struct socket_buffer *sb) {
+	if (sb) {
+		buffer = take_package(sb, buffer, size);
 	}
 	struct queue *q = get_queue(L);
 	struct netpack *np = &q->queue[q->tail];
@@ -187,7 +407,7 @@ read_size(uint8_t * buffer) {
 }
 
 static void
-push_more(lua_State *L, int fd, uint8_t *buffer, int size) {
+push_more(lua_State *L, int fd, uint8_t *buffer, int size, struct socket_buffer *sb) {
 	if (size == 1) {
 		struct uncomplete * uc = save_uncomplete(L, fd);
 		uc->read = -1;
@@ -204,14 +424,15 @@ push_more(lua_State *L, int fd, uint8_t *buffer, int size) {
 		uc->pack.size = pack_size;
 		uc->pack.buffer = skynet_malloc(pack_size);
 		memcpy(uc->pack.buffer, buffer, size);
+		ATOM_FADD(&STAT_COPY, size);
 		return;
 	}
-	push_data(L, fd, buffer, pack_size, 1);
+	push_data(L, fd, buffer, pack_size, sb);
 
 	buffer += pack_size;
 	size -= pack_size;
 	if (size > 0) {
-		push_more(L, fd, buffer, size);
+		push_more(L, fd, buffer, size, sb);
 	}
 }
 
@@ -226,7 +447,7 @@ close_uncomplete(lua_State *L, int fd) {
 }
 
 static int
-filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
+filter_data_(lua_State *L, int fd, uint8_t * buffer, int size, struct socket_buffer *sb) {
 	struct queue *q = lua_touserdata(L,1);
 	struct uncomplete * uc = find_uncomplete(q, fd);
 	if (uc) {
@@ -245,6 +466,7 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		int need = uc->pack.size - uc->read;
 		if (size < need) {
 			memcpy(uc->pack.buffer + uc->read, buffer, size);
+			ATOM_FADD(&STAT_COPY, size);
 			uc->read += size;
 			int h = hash_fd(fd);
 			uc->next = q->hash[h];
@@ -252,6 +474,8 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 			return 1;
 		}
 		memcpy(uc->pack.buffer + uc->read, buffer, need);
+		ATOM_FADD(&STAT_COPY, need);
+		ATOM_FINC(&STAT_PACKAGE);
 		buffer += need;
 		size -= need;
 		if (size == 0) {
@@ -263,9 +487,9 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 			return 5;
 		}
 		// more data
-		push_data(L, fd, uc->pack.buffer, uc->pack.size, 0);
+		push_data(L, fd, uc->pack.buffer, uc->pack.size, NULL);
 		skynet_free(uc);
-		push_more(L, fd, buffer, size);
+		push_more(L, fd, buffer, size, sb);
 		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
 		return 2;
 	} else {
@@ -285,23 +509,23 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 			uc->pack.size = pack_size;
 			uc->pack.buffer = skynet_malloc(pack_size);
 			memcpy(uc->pack.buffer, buffer, size);
+			ATOM_FADD(&STAT_COPY, size);
 			return 1;
 		}
 		if (size == pack_size) {
 			// just one package
 			lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
 			lua_pushinteger(L, fd);
-			void * result = skynet_malloc(pack_size);
-			memcpy(result, buffer, size);
+			void * result = take_package(sb, buffer, size);
 			lua_pushlightuserdata(L, result);
 			lua_pushinteger(L, size);
 			return 5;
 		}
 		// more data
-		push_data(L, fd, buffer, pack_size, 1);
+		push_data(L, fd, buffer, pack_size, sb);
 		buffer += pack_size;
 		size -= pack_size;
-		push_more(L, fd, buffer, size);
+		push_more(L, fd, buffer, size, sb);
 		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
 		return 2;
 	}
@@ -309,10 +533,13 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 
 static inline int
 filter_data(lua_State *L, int fd, uint8_t * buffer, int size) {
-	int ret = filter_data_(L, fd, buffer, size);
+	struct queue *q = lua_touserdata(L,1);
+	struct socket_buffer sb;
+	socket_buffer_init(&sb, buffer, q ? q->slice : 0);
+	int ret = filter_data_(L, fd, buffer, size, &sb);
 	// buffer is the data of socket message, it malloc at socket_server.c : function forward_message .
-	// it should be free before return,
-	skynet_free(buffer);
+	// it should be free before return, unless some slices refer to it.
+	socket_buffer_release(&sb);
 	return ret;
 }
 
@@ -463,19 +690,74 @@ ltostring(lua_State *L) {
 		lua_pushliteral(L, "");
 	} else {
 		lua_pushlstring(L, (const char *)ptr, size);
-		skynet_free(ptr);
+		release_package(ptr);
 	}
 	return 1;
 }
 
+/*
+	boolean slice
+	return userdata queue
+ */
+static int
+lqueue(lua_State *L) {
+	new_queue(L, lua_toboolean(L, 1));
+	return 1;
+}
+
+/*
+	lightuserdata msg
+	Release the message from filter/pop, it may be a slice of socket buffer.
+ */
+static int
+lrelease(lua_State *L) {
+	void * ptr = lua_touserdata(L, 1);
+	if (ptr) {
+		release_package(ptr);
+	}
+	return 0;
+}
+
+/*
+	return packages, slices, bytes copied, slices not released yet (process-wide)
+ */
+static int
+lstat(lua_State *L) {
+	lua_pushinteger(L, ATOM_LOAD(&STAT_PACKAGE));
+	lua_pushinteger(L, ATOM_LOAD(&STAT_SLICE));
+	lua_pushinteger(L, ATOM_LOAD(&STAT_COPY));
+	SPIN_LOCK(&S)
+	int live = S.n;
+	SPIN_UNLOCK(&S)
+	lua_pushinteger(L, live);
+	return 4;
+}
+
+// the module may be opened by many services at the same time, init S.lock only once
+static void
+slice_init() {
+	if (ATOM_LOAD(&SLICE_INIT) == 2)
+		return;
+	if (ATOM_CAS(&SLICE_INIT, 0, 1)) {
+		SPIN_INIT(&S)
+		ATOM_STORE(&SLICE_INIT, 2);
+	} else {
+		while (ATOM_LOAD(&SLICE_INIT) != 2) {}
+	}
+}
+
 LUAMOD_API int
 luaopen_skynet_netpack(lua_State *L) {
 	luaL_checkversion(L);
+	slice_init();
 	luaL_Reg l[] = {
 		{ "pop", lpop },
 		{ "pack", lpack },
 		{ "clear", lclear },
 		{ "tostring", ltostring },
+		{ "queue", lqueue },
+		{ "release", lrelease },
+		{ "stat", lstat },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
@@ -34,77 +34,80 @@
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
-#define BLOCK_SIZE 128
+// the write buffer on stack, grow into heap when it's not enough
+#define STACK_SIZE 256
 #define MAX_DEPTH 32
-
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];
-};
+// the hash size hint of the table (by depth) is from the last table at the same depth
+#define MAX_HASH_HINT 256
 
 struct write_block {
-	struct block * head;
-	struct block * current;
+	char * buffer;
 	int len;
-	int ptr;
+	int cap;
+	char stack[STACK_SIZE];
 };
 
 struct read_block {
 	char * buffer;
 	int len;
 	int ptr;
+	int hash_hint[MAX_DEPTH+1];
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = skynet_malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+static void
+wb_grow(struct write_block *b, int sz) {
+	int cap = b->cap * 2;
+	while (cap < b->len + sz) {
+		cap *= 2;
+	}
+	char * buffer = skynet_malloc(cap);
+	memcpy(buffer, b->buffer, b->len);
+	if (b->buffer != b->stack) {
+		skynet_free(b->buffer);
+	}
+	b->buffer = buffer;
+	b->cap = cap;
+}
+
+static inline void
+wb_reserve(struct write_block *b, int sz) {
+	if (b->len + sz > b->cap) {
+		wb_grow(b, sz);
+	}
 }
 
 inline static void
 wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-		goto _again;
-	}
+	wb_reserve(b, sz);
+	memcpy(b->buffer + b->len, buf, sz);
+	b->len += sz;
+}
+
+inline static void
+wb_byte(struct write_block *b, uint8_t v) {
+	wb_reserve(b, 1);
+	b->buffer[b->len++] = (char)v;
 }
 
 static void
-wb_init(struct write_block *wb , struct block *b) {
-	wb->head = b;
-	assert(b->next == NULL);
+wb_init(struct write_block *wb, int estimate) {
 	wb->len = 0;
-	wb->current = wb->head;
-	wb->ptr = 0;
+	if (estimate > STACK_SIZE) {
+		wb->buffer = skynet_malloc(estimate);
+		wb->cap = estimate;
+	} else {
+		wb->buffer = wb->stack;
+		wb->cap = STACK_SIZE;
+	}
 }
 
 static void
 wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	blk = blk->next;	// the first block is on stack
-	while (blk) {
-		struct block * next = blk->next;
-		skynet_free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
+	if (wb->buffer != wb->stack) {
+		skynet_free(wb->buffer);
+	}
+	wb->buffer = wb->stack;
+	wb->cap = STACK_SIZE;
 	wb->len = 0;
 }
 
@@ -113,6 +116,7 @@ rball_init(struct read_block * rb, char * buffer, int size) {
 	rb->buffer = buffer;
 	rb->len = size;
 	rb->ptr = 0;
+	memset(rb->hash_hint, 0, sizeof(rb->hash_hint));
 }
 
 static const void *
@@ -129,72 +133,70 @@ rb_read(struct read_block *rb, int sz) {
 
 static inline void
 wb_nil(struct write_block *wb) {
-	uint8_t n = TYPE_NIL;
-	wb_push(wb, &n, 1);
+	wb_byte(wb, TYPE_NIL);
 }
 
 static inline void
 wb_boolean(struct write_block *wb, int boolean) {
-	uint8_t n = COMBINE_TYPE(TYPE_BOOLEAN , boolean ? 1 : 0);
-	wb_push(wb, &n, 1);
+	wb_byte(wb, COMBINE_TYPE(TYPE_BOOLEAN , boolean ? 1 : 0));
 }
 
 static inline void
 wb_integer(struct write_block *wb, lua_Integer v) {
 	int type = TYPE_NUMBER;
+	// reserve the max size (1 type + 8 qword) once, then write directly
+	wb_reserve(wb, 1 + sizeof(int64_t));
+	uint8_t * ptr = (uint8_t *)wb->buffer + wb->len;
 	if (v == 0) {
-		uint8_t n = COMBINE_TYPE(type , TYPE_NUMBER_ZERO);
-		wb_push(wb, &n, 1);
+		ptr[0] = COMBINE_TYPE(type , TYPE_NUMBER_ZERO);
+		wb->len += 1;
 	} else if (v != (int32_t)v) {
-		uint8_t n = COMBINE_TYPE(type , TYPE_NUMBER_QWORD);
+		ptr[0] = COMBINE_TYPE(type , TYPE_NUMBER_QWORD);
 		int64_t v64 = v;
-		wb_push(wb, &n, 1);
-		wb_push(wb, &v64, sizeof(v64));
+		memcpy(ptr+1, &v64, sizeof(v64));
+		wb->len += 1 + sizeof(v64);
 	} else if (v < 0) {
 		int32_t v32 = (int32_t)v;
-		uint8_t n = COMBINE_TYPE(type , TYPE_NUMBER_DWORD);
-		wb_push(wb, &n, 1);
-		wb_push(wb, &v32, sizeof(v32));
+		ptr[0] = COMBINE_TYPE(type , TYPE_NUMBER_DWORD);
+		memcpy(ptr+1, &v32, sizeof(v32));
+		wb->len += 1 + sizeof(v32);
 	} else if (v<0x100) {
-		uint8_t n = COMBINE_TYPE(type , TYPE_NUMBER_BYTE);
-		wb_push(wb, &n, 1);
-		uint8_t byte = (uint8_t)v;
-		wb_push(wb, &byte, sizeof(byte));
+		ptr[0] = COMBINE_TYPE(type , TYPE_NUMBER_BYTE);
+		ptr[1] = (uint8_t)v;
+		wb->len += 2;
 	} else if (v<0x10000) {
-		uint8_t n = COMBINE_TYPE(type , TYPE_NUMBER_WORD);
-		wb_push(wb, &n, 1);
+		ptr[0] = COMBINE_TYPE(type , TYPE_NUMBER_WORD);
 		uint16_t word = (uint16_t)v;
-		wb_push(wb, &word, sizeof(word));
+		memcpy(ptr+1, &word, sizeof(word));
+		wb->len += 1 + sizeof(word);
 	} else {
-		uint8_t n = COMBINE_TYPE(type , TYPE_NUMBER_DWORD);
-		wb_push(wb, &n, 1);
+		ptr[0] = COMBINE_TYPE(type , TYPE_NUMBER_DWORD);
 		uint32_t v32 = (uint32_t)v;
-		wb_push(wb, &v32, sizeof(v32));
+		memcpy(ptr+1, &v32, sizeof(v32));
+		wb->len += 1 + sizeof(v32);
 	}
 }
 
 static inline void
 wb_real(struct write_block *wb, double v) {
-	uint8_t n = COMBINE_TYPE(TYPE_NUMBER , TYPE_NUMBER_REAL);
-	wb_push(wb, &n, 1);
+	wb_byte(wb, COMBINE_TYPE(TYPE_NUMBER , TYPE_NUMBER_REAL));
 	wb_push(wb, &v, sizeof(v));
 }
 
 static inline void
 wb_pointer(struct write_block *wb, void *v) {
-	uint8_t n = TYPE_USERDATA;
-	wb_push(wb, &n, 1);
+	wb_byte(wb, TYPE_USERDATA);
 	wb_push(wb, &v, sizeof(v));
 }
 
 static inline void
 wb_string(struct write_block *wb, const char *str, int len) {
 	if (len < MAX_COOKIE) {
-		uint8_t n = COMBINE_TYPE(TYPE_SHORT_STRING, len);
-		wb_push(wb, &n, 1);
-		if (len > 0) {
-			wb_push(wb, str, len);
-		}
+		wb_reserve(wb, 1 + len);
+		char * ptr = wb->buffer + wb->len;
+		ptr[0] = (char)COMBINE_TYPE(TYPE_SHORT_STRING, len);
+		memcpy(ptr+1, str, len);
+		wb->len += 1 + len;
 	} else {
 		uint8_t n;
 		if (len < 0x10000) {
@@ -218,18 +220,33 @@ static int
 wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
 	int array_size = lua_rawlen(L,index);
 	if (array_size >= MAX_COOKIE-1) {
-		uint8_t n = COMBINE_TYPE(TYPE_TABLE, MAX_COOKIE-1);
-		wb_push(wb, &n, 1);
+		wb_byte(wb, COMBINE_TYPE(TYPE_TABLE, MAX_COOKIE-1));
 		wb_integer(wb, array_size);
 	} else {
-		uint8_t n = COMBINE_TYPE(TYPE_TABLE, array_size);
-		wb_push(wb, &n, 1);
+		wb_byte(wb, COMBINE_TYPE(TYPE_TABLE, array_size));
 	}
 
 	int i;
 	for (i=1;i<=array_size;i++) {
-		lua_rawgeti(L,index,i);
-		pack_one(L, wb, -1, depth);
+		// fast path for the arrays of numbers and strings, don't go through pack_one
+		switch (lua_rawgeti(L,index,i)) {
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, -1)) {
+				wb_integer(wb, lua_tointeger(L, -1));
+			} else {
+				wb_real(wb, lua_tonumber(L, -1));
+			}
+			break;
+		case LUA_TSTRING: {
+			size_t sz = 0;
+			const char *str = lua_tolstring(L, -1, &sz);
+			wb_string(wb, str, (int)sz);
+			break;
+		}
+		default:
+			pack_one(L, wb, -1, depth);
+			break;
+		}
 		lua_pop(L,1);
 	}
 
@@ -258,8 +275,7 @@ wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int a
 
 static int
 wb_table_metapairs(lua_State *L, struct write_block *wb, int index, int depth) {
-	uint8_t n = COMBINE_TYPE(TYPE_TABLE, 0);
-	wb_push(wb, &n, 1);
+	wb_byte(wb, COMBINE_TYPE(TYPE_TABLE, 0));
 	lua_pushvalue(L, index);
 	if (lua_pcall(L, 1, 3,0) != LUA_OK)
 		return 1;
@@ -439,10 +455,10 @@ get_buffer(lua_State *L, struct read_block *rb, int len) {
 	lua_pushlstring(L,p,len);
 }
 
-static void unpack_one(lua_State *L, struct read_block *rb);
+static void unpack_one(lua_State *L, struct read_block *rb, int depth);
 
 static void
-unpack_table(lua_State *L, struct read_block *rb, int array_size) {
+unpack_table(lua_State *L, struct read_block *rb, int array_size, int depth) {
 	if (array_size == MAX_COOKIE-1) {
 		uint8_t type;
 		const uint8_t * t = (const uint8_t *)rb_read(rb, sizeof(type));
@@ -456,26 +472,34 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 		}
 		array_size = get_integer(L,rb,cookie);
 	}
+	if (depth > MAX_DEPTH) {
+		depth = MAX_DEPTH;
+	}
 	luaL_checkstack(L,LUA_MINSTACK,NULL);
-	lua_createtable(L,array_size,0);
+	// The tables at the same depth usually have the same shape (records in an array),
+	// so presize the hash part as the last one to avoid rehash.
+	lua_createtable(L,array_size,rb->hash_hint[depth]);
 	int i;
 	for (i=1;i<=array_size;i++) {
-		unpack_one(L,rb);
+		unpack_one(L,rb,depth+1);
 		lua_rawseti(L,-2,i);
 	}
+	int nhash = 0;
 	for (;;) {
-		unpack_one(L,rb);
+		unpack_one(L,rb,depth+1);
 		if (lua_isnil(L,-1)) {
 			lua_pop(L,1);
-			return;
+			break;
 		}
-		unpack_one(L,rb);
+		unpack_one(L,rb,depth+1);
 		lua_rawset(L,-3);
+		++nhash;
 	}
+	rb->hash_hint[depth] = nhash < MAX_HASH_HINT ? nhash : MAX_HASH_HINT;
 }
 
 static void
-push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
+push_value(lua_State *L, struct read_block *rb, int type, int cookie, int depth) {
 	switch(type) {
 	case TYPE_NIL:
 		lua_pushnil(L);
@@ -520,7 +544,7 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		break;
 	}
 	case TYPE_TABLE: {
-		unpack_table(L,rb,cookie);
+		unpack_table(L,rb,cookie,depth);
 		break;
 	}
 	default: {
@@ -531,35 +555,62 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 }
 
 static void
-unpack_one(lua_State *L, struct read_block *rb) {
+unpack_one(lua_State *L, struct read_block *rb, int depth) {
 	uint8_t type;
 	const uint8_t * t = (const uint8_t *)rb_read(rb, sizeof(type));
 	if (t==NULL) {
 		invalid_stream(L, rb);
 	}
 	type = *t;
-	push_value(L, rb, type & 0x7, type>>3);
+	push_value(L, rb, type & 0x7, type>>3, depth);
 }
 
 static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	while(len>0) {
-		if (len >= BLOCK_SIZE) {
-			memcpy(ptr, b->buffer, BLOCK_SIZE);
-			ptr += BLOCK_SIZE;
-			len -= BLOCK_SIZE;
-			b = b->next;
-		} else {
-			memcpy(ptr, b->buffer, len);
+seri(lua_State *L, struct write_block *wb) {
+	int len = wb->len;
+	uint8_t * buffer;
+	if (wb->buffer == wb->stack) {
+		buffer = skynet_malloc(len);
+		memcpy(buffer, wb->buffer, len);
+	} else if (wb->cap - len > len / 2 + STACK_SIZE) {
+		// the estimate is too large, shrink it
+		buffer = skynet_realloc(wb->buffer, len);
+	} else {
+		// hand out the heap buffer directly
+		buffer = (uint8_t *)wb->buffer;
+	}
+	wb->buffer = wb->stack;
+	wb->cap = STACK_SIZE;
+	wb->len = 0;
+
+	lua_pushlightuserdata(L, buffer);
+	lua_pushinteger(L, len);
+}
+
+// estimate the size of serialized values, avoid growing the write buffer
+static int
+estimate_size(lua_State *L, int from) {
+	int top = lua_gettop(L);
+	size_t sz = 0;
+	int i;
+	for (i=from+1;i<=top;i++) {
+		switch (lua_type(L, i)) {
+		case LUA_TSTRING:
+			sz += lua_rawlen(L, i) + 5;
+			break;
+		case LUA_TTABLE:
+			// guess 8 bytes for each array item, the hash part is unknown
+			sz += lua_rawlen(L, i) * 8 + 64;
+			break;
+		default:
+			sz += 9;
 			break;
 		}
 	}
-	
-	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, sz);
+	if (sz > 0x1000000) {
+		sz = 0x1000000;
+	}
+	return (int)sz;
 }
 
 int
@@ -598,7 +649,7 @@ luaseri_unpack(lua_State *L) {
 		if (t==NULL)
 			break;
 		type = *t;
-		push_value(L, &rb, type & 0x7, type>>3);
+		push_value(L, &rb, type & 0x7, type>>3, 0);
 	}
 
 	// Need not free buffer
@@ -608,15 +659,10 @@ luaseri_unpack(lua_State *L) {
 
 LUAMOD_API int
 luaseri_pack(lua_State *L) {
-	struct block temp;
-	temp.next = NULL;
 	struct write_block wb;
-	wb_init(&wb, &temp);
+	wb_init(&wb, estimate_size(L, 0));
 	pack_from(L,&wb,0);
-	assert(wb.head == &temp);
-	seri(L, &temp, wb.len);
-
-	wb_free(&wb);
+	seri(L, &wb);
 
 	return 2;
 }
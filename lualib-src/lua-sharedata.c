@@ -6,6 +6,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "atomic.h"
 
 #define KEYTYPE_INTEGER 0
@@ -38,25 +44,112 @@ struct node {
 	uint8_t nocolliding;	// 0 means colliding slot
 };
 
+/*
+	An update can be built on the current version (see lnewconf), the sub tables
+	which are not changed are shared with the older versions instead of copying.
+	A full build is made after SHARE_MAXGEN incremental updates, so the chain of
+	the versions is bounded.
+ */
+#define SHARE_MAXGEN 8
+
 struct state {
 	int dirty;
 	ATOM_INT ref;
 	struct table * root;
+	int generation;	// incremental updates since the last full build
+	int ndeps;
+	struct state * deps[SHARE_MAXGEN];	// the owners of the shared sub tables, hold a ref of each
 };
 
+struct image;
+struct field_index;
+
 struct table {
 	int sizearray;
 	int sizehash;
 	uint8_t *arraytype;
 	union value * array;
 	struct node * hash;
+	uint32_t * disp;	// perfect hash of the hash part (displacements and remap), NULL if it can't be built (see build_index)
+	int nbucket;
 	lua_State * L;
+	struct image * image;	// not NULL if the table is in a mapped snapshot, see lload
+	struct field_index * index;	// secondary indexes, see build_field_index
+};
+
+struct index_entry {
+	union value v;
+	uint8_t valuetype;
+	uint8_t keytype;
+	int key;	// the key of the row
+	int pos;	// the order of the row, for a stable result
+	struct table * row;	// the string value is in row (it may be shared from an older version)
+};
+
+struct field_index {
+	struct field_index * next;
+	int n;
+	struct index_entry * e;
+	size_t sz;
+	char field[1];
+};
+
+/*
+	The snapshot file (built by lsave) :
+		struct image_header
+		string pool : each string is uint32 length + bytes + '\0', aligned to 4
+		table data : arraytype (aligned to 8), array, hash, disp ; the same layout as struct table in memory
+		table directory : struct image_table [ntable], root is the first one
+
+	The strings are referenced by the offset in the pool (instead of index of tbl->L),
+	and the sub tables are referenced by the index of the directory (instead of pointer),
+	so the file is position independent and can be mapped read-only and shared by processes.
+ */
+
+#define IMAGE_MAGIC 0x46434453	// "SDCF"
+#define IMAGE_VERSION 3
+
+struct image_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nodesize;	// sizeof(struct node), check the layout
+	uint32_t ntable;
+	uint64_t size;
+	uint64_t strings;
+	uint64_t stringsize;
+	uint64_t tables;
+};
+
+struct image_table {
+	int32_t sizearray;
+	int32_t sizehash;
+	uint64_t arraytype;
+	uint64_t array;
+	uint64_t hash;
+	uint64_t disp;
+	int32_t nbucket;
+	int32_t reserved;
+};
+
+struct image {
+	struct state state;
+	const uint8_t * base;
+	size_t size;
+	const uint8_t * strings;
+	size_t stringsize;
+	const struct image_table * dir;
+	int ntable;
+	ATOM_POINTER * tables;	// struct table * , created on demand
 };
 
 struct context {
 	lua_State * L;
 	struct table * tbl;
 	int string_index;
+	int noindex;	// don't build perfect hash and dense array, for benchmark
+	struct table * base;	// the same table in the base version, NULL if not exist
+	int ndeps;
+	struct state * deps[SHARE_MAXGEN];
 };
 
 struct ctrl {
@@ -64,6 +157,33 @@ struct ctrl {
 	struct table * update;
 };
 
+static inline struct state *
+get_state(struct table *tbl) {
+	if (tbl->image)
+		return &tbl->image->state;
+	return lua_touserdata(tbl->L, 1);
+}
+
+static const char *
+get_string(struct table *tbl, int id, size_t *sz) {
+	struct image * img = tbl->image;
+	if (img) {
+		// compare as size > len - offset, the offsets are from the file and may overflow
+		if (id >= 0 && (size_t)id <= img->stringsize && img->stringsize - id >= 4) {
+			uint32_t len;
+			memcpy(&len, img->strings + id, sizeof(len));
+			if (len < img->stringsize - id - 4) {
+				*sz = len;
+				return (const char *)img->strings + id + 4;
+			}
+		}
+		// invalid string in snapshot
+		*sz = 0;
+		return "";
+	}
+	return lua_tolstring(tbl->L, id, sz);
+}
+
 static int
 countsize(lua_State *L, int sizearray) {
 	int n = 0;
@@ -88,12 +208,12 @@ countsize(lua_State *L, int sizearray) {
 	return n;
 }
 
+// hash every byte : the perfect hash (see build_index) can't separate the keys with the same keyhash
 static uint32_t
 calchash(const char * str, size_t l) {
 	uint32_t h = (uint32_t)l;
 	size_t l1;
-	size_t step = (l >> 5) + 1;
-	for (l1 = l; l1 >= step; l1 -= step) {
+	for (l1 = l; l1 > 0; l1--) {
 		h = h ^ ((h<<5) + (h>>2) + (uint8_t)(str[l1 - 1]));
 	}
 	return h;
@@ -120,7 +240,135 @@ stringindex(struct context *ctx, const char * str, size_t sz) {
 }
 
 static int convtable(lua_State *L);
+static struct node * lookup_key(struct table *tbl, uint32_t keyhash, int key, int keytype, const char *str, size_t sz);
+
+// find the key at index in tbl, return the value type (VALUETYPE_NIL if not exist)
+static int
+find_value(struct table *tbl, lua_State *L, int index, union value **v) {
+	int kt = lua_type(L, index);
+	if (kt == LUA_TNUMBER) {
+		if (!lua_isinteger(L, index))
+			return VALUETYPE_NIL;
+		lua_Integer key = lua_tointeger(L, index);
+		if (key > 0 && key <= tbl->sizearray) {
+			*v = &tbl->array[key-1];
+			return tbl->arraytype[key-1];
+		}
+		if (key < INT_MIN || key > INT_MAX)
+			return VALUETYPE_NIL;
+		struct node * n = lookup_key(tbl, (uint32_t)key, (int)key, KEYTYPE_INTEGER, NULL, 0);
+		if (n == NULL)
+			return VALUETYPE_NIL;
+		*v = &n->v;
+		return n->valuetype;
+	} else if (kt == LUA_TSTRING) {
+		size_t sz = 0;
+		const char * str = lua_tolstring(L, index, &sz);
+		struct node * n = lookup_key(tbl, calchash(str, sz), 0, KEYTYPE_STRING, str, sz);
+		if (n == NULL)
+			return VALUETYPE_NIL;
+		*v = &n->v;
+		return n->valuetype;
+	}
+	return VALUETYPE_NIL;
+}
+
+#define SHARE_MAXDEPTH 64
+
+/*
+	Compare the lua table at index with tbl (not in a snapshot),
+	the scalar values of this level are checked before the sub tables.
+ */
+static int
+equal_table(lua_State *L, int index, struct table *tbl, int depth) {
+	int i;
+	int n = tbl->sizehash;
+	union value *v = NULL;
+	if (depth > SHARE_MAXDEPTH || !lua_checkstack(L, 4))
+		return 0;
+	index = lua_absindex(L, index);
+	for (i=0;i<tbl->sizearray;i++) {
+		if (tbl->arraytype[i] != VALUETYPE_NIL)
+			++n;
+	}
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		int vt = find_value(tbl, L, -2, &v);
+		int equal = 0;
+		switch (lua_type(L, -1)) {
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, -1)) {
+				equal = vt == VALUETYPE_INTEGER && v->d == lua_tointeger(L, -1);
+			} else {
+				equal = vt == VALUETYPE_REAL && v->n == lua_tonumber(L, -1);
+			}
+			break;
+		case LUA_TSTRING:
+			if (vt == VALUETYPE_STRING) {
+				size_t sz, sz2;
+				const char * str = lua_tolstring(L, -1, &sz);
+				const char * str2 = lua_tolstring(tbl->L, v->string, &sz2);
+				equal = sz == sz2 && memcmp(str, str2, sz) == 0;
+			}
+			break;
+		case LUA_TBOOLEAN:
+			equal = vt == VALUETYPE_BOOLEAN && v->boolean == lua_toboolean(L, -1);
+			break;
+		case LUA_TTABLE:
+			equal = vt == VALUETYPE_TABLE;
+			break;
+		}
+		lua_pop(L, 1);
+		if (!equal || --n < 0) {
+			lua_pop(L, 1);
+			return 0;
+		}
+	}
+	if (n != 0)
+		return 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		if (lua_type(L, -1) == LUA_TTABLE) {
+			find_value(tbl, L, -2, &v);
+			if (!equal_table(L, -1, v->tbl, depth + 1)) {
+				lua_pop(L, 2);
+				return 0;
+			}
+		}
+		lua_pop(L, 1);
+	}
+	return 1;
+}
+
+// the sub table in the base version with the key at keyindex, NULL if not exist
+static struct table *
+base_child(struct context *ctx, lua_State *L, int keyindex) {
+	union value *v = NULL;
+	if (ctx->base == NULL)
+		return NULL;
+	if (find_value(ctx->base, L, keyindex, &v) != VALUETYPE_TABLE)
+		return NULL;
+	return v->tbl;
+}
 
+// share the table in the base version if it's not changed
+static int
+share_table(struct context *ctx, lua_State *L, int index, struct table *base) {
+	if (!equal_table(L, index, base, 0))
+		return 0;
+	struct state * owner = lua_touserdata(base->L, 1);
+	int i;
+	for (i=0;i<ctx->ndeps;i++) {
+		if (ctx->deps[i] == owner)
+			return 1;
+	}
+	if (ctx->ndeps >= SHARE_MAXGEN)
+		return 0;
+	ctx->deps[ctx->ndeps++] = owner;
+	return 1;
+}
+
+// the key is at index-1 (for sharing the sub table of the base version)
 static void
 setvalue(struct context * ctx, lua_State *L, int index, struct node *n) {
 	int vt = lua_type(L, index);
@@ -149,7 +397,14 @@ setvalue(struct context * ctx, lua_State *L, int index, struct node *n) {
 		n->valuetype = VALUETYPE_BOOLEAN;
 		break;
 	case LUA_TTABLE: {
+		struct table *base = base_child(ctx, L, index - 1);
+		if (base && share_table(ctx, L, index, base)) {
+			n->v.tbl = base;
+			n->valuetype = VALUETYPE_TABLE;
+			break;
+		}
 		struct table *tbl = ctx->tbl;
+		struct table *parent = ctx->base;
 		ctx->tbl = (struct table *)malloc(sizeof(struct table));
 		if (ctx->tbl == NULL) {
 			ctx->tbl = tbl;
@@ -158,6 +413,7 @@ setvalue(struct context * ctx, lua_State *L, int index, struct node *n) {
 		}
 		memset(ctx->tbl, 0, sizeof(struct table));
 		int absidx = lua_absindex(L, index);
+		ctx->base = base;
 
 		lua_pushcfunction(L, convtable);
 		lua_pushvalue(L, absidx);
@@ -169,6 +425,7 @@ setvalue(struct context * ctx, lua_State *L, int index, struct node *n) {
 		n->valuetype = VALUETYPE_TABLE;
 
 		ctx->tbl = tbl;
+		ctx->base = parent;
 
 		break;
 	}
@@ -272,6 +529,226 @@ fillcolliding(lua_State *L, struct context *ctx) {
 	}
 }
 
+/*
+	The integer keys in (sizearray, max] are moved into the array part
+	if at least half of [1, max] is filled. max is still a border for #.
+ */
+static int
+densesize(lua_State *L, int sizearray) {
+	lua_Integer max = sizearray;
+	lua_Integer n = sizearray;
+	lua_pushnil(L);
+	while (lua_next(L, 1) != 0) {
+		lua_pop(L, 1);
+		if (lua_isinteger(L, -1)) {
+			lua_Integer key = lua_tointeger(L, -1);
+			if (key > sizearray && key < INT_MAX) {
+				++n;
+				if (key > max)
+					max = key;
+			}
+		}
+	}
+	if (n * 2 >= max)
+		return (int)max;
+	return sizearray;
+}
+
+/*
+	Minimal perfect hash (hash and displace) for the hash part.
+	The keys are distributed into nbucket buckets by keyhash % nbucket,
+	each bucket finds a displacement d that puts all the keys into empty slots by mph_slot().
+	There are MPH_SPARE(n) more slots than keys (load factor below 1), so the last buckets
+	still find empty slots quickly. The nodes are reordered by the slot, the keys in
+	the spare slots [n, n + spare) are moved to the unused slots below n, and
+	disp[nbucket + slot - n] remembers where. So a lookup is exactly one probe.
+
+	The keys with the same keyhash (the hash is 32bit) can't be separated by any displacement,
+	only the first one is placed, the others take the unused slots and are chained by next.
+ */
+
+#define MPH_LOAD 2	// keys per bucket
+#define MPH_MAXTRY 0x10000
+#define MPH_SPARE(n) ((n) / 8 + 1)	// load factor about 0.89
+
+static inline int
+mph_slot(uint32_t keyhash, uint32_t d, int size) {
+	uint32_t h = keyhash ^ (d * 0x9e3779b9U);
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return (int)(h % (uint32_t)size);
+}
+
+static inline int
+mph_lookup(const struct table *tbl, uint32_t keyhash) {
+	int n = tbl->sizehash;
+	int pos = mph_slot(keyhash, tbl->disp[keyhash % tbl->nbucket], n + MPH_SPARE(n));
+	if (pos >= n)
+		pos = (int)tbl->disp[tbl->nbucket + pos - n];
+	return pos;
+}
+
+static int
+place_bucket(struct table *tbl, const int *keys, int s, uint8_t *used, int *slot, uint32_t *disp) {
+	uint32_t d;
+	int i, j;
+	int size = tbl->sizehash + MPH_SPARE(tbl->sizehash);
+	for (d=0;d<MPH_MAXTRY;d++) {
+		for (i=0;i<s;i++) {
+			int pos = mph_slot(tbl->hash[keys[i]].keyhash, d, size);
+			if (used[pos])
+				break;
+			for (j=0;j<i;j++) {
+				if (slot[keys[j]] == pos)
+					break;
+			}
+			if (j < i)
+				break;
+			slot[keys[i]] = pos;
+		}
+		if (i == s) {
+			for (i=0;i<s;i++) {
+				used[slot[keys[i]]] = 1;
+			}
+			*disp = d;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Keep the collision chain if failed (memory error, or MPH_MAXTRY exceeded)
+static void
+build_index(struct table *tbl) {
+	int n = tbl->sizehash;
+	int nbucket = (n + MPH_LOAD - 1) / MPH_LOAD;
+	int spare = MPH_SPARE(n);
+	int i;
+	uint32_t * disp = (uint32_t *)malloc((nbucket + spare) * sizeof(uint32_t));
+	int * start = (int *)calloc(nbucket + 1, sizeof(int));
+	int * keys = (int *)malloc(n * sizeof(int));
+	int * order = (int *)malloc(nbucket * sizeof(int));
+	int * count = (int *)calloc(n + 1, sizeof(int));
+	int * slot = (int *)malloc(n * sizeof(int));
+	int * first = (int *)malloc(n * sizeof(int));	// the key placed for the same keyhash, -1 if it's placed itself
+	uint8_t * used = (uint8_t *)calloc(n + spare, 1);
+	struct node * hash = (struct node *)malloc(n * sizeof(struct node));
+	if (disp == NULL || start == NULL || keys == NULL || order == NULL
+		|| count == NULL || slot == NULL || first == NULL || used == NULL || hash == NULL) {
+		goto _failed;
+	}
+	// group the keys by bucket
+	for (i=0;i<n;i++) {
+		++start[tbl->hash[i].keyhash % nbucket + 1];
+	}
+	for (i=0;i<nbucket;i++) {
+		++count[start[i+1]];
+		start[i+1] += start[i];
+	}
+	for (i=0;i<n;i++) {
+		int b = tbl->hash[i].keyhash % nbucket;
+		keys[start[b]++] = i;
+	}
+	for (i=nbucket;i>0;i--) {
+		start[i] = start[i-1];
+	}
+	start[0] = 0;
+	// place the larger buckets first
+	int offset = 0;
+	for (i=n;i>=0;i--) {
+		int c = count[i];
+		count[i] = offset;
+		offset += c;
+	}
+	for (i=0;i<nbucket;i++) {
+		int s = start[i+1] - start[i];
+		order[count[s]++] = i;
+	}
+	for (i=0;i<nbucket;i++) {
+		int b = order[i];
+		int * k = keys + start[b];
+		int s = start[b+1] - start[b];
+		int j, r = 0;
+		// move the keys with a keyhash seen in the bucket to the end
+		for (j=0;j<s;j++) {
+			int x;
+			int key = k[j];
+			uint32_t keyhash = tbl->hash[key].keyhash;
+			first[key] = -1;
+			for (x=0;x<r;x++) {
+				if (tbl->hash[k[x]].keyhash == keyhash) {
+					first[key] = k[x];
+					break;
+				}
+			}
+			if (first[key] < 0) {
+				k[j] = k[r];
+				k[r++] = key;
+			}
+		}
+		if (r == 0) {
+			disp[b] = 0;
+			continue;
+		}
+		if (!place_bucket(tbl, k, r, used, slot, &disp[b]))
+			goto _failed;
+	}
+	// move the keys in the spare slots to the unused slots below n, then the chained keys
+	int hole = 0;
+	for (i=0;i<spare;i++) {
+		if (used[n + i]) {
+			while (used[hole])
+				++hole;
+			used[hole] = 1;
+			disp[nbucket + i] = hole;
+		} else {
+			disp[nbucket + i] = 0;
+		}
+	}
+	for (i=0;i<n;i++) {
+		if (first[i] >= 0) {
+			while (used[hole])
+				++hole;
+			used[hole] = 1;
+			slot[i] = hole;
+		} else if (slot[i] >= n) {
+			slot[i] = disp[nbucket + slot[i] - n];
+		}
+	}
+	for (i=0;i<n;i++) {
+		struct node * node = &hash[slot[i]];
+		*node = tbl->hash[i];
+		node->next = -1;
+		node->nocolliding = 1;
+	}
+	for (i=0;i<n;i++) {
+		if (first[i] >= 0) {
+			struct node * head = &hash[slot[first[i]]];
+			hash[slot[i]].next = head->next;
+			head->next = slot[i];
+		}
+	}
+	free(tbl->hash);
+	tbl->hash = hash;
+	tbl->disp = disp;
+	tbl->nbucket = nbucket;
+	hash = NULL;
+	disp = NULL;
+_failed:
+	free(disp);
+	free(start);
+	free(keys);
+	free(order);
+	free(count);
+	free(slot);
+	free(first);
+	free(used);
+	free(hash);
+}
+
 // table need convert
 // struct context * ctx
 static int
@@ -281,8 +758,12 @@ convtable(lua_State *L) {
 	struct table *tbl = ctx->tbl;
 
 	tbl->L = ctx->L;
+	tbl->image = NULL;
 
 	int sizearray = lua_rawlen(L, 1);
+	if (!ctx->noindex) {
+		sizearray = densesize(L, sizearray);
+	}
 	if (sizearray) {
 		tbl->arraytype = (uint8_t *)malloc(sizearray * sizeof(uint8_t));
 		if (tbl->arraytype == NULL) {
@@ -312,12 +793,16 @@ convtable(lua_State *L) {
 
 		fillnocolliding(L, ctx);
 		fillcolliding(L, ctx);
+		if (!ctx->noindex) {
+			build_index(tbl);
+		}
 	} else {
 		int i;
 		for (i=1;i<=sizearray;i++) {
+			lua_pushinteger(L, i);
 			lua_rawgeti(L, 1, i);
 			setarray(ctx, L, -1, i);
-			lua_pop(L,1);
+			lua_pop(L,2);
 		}
 	}
 
@@ -326,22 +811,35 @@ memerror:
 	return luaL_error(L, "memory error");
 }
 
+// the sub tables shared from the older versions (tbl->L is different) are not deleted
+static inline int
+own_table(struct table *tbl, struct table *child) {
+	return child->L == NULL || child->L == tbl->L;
+}
+
 static void
 delete_tbl(struct table *tbl) {
 	int i;
 	for (i=0;i<tbl->sizearray;i++) {
-		if (tbl->arraytype[i] == VALUETYPE_TABLE) {
+		if (tbl->arraytype[i] == VALUETYPE_TABLE && own_table(tbl, tbl->array[i].tbl)) {
 			delete_tbl(tbl->array[i].tbl);
 		}
 	}
 	for (i=0;i<tbl->sizehash;i++) {
-		if (tbl->hash[i].valuetype == VALUETYPE_TABLE) {
+		if (tbl->hash[i].valuetype == VALUETYPE_TABLE && own_table(tbl, tbl->hash[i].v.tbl)) {
 			delete_tbl(tbl->hash[i].v.tbl);
 		}
 	}
+	while (tbl->index) {
+		struct field_index * fi = tbl->index;
+		tbl->index = fi->next;
+		free(fi->e);
+		free(fi);
+	}
 	free(tbl->arraytype);
 	free(tbl->array);
 	free(tbl->hash);
+	free(tbl->disp);
 	free(tbl);
 }
 
@@ -386,6 +884,8 @@ convert_stringmap(struct context *ctx, struct table *tbl) {
 	s->dirty = 0;
 	ATOM_INIT(&s->ref , 0);
 	s->root = tbl;
+	s->generation = 0;
+	s->ndeps = 0;
 	lua_replace(L, 1);
 	lua_replace(L, -2);
 
@@ -403,15 +903,353 @@ convert_stringmap(struct context *ctx, struct table *tbl) {
 	lua_gc(L, LUA_GCCOLLECT, 0);
 }
 
+/*
+	The secondary index of a table of rows : the values of a field in the rows are sorted with the keys of the rows,
+	so llookup finds the rows by a value or a range with binary search.
+	The indexes are built at lnewconf (see build_indexes), and immutable after.
+ */
+struct index_value {
+	uint8_t valuetype;
+	union value v;
+	const char * str;
+	size_t sz;
+};
+
+// boolean < number < string
+static inline int
+value_order(uint8_t vt) {
+	switch (vt) {
+	case VALUETYPE_BOOLEAN:
+		return 0;
+	case VALUETYPE_STRING:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+static int
+compare_index_value(const struct index_value *a, const struct index_value *b) {
+	int oa = value_order(a->valuetype);
+	int ob = value_order(b->valuetype);
+	if (oa != ob)
+		return oa < ob ? -1 : 1;
+	switch (oa) {
+	case 0:
+		return a->v.boolean - b->v.boolean;
+	case 1:
+		if (a->valuetype == VALUETYPE_INTEGER && b->valuetype == VALUETYPE_INTEGER) {
+			return a->v.d < b->v.d ? -1 : (a->v.d > b->v.d);
+		} else {
+			lua_Number na = a->valuetype == VALUETYPE_INTEGER ? (lua_Number)a->v.d : a->v.n;
+			lua_Number nb = b->valuetype == VALUETYPE_INTEGER ? (lua_Number)b->v.d : b->v.n;
+			return na < nb ? -1 : (na > nb);
+		}
+	default: {
+		size_t sz = a->sz < b->sz ? a->sz : b->sz;
+		int r = memcmp(a->str, b->str, sz);
+		if (r != 0)
+			return r;
+		return a->sz < b->sz ? -1 : (a->sz > b->sz);
+	}
+	}
+}
+
+static inline void
+entry_value(const struct index_entry *e, struct index_value *iv) {
+	iv->valuetype = e->valuetype;
+	iv->v = e->v;
+	if (e->valuetype == VALUETYPE_STRING) {
+		iv->str = get_string(e->row, e->v.string, &iv->sz);
+	}
+}
+
+static int
+compare_entry(const void *a, const void *b) {
+	const struct index_entry * ea = (const struct index_entry *)a;
+	const struct index_entry * eb = (const struct index_entry *)b;
+	struct index_value va, vb;
+	entry_value(ea, &va);
+	entry_value(eb, &vb);
+	int r = compare_index_value(&va, &vb);
+	if (r != 0)
+		return r;
+	return ea->pos - eb->pos;
+}
+
+static void
+add_entry(struct index_entry *e, int *count, struct table *row, uint32_t hash, const char *field, size_t sz, int keytype, int key) {
+	struct node * n = lookup_key(row, hash, 0, KEYTYPE_STRING, field, sz);
+	if (n == NULL)
+		return;
+	switch (n->valuetype) {
+	case VALUETYPE_INTEGER:
+	case VALUETYPE_REAL:
+	case VALUETYPE_STRING:
+	case VALUETYPE_BOOLEAN:
+		break;
+	default:
+		return;
+	}
+	struct index_entry * ie = &e[*count];
+	ie->v = n->v;
+	ie->valuetype = n->valuetype;
+	ie->keytype = keytype;
+	ie->key = key;
+	ie->pos = *count;
+	ie->row = row;
+	++*count;
+}
+
+static struct field_index *
+find_field_index(struct table *tbl, const char *field, size_t sz) {
+	struct field_index * fi = tbl->index;
+	while (fi) {
+		if (fi->sz == sz && memcmp(fi->field, field, sz) == 0)
+			return fi;
+		fi = fi->next;
+	}
+	return NULL;
+}
+
+// return 0 if memory error
+static int
+build_field_index(struct table *tbl, const char *field, size_t sz) {
+	int n = tbl->sizearray + tbl->sizehash;
+	struct index_entry * e = (struct index_entry *)malloc((n ? n : 1) * sizeof(*e));
+	struct field_index * fi = (struct field_index *)malloc(sizeof(*fi) + sz);
+	if (e == NULL || fi == NULL) {
+		free(e);
+		free(fi);
+		return 0;
+	}
+	uint32_t hash = calchash(field, sz);
+	int count = 0;
+	int i;
+	for (i=0;i<tbl->sizearray;i++) {
+		if (tbl->arraytype[i] == VALUETYPE_TABLE) {
+			add_entry(e, &count, tbl->array[i].tbl, hash, field, sz, KEYTYPE_INTEGER, i+1);
+		}
+	}
+	for (i=0;i<tbl->sizehash;i++) {
+		struct node * node = &tbl->hash[i];
+		if (node->valuetype == VALUETYPE_TABLE) {
+			add_entry(e, &count, node->v.tbl, hash, field, sz, node->keytype, node->key);
+		}
+	}
+	qsort(e, count, sizeof(*e), compare_entry);
+	fi->n = count;
+	fi->e = e;
+	fi->sz = sz;
+	memcpy(fi->field, field, sz);
+	fi->field[sz] = '\0';
+	fi->next = tbl->index;
+	tbl->index = fi;
+	return 1;
+}
+
+// the field names at the top of L, return 0 if memory error
+static int
+build_table_index(lua_State *L, struct table *root, struct table *tbl) {
+	// the sub tables shared from the older versions may be read by other threads, keep their indexes
+	if (!own_table(root, tbl))
+		return 1;
+	size_t sz;
+	const char * field;
+	if (lua_type(L, -1) == LUA_TSTRING) {
+		field = lua_tolstring(L, -1, &sz);
+		return find_field_index(tbl, field, sz) || build_field_index(tbl, field, sz);
+	}
+	int i;
+	int n = lua_rawlen(L, -1);
+	for (i=1;i<=n;i++) {
+		lua_rawgeti(L, -1, i);
+		field = lua_tolstring(L, -1, &sz);
+		int ok = find_field_index(tbl, field, sz) || build_field_index(tbl, field, sz);
+		lua_pop(L, 1);
+		if (!ok)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+	{ field1, field2, key1 = { field3, ... }, ... }
+	The fields in the array part index the root table, and key = { fields } index the sub table root[key].
+ */
+static void
+check_indexes(lua_State *L, int index) {
+	luaL_checktype(L, index, LUA_TTABLE);
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		int kt = lua_type(L, -2);
+		if (kt == LUA_TNUMBER && lua_isinteger(L, -2) && lua_type(L, -1) == LUA_TSTRING) {
+			lua_pop(L, 1);
+			continue;
+		}
+		if ((kt != LUA_TSTRING && !(kt == LUA_TNUMBER && lua_isinteger(L, -2))) || lua_type(L, -1) != LUA_TTABLE) {
+			luaL_error(L, "Invalid index declaration");
+		}
+		int i;
+		int n = lua_rawlen(L, -1);
+		for (i=1;i<=n;i++) {
+			if (lua_rawgeti(L, -1, i) != LUA_TSTRING) {
+				luaL_error(L, "Invalid index field");
+			}
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
+	}
+}
+
+// return 0 if memory error
+static int
+build_indexes(lua_State *L, int index, struct table *root) {
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		struct table * tbl = NULL;
+		if (lua_type(L, -1) == LUA_TSTRING) {
+			tbl = root;
+		} else if (lua_type(L, -2) == LUA_TSTRING) {
+			size_t sz;
+			const char * key = lua_tolstring(L, -2, &sz);
+			struct node * n = lookup_key(root, calchash(key, sz), 0, KEYTYPE_STRING, key, sz);
+			if (n && n->valuetype == VALUETYPE_TABLE)
+				tbl = n->v.tbl;
+		} else {
+			lua_Integer key = lua_tointeger(L, -2);
+			if (key > 0 && key <= root->sizearray) {
+				if (root->arraytype[key-1] == VALUETYPE_TABLE)
+					tbl = root->array[key-1].tbl;
+			} else {
+				struct node * n = lookup_key(root, (uint32_t)key, (int)key, KEYTYPE_INTEGER, NULL, 0);
+				if (n && n->valuetype == VALUETYPE_TABLE)
+					tbl = n->v.tbl;
+			}
+		}
+		if (tbl && !build_table_index(L, root, tbl)) {
+			lua_pop(L, 2);
+			return 0;
+		}
+		lua_pop(L, 1);
+	}
+	return 1;
+}
+
+static struct table *
+get_table(lua_State *L, int index) {
+	struct table *tbl = lua_touserdata(L,index);
+	if (tbl == NULL) {
+		luaL_error(L, "Need a conf object");
+	}
+	return tbl;
+}
+
+static void
+check_index_value(lua_State *L, int index, struct index_value *iv) {
+	switch (lua_type(L, index)) {
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, index)) {
+			iv->valuetype = VALUETYPE_INTEGER;
+			iv->v.d = lua_tointeger(L, index);
+		} else {
+			iv->valuetype = VALUETYPE_REAL;
+			iv->v.n = lua_tonumber(L, index);
+		}
+		break;
+	case LUA_TSTRING:
+		iv->valuetype = VALUETYPE_STRING;
+		iv->str = lua_tolstring(L, index, &iv->sz);
+		break;
+	case LUA_TBOOLEAN:
+		iv->valuetype = VALUETYPE_BOOLEAN;
+		iv->v.boolean = lua_toboolean(L, index);
+		break;
+	default:
+		luaL_error(L, "Invalid lookup value %s", luaL_typename(L, index));
+	}
+}
+
+/*
+	conf object (a table of rows)
+	string field
+	value min
+	value max (optional, the same as min)
+	return the keys of the rows (min <= row[field] <= max) ordered by the value, or nil if the field is not indexed
+ */
+static int
+llookup(lua_State *L) {
+	struct table *tbl = get_table(L, 1);
+	size_t sz;
+	const char * field = luaL_checklstring(L, 2, &sz);
+	struct index_value lo, hi, v;
+	check_index_value(L, 3, &lo);
+	check_index_value(L, lua_isnoneornil(L, 4) ? 3 : 4, &hi);
+	struct field_index * fi = find_field_index(tbl, field, sz);
+	if (fi == NULL)
+		return 0;
+	int begin = 0, end = fi->n;
+	while (begin < end) {
+		int mid = (begin + end) / 2;
+		entry_value(&fi->e[mid], &v);
+		if (compare_index_value(&v, &lo) < 0) {
+			begin = mid + 1;
+		} else {
+			end = mid;
+		}
+	}
+	lua_newtable(L);
+	int i, n = 0;
+	for (i=begin;i<fi->n;i++) {
+		const struct index_entry * e = &fi->e[i];
+		entry_value(e, &v);
+		if (compare_index_value(&v, &hi) > 0)
+			break;
+		if (e->keytype == KEYTYPE_INTEGER) {
+			lua_pushinteger(L, e->key);
+		} else {
+			size_t ksz = 0;
+			const char * key = get_string(tbl, e->key, &ksz);
+			lua_pushlstring(L, key, ksz);
+		}
+		lua_rawseti(L, -2, ++n);
+	}
+	return 1;
+}
+
+/*
+	table data
+	boolean noindex
+	conf object base (optional) : build on the base version, share the sub tables not changed
+	table indexes (optional) : the secondary indexes, see check_indexes
+	return conf object
+ */
 static int
 lnewconf(lua_State *L) {
 	int ret;
 	struct context ctx;
 	struct table * tbl = NULL;
+	struct state * base = NULL;
 	luaL_checktype(L,1,LUA_TTABLE);
+	int indexes = !lua_isnoneornil(L, 4);
+	if (indexes) {
+		check_indexes(L, 4);
+	}
+	if (!lua_isnoneornil(L, 3)) {
+		struct table * b = get_table(L, 3);
+		// a snapshot can't be shared, and make a full build when the chain is too long
+		if (b->image == NULL) {
+			base = get_state(b);
+			if (base->generation >= SHARE_MAXGEN)
+				base = NULL;
+		}
+	}
 	ctx.L = luaL_newstate();
 	ctx.tbl = NULL;
 	ctx.string_index = 1;	// 1 reserved for dirty flag
+	ctx.noindex = lua_toboolean(L, 2);
+	ctx.base = base ? base->root : NULL;
+	ctx.ndeps = 0;
 	if (ctx.L == NULL) {
 		lua_pushliteral(L, "memory error");
 		goto error;
@@ -442,6 +1280,22 @@ lnewconf(lua_State *L) {
 
 	convert_stringmap(&ctx, tbl);
 
+	if (indexes && !build_indexes(L, 4, tbl)) {
+		lua_pushliteral(L, "memory error");
+		goto error;
+	}
+
+	if (ctx.ndeps > 0) {
+		struct state * s = get_state(tbl);
+		int i;
+		s->generation = base->generation + 1;
+		s->ndeps = ctx.ndeps;
+		for (i=0;i<ctx.ndeps;i++) {
+			s->deps[i] = ctx.deps[i];
+			ATOM_FINC(&s->deps[i]->ref);
+		}
+	}
+
 	lua_pushlightuserdata(L, tbl);	
 
 	return 1;
@@ -456,25 +1310,442 @@ error:
 	return -1;
 }
 
+// return NULL if the table in the directory is invalid, or memory error
 static struct table *
-get_table(lua_State *L, int index) {
-	struct table *tbl = lua_touserdata(L,index);
+image_newtable(struct image *img, lua_Integer idx) {
+	if (idx < 0 || idx >= img->ntable)
+		return NULL;
+	struct table * tbl = (struct table *)ATOM_LOAD(&img->tables[idx]);
+	if (tbl)
+		return tbl;
+	const struct image_table * t = &img->dir[idx];
+	uint64_t sizearray = t->sizearray;
+	uint64_t sizehash = t->sizehash;
+	uint64_t size = img->size;
+	// the offsets are from the file, check them as size > len - offset to avoid wraparound
+	if (t->sizearray < 0 || t->sizehash < 0
+		|| t->arraytype > size || sizearray > size - t->arraytype
+		|| t->array % sizeof(union value) != 0
+		|| t->array > size || sizearray > (size - t->array) / sizeof(union value)
+		|| t->hash % sizeof(union value) != 0
+		|| t->hash > size || sizehash > (size - t->hash) / sizeof(struct node)
+		|| t->nbucket < 0 || (t->nbucket > 0 && sizehash == 0)
+		|| t->disp % sizeof(uint32_t) != 0
+		|| t->disp > size || (t->nbucket > 0 && (uint64_t)t->nbucket + MPH_SPARE(sizehash) > (size - t->disp) / sizeof(uint32_t))) {
+		return NULL;
+	}
+	// lookup_key follows node->next
+	const struct node * hash = (const struct node *)(img->base + t->hash);
+	int i;
+	for (i=0;i<t->sizehash;i++) {
+		if (hash[i].next < -1 || hash[i].next >= t->sizehash)
+			return NULL;
+	}
+	// and mph_lookup follows the remap of the spare slots
+	if (t->nbucket > 0) {
+		const uint32_t * remap = (const uint32_t *)(img->base + t->disp) + t->nbucket;
+		for (i=0;i<MPH_SPARE(t->sizehash);i++) {
+			if (remap[i] >= (uint32_t)t->sizehash)
+				return NULL;
+		}
+	}
+	tbl = (struct table *)malloc(sizeof(*tbl));
+	if (tbl == NULL)
+		return NULL;
+	tbl->sizearray = t->sizearray;
+	tbl->sizehash = t->sizehash;
+	// the mapped pages are read only
+	tbl->arraytype = (uint8_t *)(img->base + t->arraytype);
+	tbl->array = (union value *)(img->base + t->array);
+	tbl->hash = (struct node *)(img->base + t->hash);
+	tbl->disp = t->nbucket ? (uint32_t *)(img->base + t->disp) : NULL;
+	tbl->nbucket = t->nbucket;
+	tbl->L = NULL;
+	tbl->image = img;
+	tbl->index = NULL;	// the indexes are not saved in snapshot
+	if (!ATOM_CAS_POINTER(&img->tables[idx], (uintptr_t)NULL, (uintptr_t)tbl)) {
+		// created by other thread
+		free(tbl);
+		tbl = (struct table *)ATOM_LOAD(&img->tables[idx]);
+	}
+	return tbl;
+}
+
+static struct table *
+image_table(lua_State *L, struct image *img, lua_Integer idx) {
+	struct table * tbl = image_newtable(img, idx);
 	if (tbl == NULL) {
-		luaL_error(L, "Need a conf object");
+		luaL_error(L, "Invalid table %d in snapshot", (int)idx);
 	}
 	return tbl;
 }
 
+static void
+image_release(struct image *img) {
+	int i;
+	for (i=0;i<img->ntable;i++) {
+		free((void *)ATOM_LOAD(&img->tables[i]));
+	}
+	free((void *)img->tables);
+	munmap((void *)img->base, img->size);
+	free(img);
+}
+
+/*
+	string filename
+	return conf object (the same as lnewconf)
+ */
+static int
+lload(lua_State *L) {
+	const char * filename = luaL_checkstring(L, 1);
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return luaL_error(L, "Can't open %s", filename);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct image_header)) {
+		close(fd);
+		return luaL_error(L, "Invalid snapshot %s", filename);
+	}
+	size_t size = (size_t)st.st_size;
+	void * base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return luaL_error(L, "Can't mmap %s", filename);
+	}
+	const struct image_header * h = base;
+	const char * err = NULL;
+	if (h->magic != IMAGE_MAGIC) {
+		err = "not a snapshot";
+	} else if (h->version != IMAGE_VERSION) {
+		err = "version mismatch";
+	} else if (h->nodesize != sizeof(struct node)) {
+		err = "layout mismatch";
+	} else if (h->size != size || h->ntable == 0 || h->ntable > INT_MAX
+		|| h->strings > size || h->stringsize > size - h->strings
+		|| h->tables % sizeof(uint64_t) != 0
+		|| h->tables > size || h->ntable > (size - h->tables) / sizeof(struct image_table)) {
+		err = "truncated";
+	}
+	if (err) {
+		munmap(base, size);
+		return luaL_error(L, "Invalid snapshot %s : %s", filename, err);
+	}
+	struct image * img = (struct image *)malloc(sizeof(*img));
+	ATOM_POINTER * tables = (ATOM_POINTER *)calloc(h->ntable, sizeof(ATOM_POINTER));
+	if (img == NULL || tables == NULL) {
+		free(img);
+		free((void *)tables);
+		munmap(base, size);
+		return luaL_error(L, "memory error");
+	}
+	img->state.dirty = 0;
+	ATOM_INIT(&img->state.ref, 0);
+	img->state.root = NULL;
+	img->state.generation = 0;
+	img->state.ndeps = 0;
+	img->base = base;
+	img->size = size;
+	img->strings = img->base + h->strings;
+	img->stringsize = h->stringsize;
+	img->dir = (const struct image_table *)(img->base + h->tables);
+	img->ntable = (int)h->ntable;
+	img->tables = tables;
+	struct table * root = image_newtable(img, 0);
+	if (root == NULL) {
+		image_release(img);
+		return luaL_error(L, "Invalid snapshot %s : bad root", filename);
+	}
+	img->state.root = root;
+	lua_pushlightuserdata(L, root);
+	return 1;
+}
+
+struct strmap {
+	lua_State * L;
+	int * offset;	// string index of L -> offset in string pool, -1 if not used
+};
+
+struct saver {
+	FILE * f;
+	uint64_t offset;
+	int error;
+	int nmap;
+	struct strmap map[SHARE_MAXGEN + 1];	// the shared sub tables have their own string table
+	struct table ** queue;
+	struct image_table * dir;
+	int ntable;
+	int cap;
+};
+
+static void
+save_write(struct saver *S, const void *p, size_t sz) {
+	if (sz && fwrite(p, 1, sz, S->f) != sz)
+		S->error = 1;
+	S->offset += sz;
+}
+
+static void
+save_align(struct saver *S, int n) {
+	static const char zero[8] = { 0 };
+	int pad = (int)((n - S->offset % n) % n);
+	save_write(S, zero, pad);
+}
+
+// append a sub table in the queue (breadth first), return the index
+static lua_Integer
+save_push(struct saver *S, struct table *tbl) {
+	if (S->ntable >= S->cap) {
+		int cap = S->cap * 2;
+		struct table ** q = (struct table **)realloc(S->queue, cap * sizeof(*q));
+		if (q == NULL) {
+			S->error = 1;
+			return 0;
+		}
+		S->queue = q;
+		struct image_table * d = (struct image_table *)realloc(S->dir, cap * sizeof(*d));
+		if (d == NULL) {
+			S->error = 1;
+			return 0;
+		}
+		S->dir = d;
+		S->cap = cap;
+	}
+	S->queue[S->ntable] = tbl;
+	return S->ntable++;
+}
+
+static int *
+save_stroff(struct saver *S, struct table *tbl) {
+	int i;
+	for (i=0;i<S->nmap;i++) {
+		if (S->map[i].L == tbl->L)
+			return S->map[i].offset;
+	}
+	// never get here, tbl->L must be the owner of the root or the deps
+	assert(0);
+	return NULL;
+}
+
+// mark the strings used by the tree, the strings of the older versions are not all used
+static void
+save_mark(struct saver *S, struct table *tbl) {
+	int * stroff = save_stroff(S, tbl);
+	int i;
+	for (i=0;i<tbl->sizearray;i++) {
+		if (tbl->arraytype[i] == VALUETYPE_STRING) {
+			stroff[tbl->array[i].string] = 0;
+		} else if (tbl->arraytype[i] == VALUETYPE_TABLE) {
+			save_mark(S, tbl->array[i].tbl);
+		}
+	}
+	for (i=0;i<tbl->sizehash;i++) {
+		struct node * n = &tbl->hash[i];
+		if (n->keytype == KEYTYPE_STRING) {
+			stroff[n->key] = 0;
+		}
+		if (n->valuetype == VALUETYPE_STRING) {
+			stroff[n->v.string] = 0;
+		} else if (n->valuetype == VALUETYPE_TABLE) {
+			save_mark(S, n->v.tbl);
+		}
+	}
+}
+
+static union value
+save_value(struct saver *S, struct table *tbl, uint8_t vt, const union value *v) {
+	union value r;
+	memset(&r, 0, sizeof(r));
+	switch (vt) {
+	case VALUETYPE_REAL:
+		r.n = v->n;
+		break;
+	case VALUETYPE_INTEGER:
+		r.d = v->d;
+		break;
+	case VALUETYPE_STRING:
+		r.string = save_stroff(S, tbl)[v->string];
+		break;
+	case VALUETYPE_BOOLEAN:
+		r.boolean = v->boolean;
+		break;
+	case VALUETYPE_TABLE:
+		r.d = save_push(S, v->tbl);
+		break;
+	}
+	return r;
+}
+
+static void
+save_table(struct saver *S, int idx) {
+	struct table * tbl = S->queue[idx];
+	struct image_table * t = &S->dir[idx];
+	int * stroff = save_stroff(S, tbl);
+	int i;
+	t->sizearray = tbl->sizearray;
+	t->sizehash = tbl->sizehash;
+	t->arraytype = S->offset;
+	save_write(S, tbl->arraytype, tbl->sizearray);
+	save_align(S, 8);
+	t->array = S->offset;
+	for (i=0;i<tbl->sizearray;i++) {
+		union value v = save_value(S, tbl, tbl->arraytype[i], &tbl->array[i]);
+		save_write(S, &v, sizeof(v));
+	}
+	t = &S->dir[idx];	// dir may be reallocated by save_push
+	t->hash = S->offset;
+	for (i=0;i<tbl->sizehash;i++) {
+		struct node * n = &tbl->hash[i];
+		struct node tmp;
+		memset(&tmp, 0, sizeof(tmp));
+		tmp.v = save_value(S, tbl, n->valuetype, &n->v);
+		tmp.key = n->keytype == KEYTYPE_STRING ? stroff[n->key] : n->key;
+		tmp.next = n->next;
+		tmp.keyhash = n->keyhash;
+		tmp.keytype = n->keytype;
+		tmp.valuetype = n->valuetype;
+		tmp.nocolliding = n->nocolliding;
+		save_write(S, &tmp, sizeof(tmp));
+	}
+	t = &S->dir[idx];
+	t->disp = S->offset;
+	t->nbucket = tbl->disp ? tbl->nbucket : 0;
+	t->reserved = 0;
+	if (tbl->disp) {
+		save_write(S, tbl->disp, (t->nbucket + MPH_SPARE(tbl->sizehash)) * sizeof(uint32_t));
+	}
+}
+
+/*
+	conf object (created by lnewconf)
+	string filename
+
+	Write the snapshot to filename.tmp and then rename it,
+	the processes which have mapped the old file are not affected.
+ */
+static int
+lsave(lua_State *L) {
+	struct table * root = lua_touserdata(L, 1);
+	const char * filename = luaL_checkstring(L, 2);
+	if (root == NULL || root->image) {
+		return luaL_error(L, "Need a conf object created by new");
+	}
+	struct state * st = get_state(root);
+	lua_pushfstring(L, "%s.tmp", filename);
+	const char * tmpname = lua_tostring(L, -1);
+
+	struct saver S;
+	int i, j;
+	memset(&S, 0, sizeof(S));
+	S.cap = 16;
+	S.nmap = st->ndeps + 1;
+	for (i=0;i<S.nmap;i++) {
+		struct strmap * m = &S.map[i];
+		m->L = i == 0 ? root->L : st->deps[i-1]->root->L;
+		int nstr = lua_gettop(m->L);
+		m->offset = (int *)malloc((nstr + 1) * sizeof(int));
+		if (m->offset == NULL) {
+			S.error = 1;
+			goto _done;
+		}
+		for (j=0;j<=nstr;j++) {
+			m->offset[j] = -1;
+		}
+	}
+	S.queue = (struct table **)malloc(S.cap * sizeof(struct table *));
+	S.dir = (struct image_table *)malloc(S.cap * sizeof(struct image_table));
+	S.f = fopen(tmpname, "wb");
+	if (S.queue == NULL || S.dir == NULL || S.f == NULL) {
+		S.error = 1;
+		goto _done;
+	}
+
+	struct image_header h;
+	memset(&h, 0, sizeof(h));
+	save_write(&S, &h, sizeof(h));
+
+	// string pool, index 1 of tbl->L is the state
+	save_mark(&S, root);
+	h.strings = S.offset;
+	for (j=0;j<S.nmap;j++) {
+		lua_State * sL = S.map[j].L;
+		int * stroff = S.map[j].offset;
+		int nstr = lua_gettop(sL);
+		for (i=2;i<=nstr;i++) {
+			if (stroff[i] < 0)
+				continue;
+			size_t sz = 0;
+			const char * str = lua_tolstring(sL, i, &sz);
+			uint64_t off = S.offset - h.strings;
+			if (off > INT_MAX || sz > UINT32_MAX) {
+				S.error = 1;
+				goto _done;
+			}
+			stroff[i] = (int)off;
+			uint32_t len = (uint32_t)sz;
+			save_write(&S, &len, sizeof(len));
+			save_write(&S, str, sz + 1);
+			save_align(&S, 4);
+		}
+	}
+	h.stringsize = S.offset - h.strings;
+
+	save_push(&S, root);
+	for (i=0;i<S.ntable && !S.error;i++) {
+		save_align(&S, 8);
+		save_table(&S, i);
+	}
+	save_align(&S, 8);
+	h.tables = S.offset;
+	save_write(&S, S.dir, S.ntable * sizeof(struct image_table));
+
+	h.magic = IMAGE_MAGIC;
+	h.version = IMAGE_VERSION;
+	h.nodesize = sizeof(struct node);
+	h.ntable = S.ntable;
+	h.size = S.offset;
+	if (fseek(S.f, 0, SEEK_SET) != 0) {
+		S.error = 1;
+	}
+	save_write(&S, &h, sizeof(h));
+_done:
+	if (S.f && fclose(S.f) != 0) {
+		S.error = 1;
+	}
+	for (i=0;i<S.nmap;i++) {
+		free(S.map[i].offset);
+	}
+	free(S.queue);
+	free(S.dir);
+	if (S.error || rename(tmpname, filename) != 0) {
+		if (S.f)
+			remove(tmpname);
+		return luaL_error(L, "Save snapshot %s failed", filename);
+	}
+	lua_pushinteger(L, h.size);
+	lua_pushinteger(L, h.ntable);
+	return 2;
+}
+
 static int
 ldeleteconf(lua_State *L) {
 	struct table *tbl = get_table(L,1);
+	if (tbl->image) {
+		image_release(tbl->image);
+		return 0;
+	}
+	struct state * s = get_state(tbl);
+	int i;
+	for (i=0;i<s->ndeps;i++) {
+		ATOM_FDEC(&s->deps[i]->ref);
+	}
 	lua_close(tbl->L);
 	delete_tbl(tbl);
 	return 0;
 }
 
 static void
-pushvalue(lua_State *L, lua_State *sL, uint8_t vt, union value *v) {
+pushvalue(lua_State *L, struct table *tbl, uint8_t vt, union value *v) {
 	switch(vt) {
 	case VALUETYPE_REAL:
 		lua_pushnumber(L, v->n);
@@ -484,7 +1755,7 @@ pushvalue(lua_State *L, lua_State *sL, uint8_t vt, union value *v) {
 		break;
 	case VALUETYPE_STRING: {
 		size_t sz = 0;
-		const char *str = lua_tolstring(sL, v->string, &sz);
+		const char *str = get_string(tbl, v->string, &sz);
 		lua_pushlstring(L, str, sz);
 		break;
 	}
@@ -492,7 +1763,11 @@ pushvalue(lua_State *L, lua_State *sL, uint8_t vt, union value *v) {
 		lua_pushboolean(L, v->boolean);
 		break;
 	case VALUETYPE_TABLE:
-		lua_pushlightuserdata(L, v->tbl);
+		if (tbl->image) {
+			lua_pushlightuserdata(L, image_table(L, tbl->image, v->d));
+		} else {
+			lua_pushlightuserdata(L, v->tbl);
+		}
 		break;
 	default:
 		lua_pushnil(L);
@@ -504,9 +1779,18 @@ static struct node *
 lookup_key(struct table *tbl, uint32_t keyhash, int key, int keytype, const char *str, size_t sz) {
 	if (tbl->sizehash == 0)
 		return NULL;
-	struct node *n = &tbl->hash[keyhash % tbl->sizehash];
-	if (keyhash != n->keyhash && n->nocolliding)
-		return NULL;
+	struct node *n;
+	if (tbl->disp) {
+		n = &tbl->hash[mph_lookup(tbl, keyhash)];
+		// only the keys with the same keyhash are chained, see build_index
+		if (n->keyhash != keyhash)
+			return NULL;
+	} else {
+		n = &tbl->hash[keyhash % tbl->sizehash];
+		if (keyhash != n->keyhash && n->nocolliding)
+			return NULL;
+	}
+	int step = tbl->sizehash;	// a broken snapshot may have a loop in the chain
 	for (;;) {
 		if (keyhash == n->keyhash) {
 			if (n->keytype == KEYTYPE_INTEGER) {
@@ -517,17 +1801,17 @@ lookup_key(struct table *tbl, uint32_t keyhash, int key, int keytype, const char
 				// n->keytype == KEYTYPE_STRING
 				if (keytype == KEYTYPE_STRING) {
 					size_t sz2 = 0;
-					const char * str2 = lua_tolstring(tbl->L, n->key, &sz2);
+					const char * str2 = get_string(tbl, n->key, &sz2);
 					if (sz == sz2 && memcmp(str,str2,sz) == 0) {
 						return n;
 					}
 				}
 			}
 		}
-		if (n->next < 0) {
+		if (n->next < 0 || --step == 0) {
 			return NULL;
 		}
-		n = &tbl->hash[n->next];		
+		n = &tbl->hash[n->next];
 	}
 }
 
@@ -547,7 +1831,7 @@ lindexconf(lua_State *L) {
 		key = (int)lua_tointeger(L, 2);
 		if (key > 0 && key <= tbl->sizearray) {
 			--key;
-			pushvalue(L, tbl->L, tbl->arraytype[key], &tbl->array[key]);
+			pushvalue(L, tbl, tbl->arraytype[key], &tbl->array[key]);
 			return 1;
 		}
 		keytype = KEYTYPE_INTEGER;
@@ -560,7 +1844,7 @@ lindexconf(lua_State *L) {
 
 	struct node *n = lookup_key(tbl, keyhash, key, keytype, str, sz);
 	if (n) {
-		pushvalue(L, tbl->L, n->valuetype, &n->v);
+		pushvalue(L, tbl, n->valuetype, &n->v);
 		return 1;
 	} else {
 		return 0;
@@ -568,12 +1852,12 @@ lindexconf(lua_State *L) {
 }
 
 static void
-pushkey(lua_State *L, lua_State *sL, struct node *n) {
+pushkey(lua_State *L, struct table *tbl, struct node *n) {
 	if (n->keytype == KEYTYPE_INTEGER) {
 		lua_pushinteger(L, n->key);
 	} else {
 		size_t sz = 0;
-		const char * str = lua_tolstring(sL, n->key, &sz);
+		const char * str = get_string(tbl, n->key, &sz);
 		lua_pushlstring(L, str, sz);
 	}
 }
@@ -581,7 +1865,7 @@ pushkey(lua_State *L, lua_State *sL, struct node *n) {
 static int
 pushfirsthash(lua_State *L, struct table * tbl) {
 	if (tbl->sizehash) {
-		pushkey(L, tbl->L, &tbl->hash[0]);
+		pushkey(L, tbl, &tbl->hash[0]);
 		return 1;
 	} else {
 		return 0;
@@ -640,7 +1924,7 @@ lnextkey(lua_State *L) {
 		if (index == tbl->sizehash) {
 			return 0;
 		}
-		pushkey(L, tbl->L, n);
+		pushkey(L, tbl, n);
 		return 1;
 	} else {
 		return 0;
@@ -654,18 +1938,20 @@ llen(lua_State *L) {
 	return 1;
 }
 
+// return size of hash part, and buckets of the perfect hash (0 if not built)
 static int
 lhashlen(lua_State *L) {
 	struct table *tbl = get_table(L,1);
 	lua_pushinteger(L, tbl->sizehash);
-	return 1;
+	lua_pushinteger(L, tbl->disp ? tbl->nbucket : 0);
+	return 2;
 }
 
 static int
 releaseobj(lua_State *L) {
 	struct ctrl *c = lua_touserdata(L, 1);
 	struct table *tbl = c->root;
-	struct state *s = lua_touserdata(tbl->L, 1);
+	struct state *s = get_state(tbl);
 	ATOM_FDEC(&s->ref);
 	c->root = NULL;
 	c->update = NULL;
@@ -676,7 +1962,7 @@ releaseobj(lua_State *L) {
 static int
 lboxconf(lua_State *L) {
 	struct table * tbl = get_table(L,1);	
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct state * s = get_state(tbl);
 	ATOM_FINC(&s->ref);
 
 	struct ctrl * c = lua_newuserdatauv(L, sizeof(*c), 1);
@@ -694,15 +1980,29 @@ lboxconf(lua_State *L) {
 static int
 lmarkdirty(lua_State *L) {
 	struct table *tbl = get_table(L,1);
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct state * s = get_state(tbl);
 	s->dirty = 1;
 	return 0;
 }
 
+/*
+	conf object or the ctrl object created by box.
+	The proxies of the shared sub tables check the root with the ctrl object,
+	because the owner of the sub table may be marked dirty earlier.
+ */
 static int
 lisdirty(lua_State *L) {
-	struct table *tbl = get_table(L,1);
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct table *tbl;
+	if (lua_type(L, 1) == LUA_TUSERDATA) {
+		struct ctrl * c = lua_touserdata(L, 1);
+		tbl = c->root;
+		if (tbl == NULL) {
+			return luaL_error(L, "Released object");
+		}
+	} else {
+		tbl = get_table(L,1);
+	}
+	struct state * s = get_state(tbl);
 	int d = s->dirty;
 	lua_pushboolean(L, d);
 	
@@ -712,7 +2012,7 @@ lisdirty(lua_State *L) {
 static int
 lgetref(lua_State *L) {
 	struct table *tbl = get_table(L,1);
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct state * s = get_state(tbl);
 	lua_pushinteger(L , ATOM_LOAD(&s->ref));
 
 	return 1;
@@ -721,7 +2021,7 @@ lgetref(lua_State *L) {
 static int
 lincref(lua_State *L) {
 	struct table *tbl = get_table(L,1);
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct state * s = get_state(tbl);
 	int ref = ATOM_FINC(&s->ref)+1;
 	lua_pushinteger(L , ref);
 
@@ -731,7 +2031,7 @@ lincref(lua_State *L) {
 static int
 ldecref(lua_State *L) {
 	struct table *tbl = get_table(L,1);
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct state * s = get_state(tbl);
 	int ref = ATOM_FDEC(&s->ref)-1;
 	lua_pushinteger(L , ref);
 
@@ -776,10 +2076,13 @@ luaopen_skynet_sharedata_core(lua_State *L) {
 		{ "getref", lgetref },
 		{ "incref", lincref },
 		{ "decref", ldecref },
+		{ "save", lsave },
+		{ "load", lload },
 
 		// used by client
 		{ "box", lboxconf },
 		{ "index", lindexconf },
+		{ "lookup", llookup },
 		{ "nextkey", lnextkey },
 		{ "len", llen },
 		{ "hashlen", lhashlen },
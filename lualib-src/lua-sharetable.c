@@ -5,6 +5,8 @@
 #include <lualib.h>
 
 #include "lgc.h"
+#include "skynet.h"
+#include "atomic.h"
 
 #ifdef makeshared
 
@@ -240,6 +242,234 @@ matrix_from_file(lua_State *L) {
 	return box_state(L, mL);
 }
 
+/*
+	sharebox : an immutable table in its own lua state (matrix), refcounted.
+	It can be sent to the services in the same process, and they read it in place.
+ */
+
+#define BOX_MAXDEPTH 64
+#define BOX_VISITED 1
+#define BOX_COPY 2
+// the root table stays at this index of the box state
+#define BOX_ROOT 1
+
+struct sharebox {
+	ATOM_INT ref;
+	lua_State *L;
+	size_t size;
+};
+
+// number of boxes in process, for debug
+static ATOM_INT BOX_LIVE;
+
+static void
+box_unref(struct sharebox *box) {
+	if (ATOM_FDEC(&box->ref) == 1) {
+		lua_close(box->L);
+		skynet_free(box);
+		ATOM_FDEC(&BOX_LIVE);
+	}
+}
+
+// copy the value at L[idx] to the top of mL, run in mL (errors raise in mL)
+static void
+copy_value(lua_State *mL, lua_State *L, int idx, int depth) {
+	switch (lua_type(L, idx)) {
+	case LUA_TNIL:
+		lua_pushnil(mL);
+		break;
+	case LUA_TBOOLEAN:
+		lua_pushboolean(mL, lua_toboolean(L, idx));
+		break;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, idx)) {
+			lua_pushinteger(mL, lua_tointeger(L, idx));
+		} else {
+			lua_pushnumber(mL, lua_tonumber(L, idx));
+		}
+		break;
+	case LUA_TSTRING: {
+		size_t sz;
+		const char * str = lua_tolstring(L, idx, &sz);
+		lua_pushlstring(mL, str, sz);
+		break;
+	}
+	case LUA_TLIGHTUSERDATA:
+		lua_pushlightuserdata(mL, lua_touserdata(L, idx));
+		break;
+	case LUA_TTABLE: {
+		const void * p = lua_topointer(L, idx);
+		if (lua_rawgetp(mL, BOX_VISITED, p) == LUA_TTABLE) {
+			// the table is referenced more than once
+			break;
+		}
+		lua_pop(mL, 1);
+		if (depth > BOX_MAXDEPTH) {
+			luaL_error(mL, "Too depth table");
+		}
+		if (!lua_checkstack(L, 3) || !lua_checkstack(mL, 4)) {
+			luaL_error(mL, "Stack overflow");
+		}
+		if (lua_getmetatable(L, idx)) {
+			lua_pop(L, 1);
+			luaL_error(mL, "Can't share metatable");
+		}
+		if (idx < 0) {
+			idx = lua_gettop(L) + idx + 1;
+		}
+		lua_createtable(mL, (int)lua_rawlen(L, idx), 0);
+		lua_pushvalue(mL, -1);
+		lua_rawsetp(mL, BOX_VISITED, p);
+		lua_pushnil(L);
+		while (lua_next(L, idx) != 0) {
+			copy_value(mL, L, -2, depth + 1);
+			copy_value(mL, L, -1, depth + 1);
+			lua_rawset(mL, -3);
+			lua_pop(L, 1);
+		}
+		break;
+	}
+	default:
+		luaL_error(mL, "Invalid type [%s]", lua_typename(L, lua_type(L, idx)));
+		break;
+	}
+}
+
+static int
+load_box(lua_State *mL) {
+	lua_State *L = (lua_State *)lua_touserdata(mL, 1);
+	lua_settop(mL, 0);
+	lua_newtable(mL);	// BOX_VISITED
+	copy_value(mL, L, 1, 0);	// BOX_COPY
+	lua_pushnil(mL);
+	lua_replace(mL, BOX_VISITED);
+	lua_gc(mL, LUA_GCCOLLECT, 0);
+	lua_pushcfunction(mL, make_matrix);
+	lua_pushvalue(mL, BOX_COPY);
+	lua_call(mL, 1, 0);
+	return 1;
+}
+
+static struct sharebox **
+new_boxud(lua_State *L, struct sharebox *box) {
+	struct sharebox **ud = (struct sharebox **)lua_newuserdatauv(L, sizeof(*ud), 0);
+	*ud = box;
+	luaL_setmetatable(L, "SHAREBOX");
+	return ud;
+}
+
+static struct sharebox *
+check_box(lua_State *L, int idx) {
+	struct sharebox **ud = (struct sharebox **)luaL_checkudata(L, idx, "SHAREBOX");
+	if (*ud == NULL) {
+		luaL_error(L, "The sharebox is closed");
+	}
+	return *ud;
+}
+
+/*
+	table
+	return userdata sharebox
+ */
+static int
+lbox_new(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_settop(L, 1);
+	lua_State *mL = luaL_newstate();
+	if (mL == NULL) {
+		return luaL_error(L, "luaL_newstate failed");
+	}
+	lua_pushcfunction(mL, load_box);
+	lua_pushlightuserdata(mL, L);
+	if (lua_pcall(mL, 1, 1, 0) != LUA_OK) {
+		lua_pushstring(L, lua_tostring(mL, -1));
+		lua_close(mL);
+		return lua_error(L);
+	}
+	struct sharebox * box = skynet_malloc(sizeof(*box));
+	ATOM_INIT(&box->ref, 1);
+	ATOM_FINC(&BOX_LIVE);
+	box->L = mL;
+	box->size = (size_t)lua_gc(mL, LUA_GCCOUNT, 0) * 1024 + lua_gc(mL, LUA_GCCOUNTB, 0);
+	new_boxud(L, box);
+	return 1;
+}
+
+static int
+lbox_gc(lua_State *L) {
+	struct sharebox **ud = (struct sharebox **)luaL_checkudata(L, 1, "SHAREBOX");
+	if (*ud) {
+		box_unref(*ud);
+		*ud = NULL;
+	}
+	return 0;
+}
+
+/*
+	userdata sharebox
+	return table (shared, read only)
+	The shared table is never collected by L, it doesn't keep the box alive. See lualib/skynet/sharebox.lua
+ */
+static int
+lbox_value(lua_State *L) {
+	struct sharebox * box = check_box(L, 1);
+	lua_clonetable(L, lua_topointer(box->L, BOX_ROOT));
+	return 1;
+}
+
+static int
+lbox_live(lua_State *L) {
+	lua_pushinteger(L, ATOM_LOAD(&BOX_LIVE));
+	return 1;
+}
+
+static int
+lbox_size(lua_State *L) {
+	struct sharebox * box = check_box(L, 1);
+	lua_pushinteger(L, (lua_Integer)box->size);
+	return 1;
+}
+
+/*
+	userdata sharebox
+	return lightuserdata msg, integer sz
+	The message holds a reference of the box.
+ */
+static int
+lbox_pack(lua_State *L) {
+	struct sharebox * box = check_box(L, 1);
+	ATOM_FINC(&box->ref);
+	struct sharebox ** msg = skynet_malloc(sizeof(*msg));
+	*msg = box;
+	lua_pushlightuserdata(L, msg);
+	lua_pushinteger(L, sizeof(*msg));
+	return 2;
+}
+
+/*
+	lightuserdata msg, integer sz
+	return userdata sharebox
+	Add a reference for the userdata, the message's reference is released with the message by framework.
+ */
+static int
+lbox_unpack(lua_State *L) {
+	struct sharebox ** msg = (struct sharebox **)lua_touserdata(L, 1);
+	if (msg == NULL || luaL_checkinteger(L, 2) != sizeof(*msg)) {
+		return luaL_error(L, "Invalid sharebox message");
+	}
+	ATOM_FINC(&(*msg)->ref);
+	new_boxud(L, *msg);
+	return 1;
+}
+
+// registered for PTYPE_RESERVED_SHAREBOX, called when the message is freed or dropped by framework
+static void
+box_release(void *ptr) {
+	struct sharebox ** msg = (struct sharebox **)ptr;
+	box_unref(*msg);
+	skynet_free(msg);
+}
+
 LUAMOD_API int
 luaopen_skynet_sharetable_core(lua_State *L) {
 	luaL_checkversion(L);
@@ -248,8 +478,20 @@ luaopen_skynet_sharetable_core(lua_State *L) {
 		{ "stackvalues", lco_stackvalues }, 
 		{ "matrix", matrix_from_file },
 		{ "is_sharedtable", lis_sharedtable },
+		{ "box", lbox_new },
+		{ "boxvalue", lbox_value },
+		{ "boxlive", lbox_live },
+		{ "boxsize", lbox_size },
+		{ "boxpack", lbox_pack },
+		{ "boxunpack", lbox_unpack },
 		{ NULL, NULL },
 	};
+	if (luaL_newmetatable(L, "SHAREBOX")) {
+		lua_pushcfunction(L, lbox_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_pop(L, 1);
+	skynet_message_release(PTYPE_RESERVED_SHAREBOX, box_release);
 	luaL_newlib(L, l);
 	return 1;
 }
@@ -142,7 +142,8 @@ lcallback(lua_State *L) {
 	// lua层消息回调函数设置到新的luastate中
 	lua_xmove(L, cb_ctx->L, 1);
 
-	// 注册
+	// 注册，非转发模式下消息总是由框架释放，可以原地派发 skynet_sendmulti 的共享数据
+	skynet_callback_noreserve(context, !forward);
 	skynet_callback(context, cb_ctx, (forward)?(_forward_pre):(_cb_pre));
 	return 0;
 }
@@ -328,6 +329,63 @@ lsend(lua_State *L) {
 	return send_message(L, 0, 2);
 }
 
+#define SENDMULTI_STACK 256
+
+/*
+	table addresses (array of uint32)
+	integer type
+	string message
+	 lightuserdata message_ptr
+	 integer len
+
+	return integer (number of messages sent)
+ */
+static int
+lsendmulti(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int type = luaL_checkinteger(L, 2);
+	const void * msg = NULL;
+	size_t sz = 0;
+	int mtype = lua_type(L, 3);
+	switch (mtype) {
+	case LUA_TSTRING:
+		msg = lua_tolstring(L, 3, &sz);
+		break;
+	case LUA_TLIGHTUSERDATA:
+		msg = lua_touserdata(L, 3);
+		sz = luaL_checkinteger(L, 4);
+		break;
+	default:
+		return luaL_error(L, "invalid param %s", lua_typename(L, mtype));
+	}
+	int n = (int)lua_rawlen(L, 1);
+	uint32_t tmp[SENDMULTI_STACK];
+	uint32_t * dest = tmp;
+	if (n > SENDMULTI_STACK) {
+		dest = (uint32_t *)lua_newuserdatauv(L, n * sizeof(uint32_t), 0);
+	}
+	int i;
+	for (i=0;i<n;i++) {
+		lua_rawgeti(L, 1, i+1);
+		int isnum;
+		dest[i] = (uint32_t)lua_tointegerx(L, -1, &isnum);
+		lua_pop(L, 1);
+		if (!isnum) {
+			if (mtype == LUA_TLIGHTUSERDATA) {
+				skynet_free((void *)msg);
+			}
+			return luaL_error(L, "Invalid address at index %d", i+1);
+		}
+	}
+	int sent = skynet_sendmulti(context, 0, dest, n, type, 0, msg, sz);
+	if (mtype == LUA_TLIGHTUSERDATA) {
+		skynet_free((void *)msg);
+	}
+	lua_pushinteger(L, sent);
+	return 1;
+}
+
 /*
 	uint32 address
 	 string address
@@ -509,6 +567,7 @@ luaopen_skynet_core(lua_State *L) {
 
 	luaL_Reg l[] = {
 		{ "send" , lsend },
+		{ "sendmulti", lsendmulti },
 		{ "genid", lgenid },
 		{ "redirect", lredirect },
 		// 执行对应服务的命令
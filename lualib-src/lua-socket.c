@@ -635,6 +635,19 @@ lnodelay(lua_State *L) {
 	return 0;
 }
 
+static int
+lredirect(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	uint32_t target = (uint32_t)luaL_checkinteger(L, 2);
+	int header = luaL_optinteger(L, 3, 2);
+	if (header != 2 && header != 4) {
+		return luaL_error(L, "Invalid header size %d", header);
+	}
+	skynet_socket_redirect(ctx, id, target, header);
+	return 0;
+}
+
 static int
 ludp(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -885,6 +898,7 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "start", lstart },
 		{ "pause", lpause },
 		{ "nodelay", lnodelay },
+		{ "redirect", lredirect },
 		{ "udp", ludp },
 		{ "udp_connect", ludp_connect },
 		{ "udp_dial", ludp_dial},
@@ -234,6 +234,644 @@ lread(lua_State *L) {
 	}
 }
 
+/*
+	Multi-version snapshot : the variant of stm for the readers which access a few fields.
+
+	The value is the serialized message of lua-seri (skynet.pack), the writer builds an index of the
+	fields of the first value (if it's a table) when it publishes a version, and the readers read the
+	fields in place instead of unpacking the whole message.
+
+	The reader pins the version it reads by a hazard slot, and moves to the latest version by refresh.
+	The writer swaps the current version without lock, the replaced versions are retired and freed
+	when no hazard slot points to them (checked by the writer and the readers moving on).
+ */
+
+// the format of lua-seri.c
+#define SERI_NIL 0
+#define SERI_BOOLEAN 1
+#define SERI_NUMBER 2
+#define SERI_NUMBER_ZERO 0
+#define SERI_NUMBER_BYTE 1
+#define SERI_NUMBER_WORD 2
+#define SERI_NUMBER_DWORD 4
+#define SERI_NUMBER_QWORD 6
+#define SERI_NUMBER_REAL 8
+#define SERI_USERDATA 3
+#define SERI_SHORT_STRING 4
+#define SERI_LONG_STRING 5
+#define SERI_TABLE 6
+#define SERI_MAX_COOKIE 32
+#define SERI_MAX_DEPTH 32
+
+#define FIELD_EMPTY 0
+#define FIELD_INTEGER 1
+#define FIELD_STRING 2
+
+struct seri_value {
+	int type;
+	int cookie;
+	lua_Integer i;	// integer or boolean
+	double r;
+	const char * str;
+	int len;
+};
+
+struct snapshot_field {
+	int keytype;
+	uint32_t keyhash;
+	lua_Integer key;	// integer key, or offset of the string key
+	int keysz;
+	int offset;	// the serialized value
+	int sz;
+};
+
+struct snapshot_version {
+	struct snapshot_version * next;	// in the retired list
+	void * msg;
+	int sz;
+	int cap;	// size of field, power of 2 (or 0 if the value is not a table)
+	struct snapshot_field * field;
+};
+
+struct snapshot_hazard {
+	struct snapshot_hazard * next;
+	ATOM_INT active;
+	ATOM_POINTER version;	// the version in use by the reader
+};
+
+struct snapshot_object {
+	ATOM_INT reference;	// writer and readers
+	ATOM_INT reclaiming;
+	ATOM_INT nversion;
+	ATOM_POINTER current;	// struct snapshot_version *
+	ATOM_POINTER retired;
+	ATOM_POINTER hazard;	// struct snapshot_hazard list, the slots are reused
+};
+
+static int
+seri_integer(const uint8_t *buf, int sz, int pos, int cookie, lua_Integer *v) {
+	switch (cookie) {
+	case SERI_NUMBER_ZERO:
+		*v = 0;
+		return pos;
+	case SERI_NUMBER_BYTE:
+		if (pos + 1 > sz)
+			return -1;
+		*v = buf[pos];
+		return pos + 1;
+	case SERI_NUMBER_WORD: {
+		uint16_t n;
+		if (pos + 2 > sz)
+			return -1;
+		memcpy(&n, buf + pos, sizeof(n));
+		*v = n;
+		return pos + 2;
+	}
+	case SERI_NUMBER_DWORD: {
+		int32_t n;
+		if (pos + 4 > sz)
+			return -1;
+		memcpy(&n, buf + pos, sizeof(n));
+		*v = n;
+		return pos + 4;
+	}
+	case SERI_NUMBER_QWORD: {
+		int64_t n;
+		if (pos + 8 > sz)
+			return -1;
+		memcpy(&n, buf + pos, sizeof(n));
+		*v = n;
+		return pos + 8;
+	}
+	default:
+		return -1;
+	}
+}
+
+static int
+seri_arraysize(const uint8_t *buf, int sz, int pos, int cookie, lua_Integer *n) {
+	if (cookie != SERI_MAX_COOKIE-1) {
+		*n = cookie;
+		return pos;
+	}
+	if (pos >= sz)
+		return -1;
+	int type = buf[pos] & 7;
+	cookie = buf[pos] >> 3;
+	if (type != SERI_NUMBER || cookie == SERI_NUMBER_REAL)
+		return -1;
+	pos = seri_integer(buf, sz, pos + 1, cookie, n);
+	if (pos >= 0 && *n < 0)
+		return -1;
+	return pos;
+}
+
+// read a value at pos, return the position after it (or -1 if the stream is invalid)
+static int
+seri_value(const uint8_t *buf, int sz, int pos, int depth, struct seri_value *v) {
+	if (pos >= sz || depth > SERI_MAX_DEPTH)
+		return -1;
+	v->type = buf[pos] & 7;
+	v->cookie = buf[pos] >> 3;
+	++pos;
+	switch (v->type) {
+	case SERI_NIL:
+		return pos;
+	case SERI_BOOLEAN:
+		v->i = v->cookie;
+		return pos;
+	case SERI_NUMBER:
+		if (v->cookie == SERI_NUMBER_REAL) {
+			if (pos + 8 > sz)
+				return -1;
+			memcpy(&v->r, buf + pos, sizeof(v->r));
+			return pos + 8;
+		}
+		return seri_integer(buf, sz, pos, v->cookie, &v->i);
+	case SERI_USERDATA:
+		if (pos + (int)sizeof(void *) > sz)
+			return -1;
+		return pos + sizeof(void *);
+	case SERI_SHORT_STRING:
+		v->len = v->cookie;
+		break;
+	case SERI_LONG_STRING:
+		if (v->cookie == 2) {
+			uint16_t n;
+			if (pos + 2 > sz)
+				return -1;
+			memcpy(&n, buf + pos, sizeof(n));
+			v->len = n;
+			pos += 2;
+		} else if (v->cookie == 4) {
+			uint32_t n;
+			if (pos + 4 > sz)
+				return -1;
+			memcpy(&n, buf + pos, sizeof(n));
+			if (n > (uint32_t)(sz - pos - 4))
+				return -1;
+			v->len = (int)n;
+			pos += 4;
+		} else {
+			return -1;
+		}
+		break;
+	case SERI_TABLE: {
+		lua_Integer n, i;
+		struct seri_value tmp;
+		pos = seri_arraysize(buf, sz, pos, v->cookie, &n);
+		for (i=0;i<n && pos >= 0;i++) {
+			pos = seri_value(buf, sz, pos, depth + 1, &tmp);
+		}
+		while (pos >= 0) {
+			pos = seri_value(buf, sz, pos, depth + 1, &tmp);
+			if (pos < 0 || tmp.type == SERI_NIL)
+				break;
+			pos = seri_value(buf, sz, pos, depth + 1, &tmp);
+		}
+		return pos;
+	}
+	default:
+		return -1;
+	}
+	if (v->len > sz - pos)
+		return -1;
+	v->str = (const char *)buf + pos;
+	return pos + v->len;
+}
+
+static inline uint32_t
+snapshot_strhash(const char *str, size_t sz) {
+	uint32_t h = 2166136261u;
+	size_t i;
+	for (i=0;i<sz;i++) {
+		h = (h ^ (uint8_t)str[i]) * 16777619u;
+	}
+	return h;
+}
+
+static inline uint32_t
+snapshot_inthash(lua_Integer key) {
+	uint64_t k = (uint64_t)key;
+	return (uint32_t)(k ^ (k >> 32)) * 2654435761u;
+}
+
+static struct snapshot_field *
+snapshot_find(struct snapshot_version *v, int keytype, uint32_t keyhash, lua_Integer key, const char *str, size_t sz) {
+	if (v->cap == 0)
+		return NULL;
+	int mask = v->cap - 1;
+	int i = keyhash & mask;
+	for (;;) {
+		struct snapshot_field * f = &v->field[i];
+		if (f->keytype == FIELD_EMPTY)
+			return NULL;
+		if (f->keytype == keytype && f->keyhash == keyhash) {
+			if (keytype == FIELD_INTEGER) {
+				if (f->key == key)
+					return f;
+			} else if (f->keysz == (int)sz && memcmp((const char *)v->msg + f->key, str, sz) == 0) {
+				return f;
+			}
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+static void
+snapshot_insert(struct snapshot_version *v, int keytype, lua_Integer key, int keysz, int offset, int sz) {
+	uint32_t keyhash;
+	if (keytype == FIELD_INTEGER) {
+		keyhash = snapshot_inthash(key);
+	} else {
+		keyhash = snapshot_strhash((const char *)v->msg + key, keysz);
+	}
+	struct snapshot_field * f = snapshot_find(v, keytype, keyhash, key, (const char *)v->msg + key, keysz);
+	if (f == NULL) {
+		int i = keyhash & (v->cap - 1);
+		while (v->field[i].keytype != FIELD_EMPTY) {
+			i = (i + 1) & (v->cap - 1);
+		}
+		f = &v->field[i];
+	}
+	f->keytype = keytype;
+	f->keyhash = keyhash;
+	f->key = key;
+	f->keysz = keysz;
+	f->offset = offset;
+	f->sz = sz;
+}
+
+// index the fields of the first value, return 0 if the value is not a table or the stream is invalid
+static int
+snapshot_index(struct snapshot_version *v, int scan) {
+	const uint8_t * buf = v->msg;
+	int sz = v->sz;
+	int pos = 0;
+	int n = 0;
+	lua_Integer array, i;
+	struct seri_value key, value;
+	if (sz == 0 || (buf[0] & 7) != SERI_TABLE)
+		return 0;
+	pos = seri_arraysize(buf, sz, 1, buf[0] >> 3, &array);
+	for (i=1;i<=array && pos >= 0;i++) {
+		int offset = pos;
+		pos = seri_value(buf, sz, pos, 1, &value);
+		if (pos >= 0 && !scan)
+			snapshot_insert(v, FIELD_INTEGER, i, 0, offset, pos - offset);
+		++n;
+	}
+	while (pos >= 0) {
+		pos = seri_value(buf, sz, pos, 1, &key);
+		if (pos < 0 || key.type == SERI_NIL)
+			break;
+		int offset = pos;
+		pos = seri_value(buf, sz, pos, 1, &value);
+		if (pos < 0)
+			break;
+		if (key.type == SERI_NUMBER && key.cookie != SERI_NUMBER_REAL) {
+			if (!scan)
+				snapshot_insert(v, FIELD_INTEGER, key.i, 0, offset, pos - offset);
+			++n;
+		} else if (key.type == SERI_SHORT_STRING || key.type == SERI_LONG_STRING) {
+			if (!scan)
+				snapshot_insert(v, FIELD_STRING, (const uint8_t *)key.str - buf, key.len, offset, pos - offset);
+			++n;
+		}
+	}
+	return pos < 0 ? 0 : n;
+}
+
+// msg should alloc by skynet_malloc
+static struct snapshot_version *
+snapshot_newversion(void * msg, int sz) {
+	struct snapshot_version * v = skynet_malloc(sizeof(*v));
+	v->next = NULL;
+	v->msg = msg;
+	v->sz = sz;
+	v->cap = 0;
+	v->field = NULL;
+	int n = snapshot_index(v, 1);
+	if (n > 0) {
+		int cap = 4;
+		while (cap < n * 2) {
+			cap *= 2;
+		}
+		v->cap = cap;
+		v->field = skynet_malloc(cap * sizeof(struct snapshot_field));
+		memset(v->field, 0, cap * sizeof(struct snapshot_field));
+		snapshot_index(v, 0);
+	}
+	return v;
+}
+
+static void
+snapshot_freeversion(struct snapshot_object *obj, struct snapshot_version *v) {
+	ATOM_FDEC(&obj->nversion);
+	skynet_free(v->msg);
+	skynet_free(v->field);
+	skynet_free(v);
+}
+
+static int
+snapshot_inuse(struct snapshot_object *obj, struct snapshot_version *v) {
+	struct snapshot_hazard * h = (struct snapshot_hazard *)ATOM_LOAD(&obj->hazard);
+	for (;h;h=h->next) {
+		if ((struct snapshot_version *)ATOM_LOAD(&h->version) == v)
+			return 1;
+	}
+	return 0;
+}
+
+static void
+snapshot_retire(struct snapshot_object *obj, struct snapshot_version *list, struct snapshot_version *tail) {
+	for (;;) {
+		uintptr_t head = ATOM_LOAD(&obj->retired);
+		tail->next = (struct snapshot_version *)head;
+		if (ATOM_CAS_POINTER(&obj->retired, head, (uintptr_t)list))
+			break;
+	}
+}
+
+// free the retired versions which are not in use, skip if another thread is doing it
+static void
+snapshot_reclaim(struct snapshot_object *obj) {
+	if (ATOM_LOAD(&obj->retired) == 0 || !ATOM_CAS(&obj->reclaiming, 0, 1))
+		return;
+	uintptr_t head;
+	do {
+		head = ATOM_LOAD(&obj->retired);
+	} while (!ATOM_CAS_POINTER(&obj->retired, head, 0));
+	struct snapshot_version * v = (struct snapshot_version *)head;
+	struct snapshot_version * keep = NULL;
+	struct snapshot_version * tail = NULL;
+	while (v) {
+		struct snapshot_version * next = v->next;
+		if (snapshot_inuse(obj, v)) {
+			v->next = keep;
+			keep = v;
+			if (tail == NULL)
+				tail = v;
+		} else {
+			snapshot_freeversion(obj, v);
+		}
+		v = next;
+	}
+	if (keep) {
+		snapshot_retire(obj, keep, tail);
+	}
+	ATOM_STORE(&obj->reclaiming, 0);
+}
+
+static struct snapshot_object *
+snapshot_new(void * msg, int sz) {
+	struct snapshot_object * obj = skynet_malloc(sizeof(*obj));
+	ATOM_INIT(&obj->reference, 1);
+	ATOM_INIT(&obj->reclaiming, 0);
+	ATOM_INIT(&obj->nversion, 1);
+	ATOM_INIT(&obj->current, (uintptr_t)snapshot_newversion(msg, sz));
+	ATOM_INIT(&obj->retired, 0);
+	ATOM_INIT(&obj->hazard, 0);
+	return obj;
+}
+
+// only one writer, so the current version doesn't need CAS
+static void
+snapshot_update(struct snapshot_object *obj, void *msg, int sz) {
+	struct snapshot_version * v = snapshot_newversion(msg, sz);
+	ATOM_FINC(&obj->nversion);
+	struct snapshot_version * old = (struct snapshot_version *)ATOM_LOAD(&obj->current);
+	ATOM_STORE(&obj->current, (uintptr_t)v);
+	snapshot_retire(obj, old, old);
+	snapshot_reclaim(obj);
+}
+
+static void
+snapshot_release(struct snapshot_object *obj) {
+	if (ATOM_FDEC(&obj->reference) > 1)
+		return;
+	// the last one, no other thread can access it
+	struct snapshot_version * v = (struct snapshot_version *)ATOM_LOAD(&obj->retired);
+	while (v) {
+		struct snapshot_version * next = v->next;
+		snapshot_freeversion(obj, v);
+		v = next;
+	}
+	snapshot_freeversion(obj, (struct snapshot_version *)ATOM_LOAD(&obj->current));
+	struct snapshot_hazard * h = (struct snapshot_hazard *)ATOM_LOAD(&obj->hazard);
+	while (h) {
+		struct snapshot_hazard * next = h->next;
+		skynet_free(h);
+		h = next;
+	}
+	skynet_free(obj);
+}
+
+static struct snapshot_hazard *
+snapshot_newhazard(struct snapshot_object *obj) {
+	struct snapshot_hazard * h = (struct snapshot_hazard *)ATOM_LOAD(&obj->hazard);
+	for (;h;h=h->next) {
+		if (ATOM_LOAD(&h->active) == 0 && ATOM_CAS(&h->active, 0, 1))
+			return h;
+	}
+	h = skynet_malloc(sizeof(*h));
+	ATOM_INIT(&h->active, 1);
+	ATOM_INIT(&h->version, 0);
+	for (;;) {
+		uintptr_t head = ATOM_LOAD(&obj->hazard);
+		h->next = (struct snapshot_hazard *)head;
+		if (ATOM_CAS_POINTER(&obj->hazard, head, (uintptr_t)h))
+			return h;
+	}
+}
+
+// pin the current version by the hazard slot
+static struct snapshot_version *
+snapshot_acquire(struct snapshot_object *obj, struct snapshot_hazard *h) {
+	for (;;) {
+		uintptr_t v = ATOM_LOAD(&obj->current);
+		ATOM_STORE(&h->version, v);
+		if (ATOM_LOAD(&obj->current) == v)
+			return (struct snapshot_version *)v;
+	}
+}
+
+// lua binding
+
+struct boxsnapshot {
+	struct snapshot_object * obj;
+};
+
+static void *
+getmsg(lua_State *L, int index, size_t *sz) {
+	void * msg;
+	if (lua_isuserdata(L, index)) {
+		msg = lua_touserdata(L, index);
+		*sz = (size_t)luaL_checkinteger(L, index+1);
+	} else {
+		const char * tmp = luaL_checklstring(L, index, sz);
+		msg = skynet_malloc(*sz);
+		memcpy(msg, tmp, *sz);
+	}
+	if (*sz > INT32_MAX) {
+		skynet_free(msg);
+		luaL_error(L, "Too large message");
+	}
+	return msg;
+}
+
+static int
+lnewsnapshot(lua_State *L) {
+	size_t sz;
+	void * msg = getmsg(L, 1, &sz);
+	struct boxsnapshot * box = lua_newuserdatauv(L, sizeof(*box), 0);
+	box->obj = snapshot_new(msg, (int)sz);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+static int
+ldeletesnapshot(lua_State *L) {
+	struct boxsnapshot * box = lua_touserdata(L, 1);
+	snapshot_release(box->obj);
+	box->obj = NULL;
+
+	return 0;
+}
+
+static int
+lupdatesnapshot(lua_State *L) {
+	struct boxsnapshot * box = lua_touserdata(L, 1);
+	size_t sz;
+	void * msg = getmsg(L, 2, &sz);
+	snapshot_update(box->obj, msg, (int)sz);
+
+	return 0;
+}
+
+static int
+lcopysnapshot(lua_State *L) {
+	struct boxsnapshot * box = luaL_checkudata(L, 1, "STMSNAPSHOT");
+	ATOM_FINC(&box->obj->reference);
+	lua_pushlightuserdata(L, box->obj);
+	return 1;
+}
+
+// return the number of the alive versions (current and retired)
+static int
+lsnapshotversion(lua_State *L) {
+	struct boxsnapshot * box = luaL_checkudata(L, 1, "STMSNAPSHOT");
+	lua_pushinteger(L, ATOM_LOAD(&box->obj->nversion));
+	return 1;
+}
+
+struct boxsnapshotreader {
+	struct snapshot_object * obj;
+	struct snapshot_hazard * hazard;
+	struct snapshot_version * version;
+};
+
+/*
+	lightuserdata (from stm.copysnapshot)
+	function unpack (for the fields of table)
+ */
+static int
+lnewsnapshotreader(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	struct boxsnapshotreader * box = lua_newuserdatauv(L, sizeof(*box), 1);
+	box->obj = lua_touserdata(L, 1);
+	box->hazard = snapshot_newhazard(box->obj);
+	box->version = snapshot_acquire(box->obj, box->hazard);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_setmetatable(L, -2);
+	lua_pushvalue(L, 2);
+	lua_setiuservalue(L, -2, 1);
+
+	return 1;
+}
+
+static int
+ldeletesnapshotreader(lua_State *L) {
+	struct boxsnapshotreader * box = lua_touserdata(L, 1);
+	struct snapshot_object * obj = box->obj;
+	ATOM_STORE(&box->hazard->version, 0);
+	ATOM_STORE(&box->hazard->active, 0);
+	snapshot_reclaim(obj);
+	snapshot_release(obj);
+	box->obj = NULL;
+
+	return 0;
+}
+
+// move to the latest version, return true if changed
+static int
+lrefresh(lua_State *L) {
+	struct boxsnapshotreader * box = lua_touserdata(L, 1);
+	struct snapshot_object * obj = box->obj;
+	if ((struct snapshot_version *)ATOM_LOAD(&obj->current) == box->version) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	box->version = snapshot_acquire(obj, box->hazard);
+	// the last reader of the old version frees it
+	snapshot_reclaim(obj);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+// read the field of the pinned version, only the table is unpacked by the unpack function
+static int
+lfield(lua_State *L) {
+	struct boxsnapshotreader * box = lua_touserdata(L, 1);
+	struct snapshot_version * v = box->version;
+	struct snapshot_field * f;
+	int kt = lua_type(L, 2);
+	if (kt == LUA_TSTRING) {
+		size_t sz;
+		const char * str = lua_tolstring(L, 2, &sz);
+		f = snapshot_find(v, FIELD_STRING, snapshot_strhash(str, sz), 0, str, sz);
+	} else if (kt == LUA_TNUMBER && lua_isinteger(L, 2)) {
+		lua_Integer key = lua_tointeger(L, 2);
+		f = snapshot_find(v, FIELD_INTEGER, snapshot_inthash(key), key, NULL, 0);
+	} else {
+		return 0;
+	}
+	if (f == NULL)
+		return 0;
+	const uint8_t * buf = (const uint8_t *)v->msg + f->offset;
+	struct seri_value value;
+	int type = buf[0] & 7;
+	if (type == SERI_TABLE || type == SERI_USERDATA) {
+		lua_getiuservalue(L, 1, 1);
+		lua_pushlightuserdata(L, (void *)buf);
+		lua_pushinteger(L, f->sz);
+		lua_call(L, 2, 1);
+		return 1;
+	}
+	seri_value(buf, f->sz, 0, 1, &value);
+	switch (value.type) {
+	case SERI_BOOLEAN:
+		lua_pushboolean(L, (int)value.i);
+		return 1;
+	case SERI_NUMBER:
+		if (value.cookie == SERI_NUMBER_REAL) {
+			lua_pushnumber(L, value.r);
+		} else {
+			lua_pushinteger(L, value.i);
+		}
+		return 1;
+	case SERI_SHORT_STRING:
+	case SERI_LONG_STRING:
+		lua_pushlstring(L, value.str, value.len);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 LUAMOD_API int
 luaopen_skynet_stm(lua_State *L) {
 	luaL_checkversion(L);
@@ -264,5 +902,34 @@ luaopen_skynet_stm(lua_State *L) {
 	lua_setfield(L, -2, "__call");
 	luaL_setfuncs(L, reader, 1);
 
+	luaL_Reg snapshot[] = {
+		{ "newsnapshot", lnewsnapshot },
+		{ NULL, NULL },
+	};
+	luaL_newmetatable(L, "STMSNAPSHOT");
+	lua_pushcfunction(L, ldeletesnapshot),
+	lua_setfield(L, -2, "__gc");
+	lua_pushcfunction(L, lupdatesnapshot),
+	lua_setfield(L, -2, "__call");
+	luaL_setfuncs(L, snapshot, 1);
+
+	lua_pushcfunction(L, lcopysnapshot);
+	lua_setfield(L, -2, "copysnapshot");
+	lua_pushcfunction(L, lsnapshotversion);
+	lua_setfield(L, -2, "snapshotversion");
+
+	luaL_Reg snapshotreader[] = {
+		{ "newsnapshotcopy", lnewsnapshotreader },
+		{ NULL, NULL },
+	};
+	lua_createtable(L, 0, 3);
+	lua_pushcfunction(L, ldeletesnapshotreader),
+	lua_setfield(L, -2, "__gc");
+	lua_pushcfunction(L, lrefresh),
+	lua_setfield(L, -2, "__call");
+	lua_pushcfunction(L, lfield),
+	lua_setfield(L, -2, "__index");
+	luaL_setfuncs(L, snapshotreader, 1);
+
 	return 1;
 }
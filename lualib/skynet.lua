@@ -18,9 +18,17 @@ local traceback = debug.traceback
 local cresume = coroutine.resume
 local running_thread = nil
 local init_thread = nil
+local profile_thread = nil	-- set by skynet.profile_dispatch, co -> the handler profile
+local profile_stop
 
 local function coroutine_resume(co, ...)
 	running_thread = co
+	if profile_thread then
+		local p = profile_thread[co]
+		if p then
+			return profile_stop(co, p, c.hpc(), cresume(co, ...))
+		end
+	end
 	return cresume(co, ...)
 end
 local coroutine_yield = coroutine.yield
@@ -42,6 +50,8 @@ local skynet = {
 	PTYPE_LUA = 10,
 	PTYPE_SNAX = 11,
 	PTYPE_TRACE = 12,	-- use for debug trace
+	PTYPE_SHAREBOX = 13,	-- immutable table shared in process, see skynet.sharebox
+	PTYPE_STREAM = 14,	-- chunked transfer with flow control, see skynet.stream
 }
 
 -- code cache
@@ -58,9 +68,12 @@ function skynet.register_protocol(class)
 end
 
 local session_id_coroutine = {}
-local session_coroutine_id = {}
-local session_coroutine_address = {}
-local session_coroutine_tracetag = {}
+-- coroutine -> { session, address, tracetag }, the record is reused with the coroutine in coroutine_pool
+local coroutine_record = setmetatable({}, { __mode = "k" })
+local CO_SESSION <const> = 1
+local CO_ADDRESS <const> = 2
+local CO_TRACETAG <const> = 3
+local norecord = {}	-- read only, for the coroutine not created by co_create
 local unresponse = {}
 
 local wakeup_queue = {}
@@ -201,7 +214,7 @@ do ---- request/select
 			local addr = req[1]
 			local p = proto[req[2]]
 			assert(p.unpack)
-			local tag = session_coroutine_tracetag[running_thread]
+			local tag = (coroutine_record[running_thread] or norecord)[CO_TRACETAG]
 			if tag then
 				c.trace(tag, "call", 4)
 				c.send(addr, skynet.PTYPE_TRACE, 0, tag)
@@ -366,43 +379,59 @@ end
 
 -- coroutine reuse
 
-local coroutine_pool = setmetatable({}, { __mode = "kv" })
+local coroutine_pool = {}
+local coroutine_pool_max = 64
+local coroutine_pool_hit = 0
+local coroutine_pool_miss = 0
 
 local function co_create(f)
 	local co = tremove(coroutine_pool)
 	if co == nil then
+		coroutine_pool_miss = coroutine_pool_miss + 1
+		local record = { nil, nil, nil }
 		co = coroutine_create(function(...)
 			f(...)
 			while true do
-				local session = session_coroutine_id[co]
+				if profile_thread then
+					-- the handler is finished, profile_stop records it after this resume
+					local p = profile_thread[co]
+					if p then
+						p.done = true
+					end
+				end
+				local session = record[CO_SESSION]
 				if session and session ~= 0 then
 					local source = debug.getinfo(f,"S")
 					skynet.error(string.format("Maybe forgot response session %s from %s : %s:%d",
 						session,
-						skynet.address(session_coroutine_address[co]),
+						skynet.address(record[CO_ADDRESS]),
 						source.source, source.linedefined))
 				end
 				-- coroutine exit
-				local tag = session_coroutine_tracetag[co]
+				local tag = record[CO_TRACETAG]
 				if tag ~= nil then
 					if tag then c.trace(tag, "end")	end
-					session_coroutine_tracetag[co] = nil
-				end
-				local address = session_coroutine_address[co]
-				if address then
-					session_coroutine_id[co] = nil
-					session_coroutine_address[co] = nil
+					record[CO_TRACETAG] = nil
 				end
+				record[CO_SESSION] = nil
+				record[CO_ADDRESS] = nil
 
-				-- recycle co into pool
 				f = nil
+				if #coroutine_pool >= coroutine_pool_max then
+					-- pool is full, let co die
+					coroutine_record[co] = nil
+					return "SUSPEND"
+				end
+				-- recycle co into pool
 				coroutine_pool[#coroutine_pool+1] = co
 				-- recv new main function f
 				f = coroutine_yield "SUSPEND"
 				f(coroutine_yield())
 			end
 		end)
+		coroutine_record[co] = record
 	else
+		coroutine_pool_hit = coroutine_pool_hit + 1
 		-- pass the main function f to coroutine, and restore running thread
 		local running = running_thread
 		coroutine_resume(co, f)
@@ -418,7 +447,7 @@ local function dispatch_wakeup()
 			local session = sleep_session[token]
 			if session then
 				local co = session_id_coroutine[session]
-				local tag = session_coroutine_tracetag[co]
+				local tag = (coroutine_record[co] or norecord)[CO_TRACETAG]
 				if tag then c.trace(tag, "resume") end
 				session_id_coroutine[session] = "BREAK"
 				return suspend(co, coroutine_resume(co, false, "BREAK", nil, session))
@@ -433,19 +462,19 @@ end
 -- suspend is local function
 function suspend(co, result, command)
 	if not result then
-		local session = session_coroutine_id[co]
-		if session then -- coroutine may fork by others (session is nil)
-			local addr = session_coroutine_address[co]
-			if session ~= 0 then
-				-- only call response error
-				local tag = session_coroutine_tracetag[co]
-				if tag then c.trace(tag, "error") end
-				c.send(addr, skynet.PTYPE_ERROR, session, "")
+		local record = coroutine_record[co]
+		if record then
+			local session = record[CO_SESSION]
+			if session then -- coroutine may fork by others (session is nil)
+				if session ~= 0 then
+					-- only call response error
+					local tag = record[CO_TRACETAG]
+					if tag then c.trace(tag, "error") end
+					c.send(record[CO_ADDRESS], skynet.PTYPE_ERROR, session, "")
+				end
 			end
-			session_coroutine_id[co] = nil
+			coroutine_record[co] = nil
 		end
-		session_coroutine_address[co] = nil
-		session_coroutine_tracetag[co] = nil
 		skynet.fork(function() end)	-- trigger command "SUSPEND"
 		local tb = traceback(co,tostring(command))
 		coroutine.close(co)
@@ -503,7 +532,7 @@ function skynet.timeout(ti, func)
 end
 
 local function suspend_sleep(session, token)
-	local tag = session_coroutine_tracetag[running_thread]
+	local tag = (coroutine_record[running_thread] or norecord)[CO_TRACETAG]
 	if tag then c.trace(tag, "sleep", 2) end
 	session_id_coroutine[session] = running_thread
 	assert(sleep_session[token] == nil, "token duplicative")
@@ -572,15 +601,14 @@ function skynet.killthread(thread)
 	if co == nil then
 		return
 	end
-	local addr = session_coroutine_address[co]
-	if addr then
-		session_coroutine_address[co] = nil
-		session_coroutine_tracetag[co] = nil
-		local session = session_coroutine_id[co]
-		if session > 0 then
+	local record = coroutine_record[co]
+	if record then
+		local addr = record[CO_ADDRESS]
+		local session = record[CO_SESSION]
+		if addr and session and session > 0 then
 			c.send(addr, skynet.PTYPE_ERROR, session, "")
 		end
-		session_coroutine_id[co] = nil
+		coroutine_record[co] = nil
 	end
 	if watching_session[session] then
 		session_id_coroutine[session] = "BREAK"
@@ -611,15 +639,20 @@ skynet.hpc = c.hpc	-- high performance counter
 
 local traceid = 0
 function skynet.trace(info)
-	skynet.error("TRACE", session_coroutine_tracetag[running_thread])
-	if session_coroutine_tracetag[running_thread] == false then
+	local record = coroutine_record[running_thread]
+	if record == nil then
+		record = { nil, nil, nil }
+		coroutine_record[running_thread] = record
+	end
+	skynet.error("TRACE", record[CO_TRACETAG])
+	if record[CO_TRACETAG] == false then
 		-- force off trace log
 		return
 	end
 	traceid = traceid + 1
 
 	local tag = string.format(":%08x-%d",skynet.self(), traceid)
-	session_coroutine_tracetag[running_thread] = tag
+	record[CO_TRACETAG] = tag
 	if info then
 		c.trace(tag, "trace " .. info)
 	else
@@ -628,7 +661,7 @@ function skynet.trace(info)
 end
 
 function skynet.tracetag()
-	return session_coroutine_tracetag[running_thread]
+	return (coroutine_record[running_thread] or norecord)[CO_TRACETAG]
 end
 
 local starttime
@@ -648,9 +681,10 @@ function skynet.exit()
 	fork_queue = { h = 1, t = 0 }	-- no fork coroutine can be execute after skynet.exit
 	skynet.send(".launcher","lua","REMOVE",skynet.self(), false)
 	-- report the sources that call me
-	for co, session in pairs(session_coroutine_id) do
-		local address = session_coroutine_address[co]
-		if session~=0 and address then
+	for co, record in pairs(coroutine_record) do
+		local session = record[CO_SESSION]
+		local address = record[CO_ADDRESS]
+		if session and session~=0 and address then
 			c.send(address, skynet.PTYPE_ERROR, session, "")
 		end
 	end
@@ -699,6 +733,12 @@ function skynet.rawsend(addr, typename, msg, sz)
 	return c.send(addr, p.id, 0 , msg, sz)
 end
 
+-- 向 addresses (数组) 中的所有服务发送同一条消息，只打包复制一次，返回发出的消息数
+function skynet.sendmulti(addresses, typename, ...)
+	local p = proto[typename]
+	return c.sendmulti(addresses, p.id, p.pack(...))
+end
+
 skynet.genid = assert(c.genid)
 
 skynet.redirect = function(dest,source,typename,...)
@@ -723,7 +763,7 @@ local function yield_call(service, session)
 end
 
 function skynet.call(addr, typename, ...)
-	local tag = session_coroutine_tracetag[running_thread]
+	local tag = (coroutine_record[running_thread] or norecord)[CO_TRACETAG]
 	if tag then
 		c.trace(tag, "call", 2)
 		c.send(addr, skynet.PTYPE_TRACE, 0, tag)
@@ -738,7 +778,7 @@ function skynet.call(addr, typename, ...)
 end
 
 function skynet.rawcall(addr, typename, msg, sz)
-	local tag = session_coroutine_tracetag[running_thread]
+	local tag = (coroutine_record[running_thread] or norecord)[CO_TRACETAG]
 	if tag then
 		c.trace(tag, "call", 2)
 		c.send(addr, skynet.PTYPE_TRACE, 0, tag)
@@ -760,20 +800,21 @@ end
 
 function skynet.ret(msg, sz)
 	msg = msg or ""
-	local tag = session_coroutine_tracetag[running_thread]
+	local record = coroutine_record[running_thread] or norecord
+	local tag = record[CO_TRACETAG]
 	if tag then c.trace(tag, "response") end
-	local co_session = session_coroutine_id[running_thread]
+	local co_session = record[CO_SESSION]
 	if co_session == nil then
 		error "No session"
 	end
-	session_coroutine_id[running_thread] = nil
+	record[CO_SESSION] = nil
 	if co_session == 0 then
 		if sz ~= nil then
 			c.trash(msg, sz)
 		end
 		return false	-- send don't need ret
 	end
-	local co_address = session_coroutine_address[running_thread]
+	local co_address = record[CO_ADDRESS]
 	local ret = c.send(co_address, skynet.PTYPE_RESPONSE, co_session, msg, sz)
 	if ret then
 		return true
@@ -785,22 +826,25 @@ function skynet.ret(msg, sz)
 end
 
 function skynet.context()
-	local co_session = session_coroutine_id[running_thread]
-	local co_address = session_coroutine_address[running_thread]
-	return co_session, co_address
+	local record = coroutine_record[running_thread] or norecord
+	return record[CO_SESSION], record[CO_ADDRESS]
 end
 
 function skynet.ignoreret()
 	-- We use session for other uses
-	session_coroutine_id[running_thread] = nil
+	local record = coroutine_record[running_thread]
+	if record then
+		record[CO_SESSION] = nil
+	end
 end
 
 function skynet.response(pack)
 	pack = pack or skynet.pack
 
-	local co_session = assert(session_coroutine_id[running_thread], "no session")
-	session_coroutine_id[running_thread] = nil
-	local co_address = session_coroutine_address[running_thread]
+	local record = coroutine_record[running_thread] or norecord
+	local co_session = assert(record[CO_SESSION], "no session")
+	record[CO_SESSION] = nil
+	local co_address = record[CO_ADDRESS]
 	if co_session == 0 then
 		--  do not response when session == 0 (send)
 		return function() end
@@ -896,6 +940,85 @@ function skynet.fork(func,...)
 	return co
 end
 
+local dispatch_profile	-- set by skynet.profile_dispatch, name -> histogram
+local profile_resume
+
+do ---- dispatch profile
+	local hpc = c.hpc
+	local SLOTS <const> = 24	-- the same as HISTOGRAM_SLOTS in skynet-src/skynet_histogram.h
+	local NAME_MAX <const> = 256	-- the commands beyond it are counted in "protoname.other"
+	local name_count = 0
+
+	local function record(name, cmd, ti)
+		if cmd then
+			local fullname = name .. "." .. cmd
+			if dispatch_profile[fullname] == nil and name_count >= NAME_MAX then
+				fullname = name .. ".other"
+			end
+			name = fullname
+		end
+		local h = dispatch_profile[name]
+		if h == nil then
+			name_count = name_count + 1
+			h = { count = 0, total = 0, max = 0 }
+			for i = 1, SLOTS do
+				h[i] = 0
+			end
+			dispatch_profile[name] = h
+		end
+		h.count = h.count + 1
+		h.total = h.total + ti
+		if ti > h.max then
+			h.max = ti
+		end
+		-- h[1] : < 1us, h[i] : [2^(i+8), 2^(i+9)) nsec
+		local slot = 1
+		local v = ti >> 10
+		while v > 0 and slot < SLOTS do
+			slot = slot + 1
+			v = v >> 1
+		end
+		h[slot] = h[slot] + 1
+	end
+
+	-- the time of all the resumes until the handler returns (not include the time waiting for response)
+	function profile_stop(co, p, t, ok, ...)
+		p.time = p.time + hpc() - t
+		if p.done or not ok then
+			if profile_thread then
+				profile_thread[co] = nil
+			end
+			if dispatch_profile then
+				record(p.name, p.cmd, p.time)
+			end
+		end
+		return ok, ...
+	end
+
+	-- name is "protoname.command" for lua protocol
+	function profile_resume(name, co, session, source, ...)
+		local cmd = ...
+		profile_thread[co] = { name = name, cmd = type(cmd) == "string" and cmd or nil, time = 0 }
+		suspend(co, coroutine_resume(co, session, source, ...))
+	end
+
+	-- true: turn on, false: turn off and clear, returns the histograms (nsec)
+	function skynet.profile_dispatch(on)
+		if on then
+			if not dispatch_profile then
+				dispatch_profile = {}
+				-- weak keys, the handler may never finish
+				profile_thread = setmetatable({}, { __mode = "k" })
+				name_count = 0
+			end
+		elseif on == false then
+			dispatch_profile = nil
+			profile_thread = nil
+		end
+		return dispatch_profile
+	end
+end
+
 local trace_source = {}
 
 local function raw_dispatch_message(prototype, msg, sz, session, source)
@@ -907,7 +1030,7 @@ local function raw_dispatch_message(prototype, msg, sz, session, source)
 		elseif co == nil then
 			unknown_response(session, source, msg, sz)
 		else
-			local tag = session_coroutine_tracetag[co]
+			local tag = (coroutine_record[co] or norecord)[CO_TRACETAG]
 			if tag then c.trace(tag, "resume") end
 			session_id_coroutine[session] = nil
 			suspend(co, coroutine_resume(co, true, msg, sz, session))
@@ -929,26 +1052,31 @@ local function raw_dispatch_message(prototype, msg, sz, session, source)
 		local f = p.dispatch
 		if f then
 			local co = co_create(f)
-			session_coroutine_id[co] = session
-			session_coroutine_address[co] = source
+			local record = coroutine_record[co]
+			record[CO_SESSION] = session
+			record[CO_ADDRESS] = source
 			local traceflag = p.trace
 			if traceflag == false then
 				-- force off
 				trace_source[source] = nil
-				session_coroutine_tracetag[co] = false
+				record[CO_TRACETAG] = false
 			else
 				local tag = trace_source[source]
 				if tag then
 					trace_source[source] = nil
 					c.trace(tag, "request")
-					session_coroutine_tracetag[co] = tag
+					record[CO_TRACETAG] = tag
 				elseif traceflag then
 					-- set running_thread for trace
 					running_thread = co
 					skynet.trace()
 				end
 			end
-			suspend(co, coroutine_resume(co, session,source, p.unpack(msg,sz)))
+			if dispatch_profile then
+				profile_resume(p.name, co, session, source, p.unpack(msg,sz))
+			else
+				suspend(co, coroutine_resume(co, session,source, p.unpack(msg,sz)))
+			end
 		else
 			trace_source[source] = nil
 			if session ~= 0 then
@@ -960,6 +1088,91 @@ local function raw_dispatch_message(prototype, msg, sz, session, source)
 	end
 end
 
+local gc_idle	-- set by skynet.gcpolicy, run gc step after dispatch
+local gc_time = 0	-- nsec, the gc time driven by skynet.gcpolicy
+local gc_count = 0
+
+do ---- gc policy
+	local collectgarbage = collectgarbage
+	local hpc = c.hpc
+	local cintcommand = c.intcommand
+	local policy = { mode = "generational", idle = false }
+	local idle_step = 0	-- KB, 0 means a basic step
+	local idle_limit	-- KB, step even if message queue is not empty
+	local idle_next	-- KB, don't check message queue until memory grows to it
+	local IDLE_GRAIN = 8	-- KB, a basic step is about 8K work
+
+	local function gc_step()
+		local t = hpc()
+		local finish = collectgarbage("step", idle_step)
+		gc_time = gc_time + hpc() - t
+		gc_count = gc_count + 1
+		local kb = collectgarbage "count"
+		if finish then
+			-- like gcpause 200%, wait for memory double
+			idle_limit = kb * 2
+		end
+		idle_next = kb + math.max(idle_step, IDLE_GRAIN)
+	end
+
+	local function idle_gc()
+		local kb = collectgarbage "count"
+		if kb > idle_limit then
+			-- message queue is always busy, don't let the garbage grow forever
+			gc_step()
+		elseif kb > idle_next and cintcommand("STAT", "mqlen") == 0 then
+			gc_step()
+		end
+	end
+
+	--[[
+		mode : "incremental" or "generational"
+		pause, stepmul, stepsize : for incremental mode
+		minormul, majormul : for generational mode
+		idle : true means stop auto gc, and run gc step when message queue is empty,
+			it always uses incremental mode, because a step in generational mode is a whole minor collection
+		step : KB, the step size in idle mode
+	]]
+	function skynet.gcpolicy(p)
+		if p == nil then
+			return policy
+		end
+		local mode = p.mode or policy.mode
+		local idle = p.idle
+		if idle == nil then
+			idle = policy.idle
+		end
+		if idle then
+			mode = "incremental"
+		end
+		if mode == "incremental" then
+			collectgarbage("incremental", p.pause or 0, p.stepmul or 0, p.stepsize or 0)
+		elseif mode == "generational" then
+			collectgarbage("generational", p.minormul or 0, p.majormul or 0)
+		else
+			error("Invalid gc mode " .. tostring(mode))
+		end
+		local np = {}
+		for k,v in pairs(p) do
+			np[k] = v
+		end
+		np.mode = mode
+		np.idle = idle
+		if idle then
+			idle_step = np.step or 0
+			idle_limit = collectgarbage "count" * 2
+			idle_next = 0
+			collectgarbage "stop"
+			gc_idle = idle_gc
+		elseif policy.idle then
+			collectgarbage "restart"
+			gc_idle = nil
+		end
+		policy = np
+		return policy
+	end
+end
+
 function skynet.dispatch_message(...)
 	local succ, err = pcall(raw_dispatch_message,...)
 	while true do
@@ -985,6 +1198,9 @@ function skynet.dispatch_message(...)
 			end
 		end
 	end
+	if gc_idle then
+		gc_idle()
+	end
 	assert(succ, tostring(err))
 end
 
@@ -1091,9 +1307,47 @@ function skynet.mqlen()
 end
 
 function skynet.stat(what)
+	if what == "gc" then
+		return gc_time / 1000000000	-- sec
+	elseif what == "gccount" then
+		return gc_count
+	elseif what == "histogram" or what == "histogram_reset" then
+		-- text dump, see skynet-src/skynet_histogram.c
+		return c.command("STAT", what)
+	elseif what == "copool" then
+		return #coroutine_pool
+	elseif what == "cohit" then
+		return coroutine_pool_hit
+	elseif what == "comiss" then
+		return coroutine_pool_miss
+	elseif what == "colive" then
+		-- coroutines created by co_create, and not in the pool
+		local n = 0
+		for co in pairs(coroutine_record) do
+			if coroutine.status(co) ~= "dead" then
+				n = n + 1
+			end
+		end
+		return n - #coroutine_pool
+	end
 	return c.intcommand("STAT", what)
 end
 
+-- set the max size of coroutine pool, shrink the pool if it's larger. returns the current size
+function skynet.coroutine_pool(max)
+	if max then
+		assert(max >= 0)
+		coroutine_pool_max = max
+		for i = #coroutine_pool, max + 1, -1 do
+			local co = coroutine_pool[i]
+			coroutine_pool[i] = nil
+			coroutine_record[co] = nil
+			coroutine.close(co)
+		end
+	end
+	return #coroutine_pool
+end
+
 local function task_traceback(co)
 	if co == "BREAK" then
 		return co
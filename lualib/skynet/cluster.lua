@@ -113,6 +113,12 @@ function cluster.unregister(name)
 	return skynet.call(clusterd, "lua", "unregister", name)
 end
 
+-- returns sender stats (node -> stat), agent stats (fd -> stat) and the decompression stat
+-- zcount/zraw/zbytes/ztime in sender and agent stats are the compressed messages, bytes before and after, and the cpu time (ns)
+function cluster.stat()
+	return skynet.call(clusterd, "lua", "stat")
+end
+
 function cluster.query(node, name)
 	return skynet.call(get_sender(node), "lua", "req", 0, skynet.pack(name))
 end
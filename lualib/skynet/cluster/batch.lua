@@ -0,0 +1,84 @@
+local skynet = require "skynet"
+
+--[[
+	Small packages are queued and written in one socket write (a frame), when all the messages
+	in the service's message queue are handled. Used by clustersender (requests) and clusteragent (responses).
+
+	local b = batch.new(writefunc, stat)
+	writefunc(data, n) writes n packages, data is a string (n == 1) or a table of strings,
+	returns true, or false and the error. stat.frame (socket writes) and stat.bytes are counted.
+]]
+
+local batch = {}
+local batch_meta = { __index = batch }
+
+function batch.new(writefunc, stat)
+	stat = stat or {}
+	stat.frame = stat.frame or 0
+	stat.bytes = stat.bytes or 0
+	return setmetatable({
+		__write = writefunc,
+		__stat = stat,
+		__pending = {},
+		__waiting = {},	-- writers of pending, woken up after the write
+		__error = {},	-- co -> error of the write
+		__flushing = false,
+	}, batch_meta)
+end
+
+-- write the queued packages now, returns false, err if the write fails, the writers get the error too
+function batch:flush()
+	local pending = self.__pending
+	local n = #pending
+	if n == 0 then
+		return true
+	end
+	local writers = self.__waiting
+	self.__pending, self.__waiting = {}, {}
+	self.__stat.frame = self.__stat.frame + 1
+	local ok, err = self.__write(n == 1 and pending[1] or pending, n)
+	local flush_error = self.__error
+	for _, co in ipairs(writers) do
+		if not ok then
+			flush_error[co] = err
+		end
+		skynet.wakeup(co)
+	end
+	return ok, err
+end
+
+local function flush_later(self)
+	if skynet.mqlen() > 0 then
+		-- let the messages in queue join this frame
+		skynet.yield()
+	end
+	self.__flushing = false
+	self:flush()
+end
+
+-- queue the package, don't wait
+function batch:queue(data)
+	local pending = self.__pending
+	pending[#pending+1] = data
+	self.__stat.bytes = self.__stat.bytes + #data
+	if not self.__flushing then
+		self.__flushing = true
+		skynet.fork(flush_later, self)
+	end
+end
+
+-- queue the package and wait until it's written, raise the error of the write
+function batch:write(data)
+	self:queue(data)
+	local co = coroutine.running()
+	local waiting = self.__waiting
+	waiting[#waiting+1] = co
+	skynet.wait(co)
+	local err = self.__error[co]
+	if err then
+		self.__error[co] = nil
+		error(err)
+	end
+end
+
+return batch
@@ -1,18 +1,36 @@
 local skynet = require "skynet"
+local kv = require "skynet.kvstore"
 
 local datacenter = {}
 
+-- kv.opened() is true when DATACENTER runs in this process, read and write the store directly.
+
 function datacenter.get(...)
+	if kv.opened() then
+		return kv.get(...)
+	end
 	return skynet.call("DATACENTER", "lua", "QUERY", ...)
 end
 
 function datacenter.set(...)
+	if kv.opened() then
+		local ret, woken = kv.set(...)
+		if woken then
+			skynet.send("DATACENTER", "lua", "WAKEUP", woken)
+		end
+		return ret
+	end
 	return skynet.call("DATACENTER", "lua", "UPDATE", ...)
 end
 
 function datacenter.wait(...)
+	if kv.opened() then
+		local ret = kv.get(...)
+		if ret ~= nil then
+			return ret
+		end
+	end
 	return skynet.call("DATACENTER", "lua", "WAIT", ...)
 end
 
 return datacenter
-
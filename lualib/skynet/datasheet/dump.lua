@@ -31,6 +31,26 @@ type: (enum)
   3 boolean
   4 table
   5 string
+
+columns: (a homogeneous array of records, instead of table)
+  int32 0xffffffff (array of table)
+  int32 rows
+  int32 ncol
+  int32 size (bytes of columns)
+  column*ncol (sorted by key)
+  data*ncol
+
+column:
+  int32 string offset of key
+  int8 type (integer, real, boolean or string)
+  int8 width (bytes of value: 1, 2 or 4)
+  int16 reserved
+  int32 dict (number of strings in the dictionary of string column)
+  int32 offset of data (from the beginning of columns)
+
+data: (align 4)
+  int32 string offset*dict (string column only)
+  value*rows (signed integer, float, boolean or index of dictionary)
 ]]
 
 local ctd = {}
@@ -38,7 +58,209 @@ local math = math
 local table = table
 local string = string
 
-function ctd.dump(root)
+local COLUMNS = 0xffffffff
+local COLUMN_MINROWS = 16
+local FLOAT_INTEGER = 1 << 24	-- the integers in a real column must be exact in float
+
+local function string_offset(doc, v)
+	local offset = doc.strings[v]
+	if not offset then
+		offset = doc.offset
+		doc.offset = offset + #v + 1
+		doc.strings[v] = offset
+		table.insert(doc.strings, v)
+	end
+	return offset
+end
+
+local function value_type(v)
+	local t = type(v)
+	if t == "number" then
+		if math.tointeger(v) and v <= 0x7FFFFFFF and v >= -(0x7FFFFFFF+1) then
+			return 1
+		else
+			return 2
+		end
+	elseif t == "boolean" then
+		return 3
+	elseif t == "string" then
+		return 5
+	end
+end
+
+-- string.pack can't take too many arguments at once
+local function pack_values(fmt, values)
+	local tmp = {}
+	local n = #values
+	for i = 1, n, 1024 do
+		local j = math.min(i + 1023, n)
+		table.insert(tmp, string.pack("<" .. string.rep(fmt, j - i + 1), table.unpack(values, i, j)))
+	end
+	local s = table.concat(tmp)
+	return s .. string.rep("\0", (4 - #s & 3) & 3)
+end
+
+local function width_of(min, max)
+	if min >= -0x80 and max <= 0x7f then
+		return 1
+	elseif min >= -0x8000 and max <= 0x7fff then
+		return 2
+	else
+		return 4
+	end
+end
+
+-- return the type of column, or nil if the values can't be stored in a column
+local function column_type(values)
+	local typ
+	for _, v in ipairs(values) do
+		local vt = value_type(v)
+		if vt == nil then
+			return
+		end
+		if typ == nil or typ == vt then
+			typ = vt
+		elseif (typ == 1 or typ == 2) and (vt == 1 or vt == 2) then
+			typ = 2
+		else
+			return
+		end
+	end
+	if typ == 2 then
+		for _, v in ipairs(values) do
+			if math.tointeger(v) and (v > FLOAT_INTEGER or v < -FLOAT_INTEGER) then
+				return
+			end
+		end
+	end
+	return typ
+end
+
+local function encode_column(doc, key, values, typ)
+	local width, dict, data
+	if typ == 1 then
+		local min, max = 0, 0
+		for _, v in ipairs(values) do
+			if v < min then min = v elseif v > max then max = v end
+		end
+		width = width_of(min, max)
+		data = pack_values("i" .. width, values)
+		dict = 0
+	elseif typ == 2 then
+		width = 4
+		data = pack_values("f", values)
+		dict = 0
+	elseif typ == 3 then
+		width = 1
+		local b = {}
+		for i, v in ipairs(values) do
+			b[i] = v and 1 or 0
+		end
+		data = pack_values("B", b)
+		dict = 0
+	else
+		local code = {}
+		local strings = {}
+		local codes = {}
+		for i, v in ipairs(values) do
+			local c = code[v]
+			if not c then
+				strings[#strings + 1] = string_offset(doc, v)
+				c = #strings - 1
+				code[v] = c
+			end
+			codes[i] = c
+		end
+		dict = #strings
+		if dict <= 0x100 then
+			width = 1
+		elseif dict <= 0x10000 then
+			width = 2
+		else
+			width = 4
+		end
+		data = pack_values("I4", strings) .. pack_values("I" .. width, codes)
+	end
+	return {
+		key = string_offset(doc, key),
+		type = typ,
+		width = width,
+		dict = dict,
+		data = data,
+	}
+end
+
+-- encode a homogeneous array of records (the same keys, the same type of each key) as columns, or return nil
+local function dump_columns(doc, t)
+	local rows = #t
+	if rows < COLUMN_MINROWS then
+		return
+	end
+	local n = 0
+	for _ in pairs(t) do
+		n = n + 1
+	end
+	if n ~= rows or type(t[1]) ~= "table" then
+		return
+	end
+	local keys = {}
+	for k in pairs(t[1]) do
+		if type(k) ~= "string" then
+			return
+		end
+		table.insert(keys, k)
+	end
+	local ncol = #keys
+	if ncol == 0 then
+		return
+	end
+	for i = 2, rows do
+		local row = t[i]
+		if type(row) ~= "table" then
+			return
+		end
+		local n = 0
+		for k in pairs(row) do
+			n = n + 1
+		end
+		if n ~= ncol then
+			return
+		end
+	end
+	table.sort(keys)
+	local values = {}
+	local types = {}
+	for i, k in ipairs(keys) do
+		local v = {}
+		for j = 1, rows do
+			v[j] = t[j][k]
+			if v[j] == nil then
+				return
+			end
+		end
+		types[i] = column_type(v)
+		if not types[i] then
+			return
+		end
+		values[i] = v
+	end
+	local columns = {}
+	for i, k in ipairs(keys) do
+		columns[i] = encode_column(doc, k, values[i], types[i])
+	end
+	local header = {}
+	local data = {}
+	local offset = 16 + 16 * ncol
+	for i, c in ipairs(columns) do
+		header[i] = string.pack("<I4BBI2I4I4", c.key, c.type, c.width, 0, c.dict, offset)
+		data[i] = c.data
+		offset = offset + #c.data
+	end
+	return string.pack("<I4I4I4I4", COLUMNS, rows, ncol, offset) .. table.concat(header) .. table.concat(data)
+end
+
+-- the columns are used for the homogeneous arrays of records unless nocolumns is true
+function ctd.dump(root, nocolumns)
 	local doc = {
 		table_n = 0,
 		table = {},
@@ -49,6 +271,11 @@ function ctd.dump(root)
 		local index = doc.table_n + 1
 		doc.table_n = index
 		doc.table[index] = false	-- place holder
+		local columns = not nocolumns and dump_columns(doc, t)
+		if columns then
+			doc.table[index] = columns
+			return index
+		end
 		local array_n = 0
 		local array = {}
 		local kvs = {}
@@ -71,14 +298,7 @@ function ctd.dump(root)
 					return '\3', "\0\0\0\0"
 				end
 			elseif t == "string" then
-				local offset = doc.strings[v]
-				if not offset then
-					offset = doc.offset
-					doc.offset = offset + #v + 1
-					doc.strings[v] = offset
-					table.insert(doc.strings, v)
-				end
-				return '\5', string.pack("<I4", offset)
+				return '\5', string.pack("<I4", string_offset(doc, v))
 			else
 				error ("Unsupport value " .. tostring(v))
 			end
@@ -136,9 +356,48 @@ function ctd.undump(v)
 	local header = 4 + 4 + 4 * n + 1
 	stringtbl = stringtbl + 1
 	local tblidx = {}
+	local function decode_columns(toffset)
+		local rows, ncol = string.unpack("<I4I4", v, toffset + 4)
+		local result = {}
+		for i = 1, rows do
+			result[i] = {}
+		end
+		for i = 0, ncol - 1 do
+			local key, typ, width, dict, offset = string.unpack("<I4BBxxI4I4", v, toffset + 16 + i * 16)
+			key = string.unpack("z", v, stringtbl + key)
+			offset = offset + toffset
+			local fmt
+			if typ == 1 then
+				fmt = "<i" .. width
+			elseif typ == 2 then
+				fmt = "<f"
+			elseif typ == 3 then
+				fmt = "B"
+			else
+				fmt = "<I" .. width
+			end
+			local strings = { string.unpack("<" .. string.rep("I4", dict), v, offset) }
+			offset = offset + dict * 4
+			for j = 1, rows do
+				local value = string.unpack(fmt, v, offset + (j-1) * width)
+				if typ == 3 then
+					value = value ~= 0
+				elseif typ == 5 then
+					value = string.unpack("z", v, stringtbl + strings[value + 1])
+				end
+				result[j][key] = value
+			end
+		end
+		return result
+	end
 	local function decode(n)
 		local toffset = index[n+1] + header
 		local array, dict = string.unpack("<I4I4", v, toffset)
+		if array == COLUMNS then
+			local result = decode_columns(toffset)
+			tblidx[result] = n
+			return result
+		end
 		local types = { string.unpack(string.rep("B", (array+dict)), v, toffset + 8) }
 		local offset = ((array + dict + 8 + 3) & ~3) + toffset
 		local result = {}
@@ -183,6 +442,10 @@ local function diffmap(last, current)
 	local function comp(lastr, curr)
 		local old = lasti[lastr]
 		local new = curi[curr]
+		if new == nil then
+			-- the records in columns are not tables of document
+			return
+		end
 		map[new] = old
 		for k,v in pairs(lastr) do
 			if type(v) == "table" then
@@ -218,6 +481,10 @@ function ctd.diff(last, current)
 	local function remap(n)
 		local toffset = index[n+1] + header
 		local array, dict = string.unpack("<I4I4", current, toffset)
+		if array == COLUMNS then
+			local size = string.unpack("<I4", current, toffset + 12)
+			return string.sub(current, toffset, toffset + size - 1)
+		end
 		local types = { string.unpack(string.rep("B", (array+dict)), current, toffset + 8) }
 		local hlen = (array + dict + 8 + 3) & ~3
 		local hastable = false
@@ -72,4 +72,17 @@ function datasheet.query(name)
 	return t.object
 end
 
+-- return the values of key in an array of records, it's a copy and not updated by the later version.
+function datasheet.column(t, key)
+	local c = core.column(t, key)
+	if c then
+		return c
+	end
+	c = {}
+	for i, row in ipairs(t) do
+		c[i] = row[key]
+	end
+	return c
+end
+
 return datasheet
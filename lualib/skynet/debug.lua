@@ -39,11 +39,32 @@ local function init(skynet, export)
 			local stat = {}
 			stat.task = skynet.task()
 			stat.mqlen = skynet.stat "mqlen"
+			stat.wait50 = skynet.stat "wait50"
+			stat.wait99 = skynet.stat "wait99"
 			stat.cpu = skynet.stat "cpu"
 			stat.message = skynet.stat "message"
+			stat.gc = skynet.stat "gc"
+			stat.copool = skynet.stat "copool"
+			stat.colive = skynet.stat "colive"
 			skynet.ret(skynet.pack(stat))
 		end
 
+		function dbgcmd.PROFILE(on)
+			skynet.ret(skynet.pack(skynet.profile_dispatch(on)))
+		end
+
+		function dbgcmd.HISTOGRAM(reset)
+			local dump = skynet.stat "histogram"
+			if reset then
+				skynet.stat "histogram_reset"
+			end
+			skynet.ret(skynet.pack(dump))
+		end
+
+		function dbgcmd.GCPOLICY(policy)
+			skynet.ret(skynet.pack(skynet.gcpolicy(policy)))
+		end
+
 		function dbgcmd.KILLTASK(threadname)
 			local co = skynet.killthread(threadname)
 			if co then
@@ -40,7 +40,11 @@ end
 
 function chan:publish(...)
 	local c = assert(self.channel)
-	skynet.call(multicastd, "lua", "PUB", c, mc.pack(self.__pack(...)))
+	local pack, size = mc.pack(self.__pack(...))
+	-- push to the local subscribers directly, only the channel with remote nodes goes through multicastd
+	if not mc.publish(c, skynet.self(), pack, size) then
+		skynet.call(multicastd, "lua", "PUB", c, pack, size)
+	end
 end
 
 function chan:subscribe()
@@ -0,0 +1,85 @@
+local skynet = require "skynet"
+local core = require "skynet.sharetable.core"
+
+-- 同一进程内服务之间传递只读表：发送方构造一次 box，消息里只带引用计数指针，
+-- 接收方原地读取，不需要 skynet.pack / skynet.unpack 的序列化与复制。
+-- sharebox.value 返回只读的代理表，代理表 (包括从它取出的子表) 引用着 box，丢弃 box 后仍然可以使用。
+-- 指针不能跨节点，不要发给 harbor / cluster 上的远程服务。
+
+local sharebox = {}
+
+-- 共享表不会被本虚拟机回收，不能做弱表的键，所以用普通表做代理，代理通过 anchor 引用 box
+local target = setmetatable({}, { __mode = "k" })	-- proxy -> shared table
+local anchor = setmetatable({}, { __mode = "k" })	-- proxy -> box
+local cache = setmetatable({}, { __mode = "k" })	-- box -> { shared table -> proxy }
+local proxy_mt = {}
+
+local function wrap(box, v)
+	if type(v) ~= "table" then
+		return v
+	end
+	local c = cache[box]
+	if c == nil then
+		c = setmetatable({}, { __mode = "v" })
+		cache[box] = c
+	end
+	local p = c[v]
+	if p == nil then
+		p = setmetatable({}, proxy_mt)
+		target[p] = v
+		anchor[p] = box
+		c[v] = p
+	end
+	return p
+end
+
+function proxy_mt.__index(p, k)
+	return wrap(anchor[p], target[p][k])
+end
+
+function proxy_mt.__newindex()
+	error "sharebox value is read only"
+end
+
+function proxy_mt.__len(p)
+	return #target[p]
+end
+
+function proxy_mt.__pairs(p)
+	local t, box = target[p], anchor[p]
+	return function(_, k)
+		local nk, v = next(t, k)
+		if nk ~= nil then
+			return nk, wrap(box, v)
+		end
+	end, p, nil
+end
+
+skynet.register_protocol {
+	name = "sharebox",
+	id = skynet.PTYPE_SHAREBOX,
+	pack = core.boxpack,
+	unpack = core.boxunpack,
+}
+
+-- 深拷贝 tbl 到独立的 lua 虚拟机并标记为共享，只支持 nil/boolean/number/string/table，不允许元表
+function sharebox.new(tbl)
+	return core.box(tbl)
+end
+
+-- 取得共享表 (只读代理)
+function sharebox.value(box)
+	return wrap(box, core.boxvalue(box))
+end
+
+-- box 所在虚拟机占用的内存字节数
+function sharebox.size(box)
+	return core.boxsize(box)
+end
+
+-- 进程内存活的 box 数量，用于检查泄漏
+function sharebox.live()
+	return core.boxlive()
+end
+
+return sharebox
@@ -49,6 +49,33 @@ function sharedata.update(name, v, ...)
 	skynet.call(service, "lua", "update", name, v, ...)
 end
 
+-- declare the secondary indexes of name, they are built at the next sharedata.new/update/loadlist.
+-- indexes : { field1, field2, key = { field3, ... } }, the fields in the array part index the rows of the root,
+-- and key = { fields } index the rows of root[key].
+function sharedata.index(name, indexes)
+	skynet.call(service, "lua", "index", name, indexes)
+end
+
+-- return the rows (min <= row[field] <= max, max is min by default) of obj (a table of rows queried from sharedata)
+function sharedata.lookup(obj, field, min, max)
+	return sd.lookup(obj, field, min, max)
+end
+
+-- load the list { name = source } by worker services in parallel, and publish all of them at once.
+-- return the report { time = ms, worker = n, files = { { name = name, time = ms }, ... } }
+function sharedata.loadlist(list, worker)
+	return skynet.call(service, "lua", "loadlist", list, worker)
+end
+
+-- the snapshot is a binary file of a data object, it can be mapped by sharedata.mmap (in any process) instead of building from source
+function sharedata.save(name, filename)
+	return skynet.call(service, "lua", "save", name, filename)
+end
+
+function sharedata.mmap(name, filename)
+	skynet.call(service, "lua", "mmap", name, filename)
+end
+
 function sharedata.delete(name)
 	skynet.call(service, "lua", "delete", name)
 end
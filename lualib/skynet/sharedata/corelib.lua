@@ -11,6 +11,8 @@ conf.host = {
 	markdirty = core.markdirty,
 	incref = core.incref,
 	decref = core.decref,
+	save = core.save,
+	load = core.load,
 }
 
 local meta = {}
@@ -20,6 +22,7 @@ local index = core.index
 local needupdate = core.needupdate
 local len = core.len
 local core_nextkey = core.nextkey
+local lookup = core.lookup
 
 local function findroot(self)
 	while self.__parent do
@@ -29,16 +32,22 @@ local function findroot(self)
 end
 
 local function update(root, cobj, gcobj)
+	-- the sub table is shared by the new version if it's not changed, so are the children
+	local shared = root.__obj == cobj
 	root.__obj = cobj
 	root.__gcobj = gcobj
 	local children = root.__cache
 	if children then
 		for k,v in pairs(children) do
-			local pointer = index(cobj, k)
-			if type(pointer) == "userdata" then
-				update(v, pointer, gcobj)
+			if shared then
+				update(v, v.__obj, gcobj)
 			else
-				children[k] = nil
+				local pointer = index(cobj, k)
+				if type(pointer) == "userdata" then
+					update(v, pointer, gcobj)
+				else
+					children[k] = nil
+				end
 			end
 		end
 	end
@@ -55,13 +64,13 @@ end
 
 local function getcobj(self)
 	local obj = self.__obj
-	if isdirty(obj) then
+	if isdirty(self.__gcobj) then
 		local newobj, newtbl = needupdate(self.__gcobj)
 		if newobj then
 			local newgcobj = newtbl.__gcobj
 			local root = findroot(self)
 			update(root, newobj, newgcobj)
-			if obj == self.__obj then
+			if self.__gcobj ~= newgcobj then
 				error ("The key [" .. genkey(self) .. "] doesn't exist after update")
 			end
 			obj = self.__obj
@@ -136,6 +145,35 @@ function conf.flush(obj)
 	getcobj(obj)
 end
 
+local function inrange(v, min, max)
+	if max == nil then
+		return v == min
+	end
+	local t = type(v)
+	return t == type(min) and t == type(max) and t ~= "boolean" and min <= v and v <= max
+end
+
+-- return the rows (min <= row[field] <= max) of self, use the index if the field is indexed (see sharedata.index)
+function conf.lookup(self, field, min, max)
+	local rows = {}
+	local keys = lookup(getcobj(self), field, min, max)
+	if keys then
+		for i, k in ipairs(keys) do
+			rows[i] = self[k]
+		end
+	else
+		for _, row in pairs(self) do
+			if type(row) == "table" then
+				local v = row[field]
+				if v ~= nil and inrange(v, min, max) then
+					table.insert(rows, row)
+				end
+			end
+		end
+	end
+	return rows
+end
+
 local function clone_table(cobj)
 	local obj = {}
 	local key
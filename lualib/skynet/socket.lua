@@ -440,6 +440,13 @@ function socket.limit(id, limit)
 	s.buffer_limit = limit
 end
 
+-- Split the stream by 2 (default) or 4 bytes big-endian length header in socket thread,
+-- each package is sent to service as "client" message (session is id) without passing through this service.
+-- Call it before socket.start(id); service == 0 turns it off.
+function socket.redirect(id, service, header)
+	driver.redirect(id, service, header)
+end
+
 ---------------------- UDP
 
 local function create_udp_object(id, cb)
@@ -0,0 +1,212 @@
+local skynet = require "skynet"
+
+-- 分块传输大数据 (存档、录像等)，两端任意时刻只持有 WINDOW 个块，不需要把整个消息放在内存里。
+-- 每个块是一次 call ，接收方读走这个块后才回应，未回应的块不超过 WINDOW 个，这就是流控。
+--
+-- 发送方 :
+--	stream.send(addr, source, ...)
+--	stream.cluster_send(node, addr, source, ...)	-- 对方节点需要有 streamd (接收方调用 stream.dispatch 时启动)
+-- source 是字符串 (按 CHUNK 切分)，或者每次返回一个块、结束时返回 nil 的函数。
+-- ... 会传给接收方的处理函数，返回处理函数的返回值。
+--
+-- 接收方 :
+--	stream.dispatch(function(s, ...)
+--		for chunk in stream.chunks(s) do ... end	-- 或者反复调用 stream.recv(s) 直到返回 nil
+--		return ...
+--	end)
+
+local stream = {}
+
+local CHUNK = 0x7000	-- 打包后小于 cluster 的 MULTI_PART ，远程传输时不会被拆开再拼合
+local WINDOW = 8
+
+stream.CHUNK = CHUNK
+stream.WINDOW = WINDOW
+
+local streams = {}	-- sid : stream
+local handler
+local id = 0
+
+local function new_sid(node)
+	id = id + 1
+	if node then
+		return string.format("%s:%x:%d", require "skynet.cluster.core".nodename(), skynet.self(), id)
+	end
+	return string.format(":%x:%d", skynet.self(), id)
+end
+
+local function reader(source, size)
+	if type(source) == "function" then
+		return source
+	end
+	assert(type(source) == "string", "stream source must be a string or a function")
+	local offset = 1
+	local len = #source
+	return function()
+		if offset > len then
+			return
+		end
+		local chunk = source:sub(offset, offset + size - 1)
+		offset = offset + size
+		return chunk
+	end
+end
+
+local function close_stream(s)
+	streams[s.sid] = nil
+	s.closed = true
+	for seq, ack in pairs(s.ack) do
+		ack(false)
+		s.ack[seq] = nil
+		s.chunk[seq] = nil
+	end
+end
+
+local CMD = {}
+
+function CMD.open(sid, ...)
+	local f = assert(handler, "stream.dispatch is not set")
+	local s = { sid = sid, next = 1, chunk = {}, ack = {} }
+	streams[sid] = s
+	local r = table.pack(pcall(f, s, ...))
+	close_stream(s)
+	if not r[1] then
+		error(r[2])
+	end
+	skynet.ret(skynet.pack(table.unpack(r, 2, r.n)))
+end
+
+function CMD.data(sid, seq, chunk)
+	local s = streams[sid]
+	if not s then
+		error(string.format("stream %s is closed", sid))
+	end
+	s.chunk[seq] = chunk or false	-- false means eof
+	s.ack[seq] = skynet.response()
+	if s.waiting and seq == s.next then
+		skynet.wakeup(s.waiting)
+	end
+end
+
+skynet.register_protocol {
+	name = "stream",
+	id = skynet.PTYPE_STREAM,
+	pack = skynet.pack,
+	unpack = skynet.unpack,
+	dispatch = function(_, _, cmd, ...)
+		local f = assert(CMD[cmd])
+		f(...)
+	end,
+}
+
+-- 返回下一个块，结束返回 nil
+function stream.recv(s)
+	while true do
+		if s.eof or s.closed then
+			return
+		end
+		local seq = s.next
+		local ack = s.ack[seq]
+		if ack then
+			local chunk = s.chunk[seq]
+			s.chunk[seq] = nil
+			s.ack[seq] = nil
+			s.next = seq + 1
+			ack(true)
+			if chunk == false then
+				s.eof = true
+				return
+			end
+			return chunk
+		end
+		local co = coroutine.running()
+		s.waiting = co
+		skynet.wait(co)
+		s.waiting = nil
+	end
+end
+
+function stream.chunks(s)
+	return stream.recv, s
+end
+
+function stream.dispatch(f)
+	handler = f
+	-- cluster 上的发送方通过 .stream 转发到本节点的服务
+	skynet.uniqueservice "streamd"
+end
+
+local function send(call, sid, source, ...)
+	local co = coroutine.running()
+	local waiting = false
+	local inflight = 0
+	local result
+	local err
+
+	local function wakeup()
+		if waiting then
+			waiting = false
+			skynet.wakeup(co)
+		end
+	end
+
+	local function wait()
+		waiting = true
+		skynet.wait(co)
+	end
+
+	skynet.fork(function(...)
+		result = table.pack(pcall(call, "open", sid, ...))
+		wakeup()
+	end, ...)
+
+	local function push(seq, chunk)
+		local ok, e = pcall(call, "data", sid, seq, chunk)
+		if not ok then
+			err = err or e
+		end
+		inflight = inflight - 1
+		wakeup()
+	end
+
+	local read = reader(source, CHUNK)
+	local seq = 0
+	repeat
+		while inflight >= WINDOW and not result and not err do
+			wait()
+		end
+		if result or err then
+			-- 接收方已经结束或出错，不再发送剩下的块
+			break
+		end
+		local chunk = read()
+		seq = seq + 1
+		inflight = inflight + 1
+		skynet.fork(push, seq, chunk)
+	until chunk == nil
+
+	while not result do
+		wait()
+	end
+	if not result[1] then
+		error(result[2])
+	end
+	return table.unpack(result, 2, result.n)
+end
+
+function stream.send(addr, source, ...)
+	local function call(...)
+		return skynet.call(addr, "stream", ...)
+	end
+	return send(call, new_sid(), source, ...)
+end
+
+function stream.cluster_send(node, addr, source, ...)
+	local cluster = require "skynet.cluster"
+	local function call(...)
+		return cluster.call(node, ".stream", addr, ...)
+	end
+	return send(call, new_sid(node), source, ...)
+end
+
+return stream
@@ -10,6 +10,9 @@ local maxclient	-- max client
 local client_number = 0
 local CMD = setmetatable({}, { __gc = function() netpack.clear(queue) end })
 local nodelay = false
+local shards	-- facade : the gate instances own the connections
+local owner		-- facade : fd -> shard
+local facade	-- shard : the service accepts connections for this shard
 
 local connection = {}
 -- true : connected
@@ -22,6 +25,13 @@ function gateserver.openclient(fd)
 	end
 end
 
+-- Packages of fd will be sent to agent directly by socket thread, call it before openclient
+function gateserver.redirect(fd, agent)
+	if connection[fd] then
+		socketdriver.redirect(fd, agent, 2)
+	end
+end
+
 function gateserver.closeclient(fd)
 	local c = connection[fd]
 	if c ~= nil then
@@ -36,12 +46,55 @@ function gateserver.start(handler)
 
 	local listen_context = {}
 
+	local function shard_of(fd)
+		return owner[fd]
+	end
+
+	local function open_shards(source, conf)
+		local n = conf.shard
+		local shard_conf = {}
+		for k,v in pairs(conf) do
+			shard_conf[k] = v
+		end
+		shard_conf.facade = skynet.self()
+		shard_conf.watchdog = conf.watchdog or source
+		shard_conf.maxclient = maxclient + 1	-- facade limits the number of clients
+		owner = {}
+		shards = {}
+		for i = 1, n do
+			local address = skynet.newservice(SERVICE_NAME)
+			skynet.call(address, "lua", "open", shard_conf)
+			shards[i] = { address = address, n = 0 }
+		end
+	end
+
 	function CMD.open( source, conf )
 		assert(not socket)
+		if conf.facade then
+			-- shard : the connections are accepted by facade, and attached later
+			facade = conf.facade
+			maxclient = conf.maxclient or 1024
+			nodelay = conf.nodelay
+			if conf.zerocopy then
+				queue = netpack.queue(true)
+			end
+			if handler.open then
+				return handler.open(source, conf)
+			end
+			return
+		end
 		local address = conf.address or "0.0.0.0"
 		local port = assert(conf.port)
 		maxclient = conf.maxclient or 1024
 		nodelay = conf.nodelay
+		if conf.zerocopy then
+			-- the messages are slices of socket buffer, release them by netpack.release
+			queue = netpack.queue(true)
+		end
+		conf.shard = conf.shard or tonumber(skynet.getenv "gate_shard")
+		if conf.shard and conf.shard > 1 then
+			open_shards(source, conf)
+		end
 		skynet.error(string.format("Listen on %s:%d", address, port))
 		socket = socketdriver.listen(address, port, conf.backlog)
 		listen_context.co = coroutine.running()
@@ -95,6 +148,19 @@ function gateserver.start(handler)
 			socketdriver.shutdown(fd)
 			return
 		end
+		if shards then
+			-- the shard with the least connections
+			local shard = shards[1]
+			for i = 2, #shards do
+				if shards[i].n < shard.n then
+					shard = shards[i]
+				end
+			end
+			shard.n = shard.n + 1
+			owner[fd] = shard
+			skynet.send(shard.address, "lua", "attach", fd, msg)
+			return
+		end
 		if nodelay then
 			socketdriver.nodelay(fd)
 		end
@@ -103,8 +169,21 @@ function gateserver.start(handler)
 	end
 
 	function MSG.close(fd)
+		if shards and fd ~= socket then
+			-- closed before the shard starts it
+			local shard = shard_of(fd)
+			if shard then
+				skynet.send(shard.address, "lua", "socket", "close", fd)
+			else
+				client_number = client_number - 1
+			end
+			return
+		end
 		if fd ~= socket then
 			client_number = client_number - 1
+			if facade then
+				skynet.send(facade, "lua", "detach", fd)
+			end
 			if connection[fd] then
 				connection[fd] = false	-- close read
 			end
@@ -119,6 +198,11 @@ function gateserver.start(handler)
 	function MSG.error(fd, msg)
 		if fd == socket then
 			skynet.error("gateserver accept error:",msg)
+		elseif shards then
+			local shard = shard_of(fd)
+			if shard then
+				skynet.send(shard.address, "lua", "socket", "error", fd, msg)
+			end
 		else
 			socketdriver.shutdown(fd)
 			if handler.error then
@@ -128,6 +212,13 @@ function gateserver.start(handler)
 	end
 
 	function MSG.warning(fd, size)
+		if shards then
+			local shard = shard_of(fd)
+			if shard then
+				skynet.send(shard.address, "lua", "socket", "warning", fd, size)
+			end
+			return
+		end
 		if handler.warning then
 			handler.warning(fd, size)
 		end
@@ -146,6 +237,26 @@ function gateserver.start(handler)
 		end
 	end
 
+	-- shard : the connection accepted by facade
+	function CMD.attach(source, fd, addr)
+		MSG.open(fd, addr)
+	end
+
+	-- shard : the socket message of fd raised before the shard starts it
+	function CMD.socket(source, type, fd, ...)
+		MSG[type](fd, ...)
+	end
+
+	-- facade : the connection is closed by shard
+	function CMD.detach(source, fd)
+		local shard = owner[fd]
+		if shard then
+			owner[fd] = nil
+			shard.n = shard.n - 1
+			client_number = client_number - 1
+		end
+	end
+
 	skynet.register_protocol {
 		name = "socket",
 		id = skynet.PTYPE_SOCKET,	-- PTYPE_SOCKET = 6
@@ -161,12 +272,16 @@ function gateserver.start(handler)
 	}
 
 	local function init()
-		skynet.dispatch("lua", function (_, address, cmd, ...)
+		skynet.dispatch("lua", function (session, address, cmd, fd, ...)
 			local f = CMD[cmd]
 			if f then
-				skynet.ret(skynet.pack(f(address, ...)))
+				skynet.ret(skynet.pack(f(address, fd, ...)))
+			elseif shards and owner[fd] then
+				-- the command for a connection, the shard responds to the caller directly
+				skynet.ignoreret()
+				skynet.redirect(owner[fd].address, address, "lua", session, skynet.pack(cmd, fd, ...))
 			else
-				skynet.ret(skynet.pack(handler.command(cmd, address, ...)))
+				skynet.ret(skynet.pack(handler.command(cmd, address, fd, ...)))
 			end
 		end)
 	end
@@ -0,0 +1,259 @@
+// Comment: snlua 的 lua 虚拟机专用分配器(按服务划分的 arena)
+
+#ifndef skynet_lalloc_arena_h
+#define skynet_lalloc_arena_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// 小对象按 16 字节对齐划分尺寸类，lua 里的 TString/Table/Closure/UpVal 基本都落在 256 字节以内
+#define ARENA_ALIGN 16
+#define ARENA_SMALL_MAX 256
+#define ARENA_CLASS (ARENA_SMALL_MAX / ARENA_ALIGN)
+// 每次向系统申请的大块内存，按自身大小对齐，从小块地址就能找到所在的大块
+#define ARENA_CHUNK_SIZE (64 * 1024)
+// 空块累计到这么多字节，并且不少于空闲字节的一半时，才把它们归还系统
+#define ARENA_RECLAIM_MIN (4 * ARENA_CHUNK_SIZE)
+
+// 释放后的小块，挂在对应尺寸类的空闲链表上
+struct arena_free {
+	struct arena_free * next;
+};
+
+// 大块内存，里面的小块全部释放后归还系统，其余在服务退出时整体释放
+struct arena_chunk {
+	struct arena_chunk * next;
+	// 正在使用的小块个数
+	int live;
+};
+
+// 同一时刻只有一个工作线程在跑某个服务，所以这里不需要加锁
+struct arena {
+	// 所有向系统申请的大块，链表
+	struct arena_chunk * chunk;
+	// 当前大块中还未切分的部分
+	char * ptr;
+	char * end;
+	// 每个尺寸类的空闲链表
+	struct arena_free * freelist[ARENA_CLASS];
+	// 为 1 时表示虚拟机正在关闭，小块释放直接忽略，最后整体释放大块
+	int closing;
+	// 已申请的大块总字节数
+	size_t reserved;
+	// 正在使用的小块总字节数(按尺寸类向上取整后)
+	size_t used;
+	// live 为 0 的大块个数(不含正在切分的块)
+	int empty;
+	// 小块分配次数，其中命中空闲链表的次数
+	uint64_t alloc;
+	uint64_t reuse;
+};
+
+// lua 保证 ptr 不为空时 osize 就是原始块大小，因此不需要额外的块头就能反推出尺寸类
+static inline int
+arena_class(size_t sz) {
+	return (int)((sz + ARENA_ALIGN - 1) / ARENA_ALIGN) - 1;
+}
+
+static inline int
+arena_issmall(size_t sz) {
+	return sz > 0 && sz <= ARENA_SMALL_MAX;
+}
+
+static inline struct arena_chunk *
+arena_chunk(void *ptr) {
+	return (struct arena_chunk *)((uintptr_t)ptr & ~(uintptr_t)(ARENA_CHUNK_SIZE - 1));
+}
+
+// 多映射一个块的大小，再裁掉首尾不对齐的部分
+static struct arena_chunk *
+arena_chunk_new(void) {
+	size_t sz = ARENA_CHUNK_SIZE * 2;
+	char * p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	char * start = (char *)arena_chunk(p + ARENA_CHUNK_SIZE - 1);
+	size_t head = start - p;
+	if (head > 0) {
+		munmap(p, head);
+	}
+	size_t tail = sz - head - ARENA_CHUNK_SIZE;
+	if (tail > 0) {
+		munmap(start + ARENA_CHUNK_SIZE, tail);
+	}
+	struct arena_chunk * c = (struct arena_chunk *)start;
+	c->next = NULL;
+	c->live = 0;
+	return c;
+}
+
+static inline void
+arena_chunk_delete(struct arena_chunk *c) {
+	munmap(c, ARENA_CHUNK_SIZE);
+}
+
+static void
+arena_init(struct arena *a) {
+	memset(a, 0, sizeof(*a));
+}
+
+static void
+arena_release(struct arena *a) {
+	struct arena_chunk * c = a->chunk;
+	while (c) {
+		struct arena_chunk * next = c->next;
+		arena_chunk_delete(c);
+		c = next;
+	}
+	a->chunk = NULL;
+	a->ptr = a->end = NULL;
+	memset(a->freelist, 0, sizeof(a->freelist));
+	a->reserved = 0;
+	a->used = 0;
+	a->empty = 0;
+}
+
+static inline int
+arena_current(struct arena *a, struct arena_chunk *c) {
+	return a->ptr != NULL && arena_chunk(a->ptr - 1) == c;
+}
+
+// 空闲链表不会合并相邻的小块，这里把落在空块里的小块从链表中摘掉，再把空块归还系统
+static void
+arena_reclaim(struct arena *a) {
+	int k;
+	for (k=0;k<ARENA_CLASS;k++) {
+		struct arena_free ** pf = &a->freelist[k];
+		while (*pf) {
+			struct arena_chunk * c = arena_chunk(*pf);
+			if (c->live == 0 && !arena_current(a, c)) {
+				*pf = (*pf)->next;
+			} else {
+				pf = &(*pf)->next;
+			}
+		}
+	}
+	struct arena_chunk ** pc = &a->chunk;
+	struct arena_chunk * c;
+	while ((c = *pc)) {
+		if (c->live == 0 && !arena_current(a, c)) {
+			*pc = c->next;
+			arena_chunk_delete(c);
+			a->reserved -= ARENA_CHUNK_SIZE;
+		} else {
+			pc = &c->next;
+		}
+	}
+	a->empty = 0;
+}
+
+static void *
+arena_small_alloc(struct arena *a, int c) {
+	size_t sz = (size_t)(c + 1) * ARENA_ALIGN;
+	struct arena_free * f = a->freelist[c];
+	++a->alloc;
+	if (f) {
+		a->freelist[c] = f->next;
+		a->used += sz;
+		++a->reuse;
+		struct arena_chunk * chunk = arena_chunk(f);
+		if (chunk->live++ == 0 && !arena_current(a, chunk)) {
+			--a->empty;
+		}
+		return f;
+	}
+	if (a->ptr == NULL || sz > (size_t)(a->end - a->ptr)) {
+		// 当前大块剩余的尾巴不足一个对象，直接丢弃，计入碎片
+		struct arena_chunk * chunk = arena_chunk_new();
+		if (chunk == NULL)
+			return NULL;
+		if (a->ptr != NULL && arena_chunk(a->ptr - 1)->live == 0) {
+			// 换下来的块已经空了
+			++a->empty;
+		}
+		chunk->next = a->chunk;
+		a->chunk = chunk;
+		a->reserved += ARENA_CHUNK_SIZE;
+		// 块头也按 ARENA_ALIGN 对齐，保证后续切出的小块满足 lua 的最大对齐要求
+		a->ptr = (char *)chunk + ARENA_ALIGN;
+		a->end = (char *)chunk + ARENA_CHUNK_SIZE;
+	}
+	void * ret = a->ptr;
+	a->ptr += sz;
+	a->used += sz;
+	++arena_chunk(ret)->live;
+	return ret;
+}
+
+static inline void
+arena_small_free(struct arena *a, void *ptr, int c) {
+	if (a->closing)
+		return;
+	struct arena_free * f = (struct arena_free *)ptr;
+	f->next = a->freelist[c];
+	a->freelist[c] = f;
+	a->used -= (size_t)(c + 1) * ARENA_ALIGN;
+	struct arena_chunk * chunk = arena_chunk(ptr);
+	if (--chunk->live == 0 && !arena_current(a, chunk)) {
+		++a->empty;
+		// 扫描的开销是空闲链表的长度，空块至少占空闲字节的一半时才回收，开销均摊到每次释放上
+		size_t empty = (size_t)a->empty * ARENA_CHUNK_SIZE;
+		if (empty >= ARENA_RECLAIM_MIN && empty * 2 >= a->reserved - a->used) {
+			arena_reclaim(a);
+		}
+	}
+}
+
+// 语义与 lua_Alloc 一致：nsize 为 0 时释放；ptr 为空时 osize 是对象类型而不是大小
+static void *
+arena_lalloc(struct arena *a, void *ptr, size_t osize, size_t nsize) {
+	if (ptr == NULL) {
+		osize = 0;
+	}
+	int small_old = arena_issmall(osize);
+	int small_new = arena_issmall(nsize);
+	if (!small_old && !small_new) {
+		// 大对象，直接走原来的分配器
+		return skynet_lalloc(ptr, osize, nsize);
+	}
+	if (nsize == 0) {
+		arena_small_free(a, ptr, arena_class(osize));
+		return NULL;
+	}
+	if (small_old && small_new) {
+		int oc = arena_class(osize);
+		int nc = arena_class(nsize);
+		if (oc == nc) {
+			return ptr;
+		}
+		void * ret = arena_small_alloc(a, nc);
+		if (ret == NULL)
+			return NULL;
+		memcpy(ret, ptr, osize < nsize ? osize : nsize);
+		arena_small_free(a, ptr, oc);
+		return ret;
+	}
+	void * ret;
+	if (small_new) {
+		// 大对象缩小成小对象(或新建小对象)，搬进 arena
+		ret = arena_small_alloc(a, arena_class(nsize));
+	} else {
+		// 小对象长大，搬出 arena
+		ret = skynet_lalloc(NULL, 0, nsize);
+	}
+	if (ret == NULL)
+		return NULL;
+	if (ptr) {
+		memcpy(ret, ptr, osize < nsize ? osize : nsize);
+		if (small_old) {
+			arena_small_free(a, ptr, arena_class(osize));
+		} else {
+			skynet_lalloc(ptr, osize, 0);
+		}
+	}
+	return ret;
+}
+
+#endif
@@ -2,12 +2,15 @@
 #include "skynet_harbor.h"
 #include "skynet_socket.h"
 #include "skynet_handle.h"
+#include "skynet_server.h"
 
 /*
 	harbor listen the PTYPE_HARBOR (in text)
 	N name : update the global name
 	S fd id: connect to new harbor , we should send self_id to fd first , and then recv a id (check it), and at last send queue.
 	A fd id: accept new harbor , we should send self_id to fd , and then send queue.
+	D id: harbor id is down (pushed by master), invalidate the global names in it.
+	F : flush the outgoing packages (sent by harbor itself, see schedule_flush)
 
 	If the fd is disconnected, send message to slave in PTYPE_TEXT.  D id
 	If we don't known a globalname, send message to slave in PTYPE_TEXT. Q name
@@ -23,6 +26,9 @@
 
 #define HASH_SIZE 4096
 #define DEFAULT_QUEUE_SIZE 1024
+// the outgoing messages are sent in packages of this size at most (unless one message is larger)
+#define REMOTE_BATCH_SIZE (64 * 1024)
+#define REMOTE_BATCH_INIT 256
 
 // 12 is sizeof(struct remote_message_header)
 #define HEADER_COOKIE_LENGTH 12
@@ -76,11 +82,16 @@ struct slave {
 	int read;
 	uint8_t size[4];
 	char * recv_buffer;
+	uint8_t * send_buffer;	// outgoing messages packed, sent at the next flush
+	size_t send_size;
+	size_t send_cap;
 };
 
 struct harbor {
 	struct skynet_context *ctx;
 	int id;
+	uint32_t self;
+	int flushing;	// a flush command is in the message queue
 	uint32_t slave;
 	struct hashmap * map;
 	struct slave s[REMOTE_MAX];
@@ -239,6 +250,10 @@ close_harbor(struct harbor *h, int id) {
 		release_queue(s->queue);
 		s->queue = NULL;
 	}
+	skynet_free(s->send_buffer);
+	s->send_buffer = NULL;
+	s->send_size = 0;
+	s->send_cap = 0;
 }
 
 static void
@@ -329,28 +344,118 @@ forward_local_messsage(struct harbor *h, void *msg, int sz) {
 	}
 }
 
-static void
-send_remote(struct skynet_context * ctx, int fd, const char * buffer, size_t sz, struct remote_message_header * cookie) {
-	size_t sz_header = sz+sizeof(*cookie);
-	if (sz_header > UINT32_MAX) {
+// 4 bytes length + message + 12 bytes cookie
+static inline size_t
+remote_package_size(size_t sz) {
+	return 4 + sz + HEADER_COOKIE_LENGTH;
+}
+
+static int
+check_remote_size(struct skynet_context * ctx, size_t sz, const struct remote_message_header * cookie) {
+	if (sz + HEADER_COOKIE_LENGTH > UINT32_MAX) {
 		skynet_error(ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
-		return;
+		return 0;
 	}
-	uint8_t sendbuf[sz_header+4];
-	to_bigendian(sendbuf, (uint32_t)sz_header);
+	return 1;
+}
+
+static uint8_t *
+pack_remote(uint8_t * sendbuf, const char * buffer, size_t sz, const struct remote_message_header * cookie) {
+	to_bigendian(sendbuf, (uint32_t)(sz + HEADER_COOKIE_LENGTH));
 	memcpy(sendbuf+4, buffer, sz);
 	header_to_message(cookie, sendbuf+4+sz);
+	return sendbuf + remote_package_size(sz);
+}
 
+static void
+send_package(struct skynet_context * ctx, int fd, uint8_t * package, size_t sz) {
+	// the socket server takes the ownership of package, so it doesn't clone the buffer again.
 	struct socket_sendbuffer tmp;
 	tmp.id = fd;
-	tmp.type = SOCKET_BUFFER_RAWPOINTER;
-	tmp.buffer = sendbuf;
-	tmp.sz = sz_header+4;
+	tmp.type = SOCKET_BUFFER_MEMORY;
+	tmp.buffer = package;
+	tmp.sz = sz;
 
 	// ignore send error, because if the connection is broken, the mainloop will recv a message.
 	skynet_socket_sendbuffer(ctx, &tmp);
 }
 
+static void
+flush_slave(struct harbor *h, struct slave *s) {
+	if (s->send_size == 0)
+		return;
+	send_package(h->ctx, s->fd, s->send_buffer, s->send_size);
+	s->send_buffer = NULL;
+	s->send_size = 0;
+	s->send_cap = 0;
+}
+
+// The messages sent during this dispatch round are packed into one package per slave,
+// a flush command pushed to the end of our own message queue sends them out.
+static void
+schedule_flush(struct harbor *h) {
+	if (!h->flushing) {
+		h->flushing = 1;
+		skynet_send(h->ctx, 0, h->self, PTYPE_HARBOR, 0, "F", 1);
+	}
+}
+
+static void
+flush_all(struct harbor *h) {
+	int i;
+	h->flushing = 0;
+	for (i=1;i<REMOTE_MAX;i++) {
+		struct slave *s = &h->s[i];
+		if (s->send_size > 0 && s->fd != 0) {
+			flush_slave(h, s);
+		}
+	}
+}
+
+static void
+send_remote(struct harbor *h, struct slave *s, const char * buffer, size_t sz, struct remote_message_header * cookie) {
+	if (!check_remote_size(h->ctx, sz, cookie)) {
+		return;
+	}
+	size_t package_sz = remote_package_size(sz);
+	if (package_sz > REMOTE_BATCH_SIZE) {
+		// send it alone, after the pending ones
+		flush_slave(h, s);
+		uint8_t * package = skynet_malloc(package_sz);
+		pack_remote(package, buffer, sz, cookie);
+		send_package(h->ctx, s->fd, package, package_sz);
+		return;
+	}
+	if (s->send_size + package_sz > REMOTE_BATCH_SIZE) {
+		flush_slave(h, s);
+	}
+	if (s->send_size + package_sz > s->send_cap) {
+		size_t cap = s->send_cap ? s->send_cap : REMOTE_BATCH_INIT;
+		while (cap < s->send_size + package_sz) {
+			cap *= 2;
+		}
+		s->send_buffer = skynet_realloc(s->send_buffer, cap);
+		s->send_cap = cap;
+	}
+	if (s->send_size == 0) {
+		schedule_flush(h);
+	}
+	pack_remote(s->send_buffer + s->send_size, buffer, sz, cookie);
+	s->send_size += package_sz;
+}
+
+// Send all the messages in queue to the slave, they are packed as the other outgoing messages.
+// destination is or-ed into the handle of each message (for the messages queued by name).
+static void
+send_queue(struct harbor *h, struct slave *s, struct harbor_msg_queue * queue, uint32_t destination) {
+	struct harbor_msg * m;
+	while ((m = pop_queue(queue)) != NULL) {
+		m->header.destination |= destination;
+		send_remote(h, s, m->buffer, m->size, &m->header);
+		skynet_free(m->buffer);
+	}
+}
+
 static void
 dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 	struct harbor_msg_queue * queue = node->queue;
@@ -388,12 +493,7 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 		}
 		return;
 	}
-	struct harbor_msg * m;
-	while ((m = pop_queue(queue)) != NULL) {
-		m->header.destination |= (handle & HANDLE_MASK);
-		send_remote(context, fd, m->buffer, m->size, &m->header);
-		skynet_free(m->buffer);
-	}
+	send_queue(h, s, queue, handle & HANDLE_MASK);
 }
 
 static void
@@ -406,16 +506,13 @@ dispatch_queue(struct harbor *h, int id) {
 	if (queue == NULL)
 		return;
 
-	struct harbor_msg * m;
-	while ((m = pop_queue(queue)) != NULL) {
-		send_remote(h->ctx, fd, m->buffer, m->size, &m->header);
-		skynet_free(m->buffer);
-	}
+	send_queue(h, s, queue, 0);
 	release_queue(queue);
 	s->queue = NULL;
 }
 
-static void
+// return 1 if the message buffer is taken (forwarded as the last message in it)
+static int
 push_socket_data(struct harbor *h, const struct skynet_socket_message * message) {
 	assert(message->type == SKYNET_SOCKET_TYPE_DATA);
 	int fd = message->id;
@@ -431,7 +528,7 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 	}
 	if (s == NULL) {
 		skynet_error(h->ctx, "Invalid socket fd (%d) data", fd);
-		return;
+		return 0;
 	}
 	uint8_t * buffer = (uint8_t *)message->buffer;
 	int size = message->ud;
@@ -444,7 +541,7 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 			if (remote_id != id) {
 				skynet_error(h->ctx, "Invalid shakehand id (%d) from fd = %d , harbor = %d", id, fd, remote_id);
 				close_harbor(h,id);
-				return;
+				return 0;
 			}
 			++buffer;
 			--size;
@@ -463,7 +560,7 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 			if (size < need) {
 				memcpy(s->size + s->read, buffer, size);
 				s->read += size;
-				return;
+				return 0;
 			} else {
 				memcpy(s->size + s->read, buffer, need);
 				buffer += need;
@@ -472,24 +569,36 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 				if (s->size[0] != 0) {
 					skynet_error(h->ctx, "Message is too long from harbor %d", id);
 					close_harbor(h,id);
-					return;
+					return 0;
 				}
 				s->length = s->size[1] << 16 | s->size[2] << 8 | s->size[3];
 				s->read = 0;
-				s->recv_buffer = skynet_malloc(s->length);
+				s->recv_buffer = NULL;	// alloc it in STATUS_CONTENT, when the message is not at the end of this package
 				s->status = STATUS_CONTENT;
 				if (size == 0) {
-					return;
+					return 0;
 				}
 			}
 		}
 		// go though
 		case STATUS_CONTENT: {
 			int need = s->length - s->read;
+			if (s->recv_buffer == NULL) {
+				if (size == need) {
+					// The message lies at the end of the package, reuse the package buffer.
+					// The messages before it have been copied out already.
+					memmove(message->buffer, buffer, need);
+					forward_local_messsage(h, message->buffer, s->length);
+					s->length = 0;
+					s->status = STATUS_HEADER;
+					return 1;
+				}
+				s->recv_buffer = skynet_malloc(s->length);
+			}
 			if (size < need) {
 				memcpy(s->recv_buffer + s->read, buffer, size);
 				s->read += size;
-				return;
+				return 0;
 			}
 			memcpy(s->recv_buffer + s->read, buffer, need);
 			forward_local_messsage(h, s->recv_buffer, s->length);
@@ -500,11 +609,11 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 			buffer += need;
 			s->status = STATUS_HEADER;
 			if (size == 0)
-				return;
+				return 0;
 			break;
 		}
 		default:
-			return;
+			return 0;
 		}
 	}
 }
@@ -516,6 +625,8 @@ update_name(struct harbor *h, const char name[GLOBALNAME_LENGTH], uint32_t handl
 		node = hash_insert(h->map, name);
 	}
 	node->value = handle;
+	// publish to the global name cache, so skynet_sendname can bypass harbor service
+	skynet_harbor_updatename(name, handle);
 	if (node->queue) {
 		dispatch_name_queue(h, node);
 		release_queue(node->queue);
@@ -556,7 +667,7 @@ remote_send_handle(struct harbor *h, uint32_t source, uint32_t destination, int
 		cookie.source = source;
 		cookie.destination = (destination & HANDLE_MASK) | ((uint32_t)type << HANDLE_REMOTE_SHIFT);
 		cookie.session = (uint32_t)session;
-		send_remote(context, s->fd, msg,sz,&cookie);
+		send_remote(h, s, msg, sz, &cookie);
 	}
 
 	return 0;
@@ -645,6 +756,27 @@ harbor_command(struct harbor * h, const char * msg, size_t sz, int session, uint
 		}
 		break;
 	}
+	case 'D' : {
+		if (s <= 0) {
+			skynet_error(h->ctx, "Invalid command D");
+			return;
+		}
+		// msg is not NUL-terminated
+		char buffer[s+1];
+		memcpy(buffer, name, s);
+		buffer[s] = 0;
+		int id = (int)strtol(buffer, NULL, 10);
+		if (id <= 0 || id >= REMOTE_MAX) {
+			skynet_error(h->ctx, "Invalid command D %s", buffer);
+			return;
+		}
+		// keep the names in h->map, so messages to them still report the harbor is down
+		skynet_harbor_invalidate(id);
+		break;
+	}
+	case 'F' :
+		flush_all(h);
+		break;
 	default:
 		skynet_error(h->ctx, "Unknown command %s", msg);
 		return;
@@ -671,8 +803,9 @@ mainloop(struct skynet_context * context, void * ud, int type, int session, uint
 		const struct skynet_socket_message * message = msg;
 		switch(message->type) {
 		case SKYNET_SOCKET_TYPE_DATA:
-			push_socket_data(h, message);
-			skynet_free(message->buffer);
+			if (!push_socket_data(h, message)) {
+				skynet_free(message->buffer);
+			}
 			break;
 		case SKYNET_SOCKET_TYPE_ERROR:
 		case SKYNET_SOCKET_TYPE_CLOSE: {
@@ -738,6 +871,7 @@ harbor_init(struct harbor *h, struct skynet_context *ctx, const char * args) {
 		return 1;
 	}
 	h->id = harbor_id;
+	h->self = skynet_context_handle(ctx);
 	h->slave = slave;
 	if (harbor_id == 0) {
 		close_all_remotes(h);
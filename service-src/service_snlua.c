@@ -2,6 +2,7 @@
 
 #include "skynet.h"
 #include "atomic.h"
+#include "lalloc_arena.h"
 
 #include <lua.h>
 #include <lualib.h>
@@ -41,6 +42,8 @@ struct snlua {
 	// 当前活跃协程
 	lua_State * activeL;
 	ATOM_INT trap;
+	// 小对象分配器，配置 lua_arena = true 时开启，否则为 NULL
+	struct arena * arena;
 };
 
 // LUA_CACHELIB may defined in patched lua for shared proto
@@ -395,6 +398,47 @@ init_profile(lua_State *L) {
 
 /// end of coroutine
 
+// arena lib
+
+// skynet.arena.info()，返回当前服务 lua 小对象分配器的统计，未开启时返回 nil
+static int
+larena_info(lua_State *L) {
+	void *ud = NULL;
+	lua_getallocf(L, &ud);
+	struct snlua *l = (struct snlua *)ud;
+	struct arena *a = l->arena;
+	if (a == NULL) {
+		return 0;
+	}
+	lua_createtable(L, 0, 6);
+	lua_pushinteger(L, (lua_Integer)l->mem);
+	lua_setfield(L, -2, "mem");
+	lua_pushinteger(L, (lua_Integer)a->reserved);
+	lua_setfield(L, -2, "reserved");
+	lua_pushinteger(L, (lua_Integer)a->used);
+	lua_setfield(L, -2, "used");
+	// 已申请但没有被小对象占用的比例，包括空闲链表和大块尾巴
+	double frag = a->reserved ? (double)(a->reserved - a->used) / (double)a->reserved : 0;
+	lua_pushnumber(L, frag);
+	lua_setfield(L, -2, "fragmentation");
+	lua_pushinteger(L, (lua_Integer)a->alloc);
+	lua_setfield(L, -2, "alloc");
+	lua_pushinteger(L, (lua_Integer)a->reuse);
+	lua_setfield(L, -2, "reuse");
+	return 1;
+}
+
+// 初始化skynet.arena库
+static int
+init_arena(lua_State *L) {
+	luaL_Reg l[] = {
+		{ "info", larena_info },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,l);
+	return 1;
+}
+
 static int 
 traceback (lua_State *L) {
 	const char *msg = lua_tostring(L, 1);
@@ -448,6 +492,10 @@ init_cb(struct snlua *l, struct skynet_context *ctx, const char * args, size_t s
 	// 把栈清了
 	lua_settop(L, profile_lib-1);
 
+	// 加载skynet.arena库
+	luaL_requiref(L, "skynet.arena", init_arena, 0);
+	lua_pop(L,1);
+
 	// 全局注册表["skynet_context"] = ctx
 	lua_pushlightuserdata(L, ctx);
 	lua_setfield(L, LUA_REGISTRYINDEX, "skynet_context");
@@ -561,15 +609,29 @@ lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 		l->mem_report *= 2;
 		skynet_error(l->ctx, "Memory warning %.2f M", (float)l->mem / (1024 * 1024));
 	}
+	if (l->arena) {
+		return arena_lalloc(l->arena, ptr, osize, nsize);
+	}
 	return skynet_lalloc(ptr, osize, nsize);
 }
 
+// 虚拟机创建时就要确定分配器，此时服务还没有 ctx，GETENV 不依赖 ctx
+static int
+arena_enable(void) {
+	const char * opt = skynet_command(NULL, "GETENV", "lua_arena");
+	return opt != NULL && strcmp(opt, "true") == 0;
+}
+
 struct snlua *
 snlua_create(void) {
 	struct snlua * l = skynet_malloc(sizeof(*l));
 	memset(l,0,sizeof(*l));
 	l->mem_report = MEMORY_WARNING_REPORT;
 	l->mem_limit = 0;
+	if (arena_enable()) {
+		l->arena = skynet_malloc(sizeof(struct arena));
+		arena_init(l->arena);
+	}
 	l->L = lua_newstate(lalloc, l);
 	l->activeL = NULL;
 	ATOM_INIT(&l->trap , 0);
@@ -578,7 +640,15 @@ snlua_create(void) {
 
 void
 snlua_release(struct snlua *l) {
-	lua_close(l->L);
+	if (l->arena) {
+		// 关闭虚拟机时小对象不再逐个归还，最后整块释放
+		l->arena->closing = 1;
+		lua_close(l->L);
+		arena_release(l->arena);
+		skynet_free(l->arena);
+	} else {
+		lua_close(l->L);
+	}
 	skynet_free(l);
 }
 
@@ -596,5 +666,8 @@ snlua_signal(struct snlua *l, int signal) {
 		}
 	} else if (signal == 1) {
 		skynet_error(l->ctx, "Current Memory %.3fK", (float)l->mem / 1024);
+		if (l->arena) {
+			skynet_error(l->ctx, "Arena reserved %.3fK used %.3fK", (float)l->arena->reserved / 1024, (float)l->arena->used / 1024);
+		}
 	}
 }
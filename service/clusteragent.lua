@@ -1,12 +1,18 @@
 local skynet = require "skynet"
 local socket = require "skynet.socket"
 local cluster = require "skynet.cluster.core"
+local batch = require "skynet.cluster.batch"
 local ignoreret = skynet.ignoreret
 
-local clusterd, gate, fd = ...
+local clusterd, gate, fd, threshold, dictfile = ...
 clusterd = tonumber(clusterd)
 gate = tonumber(gate)
 fd = tonumber(fd)
+threshold = tonumber(threshold)
+
+-- responses are compressed after the peer says it can decompress them
+local compressor
+local zpeer
 
 local large_request = {}
 local inquery_name = {}
@@ -44,6 +50,21 @@ new_register_name()
 
 local tracetag
 
+local stat = {
+	request = 0,
+	push = 0,
+	frame = 0,	-- socket writes
+	bytes = 0,
+}
+
+-- responses are written in one socket write, see skynet.cluster.batch
+local out = batch.new(function(data, n)
+	if socket.write(fd, data) then
+		return true
+	end
+	return false, string.format("Write %d responses to fd %d failed", n, fd)
+end, stat)
+
 local function dispatch_request(_,_,addr, session, msg, sz, padding, is_push)
 	ignoreret()	-- session is fd, don't call skynet.ret
 	if session == nil then
@@ -70,21 +91,33 @@ local function dispatch_request(_,_,addr, session, msg, sz, padding, is_push)
 		if not msg then
 			tracetag = nil
 			local response = cluster.packresponse(session, false, "Invalid large req")
-			socket.write(fd, response)
+			out:write(response)
 			return
 		end
 	end
 	local ok, response
 	if addr == 0 then
-		local name = skynet.unpack(msg, sz)
+		local name, dictid = skynet.unpack(msg, sz)
 		skynet.trash(msg, sz)
-		local addr = register_name["@" .. name]
-		if addr then
+		if name == "\0compress" then
+			-- hello from clustersender, reply the dictionary id
 			ok = true
-			msg = skynet.packstring(addr)
+			if compressor then
+				compressor:usedict(dictid == compressor:dictid())
+				zpeer = compressor
+				msg = skynet.packstring(compressor:dictid())
+			else
+				msg = skynet.packstring(0)
+			end
 		else
-			ok = false
-			msg = "name not found"
+			local addr = register_name["@" .. name]
+			if addr then
+				ok = true
+				msg = skynet.packstring(addr)
+			else
+				ok = false
+				msg = "name not found"
+			end
 		end
 		sz = nil
 	else
@@ -93,9 +126,11 @@ local function dispatch_request(_,_,addr, session, msg, sz, padding, is_push)
 		end
 		if addr then
 			if is_push then
+				stat.push = stat.push + 1
 				skynet.rawsend(addr, "lua", msg, sz)
 				return	-- no response
 			else
+				stat.request = stat.request + 1
 				if tracetag then
 					ok , msg, sz = pcall(skynet.tracecall, tracetag, addr, "lua", msg, sz)
 					tracetag = nil
@@ -109,21 +144,32 @@ local function dispatch_request(_,_,addr, session, msg, sz, padding, is_push)
 		end
 	end
 	if ok then
-		response = cluster.packresponse(session, true, msg, sz)
+		response = cluster.packresponse(session, true, msg, sz, zpeer)
 		if type(response) == "table" then
+			assert(out:flush())
+			stat.frame = stat.frame + 1
 			for _, v in ipairs(response) do
 				socket.lwrite(fd, v)
 			end
 		else
-			socket.write(fd, response)
+			out:write(response)
 		end
 	else
 		response = cluster.packresponse(session, false, msg)
-		socket.write(fd, response)
+		out:write(response)
 	end
 end
 
 skynet.start(function()
+	if threshold and threshold > 0 then
+		local dict
+		if dictfile then
+			local f = assert(io.open(dictfile, "rb"))
+			dict = f:read "a"
+			f:close()
+		end
+		compressor = cluster.compressor(threshold, dict)
+	end
 	skynet.register_protocol {
 		name = "client",
 		id = skynet.PTYPE_CLIENT,
@@ -140,6 +186,11 @@ skynet.start(function()
 			skynet.exit()
 		elseif cmd == "namechange" then
 			new_register_name()
+		elseif cmd == "stat" then
+			if compressor then
+				stat.zcount, stat.zraw, stat.zbytes, stat.ztime = compressor:stat()
+			end
+			skynet.retpack(stat)
 		else
 			skynet.error(string.format("Invalid command %s from %s", cmd, skynet.address(source)))
 		end
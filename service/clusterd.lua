@@ -42,7 +42,7 @@ local function open_channel(t, key)
 		local host, port = string.match(address, "([^:]+):(.*)$")
 		c = node_sender[key]
 		if c == nil then
-			c = skynet.newservice("clustersender", key, nodename, host, port)
+			c = skynet.newservice("clustersender", key, nodename, host, port, config.compress or 0, config.compress_dict)
 			if node_sender[key] then
 				-- double check
 				skynet.kill(c)
@@ -226,6 +226,28 @@ function command.unregister(_, name)
 	skynet.error(string.format("Unregister [%s] :%08x", name, addr))
 end
 
+-- per peer stats, sender: node -> stat , agent: fd -> stat, and the decompression stat of this process
+function command.stat(source)
+	local sender = {}
+	for node, c in pairs(node_sender) do
+		local ok, s = pcall(skynet.call, c, "lua", "stat")
+		if ok then
+			sender[node] = s
+		end
+	end
+	local agent = {}
+	for fd, service in pairs(cluster_agent) do
+		if type(service) == "number" then
+			local ok, s = pcall(skynet.call, service, "lua", "stat")
+			if ok then
+				agent[fd] = s
+			end
+		end
+	end
+	local count, packed, raw, ti = cluster.decompressstat()
+	skynet.retpack(sender, agent, { count = count, packed = packed, raw = raw, time = ti })
+end
+
 function command.queryname(source, name)
 	skynet.ret(skynet.pack(register_name[name]))
 end
@@ -235,7 +257,7 @@ function command.socket(source, subcmd, fd, msg)
 		skynet.error(string.format("socket accept from %s", msg))
 		-- new cluster agent
 		cluster_agent[fd] = false
-		local agent = skynet.newservice("clusteragent", skynet.self(), source, fd)
+		local agent = skynet.newservice("clusteragent", skynet.self(), source, fd, config.compress or 0, config.compress_dict)
 		local closed = cluster_agent[fd]
 		cluster_agent[fd] = agent
 		if closed then
@@ -2,17 +2,37 @@ local skynet = require "skynet"
 local sc = require "skynet.socketchannel"
 local socket = require "skynet.socket"
 local cluster = require "skynet.cluster.core"
+local batch = require "skynet.cluster.batch"
 
 local channel
 local session = 1
-local node, nodename, init_host, init_port = ...
+local node, nodename, init_host, init_port, threshold, dictfile = ...
+
+-- payload compression, negotiated after each connect (see hello)
+local compressor
+local zpeer	-- compressor for the current connection, nil if the peer doesn't support it
 
 local command = {}
 
+local stat = {
+	request = 0,
+	push = 0,
+	frame = 0,	-- socket writes
+	bytes = 0,
+	latency = 0,	-- total, in ns
+	maxlatency = 0,
+	error = 0,
+}
+
+-- small requests are written in one socket write, see skynet.cluster.batch
+local out = batch.new(function(data)
+	return pcall(channel.request, channel, data)
+end, stat)
+
 local function send_request(addr, msg, sz)
 	-- msg is a local pointer, cluster.packrequest will free it
 	local current_session = session
-	local request, new_session, padding = cluster.packrequest(addr, session, msg, sz)
+	local request, new_session, padding = cluster.packrequest(addr, session, msg, sz, zpeer)
 	session = new_session
 
 	local tracetag = skynet.tracetag()
@@ -24,13 +44,27 @@ local function send_request(addr, msg, sz)
 			tracetag = newtag
 		end
 		skynet.tracelog(tracetag, string.format("cluster %s", node))
-		channel:request(cluster.packtrace(tracetag))
+		out:queue(cluster.packtrace(tracetag))
 	end
-	return channel:request(request, current_session, padding)
+	if padding then
+		-- multi part request, write the queued ones first
+		assert(out:flush())
+		stat.frame = stat.frame + 1
+		return channel:request(request, current_session, padding)
+	end
+	out:write(request)
+	return channel:response(current_session)
 end
 
 function command.req(...)
+	local start = skynet.hpc()
 	local ok, msg = pcall(send_request, ...)
+	local ti = skynet.hpc() - start
+	stat.request = stat.request + 1
+	stat.latency = stat.latency + ti
+	if ti > stat.maxlatency then
+		stat.maxlatency = ti
+	end
 	if ok then
 		if type(msg) == "table" then
 			skynet.ret(cluster.concat(msg))
@@ -38,18 +72,30 @@ function command.req(...)
 			skynet.ret(msg)
 		end
 	else
+		stat.error = stat.error + 1
 		skynet.error(msg)
 		skynet.response()(false)
 	end
 end
 
 function command.push(addr, msg, sz)
-	local request, new_session, padding = cluster.packpush(addr, session, msg, sz)
+	local request, new_session, padding = cluster.packpush(addr, session, msg, sz, zpeer)
+	stat.push = stat.push + 1
 	if padding then	-- is multi push
 		session = new_session
+		assert(out:flush())
+		stat.frame = stat.frame + 1
+		channel:request(request, nil, padding)
+	else
+		out:write(request)
 	end
+end
 
-	channel:request(request, nil, padding)
+function command.stat()
+	if compressor then
+		stat.zcount, stat.zraw, stat.zbytes, stat.ztime = compressor:stat()
+	end
+	skynet.retpack(stat)
 end
 
 local function read_response(sock)
@@ -58,6 +104,28 @@ local function read_response(sock)
 	return cluster.unpackresponse(msg)	-- session, ok, data, padding
 end
 
+-- ask the peer if it can decompress, and whether it has the same dictionary
+local function hello(so)
+	zpeer = nil
+	if compressor == nil then
+		return
+	end
+	local current_session = session
+	local request, new_session = cluster.packrequest(0, session, skynet.pack("\0compress", compressor:dictid()))
+	session = new_session
+	local ok, msg = pcall(so.request, so, request, current_session)
+	if ok then
+		local dictid = skynet.unpack(msg)
+		compressor:usedict(dictid == compressor:dictid())
+		zpeer = compressor
+	elseif msg == sc.error then
+		error(msg)
+	else
+		-- the old version returns "name not found"
+		skynet.error(string.format("Cluster node %s doesn't support compression : %s", node, msg))
+	end
+end
+
 function command.changenode(host, port)
 	if not host then
 		skynet.error(string.format("Close cluster sender %s:%d", channel.__host, channel.__port))
@@ -70,10 +138,21 @@ function command.changenode(host, port)
 end
 
 skynet.start(function()
+	threshold = tonumber(threshold)
+	if threshold and threshold > 0 then
+		local dict
+		if dictfile then
+			local f = assert(io.open(dictfile, "rb"))
+			dict = f:read "a"
+			f:close()
+		end
+		compressor = cluster.compressor(threshold, dict)
+	end
 	channel = sc.channel {
 			host = init_host,
 			port = tonumber(init_port),
 			response = read_response,
+			auth = hello,
 			nodelay = true,
 		}
 	skynet.dispatch("lua", function(session , source, cmd, ...)
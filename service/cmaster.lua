@@ -24,7 +24,7 @@ local socket = require "skynet.socket"
 			'W' : WAIT n
 			'C' : CONNECT slave_id slave_address
 			'N' : NAME globalname address
-			'D' : DISCONNECT slave_id
+			'D' : DISCONNECT slave_id (the global names in it are invalid)
 ]]
 
 local slave_node = {}
@@ -101,6 +101,12 @@ local function monitor_slave(slave_id, slave_address)
 	skynet.error(string.format("Harbor %d (fd=%d) report %s", slave_id, fd, slave_address))
 	while pcall(dispatch_slave, fd) do end
 	skynet.error("slave " ..slave_id .. " is down")
+	-- 移除这个节点注册的全局名字，节点重启后可以重新注册，新地址会再推送给所有 slave
+	for name, address in pairs(global_name) do
+		if address >> 24 == slave_id then
+			global_name[name] = nil
+		end
+	end
 	local message = pack_package("D", slave_id)
 	slave_node[slave_id].fd = 0
 	for k,v in pairs(slave_node) do
@@ -96,6 +96,8 @@ local function monitor_master(master_fd)
 					skynet.redirect(harbor_service, address, "harbor", 0, "N " .. id_name)
 				end
 			elseif t == 'D' then
+				-- 让 harbor 服务中缓存的、指向这个节点的全局名字失效
+				skynet.send(harbor_service, "harbor", "D " .. id_name)
 				local fd = slaves[id_name]
 				slaves[id_name] = false
 				if fd then
@@ -1,109 +1,58 @@
 -- Comment: 数据中心服务
+-- 数据存放在 skynet.kvstore 中，本进程的服务通过 skynet.datacenter 直接读写，
+-- 这个服务处理其它节点的请求，以及 wait 的通知
 
 local skynet = require "skynet"
+local kv = require "skynet.kvstore"
 
 local command = {}
-local database = {}
-local wait_queue = {}
-local mode = {}
+local waiting = {}	-- id : { response, key1, key2, ... }
+local waitid = 0
 
-local function query(db, key, ...)
-	if db == nil or key == nil then
-		return db
-	else
-		return query(db[key], ...)
-	end
-end
-
-function command.QUERY(key, ...)
-	local d = database[key]
-	if d ~= nil then
-		return query(d, ...)
-	end
+function command.QUERY(...)
+	return kv.get(...)
 end
 
-local function update(db, key, value, ...)
-	if select("#",...) == 0 then
-		local ret = db[key]
-		db[key] = value
-		return ret, value
-	else
-		if db[key] == nil then
-			db[key] = {}
-		end
-		return update(db[key], value, ...)
+function command.UPDATE(...)
+	local ret, woken = kv.set(...)
+	if woken then
+		command.WAKEUP(woken)
 	end
+	return ret
 end
 
-local function wakeup(db, key1, ...)
-	if key1 == nil then
-		return
-	end
-	local q = db[key1]
-	if q == nil then
-		return
-	end
-	if q[mode] == "queue" then
-		db[key1] = nil
-		if select("#", ...) ~= 1 then
-			-- throw error because can't wake up a branch
-			for _,response in ipairs(q) do
-				response(false)
+-- 由 kv.set 返回的 { [id] = true/false }，false 表示等待的是一个分支
+function command.WAKEUP(woken)
+	for id, ok in pairs(woken) do
+		local w = waiting[id]
+		if w then
+			waiting[id] = nil
+			if ok then
+				w[1](true, kv.get(table.unpack(w, 2)))
+			else
+				w[1](false)
 			end
-		else
-			return q
 		end
-	else
-		-- it's branch
-		return wakeup(q , ...)
 	end
 end
 
-function command.UPDATE(...)
-	local ret, value = update(database, ...)
-	if ret ~= nil or value == nil then
-		return ret
-	end
-	local q = wakeup(wait_queue, ...)
-	if q then
-		for _, response in ipairs(q) do
-			response(true,value)
-		end
-	end
-end
-
-local function waitfor(db, key1, key2, ...)
-	if key2 == nil then
-		-- push queue
-		local q = db[key1]
-		if q == nil then
-			q = { [mode] = "queue" }
-			db[key1] = q
-		else
-			assert(q[mode] == "queue")
-		end
-		table.insert(q, skynet.response())
-	else
-		local q = db[key1]
-		if q == nil then
-			q = { [mode] = "branch" }
-			db[key1] = q
-		else
-			assert(q[mode] == "branch")
-		end
-		return waitfor(q, key2, ...)
+local function waitfor(...)
+	waitid = waitid + 1
+	if kv.wait(waitid, ...) then
+		return true
 	end
+	waiting[waitid] = { skynet.response(), ... }
 end
 
 skynet.start(function()
+	kv.open()
 	skynet.dispatch("lua", function (_, _, cmd, ...)
 		if cmd == "WAIT" then
-			local ret = command.QUERY(...)
-			if ret ~= nil then
-				skynet.ret(skynet.pack(ret))
-			else
-				waitfor(wait_queue, ...)
+			if waitfor(...) then
+				skynet.ret(skynet.pack(kv.get(...)))
 			end
+		elseif cmd == "WAKEUP" then
+			command.WAKEUP(...)
 		else
 			local f = assert(command[cmd])
 			skynet.ret(skynet.pack(f(...)))
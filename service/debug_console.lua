@@ -150,6 +150,9 @@ function COMMAND.help()
 		kill = "kill address : kill service",
 		mem = "mem : show memory status",
 		gc = "gc : force every lua service do garbage collect",
+		profile = "profile address [on|off] : profile message handling time by lua protocol/command",
+		histogram = "histogram address [reset] : dump queue/exec time histogram by message type (need profile_histogram = true)",
+		gcpolicy = "gcpolicy address [incremental|generational] [idle [step]] : set/get gc policy",
 		start = "lanuch a new lua service",
 		snax = "lanuch a new snax service",
 		clearcache = "clear lua code cache",
@@ -263,6 +266,25 @@ function COMMAND.gc(ti)
 	return skynet.call(".launcher", "lua", "GC", timeout(ti))
 end
 
+function COMMAND.gcpolicy(address, ...)
+	address = adjust_address(address)
+	local policy
+	local args = { ... }
+	if #args > 0 then
+		policy = { idle = false }
+		local i = 1
+		if args[i] == "incremental" or args[i] == "generational" then
+			policy.mode = args[i]
+			i = i + 1
+		end
+		if args[i] == "idle" then
+			policy.idle = true
+			policy.step = tonumber(args[i+1])
+		end
+	end
+	return skynet.call(address, "debug", "GCPOLICY", policy)
+end
+
 function COMMAND.exit(address)
 	skynet.send(adjust_address(address), "debug", "EXIT")
 end
@@ -405,6 +427,28 @@ function COMMAND.trace(address, proto, flag)
 	skynet.call(address, "debug", "TRACELOG", proto, flag)
 end
 
+function COMMAND.profile(address, flag)
+	address = adjust_address(address)
+	if flag then
+		flag = toboolean(flag)
+	end
+	local prof = skynet.call(address, "debug", "PROFILE", flag)
+	if prof == nil then
+		return "Profile is off"
+	end
+	local ret = {}
+	for name, h in pairs(prof) do
+		ret[name] = string.format("count:%d\ttotal:%.3fms\tavg:%.3fus\tmax:%.3fus",
+			h.count, h.total / 1000000, h.total / h.count / 1000, h.max / 1000)
+	end
+	return ret
+end
+
+function COMMAND.histogram(address, reset)
+	address = adjust_address(address)
+	return skynet.call(address, "debug", "HISTOGRAM", reset == "reset")
+end
+
 function COMMANDX.call(cmd)
 	local address = adjust_address(cmd[2])
 	local cmdline = assert(cmd[1]:match("%S+%s+%S+%s(.+)") , "need arguments")
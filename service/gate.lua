@@ -1,5 +1,6 @@
 local skynet = require "skynet"
 local gateserver = require "snax.gateserver"
+local netpack = require "skynet.netpack"
 
 local watchdog
 local connection = {}	-- fd -> connection : { fd , client, agent , ip, mode }
@@ -22,11 +23,11 @@ function handler.message(fd, msg, sz)
 	local agent = c.agent
 	if agent then
 		-- It's safe to redirect msg directly , gateserver framework will not free msg.
+		-- If gate opens with zerocopy, agent should release msg by netpack.release instead of free.
 		skynet.redirect(agent, c.client, "client", fd, msg, sz)
 	else
-		skynet.send(watchdog, "lua", "socket", "data", fd, skynet.tostring(msg, sz))
-		-- skynet.tostring will copy msg to a string, so we must free msg here.
-		skynet.trash(msg,sz)
+		-- netpack.tostring will copy msg to a string and release msg.
+		skynet.send(watchdog, "lua", "socket", "data", fd, netpack.tostring(msg, sz))
 	end
 end
 
@@ -78,6 +79,15 @@ function CMD.forward(source, fd, client, address)
 	gateserver.openclient(fd)
 end
 
+-- The packages bypass gate, the agent receives "client" messages with source 0
+function CMD.redirect(source, fd, address)
+	local c = assert(connection[fd])
+	unforward(c)
+	c.agent = address or source
+	gateserver.redirect(fd, c.agent)
+	gateserver.openclient(fd)
+end
+
 function CMD.accept(source, fd)
 	local c = assert(connection[fd])
 	unforward(c)
@@ -5,8 +5,7 @@ local datacenter = require "skynet.datacenter"
 local harbor_id = skynet.harbor(skynet.self())
 
 local command = {}
-local channel = {}
-local channel_n = {}
+local channel = {}	-- the subscribers of channel are kept in multicast.core, see mc.join
 local channel_remote = {}
 local channel_id = harbor_id
 local NORET = {}
@@ -24,8 +23,8 @@ function command.NEW()
 	while channel[channel_id] do
 		channel_id = mc.nextid(channel_id)
 	end
-	channel[channel_id] = {}
-	channel_n[channel_id] = 0
+	channel[channel_id] = true
+	mc.newchannel(channel_id, false)
 	local ret = channel_id
 	channel_id = mc.nextid(channel_id)
 	return ret
@@ -34,7 +33,7 @@ end
 -- MUST call by the owner node of channel, delete a remote channel
 function command.DELR(source, c)
 	channel[c] = nil
-	channel_n[c] = nil
+	mc.delchannel(c)
 	return NORET
 end
 
@@ -48,7 +47,7 @@ function command.DEL(source, c)
 	end
 	local remote = channel_remote[c]
 	channel[c] = nil
-	channel_n[c] = nil
+	mc.delchannel(c)
 	channel_remote[c] = nil
 	if remote then
 		for node in pairs(remote) do
@@ -63,7 +62,7 @@ local function remote_publish(node, channel, source, ...)
 	skynet.redirect(node_address[node], source, "multicast", channel, ...)
 end
 
--- publish a message, for local node, use the message pointer (call mc.bind to add the reference)
+-- publish a message, for local node, mc.publish push the message pointer to the subscribers (and set the reference)
 -- for remote node, call remote_publish. (call mc.unpack and skynet.tostring to convert message pointer to string)
 local function publish(c , source, pack, size)
 	local remote = channel_remote[c]
@@ -76,19 +75,8 @@ local function publish(c , source, pack, size)
 		end
 	end
 
-	local group = channel[c]
-	if group == nil or next(group) == nil then
-		-- dead channel, delete the pack. mc.bind returns the pointer in pack and free the pack (struct mc_package **)
-		local pack = mc.bind(pack, 1)
-		mc.close(pack)
-		return
-	end
-	local msg = skynet.tostring(pack, size)	-- copy (pack,size) to a string
-	mc.bind(pack, channel_n[c])	-- mc.bind will free the pack(struct mc_package **)
-	for k in pairs(group) do
-		-- the msg is a pointer to the real message, publish pointer in local is ok.
-		skynet.redirect(k, source, "multicast", c , msg)
-	end
+	-- mc.publish will free the pack(struct mc_package **), and delete the message if there is no subscriber
+	mc.publish(c, source, pack, size, true)
 end
 
 skynet.register_protocol {
@@ -131,6 +119,8 @@ function command.SUBR(source, c)
 	if group == nil then
 		group = {}
 		channel_remote[c] = group
+		-- local publisher should send the message to multicastd, and multicastd forwards it to the remote nodes
+		mc.setremote(c, true)
 	end
 	group[node] = true
 end
@@ -147,15 +137,13 @@ function command.SUB(source, c)
 			end
 			if channel[c] == nil then
 				-- double check, because skynet.call whould yield, other SUB may occur.
-				channel[c] = {}
-				channel_n[c] = 0
+				channel[c] = true
+				mc.newchannel(c, true)
 			end
 		end
 	end
-	local group = channel[c]
-	if group and not group[source] then
-		channel_n[c] = channel_n[c] + 1
-		group[source] = true
+	if channel[c] then
+		mc.join(c, source)
 	end
 end
 
@@ -165,23 +153,24 @@ function command.USUBR(source, c)
 	assert(node ~= harbor_id)
 	local group = assert(channel_remote[c])
 	group[node] = nil
+	if next(group) == nil then
+		channel_remote[c] = nil
+		mc.setremote(c, false)
+	end
 	return NORET
 end
 
 -- Unsubscribe a channel, if the subscriber is empty and the channel is remote, send USUBR to the channel owner
 function command.USUB(source, c)
-	local group = assert(channel[c])
-	if group[source] then
-		group[source] = nil
-		channel_n[c] = channel_n[c] - 1
-		if channel_n[c] == 0 then
-			local node = c % 256
-			if node ~= harbor_id then
-				-- remote group
-				channel[c] = nil
-				channel_n[c] = nil
-				skynet.send(node_address[node], "lua", "USUBR", c)
-			end
+	assert(channel[c])
+	local n = mc.leave(c, source)
+	if n == 0 then
+		local node = c % 256
+		if node ~= harbor_id then
+			-- remote group
+			channel[c] = nil
+			mc.delchannel(c)
+			skynet.send(node_address[node], "lua", "USUBR", c)
 		end
 	end
 	return NORET
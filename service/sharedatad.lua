@@ -1,18 +1,22 @@
 local skynet = require "skynet"
+require "skynet.manager"	-- skynet.kill
 local sharedata = require "skynet.sharedata.corelib"
 local table = table
 local cache = require "skynet.codecache"
 cache.mode "OFF"	-- turn off codecache, because CMD.new may load data file
 
+local mode = ...
+
 local NORET = {}
 local pool = {}
 local pool_count = {}
 local objmap = {}
+local indexes = {}	-- name : the declaration of secondary indexes (see CMD.index)
+local fullbuild = {}	-- name : true if the declaration is changed, the shared sub tables don't have the new indexes
 local collect_tick = 10
 
-local function newobj(name, tbl)
+local function newobj(name, cobj)
 	assert(pool[name] == nil)
-	local cobj = sharedata.host.new(tbl)
 	sharedata.host.incref(cobj)
 	local v = {obj = cobj, watch = {} }
 	objmap[cobj] = v
@@ -50,7 +54,7 @@ local CMD = {}
 
 local env_mt = { __index = _ENV }
 
-function CMD.new(name, t, ...)
+local function loadconf(name, t, ...)
 	local dt = type(t)
 	local value
 	if dt == "table" then
@@ -73,7 +77,11 @@ function CMD.new(name, t, ...)
 	else
 		error ("Unknown data type " .. dt)
 	end
-	newobj(name, value)
+	return value
+end
+
+function CMD.new(name, t, ...)
+	newobj(name, sharedata.host.new(loadconf(name, t, ...), nil, nil, indexes[name]))
 end
 
 function CMD.delete(name)
@@ -102,7 +110,7 @@ function CMD.confirm(cobj)
 	return NORET
 end
 
-function CMD.update(name, t, ...)
+local function update(name, cobj)
 	local v = pool[name]
 	local watch, oldcobj
 	if v then
@@ -113,18 +121,117 @@ function CMD.update(name, t, ...)
 		pool[name] = nil
 		pool_count[name] = nil
 	end
-	CMD.new(name, t, ...)
-	local newobj = pool[name].obj
+	newobj(name, cobj)
 	if watch then
 		sharedata.host.markdirty(oldcobj)
 		for _,response in pairs(watch) do
-			sharedata.host.incref(newobj)
-			response(true, newobj)
+			sharedata.host.incref(cobj)
+			response(true, cobj)
 		end
 	end
 	collect1min()	-- collect in 1 min
 end
 
+-- the base version to build on, the sub tables not changed are shared
+local function basever(name)
+	local v = pool[name]
+	if v and not fullbuild[name] then
+		return v.obj
+	end
+end
+
+function CMD.update(name, t, ...)
+	update(name, sharedata.host.new(loadconf(name, t, ...), nil, basever(name), indexes[name]))
+	fullbuild[name] = nil
+end
+
+function CMD.index(name, decl)
+	indexes[name] = decl
+	fullbuild[name] = true
+end
+
+-- list is { name = source }, the source is the same as CMD.new (a table, a file name with @ or the code).
+-- Build them by temporary worker services in parallel, and publish all of them at once when all succeed.
+function CMD.loadlist(list, worker)
+	local start = skynet.hpc()
+	local names = {}
+	for name in pairs(list) do
+		table.insert(names, name)
+	end
+	table.sort(names)
+	local total = #names
+	worker = math.min(worker or tonumber(skynet.getenv "thread") or 8, total)
+	local objs = {}
+	local files = {}
+	local err
+	local index = 0
+	local running = worker
+	local step = math.max(total // 10, 1)
+	local co = coroutine.running()
+
+	local function build()
+		local w = skynet.newservice(SERVICE_NAME, "worker")
+		while not err do
+			index = index + 1
+			local name = names[index]
+			if name == nil then
+				break
+			end
+			local base = basever(name)
+			if base then
+				sharedata.host.incref(base)
+			end
+			local ok, cobj, ti = pcall(skynet.call, w, "lua", name, base, indexes[name], list[name])
+			if base then
+				sharedata.host.decref(base)
+			end
+			if ok then
+				objs[name] = cobj
+				table.insert(files, { name = name, time = ti })
+				if #files % step == 0 or #files == total then
+					skynet.error(string.format("sharedata loadlist %d/%d (%.0f ms)", #files, total, (skynet.hpc() - start) / 1e6))
+				end
+			else
+				err = err or string.format("Load %s failed : %s", name, cobj)
+			end
+		end
+		skynet.kill(w)
+		running = running - 1
+		if running == 0 then
+			skynet.wakeup(co)
+		end
+	end
+
+	for i = 1, worker do
+		skynet.fork(build)
+	end
+	if worker > 0 then
+		skynet.wait(co)
+	end
+	if err then
+		for _, cobj in pairs(objs) do
+			sharedata.host.delete(cobj)
+		end
+		error(err)
+	end
+	for name, cobj in pairs(objs) do
+		update(name, cobj)
+		fullbuild[name] = nil
+	end
+	table.sort(files, function(a, b) return a.time > b.time end)
+	return { time = (skynet.hpc() - start) / 1e6, worker = worker, files = files }
+end
+
+-- map a snapshot file (written by CMD.save) read-only, create or replace the object
+function CMD.mmap(name, filename)
+	update(name, sharedata.host.load(filename))
+end
+
+function CMD.save(name, filename)
+	local v = assert(pool[name], name)
+	return sharedata.host.save(v.obj, filename)
+end
+
 local function check_watch(queue)
 	local n = 0
 	for k,response in pairs(queue) do
@@ -155,6 +262,23 @@ function CMD.monitor(name, obj)
 	return NORET
 end
 
+local function worker(name, base, decl, t, ...)
+	local start = skynet.hpc()
+	local cobj = sharedata.host.new(loadconf(name, t, ...), nil, base, decl)
+	skynet.ret(skynet.pack(cobj, (skynet.hpc() - start) / 1e6))
+end
+
+if mode == "worker" then
+
+-- the temporary service of CMD.loadlist
+skynet.start(function()
+	skynet.dispatch("lua", function (session, source, ...)
+		worker(...)
+	end)
+end)
+
+else
+
 skynet.start(function()
 	skynet.fork(collectobj)
 	skynet.dispatch("lua", function (session, source ,cmd, ...)
@@ -166,3 +290,4 @@ skynet.start(function()
 	end)
 end)
 
+end
@@ -0,0 +1,18 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.register
+
+-- 把 cluster 发来的流转发给本节点的服务，见 skynet.stream
+
+skynet.register_protocol {
+	name = "stream",
+	id = skynet.PTYPE_STREAM,
+	pack = skynet.pack,
+	unpack = skynet.unpack,
+}
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, addr, ...)
+		skynet.retpack(skynet.call(addr, "stream", ...))
+	end)
+	skynet.register ".stream"
+end)
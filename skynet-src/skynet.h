@@ -23,6 +23,8 @@
 #define PTYPE_RESERVED_DEBUG 9
 #define PTYPE_RESERVED_LUA 10
 #define PTYPE_RESERVED_SNAX 11
+// read lualib/skynet/sharebox.lua
+#define PTYPE_RESERVED_SHAREBOX 13
 
 // 消息是否不复制标志
 #define PTYPE_TAG_DONTCOPY 0x10000
@@ -40,13 +42,20 @@ uint32_t skynet_queryname(struct skynet_context * context, const char * name);
 // 向一个服务发送消息，返回会话ID
 int skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * msg, size_t sz);
 int skynet_sendname(struct skynet_context * context, uint32_t source, const char * destination , int type, int session, void * msg, size_t sz);
+// 向多个本地服务发送同一份数据，只复制一次，各服务共享一块带引用计数的内存，返回发出的消息数
+int skynet_sendmulti(struct skynet_context * context, uint32_t source, const uint32_t * destination, int n, int type, int session, const void * msg, size_t sz);
 
 int skynet_isremote(struct skynet_context *, uint32_t handle, int * harbor);
 
+// 某种消息类型的数据不是独立分配的内存时(比如 netpack 的切片)，注册释放函数，框架释放或丢弃这种消息时调用它而不是 skynet_free
+void skynet_message_release(int type, void (*release)(void *msg));
+
 // 消息回调函数签名
 typedef int (*skynet_cb)(struct skynet_context * context, void *ud, int type, int session, uint32_t source , const void * msg, size_t sz);
 // 注册服务消息回调函数
 void skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb);
+// 声明回调从不保留消息 (总是返回 0)，skynet_sendmulti 的共享数据可以原地派发，否则派发前复制一份
+void skynet_callback_noreserve(struct skynet_context * context, int noreserve);
 
 uint32_t skynet_current_handle(void);
 uint64_t skynet_now(void);
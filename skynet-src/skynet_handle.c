@@ -171,6 +171,27 @@ skynet_handle_grab(uint32_t handle) {
 	return result;
 }
 
+void
+skynet_handle_grabmulti(const uint32_t *handle, int n, struct skynet_context **result) {
+	struct handle_storage *s = H;
+	int i;
+
+	rwlock_rlock(&s->lock);
+
+	for (i=0;i<n;i++) {
+		uint32_t hash = handle[i] & (s->slot_size-1);
+		struct skynet_context * ctx = s->slot[hash];
+		if (ctx && skynet_context_handle(ctx) == handle[i]) {
+			skynet_context_grab(ctx);
+			result[i] = ctx;
+		} else {
+			result[i] = NULL;
+		}
+	}
+
+	rwlock_runlock(&s->lock);
+}
+
 uint32_t 
 skynet_handle_findname(const char * name) {
 	struct handle_storage *s = H;
@@ -16,6 +16,8 @@ uint32_t skynet_handle_register(struct skynet_context *);
 int skynet_handle_retire(uint32_t handle);
 // 获取服务对象
 struct skynet_context * skynet_handle_grab(uint32_t handle);
+// 一次加锁获取多个服务对象，不存在的服务对应 NULL
+void skynet_handle_grabmulti(const uint32_t *handle, int n, struct skynet_context **result);
 void skynet_handle_retireall();
 
 // 全局服务信息对象中查找服务名对应的handle
@@ -3,6 +3,7 @@
 #include "skynet_server.h"
 #include "skynet_mq.h"
 #include "skynet_handle.h"
+#include "atomic.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -12,6 +13,21 @@ static struct skynet_context * REMOTE = 0;
 // 集群中的唯一编号​
 static unsigned int HARBOR = ~0;
 
+// 全局名字缓存的槽位数，必须是 2 的幂
+#define NAMECACHE_SIZE 4096
+
+/*
+	开放寻址的散列表，槽位只增不删（失效时只把 handle 置 0），
+	写入者填好 name 后再置 used ，所以读者看到 used 后 name 不会再变。
+ */
+struct namecache_slot {
+	char name[GLOBALNAME_LENGTH];
+	ATOM_INT used;
+	ATOM_INT handle;
+};
+
+static struct namecache_slot NAMECACHE[NAMECACHE_SIZE];
+
 static inline int
 invalid_type(int type) {
 	return type != PTYPE_SYSTEM && type != PTYPE_HARBOR;
@@ -51,3 +67,59 @@ skynet_harbor_exit() {
 		skynet_context_release(ctx);
 	}
 }
+
+static inline uint32_t
+namecache_hash(const char name[GLOBALNAME_LENGTH]) {
+	uint32_t v[GLOBALNAME_LENGTH / sizeof(uint32_t)];
+	memcpy(v, name, GLOBALNAME_LENGTH);
+	uint32_t h = v[0] ^ v[1] ^ v[2] ^ v[3];
+	return h * 2654435761u;
+}
+
+uint32_t
+skynet_harbor_findname(const char name[GLOBALNAME_LENGTH]) {
+	uint32_t h = namecache_hash(name);
+	int i;
+	for (i=0;i<NAMECACHE_SIZE;i++) {
+		struct namecache_slot * slot = &NAMECACHE[(h + i) & (NAMECACHE_SIZE-1)];
+		if (!ATOM_LOAD(&slot->used))
+			return 0;
+		if (memcmp(slot->name, name, GLOBALNAME_LENGTH) == 0)
+			return (uint32_t)ATOM_LOAD(&slot->handle);
+	}
+	return 0;
+}
+
+void
+skynet_harbor_updatename(const char name[GLOBALNAME_LENGTH], uint32_t handle) {
+	uint32_t h = namecache_hash(name);
+	int i;
+	for (i=0;i<NAMECACHE_SIZE;i++) {
+		struct namecache_slot * slot = &NAMECACHE[(h + i) & (NAMECACHE_SIZE-1)];
+		if (!ATOM_LOAD(&slot->used)) {
+			memcpy(slot->name, name, GLOBALNAME_LENGTH);
+			ATOM_STORE(&slot->handle, (int)handle);
+			ATOM_STORE(&slot->used, 1);
+			return;
+		}
+		if (memcmp(slot->name, name, GLOBALNAME_LENGTH) == 0) {
+			ATOM_STORE(&slot->handle, (int)handle);
+			return;
+		}
+	}
+	// 缓存已满，这个名字继续走 harbor 服务查询
+}
+
+void
+skynet_harbor_invalidate(int harbor) {
+	int i;
+	for (i=0;i<NAMECACHE_SIZE;i++) {
+		struct namecache_slot * slot = &NAMECACHE[i];
+		if (ATOM_LOAD(&slot->used)) {
+			uint32_t handle = (uint32_t)ATOM_LOAD(&slot->handle);
+			if (handle != 0 && (int)(handle >> HANDLE_REMOTE_SHIFT) == harbor) {
+				ATOM_STORE(&slot->handle, 0);
+			}
+		}
+	}
+}
@@ -29,4 +29,10 @@ void skynet_harbor_init(int harbor);
 void skynet_harbor_start(void * ctx);
 void skynet_harbor_exit();
 
+// 全局名字缓存：只由 harbor 服务写入，任意工作线程无锁读取，返回 0 表示未缓存
+uint32_t skynet_harbor_findname(const char name[GLOBALNAME_LENGTH]);
+void skynet_harbor_updatename(const char name[GLOBALNAME_LENGTH], uint32_t handle);
+// 某个 harbor 断开后，使指向它的名字失效
+void skynet_harbor_invalidate(int harbor);
+
 #endif
@@ -0,0 +1,159 @@
+#include "skynet.h"
+#include "skynet_histogram.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+struct histogram_set {
+	// 按需分配，服务通常只会收到少数几种类型的消息
+	struct histogram * queue[HISTOGRAM_TYPES];
+	struct histogram * exec[HISTOGRAM_TYPES];
+	char * dump;
+};
+
+static const char * histogram_name[2] = { "queue", "exec" };
+
+struct histogram_set *
+skynet_histogram_new(void) {
+	struct histogram_set * hs = skynet_malloc(sizeof(*hs));
+	memset(hs, 0, sizeof(*hs));
+	return hs;
+}
+
+void
+skynet_histogram_reset(struct histogram_set *hs) {
+	int i;
+	for (i=0;i<HISTOGRAM_TYPES;i++) {
+		skynet_free(hs->queue[i]);
+		skynet_free(hs->exec[i]);
+		hs->queue[i] = NULL;
+		hs->exec[i] = NULL;
+	}
+}
+
+void
+skynet_histogram_delete(struct histogram_set *hs) {
+	if (hs == NULL)
+		return;
+	skynet_histogram_reset(hs);
+	skynet_free(hs->dump);
+	skynet_free(hs);
+}
+
+static inline int
+histogram_slot(uint64_t ti) {
+	ti >>= 10;
+	if (ti == 0)
+		return 0;
+	int slot = 64 - __builtin_clzll(ti);
+	if (slot >= HISTOGRAM_SLOTS)
+		slot = HISTOGRAM_SLOTS - 1;
+	return slot;
+}
+
+void
+skynet_histogram_add(struct histogram *h, uint64_t ti) {
+	++h->count;
+	h->total += ti;
+	if (ti > h->max)
+		h->max = ti;
+	++h->slot[histogram_slot(ti)];
+}
+
+void
+skynet_histogram_decay(struct histogram *h) {
+	int i;
+	uint64_t count = 0;
+	for (i=0;i<HISTOGRAM_SLOTS;i++) {
+		h->slot[i] /= 2;
+		count += h->slot[i];
+	}
+	h->total = h->count ? h->total / h->count * count : 0;
+	h->count = count;
+}
+
+uint64_t
+skynet_histogram_percentile(struct histogram *h, double p) {
+	uint64_t count = 0;
+	int i;
+	for (i=0;i<HISTOGRAM_SLOTS;i++) {
+		count += h->slot[i];
+	}
+	if (count == 0)
+		return 0;
+	double rank = p * count;
+	uint64_t acc = 0;
+	for (i=0;i<HISTOGRAM_SLOTS;i++) {
+		uint32_t n = h->slot[i];
+		if (n > 0 && acc + n >= rank) {
+			uint64_t low = i == 0 ? 0 : (uint64_t)1 << (i + 9);
+			uint64_t high = (uint64_t)1 << (i + 10);
+			if (i == HISTOGRAM_SLOTS - 1 || high > h->max) {
+				high = h->max;
+			}
+			if (high < low)
+				return high;
+			double r = (rank - acc) / n;
+			return low + (uint64_t)((high - low) * r);
+		}
+		acc += n;
+	}
+	return h->max;
+}
+
+static void
+histogram_add(struct histogram **h, uint64_t ti) {
+	struct histogram * hi = *h;
+	if (hi == NULL) {
+		hi = *h = skynet_malloc(sizeof(*hi));
+		memset(hi, 0, sizeof(*hi));
+	}
+	skynet_histogram_add(hi, ti);
+}
+
+void
+skynet_histogram_record(struct histogram_set *hs, int type, uint64_t wait, uint64_t exec) {
+	if (type >= HISTOGRAM_TYPES)
+		type = HISTOGRAM_TYPES - 1;
+	if (wait)
+		histogram_add(&hs->queue[type], wait);
+	histogram_add(&hs->exec[type], exec);
+}
+
+// 每个直方图一行：类型 queue|exec 次数 总耗时 最大耗时 各个桶的计数，时间单位纳秒
+static size_t
+dump_histogram(char *buf, size_t sz, int type, int what, struct histogram *h) {
+	int n = snprintf(buf, sz, "%d %s %llu %llu %llu", type, histogram_name[what],
+		(unsigned long long)h->count, (unsigned long long)h->total, (unsigned long long)h->max);
+	int i;
+	for (i=0;i<HISTOGRAM_SLOTS;i++) {
+		n += snprintf(buf + n, sz - n, " %u", h->slot[i]);
+	}
+	n += snprintf(buf + n, sz - n, "\n");
+	return n;
+}
+
+// 一行的最大长度
+#define DUMP_LINE (16 + 3 * 21 + HISTOGRAM_SLOTS * 11 + 2)
+
+const char *
+skynet_histogram_dump(struct histogram_set *hs) {
+	size_t sz = DUMP_LINE * HISTOGRAM_TYPES * 2 + 1;
+	if (hs->dump == NULL) {
+		hs->dump = skynet_malloc(sz);
+	}
+	char * buf = hs->dump;
+	size_t n = 0;
+	int i;
+	for (i=0;i<HISTOGRAM_TYPES;i++) {
+		if (hs->queue[i]) {
+			n += dump_histogram(buf + n, sz - n, i, 0, hs->queue[i]);
+		}
+		if (hs->exec[i]) {
+			n += dump_histogram(buf + n, sz - n, i, 1, hs->exec[i]);
+		}
+	}
+	buf[n] = '\0';
+	return buf;
+}
@@ -0,0 +1,39 @@
+// Comment: 服务消息耗时直方图相关
+
+#ifndef skynet_histogram_h
+#define skynet_histogram_h
+
+#include <stdint.h>
+
+// 按 2 的幂划分的桶，0 号桶 < 1us，i 号桶为 [2^(i+9), 2^(i+10)) 纳秒，最后一个桶兜底
+#define HISTOGRAM_SLOTS 24
+// 按消息类型分别统计，类型 >= HISTOGRAM_TYPES-1 的都归到最后一类
+#define HISTOGRAM_TYPES 16
+
+// 单个直方图，单位纳秒
+struct histogram {
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	uint32_t slot[HISTOGRAM_SLOTS];
+};
+
+// 累加一个样本
+void skynet_histogram_add(struct histogram *h, uint64_t ti);
+// 所有计数减半，用于让统计偏向最近的样本
+void skynet_histogram_decay(struct histogram *h);
+// 估算百分位数(p 取 0~1)，在桶内线性插值
+uint64_t skynet_histogram_percentile(struct histogram *h, double p);
+
+// 一个服务的全部直方图
+struct histogram_set;
+
+struct histogram_set * skynet_histogram_new(void);
+void skynet_histogram_delete(struct histogram_set *hs);
+void skynet_histogram_reset(struct histogram_set *hs);
+// 记录一条消息，wait 为排队时间，exec 为处理时间，wait 为 0 表示消息没有入队时间戳
+void skynet_histogram_record(struct histogram_set *hs, int type, uint64_t wait, uint64_t exec);
+// 导出为文本，返回的字符串在下一次导出前有效
+const char * skynet_histogram_dump(struct histogram_set *hs);
+
+#endif
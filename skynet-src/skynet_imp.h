@@ -13,6 +13,10 @@ struct skynet_config {
 	int harbor;
 	// 性能分析开关。控制是否启用性能分析，用于统计各服务模块的 CPU 时间等指标
 	int profile;
+	// 消息耗时直方图开关。开启后消息入队时记录时间戳，按服务、消息类型统计排队时间和处理时间
+	int profile_histogram;
+	// 消息排队时间报警阈值(毫秒)，0 表示关闭。开启后消息入队时记录时间戳，排队超过阈值时输出 May overload 日志
+	int mq_wait_overload;
 	// 守护进程参数。如果配置（非 NULL），Skynet 将以守护进程的方式在后台运行
 	const char * daemon;
 	// 	C 服务模块的搜索路径。指定 Skynet 从哪个路径加载用 C 语言编写的服务模
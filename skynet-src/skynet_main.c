@@ -189,6 +189,8 @@ main(int argc, char *argv[]) {
 	config.logger = optstring("logger", NULL);
 	config.logservice = optstring("logservice", "logger");
 	config.profile = optboolean("profile", 1);
+	config.profile_histogram = optboolean("profile_histogram", 0);
+	config.mq_wait_overload = optint("mq_wait_overload", 0);
 
 	// 启动skynet服务器
 	skynet_start(&config);
@@ -1,6 +1,8 @@
 #include "skynet.h"
 #include "skynet_mq.h"
 #include "skynet_handle.h"
+#include "skynet_timer.h"
+#include "skynet_histogram.h"
 #include "spinlock.h"
 
 #include <stdio.h>
@@ -22,6 +24,8 @@
 
 #define MQ_IN_GLOBAL 1
 #define MQ_OVERLOAD 1024
+// 排队时间直方图的样本数超过这个值就减半，让百分位数反映最近的情况
+#define MQ_WAIT_WINDOW 0x10000
 
 // 服务消息队列
 struct message_queue {
@@ -44,8 +48,18 @@ struct message_queue {
 	int overload;
 	// 未读消息超过这个阈值，overload记录当前阈值，overload_threshold翻倍
 	int overload_threshold;
+	// 排队时间超过阈值时记录的排队时间，单位纳秒
+	uint64_t overload_wait;
+	// 排队时间阈值，规则与 overload_threshold 一样，超过后翻倍，队列为空时复原
+	uint64_t overload_wait_threshold;
+	// 排队时间直方图，开启时间戳时才有
+	struct histogram *wait;
 	// 环形缓冲区，用于存储消息
 	struct skynet_message *queue;
+	// 与 queue 一一对应的入队时间，单位纳秒，开启时间戳时才有，不开启时消息结构不必变大
+	uint64_t *time;
+	// 最近一次 pop 出的消息的入队时间，只有处理这个队列的工作线程会读写
+	uint64_t pop_time;
 	// 下一个服务消息队列指针
 	struct message_queue *next;
 };
@@ -62,6 +76,10 @@ struct global_queue {
 
 // 全局队列对象
 static struct global_queue *Q = NULL;
+// 入队时是否记录时间戳
+static int TIMESTAMP = 0;
+// 排队时间报警阈值，单位纳秒，0 表示关闭
+static uint64_t WAIT_OVERLOAD = 0;
 
 void 
 skynet_globalmq_push(struct message_queue * queue) {
@@ -114,6 +132,16 @@ skynet_mq_create(uint32_t handle) {
 	q->release = 0;
 	q->overload = 0;
 	q->overload_threshold = MQ_OVERLOAD;
+	q->overload_wait = 0;
+	q->overload_wait_threshold = WAIT_OVERLOAD;
+	q->wait = NULL;
+	q->time = NULL;
+	q->pop_time = 0;
+	if (TIMESTAMP) {
+		q->wait = skynet_malloc(sizeof(struct histogram));
+		memset(q->wait, 0, sizeof(struct histogram));
+		q->time = skynet_malloc(sizeof(uint64_t) * q->cap);
+	}
 	q->queue = skynet_malloc(sizeof(struct skynet_message) * q->cap);
 	q->next = NULL;
 
@@ -125,6 +153,8 @@ static void
 _release(struct message_queue *q) {
 	assert(q->next == NULL);
 	SPIN_DESTROY(q)
+	skynet_free(q->wait);
+	skynet_free(q->time);
 	skynet_free(q->queue);
 	skynet_free(q);
 }
@@ -160,12 +190,56 @@ skynet_mq_overload(struct message_queue *q) {
 	return 0;
 }
 
+int
+skynet_mq_overload_wait(struct message_queue *q) {
+	if (q->overload_wait) {
+		uint64_t wait = q->overload_wait;
+		q->overload_wait = 0;
+		return (int)(wait / 1000000);
+	}
+	return 0;
+}
+
+uint64_t
+skynet_mq_wait_percentile(struct message_queue *q, double p) {
+	if (q->wait == NULL)
+		return 0;
+	SPIN_LOCK(q)
+	uint64_t ti = skynet_histogram_percentile(q->wait, p);
+	SPIN_UNLOCK(q)
+	return ti;
+}
+
+// 在锁内调用，统计排队时间并检查是否超过阈值
+static void
+record_wait(struct message_queue *q, uint64_t time, uint64_t now) {
+	if (time == 0 || now <= time)
+		return;
+	uint64_t wait = now - time;
+	if (q->wait->count >= MQ_WAIT_WINDOW) {
+		skynet_histogram_decay(q->wait);
+	}
+	skynet_histogram_add(q->wait, wait);
+	if (WAIT_OVERLOAD && wait > q->overload_wait_threshold) {
+		q->overload_wait = wait;
+		while (wait > q->overload_wait_threshold) {
+			q->overload_wait_threshold *= 2;
+		}
+	}
+}
+
 int
 skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
 	int ret = 1;
+	// 取时间放在锁外
+	uint64_t now = q->wait ? skynet_monotonic_time() : 0;
 	SPIN_LOCK(q)
 
 	if (q->head != q->tail) {
+		if (q->time) {
+			q->pop_time = q->time[q->head];
+			record_wait(q, q->pop_time, now);
+		}
 		*message = q->queue[q->head++];
 		ret = 0;
 		int head = q->head;
@@ -186,6 +260,7 @@ skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
 	} else {
 		// reset overload_threshold when queue is empty
 		q->overload_threshold = MQ_OVERLOAD;
+		q->overload_wait_threshold = WAIT_OVERLOAD;
 	}
 
 	if (ret) {
@@ -206,6 +281,14 @@ expand_queue(struct message_queue *q) {
 	for (i=0;i<q->cap;i++) {
 		new_queue[i] = q->queue[(q->head + i) % q->cap];
 	}
+	if (q->time) {
+		uint64_t *new_time = skynet_malloc(sizeof(uint64_t) * q->cap * 2);
+		for (i=0;i<q->cap;i++) {
+			new_time[i] = q->time[(q->head + i) % q->cap];
+		}
+		skynet_free(q->time);
+		q->time = new_time;
+	}
 	q->head = 0;
 	q->tail = q->cap;
 	q->cap *= 2;
@@ -217,8 +300,12 @@ expand_queue(struct message_queue *q) {
 void 
 skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
 	assert(message);
+	uint64_t now = q->time ? skynet_monotonic_time() : 0;
 	SPIN_LOCK(q)
 
+	if (q->time) {
+		q->time[q->tail] = now;
+	}
 	q->queue[q->tail] = *message;
 	if (++ q->tail >= q->cap) {
 		q->tail = 0;
@@ -245,6 +332,26 @@ skynet_mq_init() {
 	Q=q;
 }
 
+uint64_t
+skynet_mq_pop_time(struct message_queue *q) {
+	return q->pop_time;
+}
+
+void
+skynet_mq_timestamp(int enable) {
+	if (enable) {
+		TIMESTAMP = 1;
+	}
+}
+
+void
+skynet_mq_wait_overload(int ms) {
+	if (ms > 0) {
+		WAIT_OVERLOAD = (uint64_t)ms * 1000000;
+		TIMESTAMP = 1;
+	}
+}
+
 void 
 skynet_mq_mark_release(struct message_queue *q) {
 	SPIN_LOCK(q)
@@ -23,6 +23,9 @@ struct skynet_message {
 #define MESSAGE_TYPE_MASK (SIZE_MAX >> 8)
 // 消息类型偏移量
 #define MESSAGE_TYPE_SHIFT ((sizeof(size_t)-1) * 8)
+// 长度的最高位标记数据是 skynet_sendmulti 共享的带引用计数的内存块，不能直接 skynet_free
+#define MESSAGE_SHARED ((size_t)1 << (MESSAGE_TYPE_SHIFT - 1))
+#define MESSAGE_SIZE_MASK (MESSAGE_TYPE_MASK >> 1)
 
 struct message_queue;
 
@@ -47,14 +50,24 @@ uint32_t skynet_mq_handle(struct message_queue *);
 int skynet_mq_pop(struct message_queue *q, struct skynet_message *message);
 // 将一条消息压入到当前服务对应消息队列中
 void skynet_mq_push(struct message_queue *q, struct skynet_message *message);
+// 最近一次 pop 出的消息的入队时间，单位纳秒，没有开启时间戳时返回 0
+uint64_t skynet_mq_pop_time(struct message_queue *q);
 
 // return the length of message queue, for debug
 // 当前未读消息个数，用于调试
 int skynet_mq_length(struct message_queue *q);
 // 未读消息是否超过阈值
 int skynet_mq_overload(struct message_queue *q);
+// 消息排队时间是否超过阈值，返回超过阈值的排队时间(毫秒)
+int skynet_mq_overload_wait(struct message_queue *q);
+// 最近一段时间消息排队时间的百分位数(p 取 0~1)，单位纳秒，没有开启时间戳时返回 0
+uint64_t skynet_mq_wait_percentile(struct message_queue *q, double p);
 
 // 初始化全局队列
 void skynet_mq_init();
+// 开启后，入队时记录消息的时间戳
+void skynet_mq_timestamp(int enable);
+// 设置排队时间报警阈值(毫秒)，0 表示关闭，开启时会同时开启时间戳
+void skynet_mq_wait_overload(int ms);
 
 #endif
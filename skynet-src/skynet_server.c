@@ -10,6 +10,7 @@
 #include "skynet_monitor.h"
 #include "skynet_imp.h"
 #include "skynet_log.h"
+#include "skynet_histogram.h"
 #include "spinlock.h"
 #include "atomic.h"
 
@@ -71,6 +72,10 @@ struct skynet_context {
 	bool endless;
 	// 是否开启CPU耗时监测
 	bool profile;
+	// 按消息类型统计的排队/处理耗时直方图，开启 profile_histogram 时才有
+	struct histogram_set * histogram;
+	// 回调从不保留消息，共享数据可以原地派发
+	bool noreserve;
 
 	CHECKCALLING_DECL
 };
@@ -86,6 +91,8 @@ struct skynet_node {
 	pthread_key_t handle_key;
 	// 是否开启CPU耗时监测 默认开启
 	bool profile;	// default is on
+	// 是否统计消息耗时直方图 默认关闭
+	bool histogram;
 };
 
 // 全局节点信息对象
@@ -135,11 +142,70 @@ struct drop_t {
 	uint32_t handle;
 };
 
+// skynet_sendmulti 的共享数据块，数据前面是引用计数，保持 16 字节对齐
+struct shared_message {
+	ATOM_INT ref;
+};
+
+#define SHARED_HEADER 16
+
+static inline struct shared_message *
+shared_header(void *data) {
+	return (struct shared_message *)((char *)data - SHARED_HEADER);
+}
+
+static void
+shared_release(void *data) {
+	struct shared_message * h = shared_header(data);
+	if (ATOM_FDEC(&h->ref) == 1) {
+		skynet_free(h);
+	}
+}
+
+// 按消息类型注册的数据释放函数，为 0 时用 skynet_free
+static ATOM_POINTER MESSAGE_RELEASE[256];
+
+void
+skynet_message_release(int type, void (*release)(void *msg)) {
+	ATOM_STORE(&MESSAGE_RELEASE[type & 0xff], (uintptr_t)release);
+}
+
+static void
+release_data(int type, void *data) {
+	void (*release)(void *) = (void (*)(void *))ATOM_LOAD(&MESSAGE_RELEASE[type & 0xff]);
+	if (release) {
+		release(data);
+	} else {
+		skynet_free(data);
+	}
+}
+
+static void
+free_message(struct skynet_message *msg) {
+	if (msg->sz & MESSAGE_SHARED) {
+		shared_release(msg->data);
+	} else {
+		release_data((int)(msg->sz >> MESSAGE_TYPE_SHIFT), msg->data);
+	}
+}
+
+// 发往其他节点的数据由 harbor 服务用 skynet_free 释放，有注册释放函数的类型先复制一份
+static void *
+detach_data(int type, void *data, size_t sz) {
+	void (*release)(void *) = (void (*)(void *))ATOM_LOAD(&MESSAGE_RELEASE[type & 0xff]);
+	if (release == NULL || data == NULL)
+		return data;
+	void * copy = skynet_malloc(sz);
+	memcpy(copy, data, sz);
+	release(data);
+	return copy;
+}
+
 // 服务销毁前，将队列中的消息全部发送给源服务，报告错误
 static void
 drop_message(struct skynet_message *msg, void *ud) {
 	struct drop_t *d = ud;
-	skynet_free(msg->data);
+	free_message(msg);
 	uint32_t source = d->handle;
 	assert(source);
 	// report error to the message source
@@ -175,6 +241,8 @@ skynet_context_new(const char * name, const char *param) {
 	ctx->cpu_start = 0;
 	ctx->message_count = 0;
 	ctx->profile = G_NODE.profile;
+	ctx->histogram = G_NODE.histogram ? skynet_histogram_new() : NULL;
+	ctx->noreserve = false;
 	// Should set to 0 first to avoid skynet_handle_retireall get an uninitialized handle
 	ctx->handle = 0;	
 	ctx->handle = skynet_handle_register(ctx);
@@ -243,6 +311,7 @@ delete_context(struct skynet_context *ctx) {
 	}
 	skynet_module_instance_release(ctx->mod, ctx->instance);
 	skynet_mq_mark_release(ctx->queue);
+	skynet_histogram_delete(ctx->histogram);
 	CHECKCALLING_DESTROY(ctx)
 	skynet_free(ctx);
 	context_dec();
@@ -298,13 +367,25 @@ dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	// 消息类型
 	int type = msg->sz >> MESSAGE_TYPE_SHIFT;
 	// 消息长度
-	size_t sz = msg->sz & MESSAGE_TYPE_MASK;
+	size_t sz = msg->sz & MESSAGE_SIZE_MASK;
+	if ((msg->sz & MESSAGE_SHARED) && !ctx->noreserve) {
+		// 回调可能保留消息并自行释放，给它一份独立的数据
+		void * data = skynet_malloc(sz+1);
+		memcpy(data, msg->data, sz+1);
+		shared_release(msg->data);
+		msg->data = data;
+		msg->sz &= ~MESSAGE_SHARED;
+	}
 	FILE *f = (FILE *)ATOM_LOAD(&ctx->logfile);
 	if (f) {
 		// 如果存在文件句柄，记录服务日志
 		skynet_log_output(f, msg->source, type, msg->session, msg->data, sz);
 	}
 	++ctx->message_count;
+	uint64_t exec_start = 0;
+	if (ctx->histogram) {
+		exec_start = skynet_monotonic_time();
+	}
 	int reserve_msg;
 	if (ctx->profile) {
 		ctx->cpu_start = skynet_thread_time();
@@ -314,8 +395,18 @@ dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	} else {
 		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, msg->data, sz);
 	}
+	if (ctx->histogram) {
+		uint64_t now = skynet_monotonic_time();
+		// 消息可能在其他线程入队，时间戳不能保证严格早于这里
+		uint64_t wait = 0;
+		uint64_t push_time = skynet_mq_pop_time(ctx->queue);
+		if (push_time) {
+			wait = exec_start > push_time ? exec_start - push_time : 1;
+		}
+		skynet_histogram_record(ctx->histogram, type, wait, now - exec_start);
+	}
 	if (!reserve_msg) {
-		skynet_free(msg->data);
+		free_message(msg);
 	}
 	CHECKCALLING_END(ctx)
 }
@@ -371,13 +462,17 @@ skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue
 		if (overload) {
 			skynet_error(ctx, "May overload, message queue length = %d", overload);
 		}
+		int overload_wait = skynet_mq_overload_wait(q);
+		if (overload_wait) {
+			skynet_error(ctx, "May overload, message queue wait = %d ms", overload_wait);
+		}
 
 		// 触发监控器，记录消息来源和处理服务句柄
 		skynet_monitor_trigger(sm, msg.source , handle);
 
 		if (ctx->cb == NULL) {
 			// 没有处理函数? 释放消息数据
-			skynet_free(msg.data);
+			free_message(&msg);
 		} else {
 			// 处理服务消息
 			dispatch_message(ctx, &msg);
@@ -629,6 +724,21 @@ cmd_stat(struct skynet_context * context, const char * param) {
 		}
 	} else if (strcmp(param, "message") == 0) {
 		sprintf(context->result, "%zu", context->message_count);
+	} else if (strcmp(param, "wait50") == 0 || strcmp(param, "wait99") == 0) {
+		double p = param[4] == '5' ? 0.5 : 0.99;
+		double t = (double)skynet_mq_wait_percentile(context->queue, p) / 1000000000.0;	// nanosec
+		sprintf(context->result, "%lf", t);
+	} else if (strcmp(param, "histogram") == 0) {
+		// 结果太长，放不进 context->result
+		if (context->histogram) {
+			return skynet_histogram_dump(context->histogram);
+		}
+		context->result[0] = '\0';
+	} else if (strcmp(param, "histogram_reset") == 0) {
+		if (context->histogram) {
+			skynet_histogram_reset(context->histogram);
+		}
+		context->result[0] = '\0';
 	} else {
 		context->result[0] = '\0';
 	}
@@ -757,10 +867,10 @@ _filter_args(struct skynet_context * context, int type, int *session, void ** da
 
 int
 skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * data, size_t sz) {
-	if ((sz & MESSAGE_TYPE_MASK) != sz) {
+	if ((sz & MESSAGE_SIZE_MASK) != sz) {
 		skynet_error(context, "The message to %x is too large", destination);
 		if (type & PTYPE_TAG_DONTCOPY) {
-			skynet_free(data);
+			release_data(type, data);
 		}
 		return -2;
 	}
@@ -773,7 +883,7 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 	if (destination == 0) {
 		if (data) {
 			skynet_error(context, "Destination address can't be 0");
-			skynet_free(data);
+			release_data((int)(sz >> MESSAGE_TYPE_SHIFT), data);
 			return -1;
 		}
 
@@ -782,7 +892,7 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 	if (skynet_harbor_message_isremote(destination)) {
 		struct remote_message * rmsg = skynet_malloc(sizeof(*rmsg));
 		rmsg->destination.handle = destination;
-		rmsg->message = data;
+		rmsg->message = detach_data((int)(sz >> MESSAGE_TYPE_SHIFT), data, sz & MESSAGE_SIZE_MASK);
 		rmsg->sz = sz & MESSAGE_TYPE_MASK;
 		rmsg->type = sz >> MESSAGE_TYPE_SHIFT;
 		skynet_harbor_send(rmsg, source, session);
@@ -794,7 +904,7 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 		smsg.sz = sz;
 
 		if (skynet_context_push(destination, &smsg)) {
-			skynet_free(data);
+			release_data((int)(sz >> MESSAGE_TYPE_SHIFT), data);
 			return -1;
 		}
 	}
@@ -813,24 +923,31 @@ skynet_sendname(struct skynet_context * context, uint32_t source, const char * a
 		des = skynet_handle_findname(addr + 1);
 		if (des == 0) {
 			if (type & PTYPE_TAG_DONTCOPY) {
-				skynet_free(data);
+				release_data(type, data);
 			}
 			return -1;
 		}
 	} else {
-		if ((sz & MESSAGE_TYPE_MASK) != sz) {
+		char name[GLOBALNAME_LENGTH];
+		copy_name(name, addr);
+		des = skynet_harbor_findname(name);
+		if (des) {
+			// the global name is resolved by harbor, send it as a handle
+			return skynet_send(context, source, des, type, session, data, sz);
+		}
+		if ((sz & MESSAGE_SIZE_MASK) != sz) {
 			skynet_error(context, "The message to %s is too large", addr);
 			if (type & PTYPE_TAG_DONTCOPY) {
-				skynet_free(data);
+				release_data(type, data);
 			}
 			return -2;
 		}
 		_filter_args(context, type, &session, (void **)&data, &sz);
 
 		struct remote_message * rmsg = skynet_malloc(sizeof(*rmsg));
-		copy_name(rmsg->destination.name, addr);
+		memcpy(rmsg->destination.name, name, GLOBALNAME_LENGTH);
 		rmsg->destination.handle = 0;
-		rmsg->message = data;
+		rmsg->message = detach_data((int)(sz >> MESSAGE_TYPE_SHIFT), data, sz & MESSAGE_SIZE_MASK);
 		rmsg->sz = sz & MESSAGE_TYPE_MASK;
 		rmsg->type = sz >> MESSAGE_TYPE_SHIFT;
 
@@ -841,6 +958,67 @@ skynet_sendname(struct skynet_context * context, uint32_t source, const char * a
 	return skynet_send(context, source, des, type, session, data, sz);
 }
 
+// 每批查找的服务数量
+#define MULTI_BATCH 64
+
+int
+skynet_sendmulti(struct skynet_context * context, uint32_t source, const uint32_t * destination, int n, int type, int session, const void * data, size_t sz) {
+	if ((sz & MESSAGE_SIZE_MASK) != sz) {
+		skynet_error(context, "The multi message is too large");
+		return -2;
+	}
+	if (source == 0) {
+		source = context->handle;
+	}
+	type &= 0xff;
+
+	// 数据只复制一次，发送期间自己持有一个引用
+	struct shared_message * h = skynet_malloc(SHARED_HEADER + sz + 1);
+	ATOM_INIT(&h->ref, 1);
+	char * payload = (char *)h + SHARED_HEADER;
+	if (sz > 0) {
+		memcpy(payload, data, sz);
+	}
+	payload[sz] = '\0';
+
+	struct skynet_message smsg;
+	smsg.source = source;
+	smsg.session = session;
+	smsg.data = payload;
+	smsg.sz = sz | (size_t)type << MESSAGE_TYPE_SHIFT | MESSAGE_SHARED;
+
+	struct skynet_context * ctx[MULTI_BATCH];
+	int sent = 0;
+	int i, j;
+	for (i=0;i<n;i+=MULTI_BATCH) {
+		int m = n - i < MULTI_BATCH ? n - i : MULTI_BATCH;
+		skynet_handle_grabmulti(destination + i, m, ctx);
+		int local = 0;
+		for (j=0;j<m;j++) {
+			if (ctx[j]) {
+				++local;
+			}
+		}
+		ATOM_FADD(&h->ref, local);
+		for (j=0;j<m;j++) {
+			uint32_t des = destination[i+j];
+			if (ctx[j]) {
+				skynet_mq_push(ctx[j]->queue, &smsg);
+				skynet_context_release(ctx[j]);
+				++sent;
+			} else if (des && skynet_harbor_message_isremote(des)) {
+				// 远程服务无法共享内存，退化成普通发送
+				if (skynet_send(context, source, des, type, session, payload, sz) >= 0) {
+					++sent;
+				}
+			}
+		}
+	}
+	shared_release(payload);
+
+	return sent;
+}
+
 uint32_t 
 skynet_context_handle(struct skynet_context *ctx) {
 	return ctx->handle;
@@ -852,6 +1030,11 @@ skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb) {
 	context->cb_ud = ud;
 }
 
+void
+skynet_callback_noreserve(struct skynet_context * context, int noreserve) {
+	context->noreserve = noreserve;
+}
+
 void
 skynet_context_send(struct skynet_context * ctx, void * msg, size_t sz, uint32_t source, int type, int session) {
 	struct skynet_message smsg;
@@ -891,3 +1074,9 @@ void
 skynet_profile_enable(int enable) {
 	G_NODE.profile = (bool)enable;
 }
+
+void
+skynet_histogram_enable(int enable) {
+	G_NODE.histogram = (bool)enable;
+	skynet_mq_timestamp(enable);
+}
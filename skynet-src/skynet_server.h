@@ -39,5 +39,7 @@ void skynet_globalexit(void);
 void skynet_initthread(int m);
 
 void skynet_profile_enable(int enable);
+// 统计每个服务按消息类型的排队/处理耗时直方图
+void skynet_histogram_enable(int enable);
 
 #endif
@@ -75,6 +75,25 @@ forward_message(int type, bool padding, struct socket_message * result) {
 	}
 }
 
+// mainloop thread, deliver each package to the target service directly as PTYPE_CLIENT (session is socket id)
+static void
+forward_package(struct socket_message * result) {
+	struct socket_package *pkg = (struct socket_package *)result->data;
+	uint32_t target = (uint32_t)result->opaque;
+	int i;
+	for (i=0;i<result->ud;i++) {
+		struct skynet_message message;
+		message.source = 0;
+		message.session = result->id;
+		message.data = pkg[i].buffer;
+		message.sz = (size_t)pkg[i].sz | ((size_t)PTYPE_CLIENT << MESSAGE_TYPE_SHIFT);
+		if (skynet_context_push(target, &message)) {
+			skynet_free(pkg[i].buffer);
+		}
+	}
+	skynet_free(pkg);
+}
+
 int 
 skynet_socket_poll() {
 	struct socket_server *ss = SOCKET_SERVER;
@@ -106,6 +125,9 @@ skynet_socket_poll() {
 	case SOCKET_WARNING:
 		forward_message(SKYNET_SOCKET_TYPE_WARNING, false, &result);
 		break;
+	case SOCKET_PACKAGE:
+		forward_package(&result);
+		break;
 	default:
 		skynet_error(NULL, "Unknown socket message type %d.",type);
 		return -1;
@@ -174,6 +196,11 @@ skynet_socket_nodelay(struct skynet_context *ctx, int id) {
 	socket_server_nodelay(SOCKET_SERVER, id);
 }
 
+void
+skynet_socket_redirect(struct skynet_context *ctx, int id, uint32_t target, int header) {
+	socket_server_redirect(SOCKET_SERVER, id, target, header);
+}
+
 int 
 skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port) {
 	uint32_t source = skynet_context_handle(ctx);
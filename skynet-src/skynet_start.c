@@ -319,6 +319,8 @@ skynet_start(struct skynet_config * config) {
 	skynet_socket_init();
 	// 开启性能分析
 	skynet_profile_enable(config->profile);
+	skynet_histogram_enable(config->profile_histogram);
+	skynet_mq_wait_overload(config->mq_wait_overload);
 
 	// 创建日志服务
 	struct skynet_context *ctx = skynet_context_new(config->logservice, config->logger);
@@ -290,3 +290,12 @@ skynet_thread_time(void) {
 
 	return (uint64_t)ti.tv_sec * MICROSEC + (uint64_t)ti.tv_nsec / (NANOSEC / MICROSEC);
 }
+
+// CLOCK_MONOTONIC 在 linux 下由 vdso 读 TSC 实现，不会陷入内核，可以在每条消息上使用
+uint64_t
+skynet_monotonic_time(void) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+
+	return (uint64_t)ti.tv_sec * NANOSEC + (uint64_t)ti.tv_nsec;
+}
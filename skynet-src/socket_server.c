@@ -22,6 +22,8 @@
 #define MAX_SOCKET_P 16
 #define MAX_EVENT 64
 #define MIN_READ_BUFFER 64
+// the same limit as service_gate
+#define MAX_FRAME_PACKAGE 0x1000000
 #define SOCKET_TYPE_INVALID 0
 #define SOCKET_TYPE_RESERVE 1
 #define SOCKET_TYPE_PLISTEN 2
@@ -86,6 +88,16 @@ struct socket_stat {
 	uint64_t write;
 };
 
+// Split the tcp stream into packages with a big-endian length header (2 or 4 bytes), see service_gate
+struct socket_frame {
+	int header;
+	int hlen;	// bytes of header already read
+	uint8_t hbuf[4];
+	int size;	// size of current package
+	int offset;	// bytes of current package already read
+	char * buffer;	// NULL when reading header
+};
+
 struct socket {
 	uintptr_t opaque;
 	struct wb_list high;
@@ -110,6 +122,8 @@ struct socket {
 	int dw_offset;
 	const void * dw_buffer;
 	size_t dw_size;
+	uintptr_t target;
+	struct socket_frame * frame;
 };
 
 struct socket_server {
@@ -197,6 +211,12 @@ struct request_dial_udp {
 	uint8_t address[UDP_ADDRESS_SIZE];
 };
 
+struct request_redirect {
+	int id;
+	int header;
+	uintptr_t target;
+};
+
 /*
 	The first byte is TYPE
 	R Resume socket
@@ -214,6 +234,7 @@ struct request_dial_udp {
 	N client dial to UDP host port
 	T Set opt
 	U Create UDP socket
+	F Split packages and redirect them (Frame)
  */
 
 struct request_package {
@@ -231,6 +252,7 @@ struct request_package {
 		struct request_udp udp;
 		struct request_setudp set_udp;
 		struct request_dial_udp dial_udp;
+		struct request_redirect redirect;
 	} u;
 	uint8_t dummy[256];
 };
@@ -487,6 +509,17 @@ clone_buffer(struct socket_sendbuffer *buf, size_t *sz) {
 	return NULL;
 }
 
+static void
+free_frame(struct socket *s) {
+	struct socket_frame *f = s->frame;
+	if (f) {
+		FREE(f->buffer);
+		FREE(f);
+		s->frame = NULL;
+	}
+	s->target = 0;
+}
+
 static void
 force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
 	result->id = s->id;
@@ -508,6 +541,7 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 		}
 	}
 	ATOM_STORE(&s->type, SOCKET_TYPE_INVALID);
+	free_frame(s);
 	if (s->dw_buffer) {
 		struct socket_sendbuffer tmp;
 		tmp.buffer = s->dw_buffer;
@@ -590,6 +624,8 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	check_wb_list(&s->low);
 	s->dw_buffer = NULL;
 	s->dw_size = 0;
+	s->target = 0;
+	s->frame = NULL;
 	memset(&s->stat, 0, sizeof(s->stat));
 	if (enable_read(ss, s, reading)) {
 		ATOM_STORE(&s->type , SOCKET_TYPE_INVALID);
@@ -1268,6 +1304,31 @@ setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
 }
 
+static void
+redirect_socket(struct socket_server *ss, struct request_redirect *request) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (socket_invalid(s, id) || s->protocol != PROTOCOL_TCP) {
+		return;
+	}
+	if (request->target == 0) {
+		// The incomplete package is dropped, the following stream goes to s->opaque as SOCKET_DATA.
+		free_frame(s);
+		return;
+	}
+	struct socket_frame *f = s->frame;
+	if (f == NULL) {
+		f = MALLOC(sizeof(*f));
+		memset(f, 0, sizeof(*f));
+		s->frame = f;
+	} else if (f->header != request->header) {
+		FREE(f->buffer);
+		memset(f, 0, sizeof(*f));
+	}
+	f->header = request->header;
+	s->target = request->target;
+}
+
 static void
 block_readpipe(int pipefd, void *buffer, int sz) {
 	for (;;) {
@@ -1449,6 +1510,9 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	case 'U':
 		add_udp_socket(ss, (struct request_udp *)buffer);
 		return -1;
+	case 'F':
+		redirect_socket(ss, (struct request_redirect *)buffer);
+		return -1;
 	default:
 		skynet_error(NULL, "socket-server: Unknown ctrl %c.",type);
 		return -1;
@@ -1457,6 +1521,107 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	return -1;
 }
 
+static int
+append_package(struct socket_package **pkg, int n, int *cap, char *buffer, int sz) {
+	if (n >= *cap) {
+		int newcap = *cap == 0 ? 4 : *cap * 2;
+		struct socket_package *p = MALLOC(newcap * sizeof(*p));
+		if (n > 0) {
+			memcpy(p, *pkg, n * sizeof(*p));
+			FREE(*pkg);
+		}
+		*pkg = p;
+		*cap = newcap;
+	}
+	(*pkg)[n].sz = sz;
+	(*pkg)[n].buffer = buffer;
+	return n + 1;
+}
+
+// return the number of complete packages, or -1 when a package is too large
+static int
+frame_split(struct socket_frame *f, const uint8_t *data, int n, struct socket_package **pkg) {
+	int count = 0;
+	int cap = 0;
+	*pkg = NULL;
+	while (n > 0) {
+		if (f->buffer == NULL) {
+			int need = f->header - f->hlen;
+			if (n < need) {
+				memcpy(f->hbuf + f->hlen, data, n);
+				f->hlen += n;
+				break;
+			}
+			memcpy(f->hbuf + f->hlen, data, need);
+			data += need;
+			n -= need;
+			f->hlen = 0;
+			int sz;
+			if (f->header == 2) {
+				sz = f->hbuf[0] << 8 | f->hbuf[1];
+			} else {
+				sz = (int)((uint32_t)f->hbuf[0] << 24 | f->hbuf[1] << 16 | f->hbuf[2] << 8 | f->hbuf[3]);
+			}
+			if (sz < 0 || sz >= MAX_FRAME_PACKAGE) {
+				int i;
+				for (i=0;i<count;i++) {
+					FREE((*pkg)[i].buffer);
+				}
+				FREE(*pkg);
+				*pkg = NULL;
+				return -1;
+			}
+			if (sz == 0) {
+				// empty package, ignore it (the same as service_gate)
+				continue;
+			}
+			f->size = sz;
+			f->offset = 0;
+			f->buffer = MALLOC(sz);
+		}
+		int bytes = f->size - f->offset;
+		if (bytes > n) {
+			bytes = n;
+		}
+		memcpy(f->buffer + f->offset, data, bytes);
+		f->offset += bytes;
+		data += bytes;
+		n -= bytes;
+		if (f->offset == f->size) {
+			count = append_package(pkg, count, &cap, f->buffer, f->size);
+			f->buffer = NULL;
+		}
+	}
+	return count;
+}
+
+// return -1 (ignore) when no complete package
+static int
+forward_message_frame(struct socket_server *ss, struct socket *s, char *buffer, int n, int sz, struct socket_message * result) {
+	struct socket_package *pkg;
+	int count = frame_split(s->frame, (const uint8_t *)buffer, n, &pkg);
+	FREE(buffer);
+	if (count < 0) {
+		// the stream can't be splited any more, stop reading and let s->opaque close it.
+		free_frame(s);
+		enable_read(ss, s, false);
+		return report_error(s, result, "package too large");
+	}
+	result->opaque = s->target;
+	result->id = s->id;
+	result->ud = count;
+	result->data = (char *)pkg;
+
+	if (n == sz) {
+		s->p.size *= 2;
+		return SOCKET_MORE;
+	} else if (sz > MIN_READ_BUFFER && n*2 < sz) {
+		s->p.size /= 2;
+	}
+
+	return count > 0 ? SOCKET_PACKAGE : -1;
+}
+
 // return -1 (ignore) when error
 static int
 forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
@@ -1505,6 +1670,10 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 
 	stat_read(ss,s,n);
 
+	if (s->frame) {
+		return forward_message_frame(ss, s, buffer, n, sz, result);
+	}
+
 	result->opaque = s->opaque;
 	result->id = s->id;
 	result->ud = n;
@@ -1765,6 +1934,13 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 					type = forward_message_tcp(ss, s, &l, result);
 					if (type == SOCKET_MORE) {
 						--ss->event_index;
+						if (s->frame) {
+							if (result->data == NULL) {
+								// no complete package yet, read again
+								continue;
+							}
+							return SOCKET_PACKAGE;
+						}
 						return SOCKET_DATA;
 					}
 				} else {
@@ -2109,6 +2285,15 @@ socket_server_nodelay(struct socket_server *ss, int id) {
 	send_request(ss, &request, 'T', sizeof(request.u.setopt));
 }
 
+void
+socket_server_redirect(struct socket_server *ss, int id, uintptr_t target, int header) {
+	struct request_package request;
+	request.u.redirect.id = id;
+	request.u.redirect.header = header;
+	request.u.redirect.target = target;
+	send_request(ss, &request, 'F', sizeof(request.u.redirect));
+}
+
 void 
 socket_server_userobject(struct socket_server *ss, struct socket_object_interface *soi) {
 	ss->soi = *soi;
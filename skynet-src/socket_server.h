@@ -13,6 +13,7 @@
 #define SOCKET_EXIT 5
 #define SOCKET_UDP 6
 #define SOCKET_WARNING 7
+#define SOCKET_PACKAGE 10
 
 // Only for internal use
 #define SOCKET_RST 8
@@ -27,6 +28,12 @@ struct socket_message {
 	char * data;
 };
 
+// SOCKET_PACKAGE : data is an array of socket_package, ud is the number of packages
+struct socket_package {
+	int sz;
+	char * buffer;
+};
+
 struct socket_server * socket_server_create(uint64_t time);
 void socket_server_release(struct socket_server *);
 void socket_server_updatetime(struct socket_server *, uint64_t time);
@@ -49,6 +56,9 @@ int socket_server_bind(struct socket_server *, uintptr_t opaque, int fd);
 
 // for tcp
 void socket_server_nodelay(struct socket_server *, int id);
+// split the stream by 2 or 4 bytes big-endian length header in socket thread, and forward each package to target.
+// target == 0 turns it off. Call it before socket_server_start to make sure the first package is splited.
+void socket_server_redirect(struct socket_server *, int id, uintptr_t target, int header);
 
 struct socket_udp_address;
 
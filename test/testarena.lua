@@ -0,0 +1,42 @@
+local skynet = require "skynet"
+local arena = require "skynet.arena"
+
+-- set lua_arena = true in config to enable per-service arena allocator
+
+local N = 200000
+
+local function bench()
+	local t = skynet.hpc()
+	local objs = {}
+	for i = 1, N do
+		objs[i] = { i, tostring(i), function() return i end }
+	end
+	local alloc_time = skynet.hpc() - t
+	-- drop half of them to make holes
+	for i = 1, N, 2 do
+		objs[i] = nil
+	end
+	t = skynet.hpc()
+	collectgarbage "collect"
+	local gc_time = skynet.hpc() - t
+	local kb = collectgarbage "count"
+	objs = nil
+	t = skynet.hpc()
+	collectgarbage "collect"
+	local free_time = skynet.hpc() - t
+	return alloc_time, gc_time, free_time, kb
+end
+
+skynet.start(function()
+	local alloc_time, gc_time, free_time, kb = bench()
+	skynet.error(string.format("alloc %d objects %.2f ms, gc %.2f ms, free all %.2f ms, lua mem %.2f K",
+		N, alloc_time / 1000000, gc_time / 1000000, free_time / 1000000, kb))
+	local info = arena.info()
+	if info then
+		skynet.error(string.format("arena reserved %.2f K, used %.2f K, fragmentation %.2f%%, alloc %d, reuse %d",
+			info.reserved / 1024, info.used / 1024, info.fragmentation * 100, info.alloc, info.reuse))
+	else
+		skynet.error("arena is off")
+	end
+	skynet.exit()
+end)
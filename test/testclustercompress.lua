@@ -0,0 +1,127 @@
+local skynet = require "skynet"
+local cluster = require "skynet.cluster"
+require "skynet.manager"
+
+-- cluster 压缩：本节点自环，分别用 不压缩 / 压缩 / 压缩+字典 三个节点名连接同一地址
+-- 校验各种大小的消息往返正确，并输出压缩前后字节数与 cpu 耗时
+-- usage : testclustercompress [requests]
+
+local mode = ...
+
+local ADDRESS = "127.0.0.1:2533"
+local THRESHOLD = 1024
+local REQUEST = 200
+
+if mode == "echo" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, ...)
+		skynet.retpack(...)
+	end)
+	cluster.register("echo", skynet.self())
+end)
+
+else
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function records(n)
+	local r = {}
+	for i = 1, n do
+		r[i] = { id = i, name = "player" .. i, level = i % 100, exp = i * 1.5, guild = "guild" .. (i % 7), online = i % 2 == 0 }
+	end
+	return r
+end
+
+local function random_string(n)
+	local t = {}
+	for i = 1, n do
+		t[i] = string.char(math.random(0, 255))
+	end
+	return table.concat(t)
+end
+
+local payloads = {
+	{ "small", { "login", 10001, "token" } },
+	{ "records", { records(100) } },	-- 约 6K
+	{ "large", { records(2000) } },	-- 大于 32K，走分片
+	{ "random", { random_string(8192) } },	-- 不可压缩，原样发送
+}
+
+local function bench(node, echo)
+	local start = skynet.hpc()
+	for _, p in ipairs(payloads) do
+		local args = p[2]
+		for _ = 1, REQUEST do
+			local r = table.pack(cluster.call(node, echo, table.unpack(args)))
+			assert(r.n == #args, p[1])
+			for i = 1, r.n do
+				assert(equal(r[i], args[i]), p[1])
+			end
+		end
+		cluster.send(node, echo, table.unpack(args))
+	end
+	-- 按名字调用也会压缩
+	assert(equal(cluster.call(node, "@echo", payloads[2][2][1]), payloads[2][2][1]))
+	return (skynet.hpc() - start) / 1e9
+end
+
+skynet.start(function()
+	REQUEST = tonumber(mode) or REQUEST
+	-- 每个节点名各自一个 clustersender，连接建立时协商，使用的是当时的配置
+	cluster.reload { raw = ADDRESS, self = ADDRESS }
+	cluster.open "self"
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	local ti = {}
+	ti.raw = bench("raw", echo)
+
+	cluster.reload { __compress = THRESHOLD, lz4 = ADDRESS }
+	ti.lz4 = bench("lz4", echo)
+
+	-- 用一条典型消息做字典
+	local dictfile = os.tmpname()
+	local f = assert(io.open(dictfile, "wb"))
+	f:write(skynet.packstring(records(20)))
+	f:close()
+	cluster.reload { __compress_dict = dictfile, dict = ADDRESS }
+	ti.dict = bench("dict", echo)
+	os.remove(dictfile)
+
+	local sender, agent, decompress = cluster.stat()
+	for _, node in ipairs { "raw", "lz4", "dict" } do
+		local s = sender[node]
+		local line = string.format("%-4s requests = %d bytes = %d time = %.2fs", node, s.request, s.bytes, ti[node])
+		if s.zcount then
+			line = line .. string.format(" compressed = %d raw = %d packed = %d (%.1f%%) cpu = %.0f us/MB",
+				s.zcount, s.zraw, s.zbytes, s.zbytes * 100 / s.zraw, s.ztime / 1000 / (s.zraw / 1048576))
+		end
+		print(line)
+	end
+	local zbytes, zraw, zcount, ztime = 0, 0, 0, 0
+	for _, s in pairs(agent) do
+		if s.zcount then
+			zcount, zraw, zbytes, ztime = zcount + s.zcount, zraw + s.zraw, zbytes + s.zbytes, ztime + s.ztime
+		end
+	end
+	print(string.format("responses compressed = %d raw = %d packed = %d (%.1f%%)", zcount, zraw, zbytes, zbytes * 100 / math.max(zraw, 1)))
+	print(string.format("decompress count = %d packed = %d raw = %d cpu = %.0f us/MB",
+		decompress.count, decompress.packed, decompress.raw, decompress.time / 1000 / math.max(decompress.raw / 1048576, 1e-9)))
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,79 @@
+local skynet = require "skynet"
+local cluster = require "skynet.cluster"
+require "skynet.manager"
+
+-- cluster 请求合帧：本节点自环 (同 examples/cluster1.lua 的配置方式)，并发小请求的吞吐、延迟与每帧请求数
+-- usage : testclusterpipe [concurrent] [requests]
+
+local mode, arg1 = ...
+
+if mode == "echo" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, ...)
+		skynet.retpack(...)
+	end)
+	cluster.register("echo", skynet.self())
+end)
+
+else
+
+local CONCURRENT = 100
+local REQUEST = 200
+
+local function bench(name, addr)
+	local co = coroutine.running()
+	local done = 0
+	local start = skynet.hpc()
+	for i = 1, CONCURRENT do
+		skynet.fork(function()
+			for j = 1, REQUEST do
+				local r = cluster.call("self", addr, i, j)
+				assert(r == i)
+			end
+			done = done + 1
+			if done == CONCURRENT then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ti = (skynet.hpc() - start) / 1e9
+	local n = CONCURRENT * REQUEST
+	print(string.format("%-6s requests = %d time = %.2fs (%d requests/s)", name, n, ti, math.floor(n / ti)))
+end
+
+skynet.start(function()
+	CONCURRENT = tonumber(mode) or CONCURRENT
+	REQUEST = tonumber(arg1) or REQUEST
+	cluster.reload { self = "127.0.0.1:2532" }
+	cluster.open "self"
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+
+	bench("handle", echo)
+	bench("name", "@echo")
+
+	-- 大于 32K 的请求走分片，和合帧的小请求交错
+	local big = string.rep("x", 100000)
+	local co = coroutine.running()
+	skynet.fork(function()
+		assert(cluster.call("self", echo, big) == big)
+		skynet.wakeup(co)
+	end)
+	cluster.send("self", echo, "push")
+	assert(cluster.call("self", echo, "small") == "small")
+	skynet.wait(co)
+
+	local sender, agent = cluster.stat()
+	for node, s in pairs(sender) do
+		print(string.format("sender %s requests = %d pushes = %d frames = %d (%.1f requests/frame) bytes = %d latency avg = %.0f us max = %.0f us errors = %d",
+			node, s.request, s.push, s.frame, (s.request + s.push) / s.frame, s.bytes, s.latency / s.request / 1000, s.maxlatency / 1000, s.error))
+	end
+	for fd, s in pairs(agent) do
+		print(string.format("agent  %d requests = %d pushes = %d frames = %d (%.1f responses/frame) bytes = %d",
+			fd, s.request, s.push, s.frame, s.request / s.frame, s.bytes))
+	end
+	skynet.exit()
+end)
+
+end
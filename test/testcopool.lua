@@ -0,0 +1,47 @@
+local skynet = require "skynet"
+
+local mode = ...
+
+if mode == "slave" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, ti)
+		skynet.sleep(ti)
+		skynet.ret()
+	end)
+end)
+
+else
+
+local function stat(title)
+	skynet.error(string.format("%s : pool %d hit %d miss %d live %d", title,
+		skynet.stat "copool", skynet.stat "cohit", skynet.stat "comiss", skynet.stat "colive"))
+end
+
+local function burst(slave, n)
+	local co = coroutine.running()
+	local count = n
+	for i = 1, n do
+		skynet.fork(function()
+			skynet.call(slave, "lua", 10)
+			count = count - 1
+			if count == 0 then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+end
+
+skynet.start(function()
+	local slave = skynet.newservice(SERVICE_NAME, "slave")
+	burst(slave, 1000)
+	stat("burst 1000")
+	burst(slave, 10)
+	stat("burst 10")
+	skynet.coroutine_pool(8)
+	stat("shrink to 8")
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,153 @@
+local skynet = require "skynet"
+local builder = require "skynet.datasheet.builder"
+local datasheet = require "skynet.datasheet"
+local dump = require "skynet.datasheet.dump"
+
+-- 同构的记录数组按列存储：整数按范围压缩，字符串每列一个字典，行按需生成 proxy
+-- 对比按行存储的文档大小、扫描 (level > 50) 的耗时和内存
+-- usage : testdatasheetcolumns [rows]
+
+local ROW = tonumber((...)) or 20000
+local COLUMN = 20
+
+local function items(n, version)
+	local t = {}
+	for i = 1, n do
+		local item = {
+			id = 100000 + i,
+			level = i % 100,
+			name = "item_" .. (i % 300),
+			tradable = i % 3 == 0,
+			price = i * 1.5 + version,
+		}
+		for j = 1, COLUMN do
+			item["attr" .. j] = (i * j) % 1000 - 500
+		end
+		t[i] = item
+	end
+	return t
+end
+
+local function check(obj, t)
+	assert(#obj == #t)
+	for i, item in ipairs(t) do
+		local row = obj[i]
+		local n = 0
+		for k, v in pairs(row) do
+			assert(item[k] == v, k)
+			n = n + 1
+		end
+		for k, v in pairs(item) do
+			assert(row[k] == v, k)
+			n = n - 1
+		end
+		assert(n == 0)
+	end
+	assert(obj[#t + 1] == nil)
+	if #t > 0 then
+		-- 比列名长的 key，以及带 \0 的 key
+		assert(obj[1][string.rep("x", 4096)] == nil)
+		assert(obj[1]["id\0"] == nil)
+	end
+end
+
+local function elapsed(f, ...)
+	local start = skynet.hpc()
+	local r = f(...)
+	return (skynet.hpc() - start) / 1e6, r
+end
+
+local function scan(t)
+	local n = 0
+	for i = 1, #t do
+		if t[i].level > 50 then
+			n = n + 1
+		end
+	end
+	return n
+end
+
+local function scan_column(t)
+	local n = 0
+	for _, level in ipairs(datasheet.column(t, "level")) do
+		if level > 50 then
+			n = n + 1
+		end
+	end
+	return n
+end
+
+local function bench(name, f, t)
+	collectgarbage()
+	local mem = collectgarbage "count"
+	local ti, n = elapsed(f, t)
+	local ti2 = elapsed(f, t)
+	collectgarbage()
+	print(string.format("%-8s level > 50 : %d first = %.1f ms second = %.1f ms memory + %.0f K",
+		name, n, ti, ti2, collectgarbage "count" - mem))
+	return n
+end
+
+local function test_format()
+	-- 不同类型的列，包括整数和小数混合
+	local t = {}
+	for i = 1, 20 do
+		t[i] = { i = i * 1000, f = i % 2 == 0 and i or i + 0.5, b = i % 2 == 0, s = "s" .. i % 3, neg = -i }
+	end
+	-- 不是同构的数组，按行存储
+	local mixed = { { a = 1 }, { b = 2 } }
+	for i = 3, 20 do
+		mixed[i] = { a = i }
+	end
+	local v = { list = t, mixed = mixed, small = { { a = 1 } } }
+	assert(#dump.dump(v) < #dump.dump(v, true))
+	builder.new("format", v)
+	local obj = datasheet.query "format"
+	check(obj.list, t)
+	check(obj.mixed, mixed)
+	assert(obj.list[2].f == 2 and obj.list[3].f == 3.5 and obj.list[4].b == true)
+	local s = datasheet.column(obj.list, "s")
+	assert(#s == 20 and s[1] == "s1" and s[3] == "s0")
+	assert(datasheet.column(obj.mixed, "a")[20] == 20)
+
+	-- 热更新：已有的行 proxy 读到新值，删除的行报错
+	local row2, row20 = obj.list[2], obj.list[20]
+	for i = 1, 19 do
+		t[i].i = -i
+	end
+	t[20] = nil
+	builder.update("format", v)
+	skynet.sleep(10)
+	assert(row2.i == -2)
+	assert(obj.list[19].i == -19)
+	assert(not pcall(function() return row20.i end))
+	check(obj.list, t)
+	-- 少于 COLUMN_MINROWS 后变成按行存储
+	for i = 5, 19 do
+		t[i] = nil
+	end
+	builder.update("format", v)
+	skynet.sleep(10)
+	check(obj.list, t)
+	assert(not pcall(function() return row2.i end))
+end
+
+skynet.start(function()
+	test_format()
+
+	local t = items(ROW, 1)
+	local ti_row, rowdoc = elapsed(dump.dump, { items = t }, true)
+	local ti_column, columndoc = elapsed(dump.dump, { items = t }, false)
+	print(string.format("rows = %d columns = %d document by row = %d bytes (%.0f ms) by column = %d bytes (%.0f ms)",
+		ROW, COLUMN + 5, #rowdoc, ti_row, #columndoc, ti_column))
+	builder.new("byrow", rowdoc)
+	builder.new("bycolumn", columndoc)
+	local byrow = datasheet.query "byrow"
+	local bycolumn = datasheet.query "bycolumn"
+	local n = bench("row", scan, byrow.items)
+	assert(bench("column", scan_column, bycolumn.items) == n)
+	assert(bench("proxy", scan, bycolumn.items) == n)
+	check(bycolumn.items, t)
+	print("ok")
+	skynet.exit()
+end)
@@ -0,0 +1,124 @@
+local skynet = require "skynet"
+require "skynet.manager"
+local socket = require "skynet.socket"
+
+-- 对比 gate 转发与 socket 线程分包直达 agent 的吞吐
+-- 10k 个连接需要 ulimit -n 大于 20000 (客户端与服务端各占一个 fd)
+
+local mode, arg1, arg2, arg3 = ...
+
+local CLIENT = 10000
+local CLIENT_SERVICE = 8
+local PACKAGE = 20	-- 每个连接发送的包数
+local BATCH = 5	-- 每次 write 拼在一起的包数，让 socket 线程跨包切分
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = function(msg, sz) return msg, sz end,
+}
+
+if mode == "sink" then
+
+local count = 0
+local bytes = 0
+local total
+local waiting
+
+skynet.start(function()
+	skynet.dispatch("client", function(_, _, msg, sz)
+		skynet.ignoreret()	-- session is socket id
+		count = count + 1
+		bytes = bytes + sz
+		if count == total and waiting then
+			skynet.wakeup(waiting)
+		end
+	end)
+	skynet.dispatch("lua", function(_, _, n)
+		total = n
+		if count < total then
+			waiting = coroutine.running()
+			skynet.wait(waiting)
+		end
+		skynet.ret(skynet.pack(count, bytes))
+	end)
+end)
+
+elseif mode == "client" then
+
+local port, n = tonumber(arg1), tonumber(arg2)
+
+skynet.start(function()
+	local fds = {}
+	skynet.dispatch("lua", function(_, _, cmd)
+		if cmd == "close" then
+			for i = 1, n do
+				socket.close(fds[i])
+			end
+			skynet.ret()
+			skynet.exit()
+			return
+		end
+		for i = 1, n do
+			fds[i] = assert(socket.open("127.0.0.1", port))
+		end
+		local batch = {}
+		for i = 1, BATCH do
+			batch[i] = string.pack(">s2", string.rep(string.char(i), 16 + i * 8))
+		end
+		batch = table.concat(batch)
+		for _ = 1, PACKAGE // BATCH do
+			for i = 1, n do
+				socket.write(fds[i], batch)
+			end
+		end
+		skynet.ret()
+	end)
+end)
+
+else
+
+local function bench(cmd, port)
+	local gate = skynet.newservice("gate")
+	local sink = skynet.newservice(SERVICE_NAME, "sink")
+	local clients = {}
+	for i = 1, CLIENT_SERVICE do
+		clients[i] = skynet.newservice(SERVICE_NAME, "client", port, CLIENT // CLIENT_SERVICE)
+	end
+	local n = CLIENT_SERVICE * (CLIENT // CLIENT_SERVICE)
+	skynet.dispatch("lua", function(_, _, what, subcmd, fd)
+		if what == "socket" and subcmd == "open" then
+			if cmd == "forward" then
+				skynet.fork(skynet.call, gate, "lua", "forward", fd, 0, sink)
+			else
+				skynet.fork(skynet.call, gate, "lua", "redirect", fd, sink)
+			end
+		end
+	end)
+	skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = port, maxclient = n + 1, watchdog = skynet.self() })
+	local start = skynet.now()
+	for i = 1, CLIENT_SERVICE do
+		skynet.fork(skynet.call, clients[i], "lua")
+	end
+	local count, bytes = skynet.call(sink, "lua", n * PACKAGE)
+	local ti = (skynet.now() - start) / 100
+	print(string.format("%-8s clients = %d packages = %d bytes = %d time = %.2fs (%d packages/s)",
+		cmd, n, count, bytes, ti, math.floor(count / math.max(ti, 0.01))))
+	for i = 1, CLIENT_SERVICE do
+		skynet.call(clients[i], "lua", "close")
+	end
+	skynet.kill(gate)
+	skynet.kill(sink)
+end
+
+skynet.start(function()
+	CLIENT = tonumber(mode) or CLIENT
+	if CLIENT < CLIENT_SERVICE then
+		CLIENT_SERVICE = CLIENT
+	end
+	bench("forward", 8101)
+	bench("redirect", 8102)
+	skynet.exit()
+end)
+
+end
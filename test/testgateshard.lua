@@ -0,0 +1,149 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"
+
+-- 对比单个 gate 与分片 gate：连接风暴 (全部连接上报 open 并 forward 完成) 与稳定收包的耗时
+-- usage : testgateshard [client] [shard]
+
+local mode, arg1, arg2 = ...
+
+local CLIENT = 4000
+local SHARD = 4
+local CLIENT_SERVICE = 8
+local PACKAGE = 20
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = function(msg, sz) return msg, sz end,
+}
+
+if mode == "sink" then
+
+local count = 0
+local total
+local waiting
+
+skynet.start(function()
+	skynet.dispatch("client", function()
+		skynet.ignoreret()	-- session is socket id
+		count = count + 1
+		if count == total and waiting then
+			skynet.wakeup(waiting)
+		end
+	end)
+	skynet.dispatch("lua", function(_, _, n)
+		total = n
+		if count < total then
+			waiting = coroutine.running()
+			skynet.wait(waiting)
+		end
+		skynet.ret(skynet.pack(count))
+	end)
+end)
+
+elseif mode == "client" then
+
+local port, n = tonumber(arg1), tonumber(arg2)
+
+skynet.start(function()
+	local fds = {}
+	local CMD = {}
+	function CMD.connect()
+		for i = 1, n do
+			fds[i] = assert(socket.open("127.0.0.1", port))
+		end
+	end
+	function CMD.send()
+		local pack = string.pack(">s2", string.rep("x", 32))
+		for _ = 1, PACKAGE do
+			for i = 1, n do
+				socket.write(fds[i], pack)
+			end
+		end
+	end
+	function CMD.close()
+		for i = 1, n do
+			socket.close(fds[i])
+		end
+	end
+	skynet.dispatch("lua", function(_, _, cmd)
+		CMD[cmd]()
+		skynet.ret()
+	end)
+end)
+
+else
+
+local function bench(shard, port)
+	local gate = skynet.newservice("gate")
+	local sink = skynet.newservice(SERVICE_NAME, "sink")
+	local clients = {}
+	for i = 1, CLIENT_SERVICE do
+		clients[i] = skynet.newservice(SERVICE_NAME, "client", port, CLIENT // CLIENT_SERVICE)
+	end
+	local n = CLIENT_SERVICE * (CLIENT // CLIENT_SERVICE)
+	local opened = 0
+	local storm = coroutine.running()
+	skynet.dispatch("lua", function(_, _, what, subcmd, fd)
+		if what == "socket" and subcmd == "open" then
+			skynet.fork(function()
+				skynet.call(gate, "lua", "forward", fd, 0, sink)
+				opened = opened + 1
+				if opened == n then
+					skynet.wakeup(storm)
+				end
+			end)
+		end
+	end)
+	skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = port, maxclient = n + 1, shard = shard, watchdog = skynet.self() })
+
+	local function all(cmd)
+		local co = coroutine.running()
+		local done = 0
+		for i = 1, CLIENT_SERVICE do
+			skynet.fork(function()
+				skynet.call(clients[i], "lua", cmd)
+				done = done + 1
+				if done == CLIENT_SERVICE then
+					skynet.wakeup(co)
+				end
+			end)
+		end
+		skynet.wait(co)
+	end
+
+	local start = skynet.now()
+	all "connect"
+	if opened < n then
+		skynet.wait(storm)
+	end
+	local storm_ti = (skynet.now() - start) / 100
+
+	start = skynet.now()
+	skynet.fork(all, "send")
+	local count = skynet.call(sink, "lua", n * PACKAGE)
+	local ti = (skynet.now() - start) / 100
+	print(string.format("shard = %d clients = %d connect = %.2fs (%d conn/s) packages = %d time = %.2fs (%d packages/s)",
+		shard, n, storm_ti, math.floor(n / math.max(storm_ti, 0.01)), count, ti, math.floor(count / math.max(ti, 0.01))))
+
+	all "close"
+	for i = 1, CLIENT_SERVICE do
+		skynet.kill(clients[i])
+	end
+	skynet.kill(sink)
+	skynet.call(gate, "lua", "close")
+end
+
+skynet.start(function()
+	CLIENT = tonumber(mode) or CLIENT
+	SHARD = tonumber(arg1) or SHARD
+	if CLIENT < CLIENT_SERVICE then
+		CLIENT_SERVICE = CLIENT
+	end
+	bench(1, 8111)
+	bench(SHARD, 8112)
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,49 @@
+local skynet = require "skynet"
+
+local mode = ...
+
+if mode == "slave" then
+
+-- set policy at launch, run gc step when message queue is empty
+skynet.gcpolicy { mode = "incremental", pause = 150, idle = true, step = 64 }
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, n)
+		local t = {}
+		for i = 1, n do
+			t[i] = { i }
+		end
+		skynet.ret()
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local slave = skynet.newservice(SERVICE_NAME, "slave")
+	for i = 1, 1000 do
+		skynet.call(slave, "lua", 1000)
+	end
+	local stat = skynet.call(slave, "debug", "STAT")
+	skynet.error(string.format("incremental idle gc : %.3f ms", stat.gc * 1000))
+	-- change policy at runtime
+	local policy = skynet.call(slave, "debug", "GCPOLICY", { mode = "generational", idle = false })
+	skynet.error("policy", policy.mode, policy.idle)
+	for i = 1, 1000 do
+		skynet.call(slave, "lua", 1000)
+	end
+	stat = skynet.call(slave, "debug", "STAT")
+	skynet.error(string.format("generational : %.3f ms, mem %.2f K", stat.gc * 1000, skynet.call(slave, "debug", "MEM")))
+	-- idle gc 总是使用 incremental 模式，generational 模式下每一步都是一次完整的 minor gc
+	policy = skynet.call(slave, "debug", "GCPOLICY", { mode = "generational", idle = true })
+	assert(policy.mode == "incremental" and policy.idle)
+	local last = stat.gc
+	for i = 1, 1000 do
+		skynet.call(slave, "lua", 1000)
+	end
+	stat = skynet.call(slave, "debug", "STAT")
+	skynet.error(string.format("generational -> incremental idle gc : %.3f ms, mem %.2f K", (stat.gc - last) * 1000, skynet.call(slave, "debug", "MEM")))
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,71 @@
+local skynet = require "skynet"
+
+-- set profile_histogram = true in config for the queue/exec histogram
+
+local mode = ...
+
+if mode == "slave" then
+
+local CMD = {}
+
+function CMD.fast()
+	skynet.ret()
+end
+
+function CMD.slow(n)
+	local t = {}
+	for i = 1, n do
+		t[i] = tostring(i)
+	end
+	skynet.ret()
+end
+
+-- 让出后再做同样多的工作，profile 统计的是所有 resume 的时间之和
+function CMD.yield(n)
+	skynet.yield()
+	CMD.slow(n)
+end
+
+-- 未知的命令名都一样处理，用来测试命令名个数的上限
+setmetatable(CMD, { __index = function() return CMD.fast end })
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, cmd, ...)
+		CMD[cmd](...)
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local slave = skynet.newservice(SERVICE_NAME, "slave")
+	skynet.call(slave, "debug", "PROFILE", true)
+	for i = 1, 1000 do
+		skynet.call(slave, "lua", "fast")
+		skynet.send(slave, "lua", "slow", 1000)
+		skynet.send(slave, "lua", "yield", 1000)
+	end
+	for i = 1, 300 do
+		skynet.send(slave, "lua", "cmd" .. i)
+	end
+	skynet.call(slave, "lua", "fast")
+	local prof = skynet.call(slave, "debug", "PROFILE")
+	local n = 0
+	for name, h in pairs(prof) do
+		n = n + 1
+		if not name:find "^lua%.cmd" then
+			skynet.error(string.format("%s count %d avg %.3fus max %.3fus", name, h.count, h.total / h.count / 1000, h.max / 1000))
+		end
+	end
+	skynet.error("profile names", n)
+	assert(n <= 256 + 1 and prof["lua.other"].count > 0)	-- 256 个命令名加上 other
+	assert(prof["lua.yield"].count == 1000)
+	-- type queue|exec count total max slots...
+	local dump = skynet.call(slave, "debug", "HISTOGRAM")
+	for line in dump:gmatch "[^\n]+" do
+		skynet.error(line)
+	end
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,146 @@
+local skynet = require "skynet"
+local datacenter = require "skynet.datacenter"
+
+-- datacenter 的数据存放在 skynet.kvstore 中，本进程的服务直接读写
+-- 对比多个服务并发读写时，直接访问和经过 DATACENTER 服务 (rpc) 的 ops/s
+-- usage : testkvstore [clients]
+
+local mode = ...
+
+local N = 20000
+
+if mode == "client" then
+
+local api = {}
+
+function api.direct(...)
+	return datacenter.get(...)
+end
+
+function api.rpc(...)
+	return skynet.call("DATACENTER", "lua", "QUERY", ...)
+end
+
+local set = {
+	direct = datacenter.set,
+	rpc = function(...)
+		return skynet.call("DATACENTER", "lua", "UPDATE", ...)
+	end,
+}
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, kind, id)
+		local get = api[kind]
+		local update = set[kind]
+		local start = skynet.hpc()
+		for i = 1, N do
+			local key = "session" .. (i % 1000)
+			if i % 4 == 0 then	-- 1/4 写
+				update("bench", key, id, i)
+			else
+				get("bench", key, id)
+			end
+		end
+		skynet.ret(skynet.pack(skynet.hpc() - start))
+		skynet.exit()
+	end)
+end)
+
+else
+
+local function bench(kind, clients)
+	local co = coroutine.running()
+	local done = 0
+	local start = skynet.hpc()
+	for i = 1, clients do
+		local c = skynet.newservice(SERVICE_NAME, "client")
+		skynet.fork(function()
+			skynet.call(c, "lua", kind, i)
+			done = done + 1
+			if done == clients then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ti = (skynet.hpc() - start) / 1e9
+	print(string.format("%-8s clients = %d ops = %d %.0f ops/s", kind, clients, N * clients, N * clients / ti))
+end
+
+local function test()
+	-- 嵌套的 key
+	assert(datacenter.set("player", 1, { name = "alice", pos = { x = 1, y = 2 } }) == nil)
+	assert(datacenter.get("player", 1, "pos", "y") == 2)
+	assert(datacenter.get("player", 1).name == "alice")
+	assert(datacenter.set("player", 1, "name", "bob") == "alice")
+	assert(datacenter.get("player", 1, "name") == "bob")
+	assert(datacenter.get("player", 2) == nil)
+	assert(datacenter.get("player", 1, "name", "x") == nil)
+	assert(not pcall(datacenter.set, "player", 1, "name", "x", 1))	-- name 不是分支
+	assert(not pcall(datacenter.set, "player", 3, print))
+	assert(datacenter.set("player", 1, "pos", nil).x == 1)	-- 删除
+	assert(datacenter.get("player", 1, "pos") == nil)
+	assert(datacenter.get(1.0) == nil and datacenter.set(2.0, "two") == nil and datacenter.get(2) == "two")
+	-- 值保持 float / integer 子类型，只有 key 会规整
+	datacenter.set("float", 2.0)
+	assert(math.type(datacenter.get("float")) == "float")
+	datacenter.set("float", { a = 1.0, b = 1, [3.0] = 3.0 })
+	local f = datacenter.get("float")
+	assert(math.type(f.a) == "float" and math.type(f.b) == "integer")
+	assert(math.type(f[3]) == "float")
+	assert(math.type(datacenter.get("float", "a")) == "float")
+	-- 经过服务和直接访问是同一份数据
+	assert(skynet.call("DATACENTER", "lua", "QUERY", "player", 1, "name") == "bob")
+
+	-- wait
+	local result = {}
+	skynet.fork(function()
+		result.leaf = datacenter.wait("match", "room", "owner")
+	end)
+	skynet.fork(function()
+		result.branch = pcall(datacenter.wait, "match")	-- 等待的是分支，失败
+	end)
+	skynet.fork(function()
+		result.deep = datacenter.wait("match", "room", "info", "level")	-- 设置上层的表时唤醒
+	end)
+	skynet.sleep(1)
+	datacenter.set("match", "room", "owner", "alice")
+	datacenter.set("match", "room", "info", { level = 10 })
+	skynet.sleep(10)
+	assert(result.leaf == "alice")
+	assert(result.branch == false)
+	assert(result.deep == 10)
+	assert(datacenter.wait("match", "room", "owner") == "alice")
+
+	-- 替换已有的上层表，也要唤醒等待更深路径的
+	skynet.fork(function()
+		result.replace = datacenter.wait("match", "room", "info", "mode")
+	end)
+	skynet.sleep(1)
+	datacenter.set("match", "room", "info", { level = 11, mode = "pvp" })
+	skynet.sleep(10)
+	assert(result.replace == "pvp")
+
+	-- get 构造 lua 值时可能触发 gc，析构函数里写同一个 key 不能死锁
+	local big = {}
+	for i = 1, 1000 do
+		big[i] = string.rep("x", 100) .. i
+	end
+	datacenter.set("gc", big)
+	for i = 1, 100 do
+		setmetatable({}, { __gc = function() datacenter.set("gc", i, "finalizer") end })
+		assert(#datacenter.get("gc") == 1000)
+	end
+	collectgarbage()
+end
+
+skynet.start(function()
+	test()
+	local clients = tonumber(mode) or 3	-- 少于工作线程数
+	bench("rpc", clients)
+	bench("direct", clients)
+	print("ok")
+	skynet.exit()
+end)
+
+end
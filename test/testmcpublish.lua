@@ -0,0 +1,83 @@
+local skynet = require "skynet"
+local multicast = require "skynet.multicast"
+local mc = require "skynet.multicast.core"
+require "skynet.manager"
+
+-- multicast 发布延迟 (发布到最后一个订阅者收到)：发布者直接推送到订阅者队列，对比经过 multicastd 转一次
+-- usage : testmcpublish [subscribers] [messages]
+
+local mode, arg1 = ...
+
+if mode == "sub" then
+
+skynet.start(function()
+	local channel
+	skynet.dispatch("lua", function(_, source, _, c)
+		channel = multicast.new {
+			channel = c,
+			dispatch = function(_, _, t)
+				skynet.send(source, "lua", t, skynet.hpc())
+			end,
+		}
+		channel:subscribe()
+		skynet.ret()
+	end)
+end)
+
+else
+
+local SUB = 2000
+local MESSAGE = 20
+
+skynet.start(function()
+	SUB = tonumber(mode) or SUB
+	MESSAGE = tonumber(arg1) or MESSAGE
+	local done, first, last, waiting
+	skynet.dispatch("lua", function(_, _, t, ti)
+		done = done + 1
+		first = math.min(first, ti - t)
+		last = math.max(last, ti - t)
+		if done == SUB then
+			skynet.wakeup(waiting)
+		end
+	end)
+
+	local channel = multicast.new()
+	local subs = {}
+	for i = 1, SUB do
+		subs[i] = skynet.newservice(SERVICE_NAME, "sub")
+		skynet.call(subs[i], "lua", "sub", channel.channel)
+	end
+	local multicastd = skynet.uniqueservice "multicastd"
+
+	-- 每次发布后等所有订阅者收到再发下一条
+	local function bench(name, publish)
+		local publish_ti, first_ti, last_ti = 0, 0, 0
+		for _ = 1, MESSAGE do
+			done, first, last = 0, math.huge, 0
+			waiting = coroutine.running()
+			local t = skynet.hpc()
+			publish(t)
+			publish_ti = publish_ti + skynet.hpc() - t
+			skynet.wait(waiting)
+			first_ti = first_ti + first
+			last_ti = last_ti + last
+		end
+		print(string.format("%-10s subscribers = %d publish = %6.0f us first delivery = %6.0f us last delivery = %6.0f us",
+			name, SUB, publish_ti / MESSAGE / 1000, first_ti / MESSAGE / 1000, last_ti / MESSAGE / 1000))
+	end
+
+	bench("multicastd", function(t)
+		skynet.call(multicastd, "lua", "PUB", channel.channel, mc.pack(skynet.pack(t)))
+	end)
+	bench("direct", function(t)
+		channel:publish(t)
+	end)
+
+	for i = 1, SUB do
+		skynet.kill(subs[i])
+	end
+	skynet.exit()
+end)
+
+end
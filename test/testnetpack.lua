@@ -0,0 +1,183 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local netpack = require "skynet.netpack"
+require "skynet.manager"
+
+-- 对比 gate 默认复制与 zerocopy (切片引用 socket buffer) 时每个包的复制字节数和耗时
+-- usage : testnetpack [client]
+
+local mode, arg1, arg2 = ...
+
+local CLIENT = 200
+local PACKAGE = 1000
+local BATCH = 10
+local SIZE = 512
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = function(msg, sz) return msg, sz end,
+}
+
+if mode == "sink" then
+
+local count = 0
+local total
+local waiting
+
+-- client 消息不由框架释放，处理完调用 netpack.release
+skynet.forward_type({ [skynet.PTYPE_CLIENT] = skynet.PTYPE_CLIENT }, function()
+	skynet.dispatch("client", function(_, _, msg, sz)
+		skynet.ignoreret()	-- session is socket id
+		assert(sz == SIZE)
+		netpack.release(msg)
+		count = count + 1
+		if count == total and waiting then
+			skynet.wakeup(waiting)
+		end
+	end)
+	skynet.dispatch("lua", function(_, _, n)
+		total = n
+		if count < total then
+			waiting = coroutine.running()
+			skynet.wait(waiting)
+		end
+		skynet.ret(skynet.pack(count))
+	end)
+end)
+
+elseif mode == "plain" then
+
+-- 不用 forward_type，client 消息由框架释放，切片也要能正确释放
+local count = 0
+local exit_at = tonumber(arg1)
+
+skynet.start(function()
+	skynet.dispatch("client", function(_, _, msg, sz)
+		skynet.ignoreret()
+		assert(sz == SIZE)
+		count = count + 1
+		if count == exit_at then
+			-- 队列中剩下的消息由框架丢弃
+			skynet.exit()
+		end
+	end)
+	skynet.dispatch("lua", function()
+		skynet.ret(skynet.pack(count))
+	end)
+end)
+
+elseif mode == "client" then
+
+local port, n = tonumber(arg1), tonumber(arg2)
+
+skynet.start(function()
+	local fds = {}
+	skynet.dispatch("lua", function(_, _, cmd)
+		if cmd == "connect" then
+			for i = 1, n do
+				fds[i] = assert(socket.open("127.0.0.1", port))
+			end
+		elseif cmd == "send" then
+			local pack = string.pack(">s2", string.rep("x", SIZE))
+			local batch = string.rep(pack, BATCH)
+			local half = #pack // 2
+			for _ = 1, PACKAGE // BATCH - 1 do
+				for i = 1, n do
+					socket.write(fds[i], batch)
+				end
+			end
+			-- 跨越两次读取的包
+			for _ = 1, BATCH do
+				for i = 1, n do
+					socket.write(fds[i], pack:sub(1, half))
+				end
+				skynet.sleep(0)
+				for i = 1, n do
+					socket.write(fds[i], pack:sub(half + 1))
+				end
+			end
+		else
+			for i = 1, n do
+				socket.close(fds[i])
+			end
+		end
+		skynet.ret()
+	end)
+end)
+
+else
+
+local function bench(zerocopy, port)
+	local gate = skynet.newservice("gate")
+	local sink = skynet.newservice(SERVICE_NAME, "sink")
+	local client = skynet.newservice(SERVICE_NAME, "client", port, CLIENT)
+	local opened = 0
+	local co = coroutine.running()
+	skynet.dispatch("lua", function(_, _, what, subcmd, fd)
+		if what == "socket" and subcmd == "open" then
+			skynet.fork(function()
+				skynet.call(gate, "lua", "forward", fd, 0, sink)
+				opened = opened + 1
+				if opened == CLIENT then
+					skynet.wakeup(co)
+				end
+			end)
+		end
+	end)
+	skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = port, maxclient = CLIENT + 1, zerocopy = zerocopy, watchdog = skynet.self() })
+	skynet.call(client, "lua", "connect")
+	if opened < CLIENT then
+		skynet.wait(co)
+	end
+	local package, slice, copy = netpack.stat()
+	local start = skynet.now()
+	skynet.fork(skynet.call, client, "lua", "send")
+	local count = skynet.call(sink, "lua", CLIENT * PACKAGE)
+	local ti = (skynet.now() - start) / 100
+	local package2, slice2, copy2 = netpack.stat()
+	package, slice, copy = package2 - package, slice2 - slice, copy2 - copy
+	print(string.format("zerocopy = %-5s packages = %d sliced = %d copy = %.1f bytes/package time = %.2fs",
+		zerocopy, count, slice, copy / package, ti))
+	skynet.call(client, "lua", "close")
+	skynet.kill(client)
+	skynet.kill(sink)
+	skynet.call(gate, "lua", "close")
+end
+
+-- agent 不用 forward_type，或者退出时队列中还有消息
+local function release(port, exit_at)
+	local gate = skynet.newservice("gate")
+	local sink = skynet.newservice(SERVICE_NAME, "plain", exit_at)
+	local client = skynet.newservice(SERVICE_NAME, "client", port, 10)
+	skynet.dispatch("lua", function(_, _, what, subcmd, fd)
+		if what == "socket" and subcmd == "open" then
+			skynet.call(gate, "lua", "forward", fd, 0, sink)
+		end
+	end)
+	skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = port, maxclient = 11, zerocopy = true, watchdog = skynet.self() })
+	skynet.call(client, "lua", "connect")
+	skynet.sleep(10)
+	skynet.call(client, "lua", "send")
+	skynet.sleep(100)
+	local _, _, _, live = netpack.stat()
+	print(string.format("plain agent exit at %s : unreleased slices = %d", exit_at, live))
+	assert(live == 0)
+	skynet.call(client, "lua", "close")
+	skynet.kill(client)
+	if not exit_at then
+		skynet.kill(sink)
+	end
+	skynet.call(gate, "lua", "close")
+end
+
+skynet.start(function()
+	CLIENT = tonumber(mode) or CLIENT
+	bench(false, 8121)
+	bench(true, 8122)
+	release(8123)
+	release(8124, 100)
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,28 @@
+local skynet = require "skynet"
+
+-- set mq_wait_overload = 50 in config, the slave will report "May overload, message queue wait = xx ms"
+
+local mode = ...
+
+if mode == "slave" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, ms)
+		local t = skynet.hpc() + ms * 1000000
+		repeat until skynet.hpc() >= t
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local slave = skynet.newservice(SERVICE_NAME, "slave")
+	for i = 1, 20 do
+		skynet.send(slave, "lua", 10)
+	end
+	local stat = skynet.call(slave, "debug", "STAT")
+	skynet.error(string.format("queue wait p50 = %.3f ms, p99 = %.3f ms", stat.wait50 * 1000, stat.wait99 * 1000))
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,124 @@
+local skynet = require "skynet"
+local multicast = require "skynet.multicast"
+require "skynet.manager"
+
+-- 向大量本地服务广播同一条消息：Lua 循环 skynet.send 、 skynet.sendmulti 与 multicast 的耗时对比
+-- usage : testsendmulti [agents] [messages]
+
+local mode, arg1 = ...
+
+if mode == "agent" then
+
+local count = 0
+local target
+local master
+
+local function recv()
+	count = count + 1
+	if count == target then
+		skynet.send(master, "lua", "done")
+	end
+end
+
+skynet.start(function()
+	local channel
+	skynet.dispatch("lua", function(_, _, cmd, a, b)
+		if cmd == "data" then
+			recv()
+		elseif cmd == "reset" then
+			count = 0
+			target = a
+			master = b
+			skynet.ret()
+		elseif cmd == "subscribe" then
+			channel = multicast.new {
+				channel = a,
+				dispatch = recv,
+			}
+			channel:subscribe()
+			skynet.ret()
+		end
+	end)
+end)
+
+else
+
+local AGENT = 1000
+local MESSAGE = 100
+local SIZE = 256
+
+local agents = {}
+local done = 0
+local waiting
+
+local function all(...)
+	local co = coroutine.running()
+	local n = 0
+	for _, agent in ipairs(agents) do
+		skynet.fork(function(...)
+			skynet.call(agent, "lua", ...)
+			n = n + 1
+			if n == #agents then
+				skynet.wakeup(co)
+			end
+		end, ...)
+	end
+	skynet.wait(co)
+end
+
+local function bench(name, send)
+	all("reset", MESSAGE, skynet.self())
+	done = 0
+	local payload = string.rep("x", SIZE)
+	local start = skynet.hpc()
+	local clock = os.clock()
+	for _ = 1, MESSAGE do
+		send(payload)
+	end
+	local sender = os.clock() - clock
+	if done < #agents then
+		waiting = coroutine.running()
+		skynet.wait(waiting)
+		waiting = nil
+	end
+	local ti = (skynet.hpc() - start) / 1e9
+	print(string.format("%-10s agents = %d messages = %d sender cpu = %.3fs total = %.3fs (%d messages/s)",
+		name, #agents, MESSAGE, sender, ti, math.floor(#agents * MESSAGE / ti)))
+end
+
+skynet.start(function()
+	AGENT = tonumber(mode) or AGENT
+	MESSAGE = tonumber(arg1) or MESSAGE
+	skynet.dispatch("lua", function()
+		done = done + 1
+		if done == #agents and waiting then
+			skynet.wakeup(waiting)
+		end
+	end)
+	for i = 1, AGENT do
+		agents[i] = skynet.newservice(SERVICE_NAME, "agent")
+	end
+
+	bench("send", function(payload)
+		for _, agent in ipairs(agents) do
+			skynet.send(agent, "lua", "data", payload)
+		end
+	end)
+
+	bench("sendmulti", function(payload)
+		assert(skynet.sendmulti(agents, "lua", "data", payload) == #agents)
+	end)
+
+	local channel = multicast.new()
+	all("subscribe", channel.channel)
+	bench("multicast", function(payload)
+		channel:publish(payload)
+	end)
+
+	for _, agent in ipairs(agents) do
+		skynet.kill(agent)
+	end
+	skynet.exit()
+end)
+
+end
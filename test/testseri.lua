@@ -0,0 +1,78 @@
+local skynet = require "skynet"
+
+-- skynet.pack / skynet.unpack 在典型消息上的耗时 (ns/message)，并校验往返结果
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function payloads()
+	local ints = {}
+	for i = 1, 1000 do
+		ints[i] = i * 37
+	end
+	local strs = {}
+	for i = 1, 200 do
+		strs[i] = "item_" .. i
+	end
+	local records = {}
+	for i = 1, 200 do
+		records[i] = { id = i, name = "player" .. i, level = i % 100, exp = i * 1.5, online = i % 2 == 0 }
+	end
+	local nested = { a = { b = { c = { d = { e = "deep" } } } }, list = { 1, 2, 3, { x = 1, y = 2 } } }
+	return {
+		{ "rpc", 100, { "login", 10001, "token_abcdef", true } },
+		{ "ints", 1000, { ints } },
+		{ "strings", 1000, { strs } },
+		{ "records", 200, { records } },
+		{ "nested", 20000, { nested, "extra", 1.25 } },
+		{ "blob", 2000, { string.rep("x", 64 * 1024) } },
+	}
+end
+
+local function bench(name, n, args)
+	local nargs = #args
+	local msg, sz = skynet.pack(table.unpack(args, 1, nargs))
+	local r = table.pack(skynet.unpack(msg, sz))
+	skynet.trash(msg, sz)
+	assert(r.n == nargs)
+	for i = 1, nargs do
+		assert(equal(args[i], r[i]), name)
+	end
+
+	local t = os.clock()
+	for _ = 1, n do
+		local m, s = skynet.pack(table.unpack(args, 1, nargs))
+		skynet.trash(m, s)
+	end
+	local pack_ns = (os.clock() - t) * 1e9 / n
+
+	msg, sz = skynet.pack(table.unpack(args, 1, nargs))
+	t = os.clock()
+	for _ = 1, n do
+		skynet.unpack(msg, sz)
+	end
+	local unpack_ns = (os.clock() - t) * 1e9 / n
+	skynet.trash(msg, sz)
+	print(string.format("%-8s size = %7d pack = %10.0f ns unpack = %10.0f ns", name, sz, pack_ns, unpack_ns))
+end
+
+skynet.start(function()
+	for _, p in ipairs(payloads()) do
+		bench(p[1], p[2], p[3])
+	end
+	skynet.exit()
+end)
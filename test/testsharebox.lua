@@ -0,0 +1,131 @@
+local skynet = require "skynet"
+local sharebox = require "skynet.sharebox"
+require "skynet.manager"
+
+-- 对比 skynet.pack 发送表 (接收方 unpack) 与 sharebox 发送 (接收方原地读取) 在 1KB - 1MB 负载下的耗时
+
+local mode = ...
+
+if mode == "idle" then
+
+-- 收到消息前就被 kill，队列里的 sharebox 消息由框架丢弃
+skynet.start(function()
+	skynet.dispatch("lua", function() skynet.ret() end)
+	skynet.dispatch("sharebox", function() skynet.sleep(100) end)
+end)
+
+elseif mode == "sink" then
+
+skynet.start(function()
+	local sum = 0
+	skynet.dispatch("lua", function(_, _, cmd, t)
+		if cmd == "data" then
+			sum = sum + #t.list + t.list[#t.list].id
+		else
+			skynet.ret(skynet.pack(sum))
+			sum = 0
+		end
+	end)
+	skynet.dispatch("sharebox", function(_, _, box)
+		local t = sharebox.value(box)
+		sum = sum + #t.list + t.list[#t.list].id
+	end)
+end)
+
+else
+
+local function payload(size)
+	local list = {}
+	local n = 0
+	local i = 0
+	while n < size do
+		i = i + 1
+		list[i] = { id = i, name = "item_" .. i, value = i * 1.5 }
+		n = n + 32
+	end
+	return { list = list }
+end
+
+local function bench(sink, size, n)
+	local t = payload(size)
+	local _, sz = skynet.pack(t)
+	local expect = (#t.list + t.list[#t.list].id) * n
+
+	local start = skynet.hpc()
+	for _ = 1, n do
+		skynet.send(sink, "lua", "data", t)
+	end
+	local sum = skynet.call(sink, "lua", "sum")
+	local lua_ns = (skynet.hpc() - start) / n
+	assert(sum == expect)
+
+	start = skynet.hpc()
+	local box = sharebox.new(t)
+	local box_ns = skynet.hpc() - start
+	start = skynet.hpc()
+	for _ = 1, n do
+		skynet.send(sink, "sharebox", box)
+	end
+	sum = skynet.call(sink, "lua", "sum")
+	local share_ns = (skynet.hpc() - start) / n
+	assert(sum == expect)
+
+	print(string.format("payload = %8d bytes lua = %10.0f ns/msg sharebox = %8.0f ns/msg (new = %.0f us, %d bytes)",
+		sz, lua_ns, share_ns, box_ns / 1000, sharebox.size(box)))
+end
+
+skynet.start(function()
+	-- 只读：写共享表会报错或破坏其它服务看到的数据
+	local box = sharebox.new { a = 1, b = { "x", "y" }, c = true }
+	local v = sharebox.value(box)
+	assert(v.a == 1 and v.b[2] == "y" and v.c == true)
+	assert(not pcall(sharebox.new, setmetatable({}, {})))
+	assert(not pcall(sharebox.new, { print }))
+	local loop = {}
+	loop.self = loop
+	v = sharebox.value(sharebox.new(loop))
+	assert(v.self == v)
+
+	-- 代理表引用着 box，丢弃 box 后仍然有效
+	local list = sharebox.value(sharebox.new { list = { { id = 1 }, { id = 2 } } }).list
+	collectgarbage()
+	collectgarbage()
+	assert(#list == 2 and list[2].id == 2)
+	local n = 0
+	for _, item in pairs(list) do
+		n = n + item.id
+	end
+	assert(n == 3)
+	assert(not pcall(function() list[3] = 3 end))
+	list = nil
+	box = nil
+	v = nil
+	collectgarbage()
+	collectgarbage()
+	assert(sharebox.live() == 0, sharebox.live())
+
+	-- 被丢弃的消息要释放 box 的引用
+	box = sharebox.new { a = 1 }
+	local idle = skynet.newservice(SERVICE_NAME, "idle")
+	skynet.call(idle, "lua")
+	for _ = 1, 100 do
+		skynet.send(idle, "sharebox", box)
+	end
+	skynet.kill(idle)
+	box = nil
+	skynet.sleep(10)
+	collectgarbage()
+	collectgarbage()
+	skynet.error("live boxes after drop", sharebox.live())
+	assert(sharebox.live() == 0)
+
+	local sink = skynet.newservice(SERVICE_NAME, "sink")
+	bench(sink, 1024, 1000)
+	bench(sink, 16 * 1024, 1000)
+	bench(sink, 256 * 1024, 100)
+	bench(sink, 1024 * 1024, 20)
+	skynet.kill(sink)
+	skynet.exit()
+end)
+
+end
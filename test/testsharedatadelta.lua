@@ -0,0 +1,142 @@
+local skynet = require "skynet"
+local sharedata = require "skynet.sharedata"
+local core = require "skynet.sharedata.core"
+local builder = require "skynet.datasheet.builder"
+local datasheet = require "skynet.datasheet"
+
+-- 增量更新：只改一个字段时，sharedata 只重建改动的路径，未改动的子表和新版本共享
+-- datasheet 已展开的未改动的表在更新后保留内容
+-- usage : testsharedatadelta [items]
+
+local ITEM = tonumber((...)) or 20000
+local MAXGEN = 8	-- 同 lua-sharedata.c 中的 SHARE_MAXGEN
+
+local function items(n)
+	local t = {}
+	for i = 1, n do
+		t[i] = {
+			id = i,
+			name = "item_" .. i,
+			price = i * 1.5,
+			attr = { hp = i % 1000, atk = i % 77, tags = { "t" .. (i % 5), "t" .. (i % 7) } },
+		}
+	end
+	return { items = t, version = 1 }
+end
+
+local function elapsed(f, ...)
+	local start = skynet.hpc()
+	local r = f(...)
+	return (skynet.hpc() - start) / 1e6, r
+end
+
+-- 等 monitor 收到新版本：flush 后根节点换成新的 C 对象
+local function wait_update(obj, cobj)
+	repeat
+		skynet.sleep(1)
+		sharedata.flush()
+	until obj.__obj ~= cobj
+end
+
+local function update(obj, name, t)
+	local cobj = obj.__obj
+	sharedata.update(name, t)
+	wait_update(obj, cobj)
+end
+
+-- 直接在本服务里构建，不含 sharedatad 的消息打包开销
+local function bench(t)
+	local ti_full, base = elapsed(core.new, t)
+	t.items[1].price = -1
+	local ti_delta, obj = elapsed(core.new, t, nil, base)
+	t.items[1].price = 1.5
+	print(string.format("items = %d core.new full = %.1f ms delta = %.1f ms", ITEM, ti_full, ti_delta))
+	core.delete(obj)
+	core.delete(base)
+end
+
+local function test_sharedata()
+	local t = items(ITEM)
+	bench(t)
+	local ti_new = elapsed(sharedata.new, "delta", t)
+	local obj = sharedata.query "delta"
+	local item1 = obj.items[1]
+	local attr2 = obj.items[2].attr
+	local cobj2 = attr2.__obj
+	assert(attr2.tags[1] == "t2")
+
+	-- 只改一个价格
+	t.items[1].price = 100
+	local cobj1 = obj.__obj
+	local ti_update = elapsed(sharedata.update, "delta", t)
+	wait_update(obj, cobj1)
+	print(string.format("sharedata.new = %.1f ms sharedata.update one field = %.1f ms", ti_new, ti_update))
+	assert(item1.price == 100)
+	assert(obj.items[1] == item1)
+	assert(attr2.__obj == cobj2, "unchanged sub table should be shared")
+	assert(attr2.tags[1] == "t2" and attr2.hp == 2)
+
+	-- 连续更新，超过 MAXGEN 次后整体重建
+	local last = obj.items[ITEM].attr
+	local cobj = last.__obj
+	for gen = 2, MAXGEN do
+		t.items[gen].attr.hp = -gen
+		update(obj, "delta", t)
+		assert(obj.items[gen].attr.hp == -gen)
+		assert(obj.items[gen].attr.tags[2] == "t" .. (gen % 7))
+		assert(item1.price == 100)
+		assert(last.__obj == cobj)
+	end
+	t.version = 2
+	update(obj, "delta", t)
+	assert(obj.version == 2)
+	assert(last.__obj ~= cobj, "full build after MAXGEN updates")
+
+	-- 再做一次增量更新，保存快照：共享的子表的字符串在旧版本里
+	t.items[ITEM].name = "last"
+	update(obj, "delta", t)
+	local filename = os.tmpname()
+	sharedata.save("delta", filename)
+	sharedata.mmap("deltaimage", filename)
+	os.remove(filename)
+	local image = sharedata.query "deltaimage"
+	assert(image.items[ITEM].name == "last")
+	assert(image.items[3].attr.hp == -3)
+	assert(image.items[ITEM - 1].attr.tags[1] == "t" .. ((ITEM - 1) % 5))
+	assert(#image.items == ITEM)
+
+	-- 删除的 key
+	local item3 = obj.items[3]
+	t.items[3] = nil
+	t.items[ITEM] = nil
+	update(obj, "delta", t)
+	assert(obj.items[ITEM] == nil)
+	assert(not pcall(function() return item3.id end))
+
+	sharedata.delete "delta"
+	sharedata.delete "deltaimage"
+end
+
+local function test_datasheet()
+	builder.new("deltasheet", { a = { x = 1 }, b = { y = "2" }, c = { 3 } })
+	local t = datasheet.query "deltasheet"
+	local a, b, c = t.a, t.b, t.c
+	assert(a.x == 1 and b.y == "2" and c[1] == 3)	-- 展开 a b c
+	builder.update("deltasheet", { a = { x = 1 }, b = { y = "20" }, c = { 3 } })
+	repeat skynet.sleep(1) until getmetatable(b) ~= nil	-- 等待 monitor 收到更新，改动的表被清空
+	assert(getmetatable(a) == nil and rawget(a, "x") == 1, "unchanged table should keep its content")
+	assert(getmetatable(c) == nil and rawget(c, 1) == 3)
+	assert(getmetatable(t) == nil and rawget(t, "a") == a)
+	assert(getmetatable(b) ~= nil and rawget(b, "y") == nil, "changed table should be cleared")
+	assert(b.y == "20")
+	builder.update("deltasheet", { a = { x = 2 }, b = { y = "20" } })
+	repeat skynet.sleep(1) until getmetatable(a) ~= nil
+	assert(a.x == 2 and b.y == "20" and t.c == nil)
+end
+
+skynet.start(function()
+	test_sharedata()
+	test_datasheet()
+	print("ok")
+	skynet.exit()
+end)
@@ -0,0 +1,143 @@
+local skynet = require "skynet"
+local sharedata = require "skynet.sharedata"
+
+-- sharedata 的二级索引：加载时在共享的结构里建好排序的索引，查询返回共享的行
+-- 对比逐行扫描、每个服务自己建 lua 索引表的耗时和内存
+-- usage : testsharedataindex [rows]
+
+local ROW = tonumber((...)) or 50000
+local NPC = 1000
+local QUERY = 1000
+
+local TYPES = { "main", "side", "daily", "weekly", "event" }
+
+local function quests(n, version)
+	local t = {}
+	for i = 1, n do
+		t[i] = { id = i, npc_id = i % NPC, type = TYPES[i % #TYPES + 1], level = i % 100, version = version }
+	end
+	return t
+end
+
+local function sameset(rows, expect)
+	assert(#rows == #expect, #rows .. " ~= " .. #expect)
+	local ids = {}
+	for _, row in ipairs(rows) do
+		ids[row.id] = true
+	end
+	for _, row in ipairs(expect) do
+		assert(ids[row.id], row.id)
+	end
+end
+
+local function scan(t, field, min, max)
+	local r = {}
+	for i = 1, #t do
+		local row = t[i]
+		local v = row[field]
+		if v == min or (max and v >= min and v <= max) then
+			table.insert(r, row)
+		end
+	end
+	return r
+end
+
+local function elapsed(f, ...)
+	local start = skynet.hpc()
+	local r = f(...)
+	return (skynet.hpc() - start) / 1e6, r
+end
+
+local function bench(obj)
+	local n = QUERY // 10	-- 逐行扫描太慢，少查几次
+	local ti_scan = elapsed(function()
+		for i = 1, n do
+			scan(obj.quests, "npc_id", i)
+		end
+	end)
+	local ti_lookup = elapsed(function()
+		for i = 1, QUERY do
+			sharedata.lookup(obj.quests, "npc_id", i % NPC)
+		end
+	end)
+	-- 每个服务自己建的索引
+	collectgarbage()
+	local mem = collectgarbage "count"
+	local ti_build, byid = elapsed(function()
+		local r = {}
+		local q = obj.quests
+		for i = 1, #q do
+			local row = q[i]
+			local npc = row.npc_id
+			local list = r[npc]
+			if list then
+				table.insert(list, row)
+			else
+				r[npc] = { row }
+			end
+		end
+		return r
+	end)
+	collectgarbage()
+	mem = collectgarbage "count" - mem
+	local ti_local = elapsed(function()
+		for i = 1, QUERY do
+			local _ = byid[i % NPC]
+		end
+	end)
+	print(string.format("rows = %d scan = %.1f ms/query lookup = %.3f ms/query lua index build = %.0f ms (%.0f K) %.4f ms/query",
+		ROW, ti_scan / n, ti_lookup / QUERY, ti_build, mem, ti_local / QUERY))
+end
+
+skynet.start(function()
+	local t = quests(ROW, 1)
+	sharedata.index("quest", { quests = { "npc_id", "type", "level" } })
+	sharedata.new("quest", { quests = t, version = 1 })
+	local obj = sharedata.query "quest"
+
+	-- 和扫描的结果一致
+	sameset(sharedata.lookup(obj.quests, "npc_id", 7), scan(t, "npc_id", 7))
+	sameset(sharedata.lookup(obj.quests, "type", "daily"), scan(t, "type", "daily"))
+	sameset(sharedata.lookup(obj.quests, "level", 95, 99), scan(t, "level", 95, 99))
+	sameset(sharedata.lookup(obj.quests, "level", 50.5, 51), scan(t, "level", 51))
+	assert(#sharedata.lookup(obj.quests, "npc_id", -1) == 0)
+	assert(#sharedata.lookup(obj.quests, "npc_id", "7") == 0)
+	local rows = sharedata.lookup(obj.quests, "npc_id", 7)
+	assert(rows[1] == obj.quests[7], "return the shared rows")
+	assert(rows[1].id < rows[2].id)
+	-- 没有建索引的字段，逐行扫描
+	sameset(sharedata.lookup(obj.quests, "id", 10, 20), scan(t, "id", 10, 20))
+
+	bench(obj)
+
+	-- 增量更新后索引仍然有效
+	t[7].npc_id = -1
+	sharedata.update("quest", { quests = t, version = 2 })
+	skynet.sleep(1)
+	sharedata.flush()
+	assert(obj.version == 2)
+	sameset(sharedata.lookup(obj.quests, "npc_id", -1), { t[7] })
+	sameset(sharedata.lookup(obj.quests, "npc_id", 7), scan(t, "npc_id", 7))
+	-- quests 没有改变，和上个版本共享，也共享它的索引
+	sharedata.update("quest", { quests = t, version = 3 })
+	skynet.sleep(1)
+	sharedata.flush()
+	assert(obj.version == 3)
+	sameset(sharedata.lookup(obj.quests, "npc_id", -1), { t[7] })
+
+	-- 索引根表，行的 key 是字符串
+	local npcs = {}
+	for i = 1, 100 do
+		npcs["npc" .. i] = { id = i, map = i % 10 }
+	end
+	sharedata.index("npc", { "map" })
+	sharedata.new("npc", npcs)
+	local npc = sharedata.query "npc"
+	local r = sharedata.lookup(npc, "map", 3)
+	assert(#r == 10 and r[1] == npc["npc" .. r[1].id])
+
+	sharedata.delete "quest"
+	sharedata.delete "npc"
+	print("ok")
+	skynet.exit()
+end)
@@ -0,0 +1,80 @@
+local skynet = require "skynet"
+local sharedata = require "skynet.sharedata"
+
+-- 并行加载配置：sharedata.loadlist 用临时的 worker 服务解析和构建，全部成功后一起发布
+-- 对比逐个 sharedata.new 的耗时 (worker 数受限于工作线程和 cpu 数)
+-- usage : testsharedataload [files] [worker]
+
+local FILE, WORKER = ...
+FILE = tonumber(FILE) or 40
+WORKER = tonumber(WORKER)
+
+local ITEM = 2000
+
+local function genfile(filename, version)
+	local f = assert(io.open(filename, "wb"))
+	f:write "local t = {}\n"
+	for i = 1, ITEM do
+		f:write(string.format("t[%d] = { id = %d, name = %q, level = %d, version = %d }\n", i, i, "item" .. i, i % 100, version))
+	end
+	f:write "return t\n"
+	f:close()
+end
+
+local function elapsed(f, ...)
+	local start = skynet.hpc()
+	local r = f(...)
+	return (skynet.hpc() - start) / 1e6, r
+end
+
+skynet.start(function()
+	local dir = os.tmpname()
+	os.remove(dir)
+	local list = {}
+	local files = {}
+	for i = 1, FILE do
+		local filename = dir .. "_" .. i .. ".lua"
+		genfile(filename, 1)
+		files[i] = filename
+		list["conf" .. i] = "@" .. filename
+	end
+
+	local ti_seq = elapsed(function()
+		for name, source in pairs(list) do
+			sharedata.new("seq" .. name, source)
+		end
+	end)
+	local ti, report = elapsed(sharedata.loadlist, list, WORKER)
+	print(string.format("files = %d sequential = %.0f ms loadlist = %.0f ms (worker = %d)", FILE, ti_seq, ti, report.worker))
+	for i = 1, math.min(3, #report.files) do
+		local r = report.files[i]
+		print(string.format("\t%s %.1f ms", r.name, r.time))
+	end
+	local conf = sharedata.query "conf1"
+	assert(conf[10].name == "item10" and conf[10].version == 1)
+
+	-- 已有的配置更新为新版本
+	for _, filename in ipairs(files) do
+		genfile(filename, 2)
+	end
+	sharedata.loadlist(list, WORKER)
+	sharedata.flush()
+	assert(conf[10].version == 2)
+	assert(sharedata.query("conf" .. FILE)[ITEM].version == 2)
+
+	-- 任何一个失败，都不发布
+	genfile(files[1], 3)
+	list.bad = "return { x = "
+	local ok, err = pcall(sharedata.loadlist, list, WORKER)
+	assert(not ok)
+	print(err)
+	sharedata.flush()
+	assert(conf[10].version == 2)
+	assert(not pcall(sharedata.query, "bad"))
+
+	for _, filename in ipairs(files) do
+		os.remove(filename)
+	end
+	print("ok")
+	skynet.exit()
+end)
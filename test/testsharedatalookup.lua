@@ -0,0 +1,123 @@
+local skynet = require "skynet"
+local core = require "skynet.sharedata.core"
+local corelib = require "skynet.sharedata.corelib"
+
+-- sharedata 单次访问耗时 (ns/access)：lua table / 完美哈希 / 原来的冲突链
+-- usage : testsharedatalookup [n]
+
+local N = tonumber((...)) or 500000
+
+local function data()
+	local record = {}
+	for _, k in ipairs { "id", "name", "price", "stack", "level", "quality", "icon", "desc", "type", "subtype", "cooldown", "duration" } do
+		record[k] = k
+	end
+	local ids = {}	-- 稀疏的整数 key
+	for i = 1, 10000 do
+		ids[100000 + i * 7] = i
+	end
+	local holes = {}	-- 有空洞的数组，rawlen 不一定覆盖全部
+	for i = 1, 10000 do
+		if i % 3 ~= 0 then
+			holes[i] = i
+		end
+	end
+	return { record = record, ids = ids, holes = holes }
+end
+
+local function keys(t)
+	local r = {}
+	for k in pairs(t) do
+		r[#r + 1] = k
+	end
+	return r
+end
+
+local function run(t, index, keylist)
+	local n = #keylist
+	collectgarbage()
+	collectgarbage "stop"	-- 返回的字符串会触发 gc，干扰计时
+	local start = skynet.hpc()
+	for i = 1, N do
+		index(t, keylist[i % n + 1])
+	end
+	local ti = skynet.hpc() - start
+	collectgarbage "restart"
+	return ti / N
+end
+
+local function noop() end
+
+-- 取三次中最小的，再扣除循环本身的开销 (同样取三次中最小的)
+local function bench(t, index, keylist)
+	local ti = math.huge
+	local base = math.huge
+	for _ = 1, 3 do
+		ti = math.min(ti, run(t, index, keylist))
+		base = math.min(base, run(t, noop, keylist))
+	end
+	return math.max(ti - base, 0)
+end
+
+local function rawindex(t, k)
+	return t[k]
+end
+
+local function proxyindex(t, k)
+	return t[k]
+end
+
+-- 各种大小的 hash 部分都要建出完美哈希，包括前 32 字节相同的长字符串 key
+local function check_index()
+	for _, n in ipairs { 1, 2, 10, 100, 1000, 2187, 10000, 100000 } do
+		local t = {}
+		local prefix = string.rep("x", 40)
+		for i = 1, n do
+			t[prefix .. i] = i
+		end
+		local conf = core.new(t)
+		local size, nbucket = core.hashlen(conf)
+		assert(size == n and nbucket > 0, n)
+		for i = 1, n do	-- 包括 keyhash 相同而串在一起的 key
+			assert(core.index(conf, prefix .. i) == i)
+		end
+		assert(core.index(conf, prefix) == nil)
+		core.delete(conf)
+	end
+	print "perfect hash built : 1 - 100000 keys"
+end
+
+skynet.start(function()
+	check_index()
+	local d = data()
+	local newconf = core.new(d)
+	local oldconf = core.new(d, true)	-- 不建完美哈希和稠密数组，即原来的实现
+	local box = corelib.box(newconf)
+	local oldbox = corelib.box(oldconf)
+	print(string.format("%-8s %10s %10s %10s %10s %10s", "", "lua", "phf", "chain", "proxy phf", "proxy chain"))
+	for _, name in ipairs { "record", "ids", "holes" } do
+		local keylist = keys(d[name])
+		local newobj = core.index(newconf, name)
+		local oldobj = core.index(oldconf, name)
+		-- 校验两种实现结果一致
+		for _, k in ipairs(keylist) do
+			assert(core.index(newobj, k) == d[name][k])
+			assert(core.index(oldobj, k) == d[name][k])
+		end
+		local size, nbucket = core.hashlen(newobj)
+		assert(size == 0 or nbucket > 0, name)
+		assert(core.index(newobj, "nonexist") == nil)
+		assert(core.index(newobj, -1) == nil)
+		print(string.format("%-8s %10.1f %10.1f %10.1f %10.1f %10.1f", name,
+			bench(d[name], rawindex, keylist),
+			bench(newobj, core.index, keylist),
+			bench(oldobj, core.index, keylist),
+			bench(box[name], proxyindex, keylist),
+			bench(oldbox[name], proxyindex, keylist)))
+	end
+	box, oldbox = nil, nil
+	collectgarbage()
+	core.delete(newconf)
+	core.delete(oldconf)
+	skynet.exit()
+end)
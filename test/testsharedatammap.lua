@@ -0,0 +1,98 @@
+local skynet = require "skynet"
+local sharedata = require "skynet.sharedata"
+
+-- sharedata 快照：从 lua 数据构建、保存成二进制文件，再 mmap 加载，对比耗时并校验内容
+-- usage : testsharedatammap [items]
+
+local ITEM = tonumber((...)) or 20000
+
+local function items(n, version)
+	local t = {}
+	for i = 1, n do
+		t[i] = {
+			id = i,
+			name = "item_" .. i,
+			price = i * 1.5 + version,
+			stack = i % 99 + 1,
+			tradable = i % 3 == 0,
+			attr = { hp = i % 1000, atk = i % 77, tags = { "t" .. (i % 5), "t" .. (i % 7) } },
+		}
+	end
+	return { items = t, version = version, [-1] = "negative", ["1.5"] = "string key" }
+end
+
+local function check(obj, t)
+	for k, v in pairs(t) do
+		if type(v) == "table" then
+			check(obj[k], v)
+		else
+			assert(obj[k] == v, k)
+		end
+	end
+	local n = 0
+	for k in pairs(obj) do
+		assert(t[k] ~= nil, k)
+		n = n + 1
+	end
+	for _ in pairs(t) do
+		n = n - 1
+	end
+	assert(n == 0)
+	assert(#obj == #t)
+end
+
+local function elapsed(f, ...)
+	local start = skynet.hpc()
+	local r = f(...)
+	return (skynet.hpc() - start) / 1e6, r
+end
+
+skynet.start(function()
+	local filename = os.tmpname()
+	local t1 = items(ITEM, 1)
+
+	local ti_new = elapsed(sharedata.new, "source", t1)
+	local ti_save, size = elapsed(sharedata.save, "source", filename)
+	local ti_mmap = elapsed(sharedata.mmap, "image", filename)
+	print(string.format("items = %d new = %.1f ms save = %.1f ms (%d bytes) mmap = %.1f ms", ITEM, ti_new, ti_save, size, ti_mmap))
+
+	local obj = sharedata.query "image"
+	local start = skynet.hpc()
+	check(obj, t1)
+	print(string.format("check snapshot = %.1f ms", (skynet.hpc() - start) / 1e6))
+	assert(obj.items[10].attr.tags[2] == "t3")
+	assert(obj.items[ITEM + 1] == nil)
+	assert(sharedata.deepcopy("image", "items", 2, "attr").atk == 2)
+
+	-- 热更新：用新的快照替换，已有的引用读到新值
+	local item = obj.items[1]
+	local t2 = items(ITEM, 2)
+	sharedata.update("source", t2)
+	sharedata.save("source", filename)
+	sharedata.mmap("image", filename)
+	sharedata.flush()
+	assert(obj.version == 2)
+	assert(item.price == 3.5)
+
+	-- 损坏的文件：偏移加长度回绕
+	local f = io.open(filename, "r+b")
+	f:seek("set", 24)	-- image_header.strings, stringsize
+	f:write(string.pack("<I8I8", -16, 32))
+	f:close()
+	local ok, err = pcall(sharedata.mmap, "bad", filename)
+	assert(not ok)
+	print(err)
+
+	f = io.open(filename, "r+b")
+	f:write "xxxx"
+	f:close()
+	ok, err = pcall(sharedata.mmap, "bad", filename)
+	assert(not ok)
+	print(err)
+
+	os.remove(filename)
+	sharedata.delete "source"
+	sharedata.delete "image"
+	print("ok")
+	skynet.exit()
+end)
@@ -0,0 +1,122 @@
+local skynet = require "skynet"
+local stm = require "skynet.stm"
+
+-- 多个 reader 服务在 writer 不断更新时读取字段：
+-- stm.newcopy 每次更新都要完整 unpack，stm.newsnapshotcopy 原地读取字段
+-- usage : teststmsnapshot [readers]
+
+local mode = ...
+
+local ROUND = 200000
+local ITEM = 3000
+
+if mode == "reader" then
+
+local function read_copy(obj)
+	local t
+	local n = 0
+	for _ = 1, ROUND do
+		local changed, v = obj(skynet.unpack)
+		if changed then
+			t = v
+			n = n + 1
+		end
+		assert(t.hp == t.version * 10)
+	end
+	return n
+end
+
+local function read_snapshot(obj)
+	local n = 0
+	for _ = 1, ROUND do
+		if obj() then
+			n = n + 1
+		end
+		assert(obj.hp == obj.version * 10)
+	end
+	assert(obj.items == nil)	-- 只有 writer 的第一个值的字段可读
+	assert(obj[1] == "first")
+	assert(obj.record.name == "item1")	-- 子表用 unpack 函数解开
+	return n
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, kind, copy)
+		local obj
+		local start = skynet.hpc()
+		local n
+		if kind == "copy" then
+			obj = stm.newcopy(copy)
+			n = read_copy(obj)
+		else
+			obj = stm.newsnapshotcopy(copy, skynet.unpack)
+			n = read_snapshot(obj)
+		end
+		local ti = skynet.hpc() - start
+		obj = nil
+		collectgarbage()	-- 释放 reader，不再引用旧版本
+		skynet.ret(skynet.pack(ti, n))
+		skynet.exit()
+	end)
+end)
+
+else
+
+local function data(version)
+	local t = { "first", version = version, hp = version * 10, name = "config" }
+	for i = 1, ITEM do
+		t["item" .. i] = { id = i, name = "item" .. i, price = i * 1.5 + version }
+	end
+	t.record = t.item1
+	return t
+end
+
+-- 预先打包好，writer 每个 tick 更新一次
+local versions = {}
+
+local function bench(kind, reader, obj, copy)
+	local done = 0
+	local co = coroutine.running()
+	local ti, n = 0, 0
+	for i = 1, reader do
+		local r = skynet.newservice(SERVICE_NAME, "reader")
+		skynet.fork(function()
+			local t, v = skynet.call(r, "lua", kind, copy(obj))
+			ti = ti + t
+			n = n + v
+			done = done + 1
+			if done == reader then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	local version = 0
+	local start = skynet.hpc()
+	skynet.fork(function()
+		while done < reader do
+			version = version + 1
+			obj(versions[version % #versions + 1])
+			skynet.sleep(1)
+		end
+	end)
+	skynet.wait(co)
+	print(string.format("%-8s readers = %d updates = %d versions read = %d time = %.0f ns/read (%.2fs)",
+		kind, reader, version, n, ti / (reader * ROUND), (skynet.hpc() - start) / 1e9))
+end
+
+skynet.start(function()
+	local reader = tonumber(mode) or 2	-- 少于工作线程数，给 writer 留出线程
+	for i = 1, 20 do
+		versions[i] = skynet.packstring(data(i))
+	end
+	bench("copy", reader, stm.new(skynet.pack(data(0))), stm.copy)
+	local obj = stm.newsnapshot(skynet.pack(data(0)))
+	bench("snapshot", reader, obj, stm.copysnapshot)
+	-- reader 都已释放，更新时回收所有旧版本
+	obj(skynet.pack(data(-1)))
+	print("alive versions", stm.snapshotversion(obj))
+	assert(stm.snapshotversion(obj) == 1)
+	skynet.exit()
+end)
+
+end
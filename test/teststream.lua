@@ -0,0 +1,84 @@
+local skynet = require "skynet"
+local stream = require "skynet.stream"
+local cluster = require "skynet.cluster"
+require "skynet.manager"
+
+-- 对比一次 call 发送整个大消息与 skynet.stream 分块发送 (本地与 cluster) 时接收方的内存峰值
+-- usage : teststream [MB]
+
+local mode = ...
+
+if mode == "sink" then
+
+local function memory()
+	return math.floor(collectgarbage "count" * 1024)
+end
+
+skynet.start(function()
+	stream.dispatch(function(s, name)
+		local base = memory()
+		local peak = 0
+		local bytes = 0
+		for chunk in stream.chunks(s) do
+			bytes = bytes + #chunk
+			peak = math.max(peak, memory() - base)
+		end
+		return name, bytes, peak
+	end)
+	skynet.dispatch("lua", function(_, _, _, data)
+		skynet.ret(skynet.pack(#data, memory()))
+	end)
+end)
+
+else
+
+local SIZE = 64 * 1024 * 1024
+
+local function generator()
+	local piece = string.rep("x", stream.CHUNK)
+	local n = 0
+	return function()
+		if n >= SIZE then
+			return
+		end
+		local sz = math.min(#piece, SIZE - n)
+		n = n + sz
+		return sz == #piece and piece or piece:sub(1, sz)
+	end
+end
+
+skynet.start(function()
+	SIZE = (tonumber(mode) or 64) * 1024 * 1024
+	local sink = skynet.newservice(SERVICE_NAME, "sink")
+
+	local start = skynet.hpc()
+	local name, bytes, peak = stream.send(sink, generator(), "local")
+	assert(name == "local" and bytes == SIZE)
+	print(string.format("stream  %-7s bytes = %d peak = %8d bytes time = %.2fs", name, bytes, peak, (skynet.hpc() - start) / 1e9))
+
+	cluster.reload { self = "127.0.0.1:2531" }
+	cluster.open "self"
+	start = skynet.hpc()
+	name, bytes, peak = stream.cluster_send("self", sink, generator(), "cluster")
+	assert(name == "cluster" and bytes == SIZE)
+	print(string.format("stream  %-7s bytes = %d peak = %8d bytes time = %.2fs", name, bytes, peak, (skynet.hpc() - start) / 1e9))
+
+	-- 字符串按 CHUNK 切分，内容完整
+	local text = {}
+	for i = 1, 10000 do
+		text[i] = tostring(i)
+	end
+	text = table.concat(text, ",")
+	name, bytes = stream.send(sink, text, "string")
+	assert(bytes == #text)
+
+	start = skynet.hpc()
+	local data = string.rep("x", SIZE)
+	local len, mem = skynet.call(sink, "lua", "whole", data)
+	assert(len == SIZE)
+	print(string.format("call    %-7s bytes = %d peak = %8d bytes time = %.2fs", "whole", len, mem, (skynet.hpc() - start) / 1e9))
+	skynet.kill(sink)
+	skynet.exit()
+end)
+
+end